@@ -0,0 +1,77 @@
+/************************************************************
+ *                                                          *
+ *            Archivio dei dati persistenti del server      *
+ *                                                          *
+ ************************************************************/
+
+#include "archivio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Motori disponibili (il primo è quello di default)
+static struct archivio* motori[] = {&archivio_file, &archivio_memoria, &archivio_log};
+#define NUM_MOTORI (sizeof(motori) / sizeof(motori[0]))
+
+/*
+ * Restituisce il motore con il nome specificato o NULL se non esiste
+ */
+struct archivio* find_storage_engine(char* nome) {
+    int i;
+
+    for (i = 0; i < NUM_MOTORI; i++)
+        if (strcmp(motori[i]->nome, nome) == 0)
+            return motori[i];
+
+    return NULL;
+}
+
+/*
+ * Aggiunge al riepilogo della coda 'numero' messaggi di 'mittente', il più recente dei quali inviato a 'timestamp'.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int add_to_offline_summary(struct coda_offline* coda, char* mittente, int numero, time_t timestamp) {
+    struct mittente_offline* record;
+
+    // Cerco il mittente tra quelli che hanno già messaggi pendenti
+    for (record = coda->primo; record != NULL; record = record->next)
+        if (strcmp(record->username, mittente) == 0)
+            break;
+
+    // Altrimenti lo aggiungo in fondo
+    if (record == NULL) {
+        record = malloc(sizeof(struct mittente_offline));
+        if (record == NULL) {
+            perror("Impossibile allocare il riepilogo dei messaggi pendenti");
+            return -1;
+        }
+        snprintf(record->username, USERNAME_LEN, "%s", mittente);
+        record->numero = 0;
+        record->ultimo = 0;
+        record->next = NULL;
+        if (coda->ultimo != NULL)
+            coda->ultimo->next = record;
+        else
+            coda->primo = record;
+        coda->ultimo = record;
+    }
+
+    record->numero += numero;
+    if (timestamp > record->ultimo)
+        record->ultimo = timestamp;
+    return 0;
+}
+
+/*
+ * Svuota il riepilogo della coda
+ */
+void free_offline_summary(struct coda_offline* coda) {
+    struct mittente_offline* record;
+
+    while (coda->primo != NULL) {
+        record = coda->primo;
+        coda->primo = record->next;
+        free(record);
+    }
+    coda->ultimo = NULL;
+}
@@ -0,0 +1,154 @@
+/************************************************************
+ *                                                          *
+ *            Archivio dei dati persistenti del server      *
+ *                                                          *
+ ************************************************************/
+
+#ifndef ARCHIVIO_H
+#define ARCHIVIO_H
+
+#include <time.h>
+#include "../struct/coda_offline.h"
+#include "../util/log_chat.h"
+#include "../util/snapshot.h"
+
+/*
+ * L'archivio conserva i dati del server che devono sopravvivere a un riavvio: gli utenti registrati, i messaggi
+ * inviati agli utenti offline (nello storico della chat e nel riepilogo dei messaggi pendenti del destinatario)
+ * e i segni di lettura. Il server lo usa solo attraverso le operazioni di struct archivio, così il motore si sceglie
+ * all'avvio (opzione -s):
+ * - file (default): i file di testo e i log delle chat, condivisi con i device, resi consistenti dal journal
+ *   (vedi archivio/file.c);
+ * - memoria: tutto resta in memoria e si perde alla chiusura (per le prove di carico);
+ * - log: un unico file in cui ogni operazione aggiunge un record in fondo, con gli indici in memoria ricostruiti
+ *   all'avvio (vedi archivio/log.c).
+ * Solo con 'file' i device trovano nei log delle chat anche i messaggi registrati dal server.
+ * Ogni motore protegge il proprio stato con i suoi lock: le operazioni si possono invocare da più thread.
+ * Le operazioni che modificano l'archivio restituiscono il turno del commit della scrittura (vedi wait_for_commit(),
+ * 0 se non c'è niente da aspettare) o -1 in caso di errore.
+ */
+struct archivio {
+    char* nome; // Nome con cui si sceglie il motore all'avvio
+
+    /*
+     * Prepara l'archivio (una sola volta, all'avvio, prima delle altre operazioni) a partire dall'ultimo snapshot
+     * del server ('snapshot', NULL se non c'è), in cui il motore ritrova le sezioni scritte dall'operazione 'snapshot'.
+     * Da qui in poi lo snapshot è del motore, che lo chiude quando non gli serve più.
+     * Restituisce 0 in caso di successo, -1 in caso di errore.
+     */
+    int (*open)(struct lettura_snapshot* snapshot);
+
+    /*
+     * Invoca 'visita' su ogni utente registrato che non era già nello snapshot passato a 'open' (le credenziali
+     * dello snapshot le ripristina il server). Restituisce 0 in caso di successo, -1 in caso di errore.
+     */
+    int (*load_users)(void (*visita)(char* username, char* password, void* contesto), void* contesto);
+
+    /*
+     * Registra un nuovo utente: il commit restituito è durabile qualunque sia la politica dei commit
+     */
+    long (*put_user)(char* username, char* password);
+
+    /*
+     * Registra il messaggio inviato da 'mittente' a 'destinatario' mentre questo era offline. Se 'pendente' è 1
+     * (il destinatario è registrato) il messaggio finisce anche nel riepilogo dei suoi messaggi pendenti.
+     */
+    long (*append_message)(char* mittente, char* destinatario, char* testo, int pendente);
+
+    /*
+     * Invoca 'visita' su ogni messaggio della chat tra 'utente1' e 'utente2' a partire dal numero di sequenza 'primo',
+     * in ordine. Il messaggio passato a 'visita' è valido solo durante l'invocazione.
+     * Restituisce il numero di messaggi visitati (0 se la chat non esiste) o -1 in caso di errore.
+     */
+    int (*read_range)(char* utente1, char* utente2, unsigned long long primo,
+                      void (*visita)(struct messaggio_chat* messaggio, void* contesto), void* contesto);
+
+    /*
+     * Restituisce il segno di lettura di 'lettore' nella chat con 'interlocutore': il numero di sequenza dell'ultimo
+     * messaggio che ha letto (0 se nessuno)
+     */
+    long (*read_mark)(char* lettore, char* interlocutore);
+
+    /*
+     * Sposta in avanti il segno di lettura di 'lettore' nella chat con 'interlocutore' a 'segno'
+     */
+    long (*mark_read)(char* lettore, char* interlocutore, long segno);
+
+    /*
+     * Toglie dall'archivio il riepilogo dei messaggi pendenti di 'destinatario' e lo sposta in 'riepilogo'
+     * (inizialmente vuoto, da svuotare con free_offline_summary())
+     */
+    long (*pending_summary)(char* destinatario, struct coda_offline* riepilogo);
+
+    /*
+     * Rende definitive su disco le scritture fatte finora se 'sempre' è 1 o se il motore lo ritiene opportuno.
+     * Va invocata senza possedere lock dopo le operazioni che modificano l'archivio (e alla chiusura).
+     */
+    void (*checkpoint)(int sempre);
+
+    /*
+     * Fotografa lo stato del motore da scrivere nel prossimo snapshot del server (vedi 'snapshot'). Il server la invoca
+     * possedendo 'users_lock', dopo aver scritto le credenziali: nel frattempo non ci sono nuove registrazioni, quindi
+     * va fatto il minimo indispensabile (niente scritture su disco). Restituisce 0 in caso di successo, -1 in caso di
+     * errore. Vale NULL se il motore non usa gli snapshot.
+     */
+    int (*prepare_snapshot)(void);
+
+    /*
+     * Aggiunge allo snapshot del server le sezioni del motore, con lo stato fotografato da 'prepare_snapshot', e lo
+     * rende definitivo con commit_snapshot(). Il server la invoca dal thread degli snapshot senza possedere lock:
+     * intanto le altre operazioni proseguono.
+     * Restituisce 0 in caso di successo, -1 in caso di errore. Vale NULL se il motore non usa gli snapshot (e allora
+     * il server non ne scrive).
+     */
+    int (*snapshot)(struct scrittura_snapshot* snapshot);
+};
+
+/*
+ * Tipi dei record del journal scritti dai motori che ne usano uno, con i loro campi (stringhe)
+ */
+enum RECORD_JOURNAL {
+    JOURNAL_MESSAGE = 1, // Messaggio per un utente offline non registrato (mittente, destinatario, testo)
+    JOURNAL_PENDING_MESSAGE, // Messaggio per un utente offline, anche tra i suoi pendenti (mittente, destinatario, testo)
+    JOURNAL_HANGING, // Riepilogo dei messaggi pendenti recapitato con hanging (destinatario)
+    JOURNAL_READ_MARK, // Segno di lettura spostato da show (lettore, interlocutore, numero di sequenza)
+    JOURNAL_USER // Nuovo utente registrato (username, password)
+};
+
+/*
+ * Sezioni dello snapshot del server (vedi util/snapshot.h): quelle dello stato del server e quelle dei motori
+ */
+enum SEZIONE_SNAPSHOT {
+    SNAPSHOT_SERVER = 1, // Motore dell'archivio con cui è stato scritto lo snapshot (server)
+    SNAPSHOT_USERS, // Credenziali degli utenti (server)
+    SNAPSHOT_REGISTER, // Registro del login/logout (server)
+    SNAPSHOT_SHOW, // Notifiche di show pendenti (server)
+    SNAPSHOT_USERS_FILE, // Parte di USERS_FILE già nello snapshot (motore 'file')
+    SNAPSHOT_CHATS, // Chat in memoria: utenti, segni di lettura e messaggi (motore 'log')
+    SNAPSHOT_MESSAGES, // Messaggi delle chat in memoria (motore 'log')
+    SNAPSHOT_TEXTS, // Testi dei messaggi delle chat in memoria (motore 'log')
+    SNAPSHOT_PENDING, // Riepiloghi dei messaggi pendenti in memoria (motore 'log')
+    SNAPSHOT_LOG // Ultimo record del log già nello snapshot (motore 'log')
+};
+
+extern struct archivio archivio_file;
+extern struct archivio archivio_memoria;
+extern struct archivio archivio_log;
+
+/*
+ * Restituisce il motore con il nome specificato o NULL se non esiste
+ */
+struct archivio* find_storage_engine(char* nome);
+
+/*
+ * Aggiunge al riepilogo della coda 'numero' messaggi di 'mittente', il più recente dei quali inviato a 'timestamp'.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int add_to_offline_summary(struct coda_offline* coda, char* mittente, int numero, time_t timestamp);
+
+/*
+ * Svuota il riepilogo della coda
+ */
+void free_offline_summary(struct coda_offline* coda);
+
+#endif
@@ -0,0 +1,619 @@
+/************************************************************
+ *                                                          *
+ *            Archivio su file (motore 'file')              *
+ *                                                          *
+ ************************************************************/
+
+#include "archivio.h"
+#include "../costanti.h"
+#include "../util/file.h"
+#include "../util/string.h"
+#include "../util/tabella_hash.h"
+#include "../util/cache_file.h"
+#include "../util/commit.h"
+#include "../util/log_chat.h"
+#include "../util/journal.h"
+#include "../util/snapshot.h"
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*
+ * Gli utenti sono in USERS_FILE (una riga "username password" per utente), i messaggi nei log delle chat
+ * (vedi util/log_chat.h), letti anche dai device, e nelle code dei messaggi pendenti (vedi struct coda_offline),
+ * i segni di lettura accanto ai log. Ogni operazione che modifica più file viene prima registrata in un record
+ * del journal (JOURNAL_FILE, vedi util/journal.h): code, log e segni di lettura sono file derivati, aggiornati dopo
+ * aver scritto il record senza sincronizzarli, e all'avvio i record non ancora applicati vengono riapplicati
+ * (vedi apply_journal_record()).
+ */
+
+static FILE* file_utenti; // USERS_FILE aperto in append
+static long utenti_ripristinati = 0; // Byte iniziali di USERS_FILE con gli utenti già nello snapshot del server
+static long utenti_fotografati; // Byte di USERS_FILE con gli utenti del prossimo snapshot (vedi prepare_snapshot_files())
+
+/*
+ * Code dei messaggi pendenti degli utenti offline, indicizzate per username del destinatario. Il riepilogo di una
+ * coda viene caricato dal suo file la prima volta che serve. Protette da 'offline_lock'.
+ */
+static struct tabella_hash code_offline;
+
+static struct cache_file log_aperti; // Log delle chat usati più di recente, aperti in append (protetti da 'chat_log_lock')
+
+/*
+ * Se servono più lock contemporaneamente vanno presi nell'ordine in cui sono dichiarati qui
+ */
+static pthread_mutex_t utenti_lock = PTHREAD_MUTEX_INITIALIZER; // File degli utenti registrati
+static pthread_mutex_t offline_lock = PTHREAD_MUTEX_INITIALIZER; // Code dei messaggi pendenti
+static pthread_mutex_t chat_log_lock = PTHREAD_MUTEX_INITIALIZER; // Log delle chat
+
+/*
+ * Restituisce la coda dei messaggi pendenti di 'destinatario'. La prima volta il riepilogo viene ricostruito
+ * dal file della coda, poi resta in memoria. Restituisce NULL in caso di errore.
+ * NB: il chiamante deve possedere 'offline_lock'.
+ */
+static struct coda_offline* get_offline_queue(char* destinatario) {
+    struct coda_offline* coda;
+    char path[PATH_MAX]; // Path del file della coda
+    char line[MAX_LINE_LEN]; // Riga letta dal file
+    char* mittente;
+    char* numero;
+    char* timestamp;
+    char* journal;
+    FILE* file;
+
+    coda = find_in_hash_table(&code_offline, destinatario);
+    if (coda != NULL)
+        return coda;
+
+    coda = calloc(1, sizeof(struct coda_offline));
+    if (coda == NULL) {
+        perror("Impossibile allocare la coda dei messaggi pendenti");
+        return NULL;
+    }
+
+    // Ogni riga del file è "mittente numero timestamp journal", tranne quella scritta da hanging ("@journal")
+    get_offline_queue_path(destinatario, path);
+    file = open_file(path, "r");
+    if (file != NULL) {
+        while (fgets(line, MAX_LINE_LEN, file) != NULL) {
+            if (line[0] == '@') {
+                coda->applicato = (unsigned int) strtoul(line + 1, NULL, 10);
+                continue;
+            }
+
+            mittente = strtok(line, " ");
+            numero = strtok(NULL, " ");
+            timestamp = strtok(NULL, " \n");
+            journal = strtok(NULL, " \n");
+            if (mittente == NULL || numero == NULL || timestamp == NULL)
+                continue; // Riga non valida
+
+            if (journal != NULL && strtoul(journal, NULL, 10) != 0)
+                coda->applicato = (unsigned int) strtoul(journal, NULL, 10);
+            add_to_offline_summary(coda, mittente, atoi(numero), (time_t) atol(timestamp));
+        }
+
+        if (fclose(file) != 0)
+            fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", path, strerror(errno));
+    }
+
+    if (insert_into_hash_table(&code_offline, destinatario, coda) == -1) {
+        free_offline_summary(coda);
+        free(coda);
+        return NULL;
+    }
+
+    return coda;
+}
+
+/*
+ * Aggiunge in fondo alla coda di 'destinatario' 'numero' messaggi inviati da 'mittente', il più recente a 'timestamp',
+ * registrati dal record 'journal' del journal (0 se non ci sono passati). Il file non viene sincronizzato: lo sarà al
+ * prossimo checkpoint del journal. Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'offline_lock'.
+ */
+static int append_to_offline_queue(char* destinatario, char* mittente, int numero, time_t timestamp,
+                                   unsigned int journal) {
+    struct coda_offline* coda;
+    char path[PATH_MAX]; // Path del file della coda
+    FILE* file;
+    int ret;
+
+    coda = get_offline_queue(destinatario);
+    if (coda == NULL)
+        return -1;
+
+    get_offline_queue_path(destinatario, path);
+    file = open_or_create(path, "a");
+    if (file == NULL)
+        return -1; // Impossibile accedere al file
+
+    ret = fprintf(file, "%s %d %ld %u\n", mittente, numero, (long) timestamp, journal);
+    if (fclose(file) != 0 || ret < 0) {
+        fprintf(stderr, "Errore durante la scrittura del file '%s' : %s\n", path, strerror(errno));
+        return -1;
+    }
+    mark_derived_file(path);
+
+    if (journal != 0)
+        coda->applicato = journal;
+    return add_to_offline_summary(coda, mittente, numero, timestamp);
+}
+
+/*
+ * Svuota la coda di 'destinatario' (recapitata dal record 'journal' del journal): il file viene riscritto con la sola
+ * riga "@journal", senza sincronizzarlo.
+ * NB: il chiamante deve possedere 'offline_lock'.
+ */
+static void clear_offline_queue(struct coda_offline* coda, char* destinatario, unsigned int journal) {
+    char path[PATH_MAX]; // Path del file della coda
+    FILE* file;
+    int ret;
+
+    free_offline_summary(coda);
+    coda->applicato = journal;
+
+    get_offline_queue_path(destinatario, path);
+    file = open_or_create(path, "w");
+    if (file == NULL)
+        return; // Impossibile accedere al file
+
+    ret = fprintf(file, "@%u\n", journal);
+    if (fclose(file) != 0 || ret < 0)
+        fprintf(stderr, "Errore durante la scrittura del file '%s' : %s\n", path, strerror(errno));
+    mark_derived_file(path);
+}
+
+#ifdef DEBUG
+/*
+ * Stampa il riepilogo dei messaggi pendenti di 'destinatario'
+ * NB: il chiamante deve possedere 'offline_lock'.
+ */
+static void print_offline_queue(char* destinatario) {
+    struct coda_offline* coda = find_in_hash_table(&code_offline, destinatario);
+    struct mittente_offline* record;
+
+    printf("Messaggi pendenti per '%s':\n", destinatario);
+    if (coda == NULL)
+        return;
+
+    for (record = coda->primo; record != NULL; record = record->next)
+        printf("'%s': %d, ultimo alle %ld\n", record->username, record->numero, (long) record->ultimo);
+}
+#endif
+
+/*
+ * Prepara le code dei messaggi pendenti. Se c'è ancora il vecchio file unico (OFFLINE_MSG_FILE, con per ogni utente
+ * una riga con l'username e una "list:mittente:numero:timestamp:..."), il suo contenuto viene spostato nelle code.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+static int load_offline_queues(void) {
+    FILE* file;
+    char* linea = NULL; // Riga letta dal file
+    size_t dim_linea = 0;
+    char destinatario[USERNAME_LEN];
+    char* mittente;
+    char* numero;
+    char* timestamp;
+    int i;
+
+    if (init_hash_table(&code_offline, 0) == -1 || create_directory(OFFLINE_QUEUE_FOLDER) == -1)
+        return -1;
+
+    file = open_file(OFFLINE_MSG_FILE, "r");
+    if (file == NULL)
+        return 0; // Niente da convertire
+
+    destinatario[0] = '\0';
+    for (i = 0; getline(&linea, &dim_linea, file) != -1; i++) {
+        remove_new_line(linea);
+
+        // Le righe pari contengono l'username del destinatario
+        if (i % 2 == 0) {
+            snprintf(destinatario, USERNAME_LEN, "%s", linea);
+            continue;
+        }
+        if (strncmp(linea, "list:", 5) != 0)
+            continue; // Riga non valida
+
+        for (mittente = strtok(linea + 5, ":"); mittente != NULL; mittente = strtok(NULL, ":")) {
+            numero = strtok(NULL, ":");
+            timestamp = strtok(NULL, ":");
+            if (numero == NULL || timestamp == NULL)
+                break;
+
+            if (append_to_offline_queue(destinatario, mittente, atoi(numero), (time_t) atol(timestamp), 0) == -1) {
+                free(linea);
+                fclose(file);
+                return -1;
+            }
+        }
+    }
+    free(linea);
+    if (fclose(file) != 0)
+        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", OFFLINE_MSG_FILE, strerror(errno));
+
+    // Il vecchio file non serve più, ma solo una volta che le code sono su disco
+    if (sync_derived_files() == -1)
+        return -1;
+    if (remove(OFFLINE_MSG_FILE) == -1)
+        perror("Errore durante la cancellazione del vecchio file dei messaggi pendenti");
+
+    #ifdef DEBUG
+    printf("Convertito il file '%s' nelle code dei messaggi pendenti.\n", OFFLINE_MSG_FILE);
+    #endif
+
+    return 0;
+}
+
+/*
+ * Aggiunge al log della chat tra 'mittente' e 'destinatario' il messaggio registrato all'istante 'timestamp' dal record
+ * 'journal' del journal. Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'chat_log_lock'.
+ */
+static int write_to_chat_log(char* mittente, char* destinatario, char* messaggio, time_t timestamp,
+                             unsigned int journal) {
+    char path[PATH_MAX]; // Path del file di log della chat
+    FILE* log;
+    int tentativi = 0;
+
+    do {
+        // Il log viene aperto (in append) solo se non lo è già: solo allora può servire convertire il log testuale
+        get_chat_log_path(mittente, destinatario, path);
+        if (is_file_cached(&log_aperti, path) == 0)
+            prepare_chat_log(mittente, destinatario, path);
+
+        /*
+         * Il messaggio viene registrato come non letto poiché se arrivo qui l'utente è offline (altrimenti la
+         * gestirebbe il client). Il file resta aperto e il record arriva subito sul file (lo leggono show() e i
+         * device), ma viene sincronizzato solo al prossimo checkpoint del journal.
+         */
+        log = append_journaled_chat_message(&log_aperti, path, mittente, messaggio, timestamp, journal);
+    } while (log == NULL && errno == ESTALE && ++tentativi < 2); // Il log è stato spostato: lo cerco di nuovo
+
+    if (log == NULL)
+        return -1;
+    mark_derived_file(path);
+    return 0;
+}
+
+/*
+ * Sposta il segno di lettura di 'lettore' nella chat con 'interlocutore' a 'segno', senza sincronizzarlo
+ * NB: il chiamante deve possedere 'chat_log_lock'.
+ */
+static void move_read_mark(char* lettore, char* interlocutore, long segno) {
+    char path[PATH_MAX]; // Path del log della chat
+    char mark_path[PATH_MAX]; // Path del file del segno di lettura
+    int ret, tentativi = 0;
+
+    do {
+        get_chat_log_path(lettore, interlocutore, path);
+        ret = set_read_mark(path, lettore, segno);
+    } while (ret == -1 && errno == ESTALE && ++tentativi < 2); // Il log è stato spostato: lo cerco di nuovo
+
+    if (ret == -1)
+        return;
+    get_read_mark_path(path, lettore, mark_path);
+    mark_derived_file(mark_path);
+}
+
+/*
+ * Riapplica un record del journal trovato all'avvio (vedi open_journal()), se i file derivati non lo contengono già.
+ * All'avvio c'è un solo thread: non servono i lock.
+ */
+static void apply_journal_record(struct record_journal* record, void* contesto) {
+    struct coda_offline* coda;
+    char path[PATH_MAX]; // Path del log della chat
+    int num_campi = record->tipo == JOURNAL_HANGING ? 1 : 3;
+
+    (void) contesto;
+    if (record->num_campi != num_campi)
+        return; // Record non valido
+
+    if (record->tipo == JOURNAL_MESSAGE || record->tipo == JOURNAL_PENDING_MESSAGE) {
+        // Mittente, destinatario e testo: la coda e il log riportano l'ultimo record del journal che hanno ricevuto
+        coda = record->tipo == JOURNAL_PENDING_MESSAGE ? get_offline_queue(record->campi[1]) : NULL;
+        if (coda != NULL && !is_journal_record_applied(record->numero, coda->applicato))
+            append_to_offline_queue(record->campi[1], record->campi[0], 1, record->timestamp, record->numero);
+
+        prepare_chat_log(record->campi[0], record->campi[1], path);
+        if (!is_journal_record_applied(record->numero, last_chat_journal_record(path)))
+            write_to_chat_log(record->campi[0], record->campi[1], record->campi[2], record->timestamp, record->numero);
+    } else if (record->tipo == JOURNAL_HANGING) {
+        coda = get_offline_queue(record->campi[0]);
+        if (coda != NULL && !is_journal_record_applied(record->numero, coda->applicato))
+            clear_offline_queue(coda, record->campi[0], record->numero);
+    } else if (record->tipo == JOURNAL_READ_MARK) {
+        // Il segno di lettura si sposta solo in avanti: basta confrontarlo con quello sul file
+        prepare_chat_log(record->campi[1], record->campi[0], path);
+        if (atol(record->campi[2]) > get_read_mark(path, record->campi[0]))
+            move_read_mark(record->campi[0], record->campi[1], atol(record->campi[2]));
+    }
+}
+
+/*
+ * Esegue un checkpoint del journal se 'sempre' è 1 o se il journal è diventato troppo lungo. Solo mentre il journal
+ * passa all'altro segmento non si devono applicare record (si prendono i lock di tutti i file derivati): i file
+ * derivati si sincronizzano dopo averli rilasciati, mentre la registrazione dei messaggi prosegue.
+ */
+static void checkpoint(int sempre) {
+    int ret = 1;
+
+    if (!sempre && !journal_needs_checkpoint())
+        return;
+
+    pthread_mutex_lock(&offline_lock);
+    pthread_mutex_lock(&chat_log_lock);
+    if (sempre || journal_needs_checkpoint())
+        ret = begin_journal_checkpoint();
+    pthread_mutex_unlock(&chat_log_lock);
+    pthread_mutex_unlock(&offline_lock);
+
+    if (ret == 0)
+        end_journal_checkpoint();
+}
+
+/*
+ * Prepara le code dei messaggi pendenti e la cache dei log delle chat, poi riapplica i record rimasti nel journal
+ * da un'esecuzione interrotta e fa ripartire il journal vuoto. Dallo snapshot serve solo la parte di USERS_FILE da
+ * saltare: le code dei messaggi pendenti si caricano comunque solo quando servono.
+ */
+static int open_files(struct lettura_snapshot* snapshot) {
+    struct cursore_snapshot cursore;
+
+    if (snapshot != NULL) {
+        if (find_snapshot_section(snapshot, SNAPSHOT_USERS_FILE, 1, &cursore) == 0) {
+            utenti_ripristinati = read_snapshot_u64(&cursore);
+            if (cursore.errore)
+                utenti_ripristinati = 0;
+        }
+        close_snapshot(snapshot);
+    }
+
+    if (load_offline_queues() == -1 || init_file_cache(&log_aperti, CHAT_LOG_CACHE_LEN) == -1 ||
+        open_journal(JOURNAL_FILE, apply_journal_record, NULL) == -1)
+        return -1;
+
+    checkpoint(1);
+    return 0;
+}
+
+/*
+ * Legge gli utenti registrati da USERS_FILE (saltando quelli già nello snapshot) e apre il file in append per
+ * le nuove registrazioni
+ */
+static int load_users_file(void (*visita)(char* username, char* password, void* contesto), void* contesto) {
+    FILE* file;
+    char* linea = NULL; // Riga letta dal file (getline() la alloca della lunghezza della riga)
+    size_t dim_linea = 0;
+    char* username;
+    char* password;
+
+    file = open_or_create(USERS_FILE, "r");
+    if (file == NULL)
+        return -1;
+
+    // Se il file è più corto della parte nello snapshot non è quello da cui è stato scritto: lo rileggo tutto
+    if (utenti_ripristinati > 0 && (fseek(file, 0, SEEK_END) == -1 || ftell(file) < utenti_ripristinati ||
+                                    fseek(file, utenti_ripristinati, SEEK_SET) == -1))
+        rewind(file);
+
+    while (getline(&linea, &dim_linea, file) != -1) {
+        // Ricavo l'username e la password dalla riga (la password arriva fino a fine riga così da consentire passphrase)
+        remove_new_line(linea);
+        username = strtok(linea, " ");
+        password = strtok(NULL, "");
+        if (username == NULL || password == NULL)
+            continue; // Riga non valida
+
+        visita(username, password, contesto);
+    }
+    free(linea);
+    if (fclose(file) != 0)
+        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", USERS_FILE, strerror(errno));
+
+    file_utenti = open_file(USERS_FILE, "a");
+    if (file_utenti == NULL)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Aggiunge l'utente in fondo a USERS_FILE
+ */
+static long put_user_file(char* username, char* password) {
+    long turno;
+
+    pthread_mutex_lock(&utenti_lock);
+    if (fprintf(file_utenti, "%s %s\n", username, password) < 0 ||
+        (turno = commit_append(file_utenti, USERS_FILE, 1)) == -1) {
+        fprintf(stderr, "Errore durante la scrittura del file '%s' : %s\n", USERS_FILE, strerror(errno));
+        clearerr(file_utenti);
+        turno = -1;
+    }
+    pthread_mutex_unlock(&utenti_lock);
+
+    return turno;
+}
+
+/*
+ * Il messaggio viene reso definitivo da un solo record del journal, poi viene aggiunto al log della chat e, se è
+ * pendente, in fondo alla coda del destinatario (che non viene riletta né riscritta)
+ */
+static long append_message_file(char* mittente, char* destinatario, char* testo, int pendente) {
+    struct record_journal record = {0, JOURNAL_MESSAGE, 0, 3, {mittente, destinatario, testo}};
+    long turno; // Turno del commit del record
+
+    if (pendente)
+        record.tipo = JOURNAL_PENDING_MESSAGE;
+    record.timestamp = time(NULL);
+
+    // Record e file derivati si aggiornano sotto gli stessi lock: così nei file i record sono nell'ordine del journal
+    pthread_mutex_lock(&offline_lock);
+    pthread_mutex_lock(&chat_log_lock);
+
+    turno = append_to_journal(&record);
+    if (turno != -1) {
+        if (pendente)
+            append_to_offline_queue(destinatario, mittente, 1, record.timestamp, record.numero);
+        write_to_chat_log(mittente, destinatario, testo, record.timestamp, record.numero);
+    }
+
+    #ifdef DEBUG
+    print_offline_queue(destinatario);
+    #endif
+
+    pthread_mutex_unlock(&chat_log_lock);
+    pthread_mutex_unlock(&offline_lock);
+    return turno;
+}
+
+/*
+ * Il lettore mappa il log della chat e salta direttamente al messaggio 'primo': il log non viene riletto
+ */
+static int read_range_file(char* utente1, char* utente2, unsigned long long primo,
+                           void (*visita)(struct messaggio_chat* messaggio, void* contesto), void* contesto) {
+    char path[PATH_MAX]; // Path del log della chat
+    struct lettore_chat lettore; // Log della chat mappato in memoria
+    struct messaggio_chat messaggio; // Messaggio letto dal log
+    int visitati = 0, ret;
+
+    pthread_mutex_lock(&chat_log_lock);
+
+    prepare_chat_log(utente1, utente2, path);
+    ret = open_chat_reader(&lettore, path);
+    if (ret <= 0) {
+        pthread_mutex_unlock(&chat_log_lock);
+        return ret;
+    }
+
+    seek_chat_sequence(&lettore, primo);
+    while (next_chat_message(&lettore, &messaggio) == 1) {
+        visita(&messaggio, contesto);
+        visitati++;
+    }
+    close_chat_reader(&lettore);
+
+    pthread_mutex_unlock(&chat_log_lock);
+    return visitati;
+}
+
+/*
+ * Il segno di lettura è nel file accanto al log della chat
+ */
+static long read_mark_file(char* lettore, char* interlocutore) {
+    char path[PATH_MAX]; // Path del log della chat
+    long segno;
+
+    pthread_mutex_lock(&chat_log_lock);
+    get_chat_log_path(lettore, interlocutore, path);
+    segno = get_read_mark(path, lettore);
+    pthread_mutex_unlock(&chat_log_lock);
+
+    return segno;
+}
+
+/*
+ * Il nuovo segno di lettura viene registrato nel journal, poi viene scritto sul file accanto al log della chat
+ */
+static long mark_read_file(char* lettore, char* interlocutore, long segno) {
+    char path[PATH_MAX]; // Path del log della chat
+    char campo[24]; // Nuovo segno di lettura (campo del record del journal)
+    struct record_journal lettura = {0, JOURNAL_READ_MARK, 0, 3, {lettore, interlocutore, campo}};
+    long turno = 0; // Turno del commit del record
+
+    pthread_mutex_lock(&chat_log_lock);
+
+    get_chat_log_path(lettore, interlocutore, path);
+    if (segno > get_read_mark(path, lettore)) {
+        sprintf(campo, "%ld", segno);
+        lettura.timestamp = time(NULL);
+        turno = append_to_journal(&lettura);
+        if (turno != -1)
+            move_read_mark(lettore, interlocutore, segno);
+    }
+
+    #ifdef DEBUG
+    printf("Segno di lettura di '%s' nel file '%s' spostato a %ld.\n", lettore, path, segno);
+    #endif
+
+    pthread_mutex_unlock(&chat_log_lock);
+    return turno;
+}
+
+/*
+ * Il recapito viene registrato nel journal (solo se ci sono messaggi pendenti), poi la coda viene svuotata
+ */
+static long pending_summary_file(char* destinatario, struct coda_offline* riepilogo) {
+    struct coda_offline* coda;
+    struct record_journal recapito = {0, JOURNAL_HANGING, 0, 1, {destinatario}}; // Record che registra il recapito
+    long turno = 0; // Turno del commit del record
+
+    pthread_mutex_lock(&offline_lock);
+
+    coda = get_offline_queue(destinatario);
+    if (coda == NULL)
+        turno = -1;
+    else if (coda->primo != NULL) {
+        recapito.timestamp = time(NULL);
+        turno = append_to_journal(&recapito);
+        if (turno != -1) {
+            riepilogo->primo = coda->primo;
+            riepilogo->ultimo = coda->ultimo;
+            coda->primo = NULL;
+            coda->ultimo = NULL;
+            clear_offline_queue(coda, destinatario, recapito.numero);
+        }
+    }
+
+    pthread_mutex_unlock(&offline_lock);
+    return turno;
+}
+
+/*
+ * Legge la lunghezza attuale di USERS_FILE: le righe fin lì sono tra le credenziali che il server ha appena scritto
+ * nello snapshot
+ */
+static int prepare_snapshot_files(void) {
+    struct stat info;
+    int ret = 0;
+
+    pthread_mutex_lock(&utenti_lock);
+    if (fflush(file_utenti) != 0 || fstat(fileno(file_utenti), &info) == -1) {
+        fprintf(stderr, "Impossibile leggere la lunghezza del file '%s' : %s\n", USERS_FILE, strerror(errno));
+        ret = -1;
+    } else
+        utenti_fotografati = info.st_size;
+    pthread_mutex_unlock(&utenti_lock);
+
+    return ret;
+}
+
+/*
+ * Aggiunge allo snapshot la lunghezza di USERS_FILE letta da prepare_snapshot_files()
+ */
+static int snapshot_files(struct scrittura_snapshot* snapshot) {
+    begin_snapshot_section(snapshot, SNAPSHOT_USERS_FILE);
+    write_snapshot_u64(snapshot, utenti_fotografati);
+    return commit_snapshot(snapshot);
+}
+
+struct archivio archivio_file = {
+    "file",
+    open_files,
+    load_users_file,
+    put_user_file,
+    append_message_file,
+    read_range_file,
+    read_mark_file,
+    mark_read_file,
+    pending_summary_file,
+    checkpoint,
+    prepare_snapshot_files,
+    snapshot_files
+};
@@ -0,0 +1,309 @@
+/************************************************************
+ *                                                          *
+ *       Archivio in un unico log (motore 'log')            *
+ *                                                          *
+ ************************************************************/
+
+#include "memoria.h"
+#include "../costanti.h"
+#include "../util/tabella_hash.h"
+#include "../util/journal.h"
+#include "../util/snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Tutto l'archivio è un solo file (STORAGE_LOG_FILE, nel formato del journal: vedi util/journal.h) in cui ogni
+ * operazione aggiunge in fondo un record, con un'unica scrittura sequenziale e nessun file derivato da aggiornare.
+ * Le letture sono servite dagli indici in memoria del motore 'memoria'. Record e indici si aggiornano sotto
+ * 'memoria_lock', così gli indici ricostruiti all'avvio corrispondono a quelli che c'erano prima del riavvio
+ * (ad esempio nei numeri di sequenza dei messaggi).
+ * Gli indici finiscono negli snapshot del server insieme al numero dell'ultimo record del log: solo a quel punto il
+ * log viene svuotato, e all'avvio si ripristinano gli indici dallo snapshot e si riapplicano i soli record successivi.
+ * Il costo dell'avvio non dipende quindi dalla storia, ma dai record scritti dopo l'ultimo snapshot.
+ */
+
+/*
+ * Utenti trovati nel log all'avvio (username -> password): servono solo fino a load_users_log()
+ */
+static struct tabella_hash utenti;
+
+/*
+ * Snapshot da cui sono stati ripristinati gli indici: i messaggi ripristinati restano nella sua mappa
+ */
+static struct lettura_snapshot ripristinato;
+
+/*
+ * Stato fotografato da prepare_snapshot_log() per il prossimo snapshot
+ */
+static struct copia_memoria copia; // Copia degli indici
+static unsigned int ultimo_copiato; // Ultimo record del log già negli indici copiati
+static int checkpoint_iniziato; // Indica se i record fino a 'ultimo_copiato' sono nel vecchio segmento del log
+
+/*
+ * Applica agli indici in memoria un record letto dal log all'avvio (vedi open_journal()), se non era già nello
+ * snapshot da cui sono stati ripristinati ('contesto' è il numero dell'ultimo record dello snapshot).
+ * All'avvio c'è un solo thread: non servono i lock.
+ */
+static void apply_log_record(struct record_journal* record, void* contesto) {
+    struct coda_offline recapitati = {NULL, NULL, 0};
+    char* password;
+    int num_campi;
+
+    if (is_journal_record_applied(record->numero, *(unsigned int*) contesto))
+        return;
+    if (record->tipo == JOURNAL_HANGING)
+        num_campi = 1;
+    else if (record->tipo == JOURNAL_USER)
+        num_campi = 2;
+    else
+        num_campi = 3;
+    if (record->num_campi != num_campi)
+        return; // Record non valido
+
+    if (record->tipo == JOURNAL_USER) {
+        if (find_in_hash_table(&utenti, record->campi[0]) != NULL)
+            return;
+        password = strdup(record->campi[1]);
+        if (password == NULL || insert_into_hash_table(&utenti, record->campi[0], password) == -1) {
+            perror("Impossibile caricare gli utenti dal log");
+            free(password);
+        }
+    } else if (record->tipo == JOURNAL_MESSAGE || record->tipo == JOURNAL_PENDING_MESSAGE) {
+        store_message(record->campi[0], record->campi[1], record->campi[2], record->timestamp,
+                      record->tipo == JOURNAL_PENDING_MESSAGE);
+    } else if (record->tipo == JOURNAL_HANGING) {
+        take_stored_summary(record->campi[0], &recapitati);
+        free_offline_summary(&recapitati);
+    } else if (record->tipo == JOURNAL_READ_MARK) {
+        store_read_mark(record->campi[0], record->campi[1], atol(record->campi[2]));
+    }
+}
+
+/*
+ * Ripristina gli indici dallo snapshot (se c'è) e riapplica i record del log scritti dopo
+ */
+static int open_log(struct lettura_snapshot* snapshot) {
+    struct cursore_snapshot cursore;
+    unsigned int applicato = 0; // Ultimo record del log nello snapshot
+    unsigned int primo;
+
+    if (init_memory_store() == -1 || init_hash_table(&utenti, 0) == -1)
+        return -1;
+
+    if (snapshot != NULL && find_snapshot_section(snapshot, SNAPSHOT_LOG, 1, &cursore) == 0) {
+        applicato = read_snapshot_u32(&cursore);
+        if (cursore.errore || load_memory_store(snapshot, 1) == -1) {
+            fprintf(stderr, "Impossibile ripristinare l'archivio dallo snapshot.\n");
+            return -1;
+        }
+        ripristinato = *snapshot; // Resta aperto fino al prossimo snapshot
+    } else if (snapshot != NULL)
+        close_snapshot(snapshot);
+
+    if (open_journal(STORAGE_LOG_FILE, apply_log_record, &applicato) == -1)
+        return -1;
+
+    // Se il log è stato svuotato, i record eliminati devono essere tutti nello snapshot
+    primo = get_first_journal_record();
+    if (primo != 1 && !is_journal_record_applied(primo - 1, applicato)) {
+        fprintf(stderr, "Il log '%s' è stato svuotato dopo uno snapshot che non c'è più: i dati sarebbero incompleti.\n",
+                STORAGE_LOG_FILE);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Visitatore passato a load_users_log() e il suo contesto
+ */
+struct visita_utenti {
+    void (*visita)(char* username, char* password, void* contesto);
+    void* contesto;
+};
+
+/*
+ * Passa al visitatore ('contesto', struct visita_utenti) un utente trovato nel log
+ */
+static void visit_user(const char* username, void* password, void* contesto) {
+    struct visita_utenti* visita = contesto;
+
+    visita->visita((char*) username, password, visita->contesto);
+}
+
+/*
+ * Gli utenti trovati nel log all'avvio passano all'indice delle credenziali del server: qui non servono più
+ */
+static int load_users_log(void (*visita)(char* username, char* password, void* contesto), void* contesto) {
+    struct visita_utenti visita_utenti = {visita, contesto};
+
+    visit_hash_table(&utenti, visit_user, &visita_utenti);
+    free_hash_table(&utenti, free);
+    return 0;
+}
+
+/*
+ * La registrazione viene confermata solo quando il suo record è su disco. Nel frattempo il server possiede
+ * 'users_lock', così nessuno snapshot svuota il log tra la scrittura del record e l'inserimento nelle credenziali.
+ */
+static long put_user_log(char* username, char* password) {
+    struct record_journal record = {0, JOURNAL_USER, 0, 2, {username, password}};
+
+    record.timestamp = time(NULL);
+    if (append_to_journal(&record) == -1)
+        return -1;
+    return sync_journal();
+}
+
+static long append_message_log(char* mittente, char* destinatario, char* testo, int pendente) {
+    struct record_journal record = {0, JOURNAL_MESSAGE, 0, 3, {mittente, destinatario, testo}};
+    long turno; // Turno del commit del record
+
+    if (pendente)
+        record.tipo = JOURNAL_PENDING_MESSAGE;
+    record.timestamp = time(NULL);
+
+    pthread_mutex_lock(&memoria_lock);
+    turno = append_to_journal(&record);
+    if (turno != -1)
+        store_message(mittente, destinatario, testo, record.timestamp, pendente);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return turno;
+}
+
+static int read_range_log(char* utente1, char* utente2, unsigned long long primo,
+                          void (*visita)(struct messaggio_chat* messaggio, void* contesto), void* contesto) {
+    int ret;
+
+    pthread_mutex_lock(&memoria_lock);
+    ret = visit_stored_messages(utente1, utente2, primo, visita, contesto);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return ret;
+}
+
+static long read_mark_log(char* lettore, char* interlocutore) {
+    long segno;
+
+    pthread_mutex_lock(&memoria_lock);
+    segno = get_stored_read_mark(lettore, interlocutore);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return segno;
+}
+
+static long mark_read_log(char* lettore, char* interlocutore, long segno) {
+    char campo[24]; // Nuovo segno di lettura (campo del record)
+    struct record_journal lettura = {0, JOURNAL_READ_MARK, 0, 3, {lettore, interlocutore, campo}};
+    long turno = 0; // Turno del commit del record
+
+    pthread_mutex_lock(&memoria_lock);
+    if (segno > get_stored_read_mark(lettore, interlocutore)) {
+        sprintf(campo, "%ld", segno);
+        lettura.timestamp = time(NULL);
+        turno = append_to_journal(&lettura);
+        if (turno != -1)
+            store_read_mark(lettore, interlocutore, segno);
+    }
+    pthread_mutex_unlock(&memoria_lock);
+
+    return turno;
+}
+
+/*
+ * Il recapito viene registrato nel log solo se ci sono messaggi pendenti
+ */
+static long pending_summary_log(char* destinatario, struct coda_offline* riepilogo) {
+    struct record_journal recapito = {0, JOURNAL_HANGING, 0, 1, {destinatario}};
+    long turno = 0; // Turno del commit del record
+
+    pthread_mutex_lock(&memoria_lock);
+    if (has_stored_summary(destinatario)) {
+        recapito.timestamp = time(NULL);
+        turno = append_to_journal(&recapito);
+        if (turno != -1)
+            take_stored_summary(destinatario, riepilogo);
+    }
+    pthread_mutex_unlock(&memoria_lock);
+
+    return turno;
+}
+
+/*
+ * Non ci sono file derivati: i record arrivano su disco con i commit del log (vedi flush_commits())
+ */
+static void checkpoint_log(int sempre) {
+}
+
+/*
+ * Copia gli indici e il numero dell'ultimo record del log, poi inizia un checkpoint del log: i record successivi
+ * finiscono nell'altro segmento, così quelli negli indici copiati si possono eliminare quando sono nello snapshot.
+ * Avviene sotto 'memoria_lock' (e, per le registrazioni, 'users_lock'): nessun record si aggiunge nel frattempo.
+ * Non si copia la storia delle chat, ma solo i messaggi registrati dopo l'ultimo snapshot (vedi copy_memory_store()).
+ */
+static int prepare_snapshot_log(void) {
+    int ret;
+
+    pthread_mutex_lock(&memoria_lock);
+    ret = copy_memory_store(&copia);
+    if (ret == 0) {
+        ultimo_copiato = get_last_journal_record();
+        checkpoint_iniziato = begin_journal_checkpoint() == 0;
+    }
+    pthread_mutex_unlock(&memoria_lock);
+
+    return ret;
+}
+
+/*
+ * Aggiunge allo snapshot gli indici copiati da prepare_snapshot_log() e il numero dell'ultimo record del log già
+ * copiato, poi svuota il vecchio segmento del log, i cui record sono tutti nello snapshot, e passa i messaggi dalla
+ * memoria alla mappa del nuovo snapshot. Solo quest'ultimo passo avviene sotto 'memoria_lock', e costa quanto i
+ * messaggi registrati dopo l'ultimo snapshot: scrivere la storia delle chat non ferma le altre operazioni.
+ */
+static int snapshot_log(struct scrittura_snapshot* snapshot) {
+    struct lettura_snapshot nuovo;
+    int ret;
+
+    write_memory_copy(snapshot, &copia);
+    begin_snapshot_section(snapshot, SNAPSHOT_LOG);
+    write_snapshot_u32(snapshot, ultimo_copiato);
+    ret = commit_snapshot(snapshot);
+
+    // Il vecchio segmento si svuota solo se i suoi record sono nello snapshot
+    if (checkpoint_iniziato && ret == 0)
+        end_journal_checkpoint();
+    else if (checkpoint_iniziato)
+        abort_journal_checkpoint();
+
+    if (ret == 0 && open_snapshot(&nuovo, snapshot->path) == 1) {
+        pthread_mutex_lock(&memoria_lock);
+        if (load_memory_store(&nuovo, 0) == 0) {
+            close_snapshot(&ripristinato); // Nessuna chat punta più ai messaggi del vecchio snapshot
+            ripristinato = nuovo;
+        } else
+            close_snapshot(&nuovo);
+        pthread_mutex_unlock(&memoria_lock);
+    }
+
+    free_memory_copy(&copia);
+    return ret;
+}
+
+struct archivio archivio_log = {
+    "log",
+    open_log,
+    load_users_log,
+    put_user_log,
+    append_message_log,
+    read_range_log,
+    read_mark_log,
+    mark_read_log,
+    pending_summary_log,
+    checkpoint_log,
+    prepare_snapshot_log,
+    snapshot_log
+};
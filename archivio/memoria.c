@@ -0,0 +1,703 @@
+/************************************************************
+ *                                                          *
+ *          Archivio in memoria (motore 'memoria')          *
+ *                                                          *
+ ************************************************************/
+
+#include "memoria.h"
+#include "../costanti.h"
+#include "../util/file.h"
+#include "../util/tabella_hash.h"
+#include <linux/limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Messaggio di una chat in memoria (il numero di sequenza è la sua posizione nella chat, da 1)
+ */
+struct messaggio_memoria {
+    time_t timestamp; // Istante in cui è stato registrato
+    int mittente; // Indice del mittente in 'utenti' della chat
+    char* testo;
+    int len_testo;
+};
+
+/*
+ * Messaggio di una chat nello snapshot (un record della sezione SNAPSHOT_MESSAGES)
+ */
+struct messaggio_snapshot {
+    int64_t timestamp;
+    uint64_t testo; // Offset del testo (terminato) nella sezione SNAPSHOT_TEXTS
+    uint32_t len_testo;
+    uint32_t mittente; // Indice del mittente in 'utenti' della chat
+};
+
+/*
+ * Chat tra due utenti in memoria. I primi messaggi possono essere quelli ripristinati dallo snapshot, che restano
+ * nella sua mappa; seguono quelli registrati dopo.
+ */
+struct chat_memoria {
+    char* utenti[2]; // I due utenti della chat
+    long segni[2]; // Segno di lettura di ciascun utente
+    uint64_t primo_base; // Posizione in 'messaggi_base' del primo messaggio ripristinato dallo snapshot
+    uint64_t num_base; // Messaggi ripristinati dallo snapshot
+    struct messaggio_memoria* messaggi; // Messaggi registrati dopo lo snapshot, in ordine
+    size_t num_messaggi;
+    size_t dim_messaggi; // Messaggi allocati
+};
+
+/*
+ * Riepilogo dei messaggi pendenti di un destinatario copiato da copy_memory_store()
+ */
+struct pendenti_copiati {
+    const char* destinatario; // Chiave nella tabella dei riepiloghi, da cui non viene mai tolta
+    struct mittente_offline* mittenti;
+    uint32_t num_mittenti;
+};
+
+pthread_mutex_t memoria_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct tabella_hash chat; // Chat indicizzate per nome (vedi get_chat_name()), che non dipende dall'ordine degli utenti
+static struct tabella_hash pendenti; // Riepiloghi dei messaggi pendenti (struct coda_offline), indicizzati per destinatario
+
+/*
+ * Messaggi ripristinati dall'ultimo snapshot caricato (vedi load_memory_store()), nella sua mappa
+ */
+static const char* messaggi_base; // Record della sezione SNAPSHOT_MESSAGES (struct messaggio_snapshot)
+static uint64_t num_messaggi_base;
+static const char* testi_base; // Sezione SNAPSHOT_TEXTS
+static uint64_t dim_testi_base;
+
+/*
+ * Prepara gli indici vuoti. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_memory_store(void) {
+    if (init_hash_table(&chat, 0) == -1 || init_hash_table(&pendenti, 0) == -1)
+        return -1;
+    return 0;
+}
+
+/*
+ * Restituisce la chat tra 'utente1' e 'utente2'. Se non esiste viene creata se 'crea' è 1, altrimenti si restituisce NULL
+ * (così come in caso di errore).
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+static struct chat_memoria* get_chat(char* utente1, char* utente2, int crea) {
+    struct chat_memoria* conversazione;
+    char chiave[PATH_MAX];
+
+    get_chat_name(utente1, utente2, chiave);
+    conversazione = find_in_hash_table(&chat, chiave);
+    if (conversazione != NULL || !crea)
+        return conversazione;
+
+    conversazione = calloc(1, sizeof(struct chat_memoria));
+    if (conversazione == NULL) {
+        perror("Impossibile allocare una chat in memoria");
+        return NULL;
+    }
+    conversazione->utenti[0] = strdup(utente1);
+    conversazione->utenti[1] = strdup(utente2);
+    if (conversazione->utenti[0] == NULL || conversazione->utenti[1] == NULL ||
+        insert_into_hash_table(&chat, chiave, conversazione) == -1) {
+        perror("Impossibile allocare una chat in memoria");
+        free(conversazione->utenti[0]);
+        free(conversazione->utenti[1]);
+        free(conversazione);
+        return NULL;
+    }
+
+    return conversazione;
+}
+
+/*
+ * Restituisce l'indice di 'username' tra gli utenti della chat
+ */
+static int user_index(struct chat_memoria* conversazione, char* username) {
+    return strcmp(conversazione->utenti[0], username) == 0 ? 0 : 1;
+}
+
+/*
+ * Copia in 'messaggio' il messaggio della chat con numero di sequenza 'seq' (tra 1 e il numero di messaggi)
+ * NB: il chiamante deve possedere 'memoria_lock' (o la chat è una copia: vedi copy_memory_store()).
+ */
+static void get_message(struct chat_memoria* conversazione, uint64_t seq, struct messaggio_memoria* messaggio) {
+    struct messaggio_snapshot record;
+
+    if (seq > conversazione->num_base) {
+        *messaggio = conversazione->messaggi[seq - conversazione->num_base - 1];
+        return;
+    }
+
+    memcpy(&record, messaggi_base + (conversazione->primo_base + seq - 1) * sizeof(record), sizeof(record));
+    messaggio->timestamp = (time_t) record.timestamp;
+    messaggio->mittente = record.mittente != 0;
+
+    // Un testo che non sta nella sezione (snapshot danneggiato) diventa vuoto
+    if (record.testo >= dim_testi_base || record.len_testo >= dim_testi_base - record.testo ||
+        testi_base[record.testo + record.len_testo] != '\0') {
+        messaggio->testo = (char*) "";
+        messaggio->len_testo = 0;
+        return;
+    }
+    messaggio->testo = (char*) testi_base + record.testo;
+    messaggio->len_testo = record.len_testo;
+}
+
+/*
+ * Restituisce il riepilogo dei messaggi pendenti di 'destinatario', creandolo vuoto se non esiste.
+ * Restituisce NULL in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+static struct coda_offline* get_pending_queue(char* destinatario) {
+    struct coda_offline* coda = find_in_hash_table(&pendenti, destinatario);
+
+    if (coda != NULL)
+        return coda;
+
+    coda = calloc(1, sizeof(struct coda_offline));
+    if (coda == NULL || insert_into_hash_table(&pendenti, destinatario, coda) == -1) {
+        perror("Impossibile allocare la coda dei messaggi pendenti");
+        free(coda);
+        return NULL;
+    }
+    return coda;
+}
+
+/*
+ * Aggiunge alla chat tra 'mittente' e 'destinatario' il messaggio registrato all'istante 'timestamp' e, se 'pendente'
+ * è 1, lo conta tra i messaggi pendenti del destinatario. Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int store_message(char* mittente, char* destinatario, char* testo, time_t timestamp, int pendente) {
+    struct chat_memoria* conversazione;
+    struct messaggio_memoria* messaggio;
+    struct messaggio_memoria* nuovi;
+    struct coda_offline* coda;
+    size_t dim;
+
+    conversazione = get_chat(mittente, destinatario, 1);
+    if (conversazione == NULL)
+        return -1;
+
+    if (conversazione->num_messaggi == conversazione->dim_messaggi) {
+        dim = conversazione->dim_messaggi == 0 ? 16 : 2 * conversazione->dim_messaggi;
+        nuovi = realloc(conversazione->messaggi, dim * sizeof(struct messaggio_memoria));
+        if (nuovi == NULL) {
+            perror("Impossibile aggiungere un messaggio alla chat in memoria");
+            return -1;
+        }
+        conversazione->messaggi = nuovi;
+        conversazione->dim_messaggi = dim;
+    }
+
+    messaggio = &conversazione->messaggi[conversazione->num_messaggi];
+    messaggio->testo = strdup(testo);
+    if (messaggio->testo == NULL) {
+        perror("Impossibile aggiungere un messaggio alla chat in memoria");
+        return -1;
+    }
+    messaggio->len_testo = strlen(testo);
+    messaggio->timestamp = timestamp;
+    messaggio->mittente = user_index(conversazione, mittente);
+    conversazione->num_messaggi++;
+
+    if (!pendente)
+        return 0;
+
+    coda = get_pending_queue(destinatario);
+    if (coda == NULL)
+        return -1;
+    return add_to_offline_summary(coda, mittente, 1, timestamp);
+}
+
+/*
+ * Invoca 'visita' sui messaggi della chat tra 'utente1' e 'utente2' a partire dal numero di sequenza 'primo'.
+ * Restituisce il numero di messaggi visitati (0 se la chat non esiste).
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int visit_stored_messages(char* utente1, char* utente2, unsigned long long primo,
+                          void (*visita)(struct messaggio_chat* messaggio, void* contesto), void* contesto) {
+    struct chat_memoria* conversazione = get_chat(utente1, utente2, 0);
+    struct messaggio_memoria registrato;
+    struct messaggio_chat messaggio;
+    unsigned long long seq;
+    int visitati = 0;
+
+    if (conversazione == NULL)
+        return 0;
+
+    for (seq = primo > 0 ? primo : 1; seq <= conversazione->num_base + conversazione->num_messaggi; seq++) {
+        get_message(conversazione, seq, &registrato);
+        messaggio.seq = seq;
+        messaggio.timestamp = registrato.timestamp;
+        messaggio.letto = 0; // Il server registra solo messaggi non letti
+        messaggio.mittente = conversazione->utenti[registrato.mittente];
+        messaggio.len_mittente = strlen(messaggio.mittente);
+        messaggio.testo = registrato.testo;
+        messaggio.len_testo = registrato.len_testo;
+        visita(&messaggio, contesto);
+        visitati++;
+    }
+
+    return visitati;
+}
+
+/*
+ * Restituisce il segno di lettura di 'lettore' nella chat con 'interlocutore' (0 se non ha letto nulla)
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+long get_stored_read_mark(char* lettore, char* interlocutore) {
+    struct chat_memoria* conversazione = get_chat(lettore, interlocutore, 0);
+
+    return conversazione != NULL ? conversazione->segni[user_index(conversazione, lettore)] : 0;
+}
+
+/*
+ * Sposta il segno di lettura di 'lettore' nella chat con 'interlocutore' a 'segno', se è più avanti di quello attuale.
+ * Restituisce 1 se lo ha spostato, 0 altrimenti, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int store_read_mark(char* lettore, char* interlocutore, long segno) {
+    struct chat_memoria* conversazione = get_chat(lettore, interlocutore, 1);
+    int indice;
+
+    if (conversazione == NULL)
+        return -1;
+
+    indice = user_index(conversazione, lettore);
+    if (segno <= conversazione->segni[indice])
+        return 0;
+    conversazione->segni[indice] = segno;
+    return 1;
+}
+
+/*
+ * Indica se 'destinatario' ha messaggi pendenti
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int has_stored_summary(char* destinatario) {
+    struct coda_offline* coda = find_in_hash_table(&pendenti, destinatario);
+
+    return coda != NULL && coda->primo != NULL;
+}
+
+/*
+ * Sposta in 'riepilogo' il riepilogo dei messaggi pendenti di 'destinatario' (che resta senza)
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+void take_stored_summary(char* destinatario, struct coda_offline* riepilogo) {
+    struct coda_offline* coda = find_in_hash_table(&pendenti, destinatario);
+
+    if (coda == NULL)
+        return;
+
+    riepilogo->primo = coda->primo;
+    riepilogo->ultimo = coda->ultimo;
+    coda->primo = NULL;
+    coda->ultimo = NULL;
+}
+
+/*
+ * Scrittura delle chat nello snapshot: le sezioni si scrivono una alla volta, scorrendo le chat nello stesso ordine
+ */
+struct scrittura_chat {
+    struct scrittura_snapshot* snapshot;
+    uint64_t posizione; // Record (o byte di testo) scritti finora nella sezione
+};
+
+/*
+ * Copia la chat 'valore' nella prossima posizione libera della copia ('contesto'): i messaggi registrati dopo lo
+ * snapshot finiscono in un array nuovo, perché quello della chat può essere riallocato da store_message()
+ */
+static void copy_chat(const char* chiave, void* valore, void* contesto) {
+    struct chat_memoria* conversazione = valore;
+    struct copia_memoria* copia = contesto;
+    struct chat_memoria* copiata = &copia->chat[copia->num_chat];
+
+    (void) chiave;
+    *copiata = *conversazione;
+    copiata->dim_messaggi = conversazione->num_messaggi;
+    copiata->messaggi = NULL;
+    if (conversazione->num_messaggi > 0) {
+        copiata->messaggi = malloc(conversazione->num_messaggi * sizeof(struct messaggio_memoria));
+        if (copiata->messaggi == NULL) {
+            copia->errore = 1;
+            return;
+        }
+        memcpy(copiata->messaggi, conversazione->messaggi, conversazione->num_messaggi * sizeof(struct messaggio_memoria));
+    }
+    copia->num_chat++;
+}
+
+/*
+ * Copia il riepilogo dei messaggi pendenti del destinatario 'chiave' nella prossima posizione libera della copia
+ * ('contesto'). I riepiloghi vuoti non si copiano.
+ */
+static void copy_pending(const char* chiave, void* valore, void* contesto) {
+    struct coda_offline* coda = valore;
+    struct copia_memoria* copia = contesto;
+    struct pendenti_copiati* copiati = &copia->pendenti[copia->num_pendenti];
+    struct mittente_offline* record;
+    uint32_t num_mittenti = 0;
+
+    for (record = coda->primo; record != NULL; record = record->next)
+        num_mittenti++;
+    if (num_mittenti == 0)
+        return;
+
+    copiati->destinatario = chiave;
+    copiati->mittenti = malloc(num_mittenti * sizeof(struct mittente_offline));
+    if (copiati->mittenti == NULL) {
+        copia->errore = 1;
+        return;
+    }
+    copiati->num_mittenti = 0;
+    for (record = coda->primo; record != NULL; record = record->next)
+        copiati->mittenti[copiati->num_mittenti++] = *record;
+    copia->num_pendenti++;
+}
+
+/*
+ * Libera la copia degli indici
+ */
+void free_memory_copy(struct copia_memoria* copia) {
+    uint32_t i;
+
+    for (i = 0; i < copia->num_chat; i++)
+        free(copia->chat[i].messaggi);
+    for (i = 0; i < copia->num_pendenti; i++)
+        free(copia->pendenti[i].mittenti);
+    free(copia->chat);
+    free(copia->pendenti);
+    copia->chat = NULL;
+    copia->pendenti = NULL;
+    copia->num_chat = copia->num_pendenti = 0;
+}
+
+/*
+ * Copia in 'copia' gli indici da scrivere nello snapshot. Non si copia la storia delle chat: i messaggi già nella mappa
+ * dell'ultimo snapshot caricato restano lì, dei messaggi registrati dopo si copiano solo i riferimenti ai testi
+ * (che non cambiano più). Costa quanto il numero di chat e i messaggi registrati dopo l'ultimo snapshot.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'. Finché si usa la copia non vanno caricati altri snapshot.
+ */
+int copy_memory_store(struct copia_memoria* copia) {
+    unsigned int num_chat = chat.num_elementi;
+    unsigned int num_pendenti = pendenti.num_elementi;
+
+    copia->num_chat = copia->num_pendenti = 0;
+    copia->errore = 0;
+    copia->chat = malloc((num_chat > 0 ? num_chat : 1) * sizeof(struct chat_memoria));
+    copia->pendenti = malloc((num_pendenti > 0 ? num_pendenti : 1) * sizeof(struct pendenti_copiati));
+    if (copia->chat == NULL || copia->pendenti == NULL) {
+        perror("Impossibile copiare gli indici in memoria");
+        free_memory_copy(copia);
+        return -1;
+    }
+
+    visit_hash_table(&chat, copy_chat, copia);
+    visit_hash_table(&pendenti, copy_pending, copia);
+    if (copia->errore) {
+        perror("Impossibile copiare gli indici in memoria");
+        free_memory_copy(copia);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Scrive nella sezione SNAPSHOT_CHATS gli utenti e i segni di lettura della chat e la posizione dei suoi messaggi
+ */
+static void write_chat(struct chat_memoria* conversazione, struct scrittura_chat* scrittura) {
+    uint64_t num = conversazione->num_base + conversazione->num_messaggi;
+
+    write_snapshot_string(scrittura->snapshot, conversazione->utenti[0]);
+    write_snapshot_string(scrittura->snapshot, conversazione->utenti[1]);
+    write_snapshot_u64(scrittura->snapshot, conversazione->segni[0]);
+    write_snapshot_u64(scrittura->snapshot, conversazione->segni[1]);
+    write_snapshot_u64(scrittura->snapshot, scrittura->posizione);
+    write_snapshot_u64(scrittura->snapshot, num);
+    scrittura->posizione += num;
+}
+
+/*
+ * Scrive nella sezione SNAPSHOT_MESSAGES i record dei messaggi della chat
+ */
+static void write_chat_messages(struct chat_memoria* conversazione, struct scrittura_chat* scrittura) {
+    struct messaggio_memoria messaggio;
+    struct messaggio_snapshot record;
+    uint64_t seq;
+
+    for (seq = 1; seq <= conversazione->num_base + conversazione->num_messaggi; seq++) {
+        get_message(conversazione, seq, &messaggio);
+        record.timestamp = messaggio.timestamp;
+        record.testo = scrittura->posizione;
+        record.len_testo = messaggio.len_testo;
+        record.mittente = messaggio.mittente;
+        write_to_snapshot(scrittura->snapshot, &record, sizeof(record));
+        scrittura->posizione += messaggio.len_testo + 1;
+    }
+}
+
+/*
+ * Scrive nella sezione SNAPSHOT_TEXTS i testi dei messaggi della chat
+ */
+static void write_chat_texts(struct chat_memoria* conversazione, struct scrittura_chat* scrittura) {
+    struct messaggio_memoria messaggio;
+    uint64_t seq;
+
+    for (seq = 1; seq <= conversazione->num_base + conversazione->num_messaggi; seq++) {
+        get_message(conversazione, seq, &messaggio);
+        write_to_snapshot(scrittura->snapshot, messaggio.testo, messaggio.len_testo + 1);
+    }
+}
+
+/*
+ * Scrive nella sezione SNAPSHOT_PENDING il riepilogo copiato dei messaggi pendenti di un destinatario
+ */
+static void write_pending(struct scrittura_snapshot* snapshot, struct pendenti_copiati* copiati) {
+    uint32_t i;
+
+    write_snapshot_string(snapshot, copiati->destinatario);
+    write_snapshot_u32(snapshot, copiati->num_mittenti);
+    for (i = 0; i < copiati->num_mittenti; i++) {
+        write_snapshot_string(snapshot, copiati->mittenti[i].username);
+        write_snapshot_u32(snapshot, copiati->mittenti[i].numero);
+        write_snapshot_u64(snapshot, copiati->mittenti[i].ultimo);
+    }
+}
+
+/*
+ * Scrive nello snapshot gli indici copiati in 'copia' (sezioni SNAPSHOT_CHATS, SNAPSHOT_MESSAGES, SNAPSHOT_TEXTS e
+ * SNAPSHOT_PENDING). Non serve possedere 'memoria_lock'.
+ */
+void write_memory_copy(struct scrittura_snapshot* snapshot, struct copia_memoria* copia) {
+    struct scrittura_chat scrittura = {snapshot, 0};
+    uint32_t i;
+
+    begin_snapshot_section(snapshot, SNAPSHOT_CHATS);
+    write_snapshot_u32(snapshot, copia->num_chat);
+    for (i = 0; i < copia->num_chat; i++)
+        write_chat(&copia->chat[i], &scrittura);
+
+    begin_snapshot_section(snapshot, SNAPSHOT_MESSAGES);
+    scrittura.posizione = 0;
+    for (i = 0; i < copia->num_chat; i++)
+        write_chat_messages(&copia->chat[i], &scrittura);
+
+    begin_snapshot_section(snapshot, SNAPSHOT_TEXTS);
+    for (i = 0; i < copia->num_chat; i++)
+        write_chat_texts(&copia->chat[i], &scrittura);
+
+    begin_snapshot_section(snapshot, SNAPSHOT_PENDING);
+    write_snapshot_u32(snapshot, copia->num_pendenti);
+    for (i = 0; i < copia->num_pendenti; i++)
+        write_pending(snapshot, &copia->pendenti[i]);
+}
+
+/*
+ * Ricostruisce i riepiloghi dei messaggi pendenti dalla sezione SNAPSHOT_PENDING.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+static int load_pending(struct cursore_snapshot* cursore) {
+    struct coda_offline* coda;
+    const char* destinatario;
+    const char* mittente;
+    uint32_t num, num_mittenti, numero;
+    uint64_t ultimo;
+
+    for (num = read_snapshot_u32(cursore); num > 0 && !cursore->errore; num--) {
+        destinatario = read_snapshot_string(cursore);
+        num_mittenti = read_snapshot_u32(cursore);
+        if (cursore->errore)
+            break;
+        coda = get_pending_queue((char*) destinatario);
+        if (coda == NULL)
+            return -1;
+
+        for (; num_mittenti > 0; num_mittenti--) {
+            mittente = read_snapshot_string(cursore);
+            numero = read_snapshot_u32(cursore);
+            ultimo = read_snapshot_u64(cursore);
+            if (cursore->errore)
+                break;
+            if (add_to_offline_summary(coda, (char*) mittente, numero, (time_t) ultimo) == -1)
+                return -1;
+        }
+    }
+
+    return cursore->errore ? -1 : 0;
+}
+
+/*
+ * Ripristina gli indici dallo snapshot: le chat ripartono dai messaggi dello snapshot, che restano nella sua mappa
+ * (lo snapshot non va chiuso finché li si usa). Le chat già in memoria perdono i messaggi che sono nello snapshot,
+ * tenendo quelli registrati dopo la copia da cui è stato scritto: così i messaggi passano dalla memoria alla sua mappa.
+ * Se 'riepiloghi' è 1 ripristina anche i riepiloghi dei messaggi pendenti (che devono essere vuoti).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int load_memory_store(struct lettura_snapshot* snapshot, int riepiloghi) {
+    struct cursore_snapshot chat_snapshot, messaggi, testi, pendenti_snapshot;
+    struct chat_memoria* conversazione;
+    const char* utente1;
+    const char* utente2;
+    uint64_t segni[2], primo, num;
+    uint32_t num_chat;
+    size_t i, scritti;
+
+    if (find_snapshot_section(snapshot, SNAPSHOT_CHATS, 1, &chat_snapshot) == -1 ||
+        find_snapshot_section(snapshot, SNAPSHOT_MESSAGES, 0, &messaggi) == -1 ||
+        find_snapshot_section(snapshot, SNAPSHOT_TEXTS, 0, &testi) == -1 ||
+        (riepiloghi && find_snapshot_section(snapshot, SNAPSHOT_PENDING, 1, &pendenti_snapshot) == -1))
+        return -1;
+
+    // I messaggi restano dove sono: si legge solo l'elenco delle chat
+    messaggi_base = messaggi.pos;
+    num_messaggi_base = (messaggi.fine - messaggi.pos) / sizeof(struct messaggio_snapshot);
+    testi_base = testi.pos;
+    dim_testi_base = testi.fine - testi.pos;
+
+    for (num_chat = read_snapshot_u32(&chat_snapshot); num_chat > 0; num_chat--) {
+        utente1 = read_snapshot_string(&chat_snapshot);
+        utente2 = read_snapshot_string(&chat_snapshot);
+        segni[0] = read_snapshot_u64(&chat_snapshot);
+        segni[1] = read_snapshot_u64(&chat_snapshot);
+        primo = read_snapshot_u64(&chat_snapshot);
+        num = read_snapshot_u64(&chat_snapshot);
+        if (chat_snapshot.errore || primo > num_messaggi_base || num > num_messaggi_base - primo) {
+            fprintf(stderr, "L'elenco delle chat dello snapshot è danneggiato.\n");
+            return -1;
+        }
+
+        conversazione = get_chat((char*) utente1, (char*) utente2, 1);
+        if (conversazione == NULL)
+            return -1;
+
+        // I messaggi in memoria fino al numero di sequenza 'num' sono nello snapshot, gli altri restano in memoria
+        scritti = num > conversazione->num_base ? num - conversazione->num_base : 0;
+        if (scritti > conversazione->num_messaggi)
+            scritti = conversazione->num_messaggi;
+        if (scritti > 0) {
+            for (i = 0; i < scritti; i++)
+                free(conversazione->messaggi[i].testo);
+            conversazione->num_messaggi -= scritti;
+            memmove(conversazione->messaggi, conversazione->messaggi + scritti,
+                    conversazione->num_messaggi * sizeof(struct messaggio_memoria));
+        }
+
+        conversazione->primo_base = primo;
+        conversazione->num_base = num;
+        // I segni di lettura possono essere stati spostati dopo la copia
+        if ((long) segni[0] > conversazione->segni[0])
+            conversazione->segni[0] = segni[0];
+        if ((long) segni[1] > conversazione->segni[1])
+            conversazione->segni[1] = segni[1];
+    }
+
+    if (riepiloghi && load_pending(&pendenti_snapshot) == -1) {
+        fprintf(stderr, "I messaggi pendenti dello snapshot sono danneggiati.\n");
+        return -1;
+    }
+
+    #ifdef DEBUG
+    printf("Ripristinate dallo snapshot %u chat con %llu messaggi.\n", chat.num_elementi,
+           (unsigned long long) num_messaggi_base);
+    #endif
+
+    return 0;
+}
+
+/*
+ * Gli indici partono vuoti a ogni avvio
+ */
+static int open_memory(struct lettura_snapshot* snapshot) {
+    if (snapshot != NULL)
+        close_snapshot(snapshot);
+    return init_memory_store();
+}
+
+/*
+ * Nessun utente sopravvive a un riavvio: l'indice delle credenziali del server è l'unica copia
+ */
+static int load_users_memory(void (*visita)(char* username, char* password, void* contesto), void* contesto) {
+    return 0;
+}
+
+static long put_user_memory(char* username, char* password) {
+    return 0;
+}
+
+static long append_message_memory(char* mittente, char* destinatario, char* testo, int pendente) {
+    int ret;
+
+    pthread_mutex_lock(&memoria_lock);
+    ret = store_message(mittente, destinatario, testo, time(NULL), pendente);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return ret;
+}
+
+static int read_range_memory(char* utente1, char* utente2, unsigned long long primo,
+                             void (*visita)(struct messaggio_chat* messaggio, void* contesto), void* contesto) {
+    int ret;
+
+    pthread_mutex_lock(&memoria_lock);
+    ret = visit_stored_messages(utente1, utente2, primo, visita, contesto);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return ret;
+}
+
+static long read_mark_memory(char* lettore, char* interlocutore) {
+    long segno;
+
+    pthread_mutex_lock(&memoria_lock);
+    segno = get_stored_read_mark(lettore, interlocutore);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return segno;
+}
+
+static long mark_read_memory(char* lettore, char* interlocutore, long segno) {
+    int ret;
+
+    pthread_mutex_lock(&memoria_lock);
+    ret = store_read_mark(lettore, interlocutore, segno);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return ret == -1 ? -1 : 0;
+}
+
+static long pending_summary_memory(char* destinatario, struct coda_offline* riepilogo) {
+    pthread_mutex_lock(&memoria_lock);
+    take_stored_summary(destinatario, riepilogo);
+    pthread_mutex_unlock(&memoria_lock);
+
+    return 0;
+}
+
+/*
+ * Non c'è niente da rendere definitivo
+ */
+static void checkpoint_memory(int sempre) {
+}
+
+struct archivio archivio_memoria = {
+    "memoria",
+    open_memory,
+    load_users_memory,
+    put_user_memory,
+    append_message_memory,
+    read_range_memory,
+    read_mark_memory,
+    mark_read_memory,
+    pending_summary_memory,
+    checkpoint_memory,
+    NULL,
+    NULL // Tutto si perde alla chiusura: non si scrivono snapshot
+};
@@ -0,0 +1,109 @@
+/************************************************************
+ *                                                          *
+ *          Archivio in memoria (motore 'memoria')          *
+ *                                                          *
+ ************************************************************/
+
+#ifndef ARCHIVIO_MEMORIA_H
+#define ARCHIVIO_MEMORIA_H
+
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "archivio.h"
+
+/*
+ * Indici in memoria delle chat (messaggi e segni di lettura) e dei messaggi pendenti. Li usa il motore 'memoria'
+ * e, per servire le letture senza accedere al disco, anche il motore 'log', che li ripristina all'avvio dallo snapshot
+ * del server e dal log.
+ * Sono protetti da 'memoria_lock'.
+ */
+extern pthread_mutex_t memoria_lock;
+
+/*
+ * Prepara gli indici vuoti. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_memory_store(void);
+
+/*
+ * Aggiunge alla chat tra 'mittente' e 'destinatario' il messaggio registrato all'istante 'timestamp' e, se 'pendente'
+ * è 1, lo conta tra i messaggi pendenti del destinatario. Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int store_message(char* mittente, char* destinatario, char* testo, time_t timestamp, int pendente);
+
+/*
+ * Invoca 'visita' sui messaggi della chat tra 'utente1' e 'utente2' a partire dal numero di sequenza 'primo'.
+ * Restituisce il numero di messaggi visitati (0 se la chat non esiste).
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int visit_stored_messages(char* utente1, char* utente2, unsigned long long primo,
+                          void (*visita)(struct messaggio_chat* messaggio, void* contesto), void* contesto);
+
+/*
+ * Restituisce il segno di lettura di 'lettore' nella chat con 'interlocutore' (0 se non ha letto nulla)
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+long get_stored_read_mark(char* lettore, char* interlocutore);
+
+/*
+ * Sposta il segno di lettura di 'lettore' nella chat con 'interlocutore' a 'segno', se è più avanti di quello attuale.
+ * Restituisce 1 se lo ha spostato, 0 altrimenti, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int store_read_mark(char* lettore, char* interlocutore, long segno);
+
+/*
+ * Indica se 'destinatario' ha messaggi pendenti
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int has_stored_summary(char* destinatario);
+
+/*
+ * Sposta in 'riepilogo' il riepilogo dei messaggi pendenti di 'destinatario' (che resta senza)
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+void take_stored_summary(char* destinatario, struct coda_offline* riepilogo);
+
+/*
+ * Copia degli indici da cui si scrive lo snapshot senza possedere 'memoria_lock' (vedi copy_memory_store())
+ */
+struct copia_memoria {
+    struct chat_memoria* chat; // Chat copiate
+    uint32_t num_chat;
+    struct pendenti_copiati* pendenti; // Riepiloghi dei messaggi pendenti copiati
+    uint32_t num_pendenti;
+    int errore; // 1 se qualche allocazione è fallita durante la copia
+};
+
+/*
+ * Copia in 'copia' gli indici da scrivere nello snapshot. Non si copia la storia delle chat: i messaggi già nella mappa
+ * dell'ultimo snapshot caricato restano lì, dei messaggi registrati dopo si copiano solo i riferimenti ai testi
+ * (che non cambiano più). Costa quanto il numero di chat e i messaggi registrati dopo l'ultimo snapshot.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'. Finché si usa la copia non vanno caricati altri snapshot.
+ */
+int copy_memory_store(struct copia_memoria* copia);
+
+/*
+ * Scrive nello snapshot gli indici copiati in 'copia' (sezioni SNAPSHOT_CHATS, SNAPSHOT_MESSAGES, SNAPSHOT_TEXTS e
+ * SNAPSHOT_PENDING). Non serve possedere 'memoria_lock'.
+ */
+void write_memory_copy(struct scrittura_snapshot* snapshot, struct copia_memoria* copia);
+
+/*
+ * Libera la copia degli indici
+ */
+void free_memory_copy(struct copia_memoria* copia);
+
+/*
+ * Ripristina gli indici dallo snapshot: le chat ripartono dai messaggi dello snapshot, che restano nella sua mappa
+ * (lo snapshot non va chiuso finché li si usa). Le chat già in memoria perdono i messaggi che sono nello snapshot,
+ * tenendo quelli registrati dopo la copia da cui è stato scritto: così i messaggi passano dalla memoria alla sua mappa.
+ * Se 'riepiloghi' è 1 ripristina anche i riepiloghi dei messaggi pendenti (che devono essere vuoti).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'memoria_lock'.
+ */
+int load_memory_store(struct lettura_snapshot* snapshot, int riepiloghi);
+
+#endif
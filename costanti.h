@@ -3,6 +3,9 @@
 *********************************/
 #define DEFAULT_SERVER_PORT 4242 // Porta di default del server
 #define QUEUE_LEN 10 // Massimo numero di client
+#define SERVER_QUEUE_LEN 4096 // Massimo numero di connessioni in attesa di essere accettate dal server
+#define MAX_EVENTS 256 // Numero massimo di eventi gestiti dal server a ogni risveglio dell'event loop
+#define HELLO_TIMEOUT 2 // Secondi entro cui il server deve rispondere alla negoziazione del protocollo
 #define INVALID_SOCKET (-1) // Permette di riconoscere un client disconnesso
 #define READ_MARK "(**)" // Contrassegna i messaggi letti dal destinatario
 #define UNREAD_MARK "(*)" // Contrassegna i messaggi non letti dal destinatario
@@ -14,22 +17,44 @@
 #define PASSWORD_LEN 60 // Lunghezza massima di una password
 #define GROUP_SIZE 100 // Numero massimo di utenti in un gruppo
 #define CONTACT_LIST_SIZE 200 // Numero massimo di contatti in rubrica
+#define MAX_PENDING_REQUESTS 64 // Numero massimo di richieste che un device invia al server senza averne ricevuto la risposta
+#define SEND_WINDOW 32 // Numero massimo di messaggi inviati a un membro della chat e non ancora confermati
 #define MAX_COMMAND_LEN (50 + USERNAME_LEN + PASSWORD_LEN) // Lunghezza massima di un comando inseribile da terminale
 #define TIMESTAMP_LEN 50 // Lunghezza massima di un timestamp formattato
 #define MAX_LINE_LEN MAX_COMMAND_LEN // Lunghezza massima di una riga in un file
 #define FILE_MSG_SIZE 1023 // Quando si vuole condividere un file si inviano FILE_MSG_SIZE byte alla volta
 #define MAX_MSG_LEN FILE_MSG_SIZE // Lunghezza massima di un messaggio (scambiato tra peer o tra client e server)
+#define MAX_CAMPI 3 // Numero massimo di campi di un messaggio tra client e server (oltre al nome o all'opcode)
+#define MAX_FRAME_LEN (1 + MAX_CAMPI * (MAX_MSG_LEN + 2)) // Lunghezza massima di un frame con lunghezza a 16 bit (protocollo binario versione 2)
+#define MAX_VARINT_LEN 5 // Byte occupati al massimo da un intero a 32 bit codificato come varint
+#define DEFAULT_MAX_FRAME_LEN (1024 * 1024) // Lunghezza massima predefinita di un frame con lunghezza varint (vedi l'opzione -m del server)
+#define MIN_MAX_FRAME_LEN (1 + 2 * MAX_VARINT_LEN + CONTACT_LIST_SIZE * USERNAME_LEN) // Valore minimo dell'opzione -m: ci deve stare una richiesta con l'intera rubrica
+#define COMPRESSION_THRESHOLD 256 // I frame più corti di COMPRESSION_THRESHOLD byte vengono inviati senza compressione (vedi l'opzione -z del server)
+#define RECEIVE_BUFFER_LEN (4 * (MAX_MSG_LEN + 2)) // Dimensione del buffer di ricezione di una connessione del server
+#define SEND_SEGMENT_LEN 4096 // Dimensione di un segmento della coda di invio di una connessione del server
+#define SEND_QUEUE_MAX_IOV 64 // Numero massimo di segmenti inviati con una singola writev()
+#define SEND_QUEUE_HIGH (64 * 1024) // Byte in coda oltre i quali si smette di leggere le richieste del client
+#define SEND_QUEUE_LOW (16 * 1024) // Byte in coda sotto i quali si riprende a leggere le richieste del client
+#define SEND_QUEUE_MAX (4 * 1024 * 1024) // Byte in coda oltre i quali la connessione viene chiusa (il client non legge)
+#define CHAT_LOG_CACHE_LEN 64 // Numero massimo di log delle chat tenuti aperti in append
+#define SHARE_BATCH_LEN (64 * 1024) // I frame di un file condiviso vengono inviati a blocchi di al massimo SHARE_BATCH_LEN byte
+#define JOURNAL_CHECKPOINT_LEN (4 * 1024 * 1024) // Byte del journal oltre i quali si esegue un checkpoint
+#define SNAPSHOT_INTERVAL 300 // Secondi tra due snapshot dello stato del server (vedi util/snapshot.h)
 
 /********************************
  *             FILE             *
 *********************************/
 #define USERS_FILE "./users.txt" // File contenente le credenziali degli utenti
 #define ACTIVITY_LOG_FILE "./activity.txt" // File su cui vengono registrati i login/logout degli utenti
-#define OFFLINE_MSG_FILE "./messaggi_offline.txt" // File su cui vengono memorizzati i messaggi recapitati a utenti offline
+#define OFFLINE_MSG_FILE "./messaggi_offline.txt" // Vecchio file unico dei messaggi pendenti (convertito all'avvio)
+#define OFFLINE_QUEUE_FOLDER "./offline/" // Cartella contenente la coda dei messaggi pendenti di ogni utente
 #define SHARED_FILE_FOLDER "./shared/" // Cartella contenente i file che gli utenti possono condividere
 #define CONTACT_LIST_FOLDER "./rubriche/" // Cartella contenente le rubriche di tutti gli utenti
 #define CHAT_LOG_FOLDER "./chat/" // Cartella contenente i log delle chat tra ogni coppia di utenti
 #define SHOW_LOG_FILE "./show_log.txt" // File di log contenente l'elenco delle show da notificare
+#define JOURNAL_FILE "./journal.bin" // Journal in cui il server registra i messaggi ricevuti prima di aggiornare gli altri file
+#define STORAGE_LOG_FILE "./archivio.bin" // Unico file dell'archivio del server con il motore 'log' (vedi archivio/log.c)
+#define SNAPSHOT_FILE "./stato.bin" // Ultimo snapshot dello stato del server, da cui riparte all'avvio
 
 /********************************
  *    COMANDI CLIENT<->SERVER   *
@@ -66,6 +91,14 @@
 #define ACK_SHARE "OKSHARE" // Mandato dal ricevente per segnalare la ricezione del comando di condivisione file
 #define DONE_SHARE "ENDSHARE" // Inviato dal mittente per segnalare la fine del file
 
+/*
+ * Solo se il server ha comunicato che il peer supporta PROTOCOL_HANDSHAKE (vedi OP_PEER_PORT):
+ * 1) Chi apre la connessione peer-to-peer invia il comando
+ * 2) Invia poi le proprie capacità (OP_CAPABILITIES, in un frame con lunghezza varint)
+ * 3) Il peer risponde con OP_CAPABILITIES e i valori in comune
+ */
+#define PEER_HELLO "HELLO" // Inviato da chi apre una connessione peer-to-peer per negoziarne il formato
+
 /*
  * 1) Si invia al server il comando che segnala la volontà di iniziare una chat
  * 2) Si invia al server l'username dell'utente con cui si vuole avviare una chat
@@ -20,6 +20,9 @@
 #include "util/string.h"
 #include "util/file.h"
 #include "util/time.h"
+#include "util/protocollo.h"
+#include "util/cache_file.h"
+#include "util/log_chat.h"
 
 // Elenco di comandi eseguibili (solo) durante una chat
 enum CHAT_COMMAND {
@@ -28,6 +31,17 @@ enum CHAT_COMMAND {
 
 int server_port; // Porta di ascolto del server
 int server_socket; // Socket di ascolto con il server
+int versione_server = PROTOCOL_LEGACY; // Versione del protocollo negoziata con il server (vedi negotiate_protocol())
+int codec_server = CODEC_NONE; // Codec con cui si comprimono i messaggi per il server (vedi negotiate_features())
+
+/*
+ * Capacità negoziate con i peer (vedi PEER_HELLO), nella posizione del socket peer-to-peer. Con i peer che non
+ * supportano PROTOCOL_HANDSHAKE la versione resta PROTOCOL_LEGACY e si usano solo i comandi a stringhe; vale 0
+ * per una connessione accettata da cui non è ancora arrivato alcun comando.
+ */
+int versione_peer[FD_SETSIZE]; // Versione del protocollo negoziata con il peer
+int max_frame_peer[FD_SETSIZE]; // Lunghezza massima dei frame che il peer accetta
+int codec_peer[FD_SETSIZE]; // Codec con cui si comprimono i messaggi per il peer
 int client_port; // Porta su cui il client è in ascolto
 int logged = 0; // Indica se è stato eseguito il login o meno
 char username[USERNAME_LEN]; // Username dell'utente autenticato
@@ -39,8 +53,58 @@ char chat_users[GROUP_SIZE][USERNAME_LEN]; // Username degli utenti attualmente
 int destinatario_offline = 0; // 1 quando il interlocutore è offline, altrimenti 0
 int server_offline = 0; // 1 quando il server è offline, 0 se online
 fd_set master; // Elenco di socket monitorati
+struct cache_file log_aperti; // Log delle chat usati più di recente, aperti in append
 int fd_max; // Numero di socket massimo
 
+/*
+ * Esito di una richiesta asincrona: l'opcode e i campi interi della risposta del server
+ */
+struct esito_richiesta {
+    int completata; // 1 quando è arrivata la risposta, -1 se non arriverà (errore), 0 finché è in attesa
+    int opcode;
+    int interi[MAX_CAMPI];
+};
+
+/*
+ * Richiesta inviata al server di cui non si è ancora ricevuta la risposta: il device può inviarne
+ * altre nel frattempo e la risposta viene registrata nel suo esito quando arriva
+ */
+struct richiesta_pendente {
+    uint32_t id; // Identificativo della richiesta (vedi 'struct messaggio')
+    const int* attesi; // Risposte possibili (nel protocollo a stringhe servono a interpretarla)
+    int num_attesi;
+    struct esito_richiesta* esito; // Dove registrare la risposta
+};
+
+struct richiesta_pendente richieste_pendenti[MAX_PENDING_REQUESTS]; // Richieste asincrone, in ordine di invio
+int num_pendenti = 0; // Numero di richieste asincrone in attesa di risposta
+uint32_t ultimo_id = 0; // Identificativo dell'ultima richiesta inviata al server
+uint32_t id_atteso = 0; // Identificativo della richiesta di cui receive_from_server() attende la risposta
+uint32_t ultima_sequenza = 0; // Numero di sequenza dell'ultimo messaggio inviato (non riparte tra una chat e l'altra)
+uint32_t sessione = 0; // Sessione del device (vedi OP_SESSION): i numeri di sequenza valgono solo al suo interno
+
+/*
+ * Messaggio inviato a un membro della chat e non ancora confermato
+ */
+struct messaggio_inviato {
+    uint32_t sequenza; // Numero di sequenza del messaggio nella conversazione
+    char* testo; // Testo del messaggio (allocato con malloc())
+    int socket; // Socket su cui è stato inviato (del peer o del server): da lì arriverà la conferma
+};
+
+/*
+ * Finestra di invio verso un membro della chat. I messaggi vengono inviati senza attendere la conferma di
+ * registrazione, che arriva in modo asincrono: LOGGED_MSG dal peer (uno per messaggio, nell'ordine di invio)
+ * o OP_MESSAGES_ACKED dal server (cumulativa, per numero di sequenza). Se il membro si disconnette, i messaggi
+ * non confermati vengono ritrasmessi sul nuovo socket (quello del server).
+ */
+struct finestra_invio {
+    struct messaggio_inviato messaggi[SEND_WINDOW]; // Messaggi non ancora confermati, in ordine di invio
+    int num; // Numero di messaggi non ancora confermati
+};
+
+struct finestra_invio finestre[GROUP_SIZE]; // Finestre di invio verso i membri della chat (nella posizione del membro)
+
 /*
  * Crea tutte le cartelle necessarie al funzionamento del device
  */
@@ -100,6 +164,8 @@ void clear_shell_line(void) {
     printf("\33[2K\r");
 }
 
+void retransmit_window(int k, int socket); // Definita più avanti (vedi 'struct finestra_invio')
+
 /*
  * Gestisce la disconnessione di 'socket' (recv() ha restituito 0)
  */
@@ -145,11 +211,635 @@ void socket_disconnection(int socket) {
                 // Invio al server (che li memorizzerà) i messaggi destinati all'utente che si è disconnesso
                 socket_gruppo[k] = server_socket;
             }
+
+            // I messaggi che il peer non ha confermato vengono inviati al server
+            retransmit_window(k, socket);
             break;
         }
     }
 }
 
+/*
+ * Registra le capacità negoziate con il peer connesso su 'socket': la versione del protocollo, la lunghezza
+ * massima dei frame e le funzionalità opzionali in comune.
+ * Restituisce 0 in caso di successo, -1 se i valori non sono validi.
+ */
+int set_peer_capabilities(int socket, int versione, int max_frame, int funzionalita) {
+    if (versione < PROTOCOL_HANDSHAKE || max_frame < MIN_MAX_FRAME_LEN) {
+        fprintf(stderr, "Capacità non valide ricevute dal peer sul socket %d.\n", socket);
+        return -1;
+    }
+
+    versione_peer[socket] = versione < PROTOCOL_VERSION ? versione : PROTOCOL_VERSION;
+    max_frame_peer[socket] = max_frame < get_max_frame_len() ? max_frame : get_max_frame_len();
+    codec_peer[socket] = choose_codec(funzionalita & supported_features());
+
+    #ifdef DEBUG
+    printf("Peer sul socket %d: versione %d, frame fino a %d byte, codec '%s'.\n", socket, versione_peer[socket],
+           max_frame_peer[socket], codec_name(codec_peer[socket]));
+    #endif
+
+    return 0;
+}
+
+/*
+ * Apre la connessione peer-to-peer con il peer in ascolto sulla porta specificata. Se il server ha comunicato
+ * che il peer supporta PROTOCOL_HANDSHAKE ('versione'), si negoziano le capacità della connessione: si invia
+ * PEER_HELLO con le proprie capacità (OP_CAPABILITIES) e il peer risponde con quelle in comune. Se il peer
+ * risponde con PROTOCOL_LEGACY (non ha accettato la proposta) si continua con i comandi a stringhe.
+ * Restituisce il socket peer-to-peer o -1 in caso di errore.
+ */
+int connect_to_peer(int porta, int versione) {
+    const int attesi[] = {OP_CAPABILITIES};
+    struct sockaddr_in peer_addr; // Indirizzo del socket del peer
+    struct messaggio risposta;
+    int ret, socket_p2p;
+
+    memset(&peer_addr, 0, sizeof(peer_addr));
+    peer_addr.sin_port = htons(porta);
+    peer_addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &peer_addr.sin_addr);
+    socket_p2p = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_p2p == -1) {
+        perror("Errore durante la creazione del socket peer-to-peer");
+        return -1;
+    }
+
+    // Connessione al peer
+    ret = connect(socket_p2p, (struct sockaddr*) &peer_addr, sizeof(peer_addr));
+    if (ret == -1) {
+        perror("Errore nella connessione con l'altro peer");
+        close(socket_p2p);
+        return -1;
+    }
+
+    versione_peer[socket_p2p] = PROTOCOL_LEGACY;
+    if (versione < PROTOCOL_HANDSHAKE)
+        return socket_p2p; // Il peer conosce solo i comandi a stringhe
+
+    // Le capacità viaggiano in un frame con lunghezza varint, dopo il comando PEER_HELLO
+    ret = send_string(socket_p2p, PEER_HELLO);
+    if (ret >= 0)
+        ret = send_message(socket_p2p, PROTOCOL_VARINT, 0, OP_CAPABILITIES, PROTOCOL_VERSION, get_max_frame_len(),
+                           supported_features());
+    if (ret >= 0)
+        ret = receive_message(socket_p2p, PROTOCOL_VARINT, attesi, 1, &risposta);
+    if (ret > 0 && risposta.opcode == OP_CAPABILITIES && risposta.interi[0] == PROTOCOL_LEGACY)
+        return socket_p2p;
+    if (ret > 0 && risposta.opcode == OP_CAPABILITIES)
+        ret = set_peer_capabilities(socket_p2p, risposta.interi[0], risposta.interi[1], risposta.interi[2]);
+    else
+        ret = -1;
+    if (ret < 0) {
+        fprintf(stderr, "Negoziazione con il peer sulla porta %d fallita.\n", porta);
+        close(socket_p2p);
+        return -1;
+    }
+
+    return socket_p2p;
+}
+
+/*
+ * Risponde alla negoziazione (PEER_HELLO) del peer che si è connesso su 'socket': riceve le sue capacità e
+ * risponde con quelle in comune. Se le capacità proposte non sono valide risponde con PROTOCOL_LEGACY (si
+ * continua con i comandi a stringhe); se non riesce a riceverle chiude la connessione, così che il peer
+ * non resti in attesa della risposta.
+ */
+void accept_peer_hello(int socket) {
+    const int attesi[] = {OP_CAPABILITIES};
+    struct messaggio proposta;
+    int ret;
+
+    ret = receive_message(socket, PROTOCOL_VARINT, attesi, 1, &proposta);
+    if (ret == 0) { // Disconnessione del peer
+        socket_disconnection(socket);
+        return;
+    }
+    if (ret < 0 || proposta.opcode != OP_CAPABILITIES) {
+        fprintf(stderr, "Negoziazione con il peer sul socket %d fallita.\n", socket);
+        socket_disconnection(socket);
+        return;
+    }
+
+    if (set_peer_capabilities(socket, proposta.interi[0], proposta.interi[1], proposta.interi[2]) < 0) {
+        // Si continua con i comandi a stringhe
+        versione_peer[socket] = PROTOCOL_LEGACY;
+        ret = send_message(socket, PROTOCOL_VARINT, 0, OP_CAPABILITIES, PROTOCOL_LEGACY, get_max_frame_len(), 0);
+    } else
+        ret = send_message(socket, PROTOCOL_VARINT, 0, OP_CAPABILITIES, versione_peer[socket], max_frame_peer[socket],
+                           proposta.interi[2] & supported_features());
+    if (ret < 0)
+        socket_disconnection(socket);
+}
+
+/*
+ * Invia al peer connesso su 'socket' il messaggio con l'opcode e i campi indicati, con la versione del protocollo
+ * negoziata con il peer. I messaggi più lunghi della soglia di compressione vengono compressi con il codec negoziato.
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_peer_message(int socket, int opcode, ...) {
+    char locale[MESSAGE_BUFFER_LEN];
+    char* buffer;
+    va_list campi;
+    int len, ret;
+
+    va_start(campi, opcode);
+    len = encode_message(locale, &buffer, versione_peer[socket], 0, opcode, campi);
+    va_end(campi);
+    if (len < 0)
+        return len;
+
+    ret = compress_message(locale, &buffer, len, versione_peer[socket], codec_peer[socket]);
+    if (ret >= 0) {
+        ret = send_all(socket, buffer, ret);
+        if (ret < 0)
+            perror("Errore durante l'invio di un messaggio al peer");
+    }
+    free_message_buffer(locale, buffer);
+
+    return ret;
+}
+
+/*
+ * Invocata quando il server notifica al mittente dei messaggi che il destinatario (inizialmente offline)
+ * è tornato online e ha ricevuto i messaggi pendenti inviati in precedenza
+ */
+void pending_messages_sent(struct messaggio* notifica) {
+    char* destinatario = notifica->stringhe[0]; // Destinatario che ha ricevuto i messaggi pendenti
+
+    clear_shell_line();
+    printf("Uno o più messaggi inviati a '%s' sono stati consegnati.\n", destinatario);
+
+    if (in_chat == 1) // Se sono in chat
+        printf("%s>", username);
+    else
+        printf(">");
+
+    fflush(stdout);
+}
+
+/*
+ * Invocata ogni volta che un utente esegue il login (il server ci invia una notifica). Controlla se l'utente
+ * ora online fa parte della chat così che possa stabilirci una nuova connessione peer-to-peer (non passerò
+ * più dal server).
+ */
+void now_online(struct messaggio* notifica) {
+    char* utente = notifica->stringhe[0]; // Username dell'utente ora online
+    int peer_port = notifica->interi[1]; // Porta su cui è in ascolto il device dell'utente ora online
+    // Versione del protocollo del device dell'utente ora online (solo in OP_PEER_ONLINE)
+    int versione = notifica->opcode == OP_PEER_ONLINE ? notifica->interi[2] : PROTOCOL_LEGACY;
+    int i;
+    int socket_p2p; // Socket peer-to-peer per comunicare con un altro device
+
+    // Controllo se sono in chat con l'utente diventato online
+    if ((in_chat == 1 || in_group_chat == 1) && destinatario_offline == 1) {
+        for (i = 0; i < peer_number; i++) {
+            if (strcmp(chat_users[i], utente) == 0)
+                break;
+        }
+        if (i == peer_number)
+            return; // Corrispondenza non trovata
+
+        /* Sono in chat con l'utente ora online */
+
+        /*
+         * Creo il socket peer-to-peer con il nuovo interlocutore: i
+         * messaggi vengono inviati direttamente senza passare dal server
+         */
+        socket_p2p = connect_to_peer(peer_port, versione);
+        if (socket_p2p == -1)
+            return;
+
+        // Aggiorno il set dei socket monitorati
+        FD_SET(socket_p2p, &master);
+        if (socket_p2p > fd_max)
+            fd_max = socket_p2p;
+
+        // Aggiungo il socket peer-to-peer alla lista dei socket che partecipano alla chat
+        socket_gruppo[i] = socket_p2p;
+
+        destinatario_offline = 0;
+    }
+}
+
+/*
+ * Rimuove dalla finestra di invio del k-esimo membro della chat il messaggio in posizione 'i'
+ */
+void remove_sent_message(int k, int i) {
+    struct finestra_invio* finestra = &finestre[k];
+
+    free(finestra->messaggi[i].testo);
+    finestra->num--;
+    memmove(&finestra->messaggi[i], &finestra->messaggi[i + 1], (finestra->num - i) * sizeof(struct messaggio_inviato));
+}
+
+/*
+ * Segna come confermati i messaggi inviati al k-esimo membro della chat sul socket specificato,
+ * fino al numero di sequenza 'sequenza' compreso
+ */
+void acknowledge_messages(int k, int socket, uint32_t sequenza) {
+    struct finestra_invio* finestra = &finestre[k];
+    int i = 0;
+
+    while (i < finestra->num) {
+        if (finestra->messaggi[i].socket == socket && finestra->messaggi[i].sequenza <= sequenza)
+            remove_sent_message(k, i);
+        else
+            i++;
+    }
+}
+
+/*
+ * Gestisce la conferma di un messaggio (LOGGED_MSG) ricevuta dal peer connesso sul socket specificato:
+ * il peer conferma i messaggi uno alla volta, nell'ordine in cui li ha ricevuti
+ */
+void acknowledge_peer_message(int socket) {
+    int i, k;
+
+    for (k = 0; k < peer_number; k++) {
+        for (i = 0; i < finestre[k].num; i++) {
+            if (finestre[k].messaggi[i].socket == socket) {
+                remove_sent_message(k, i);
+                return;
+            }
+        }
+    }
+}
+
+/*
+ * Gestisce la notifica OP_MESSAGES_ACKED: il server ha registrato i messaggi per il destinatario indicato
+ */
+void messages_acked(struct messaggio* notifica) {
+    int k;
+
+    for (k = 0; k < peer_number; k++)
+        if (strcmp(chat_users[k], notifica->stringhe[0]) == 0)
+            acknowledge_messages(k, server_socket, (uint32_t) notifica->interi[1]);
+}
+
+/*
+ * Notifica che il server può inviare in qualsiasi momento, al di fuori dei dialoghi avviati dal device
+ */
+struct notifica_server {
+    int opcode; // Opcode della notifica
+    void (*gestisci)(struct messaggio* notifica); // Funzione che gestisce la notifica
+};
+
+// Tabella delle notifiche del server
+const struct notifica_server notifiche_server[] = {
+    {OP_NOW_ONLINE, now_online},
+    {OP_PEER_ONLINE, now_online},
+    {OP_MESSAGES_SENT, pending_messages_sent},
+    {OP_MESSAGES_ACKED, messages_acked}
+};
+#define NUM_NOTIFICHE_SERVER (sizeof(notifiche_server) / sizeof(notifiche_server[0]))
+
+/*
+ * Se 'messaggio' è una notifica del server la gestisce e restituisce 1, altrimenti restituisce 0
+ */
+int handle_server_notification(struct messaggio* messaggio) {
+    int i;
+
+    for (i = 0; i < NUM_NOTIFICHE_SERVER; i++) {
+        if (notifiche_server[i].opcode == messaggio->opcode) {
+            notifiche_server[i].gestisci(messaggio);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Riceve e gestisce una notifica del server (il socket del server è pronto senza che ci sia un dialogo in corso)
+ */
+void server_notification(void) {
+    int attesi[NUM_NOTIFICHE_SERVER];
+    struct messaggio notifica;
+    int i, ret;
+
+    for (i = 0; i < NUM_NOTIFICHE_SERVER; i++)
+        attesi[i] = notifiche_server[i].opcode;
+
+    ret = receive_message(server_socket, versione_server, attesi, NUM_NOTIFICHE_SERVER, &notifica);
+    if (ret == 0) { // Disconnessione del server
+        socket_disconnection(server_socket);
+        return;
+    }
+    if (ret < 0) // Errore
+        return;
+
+    if (handle_server_notification(&notifica) == 0)
+        fprintf(stderr, "Ricevuto dal server il messaggio inatteso con opcode %d.\n", notifica.opcode);
+}
+
+/*
+ * Invia al server la richiesta con l'opcode e i campi indicati, con un nuovo identificativo che viene posto in 'id'.
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_request_with_id(uint32_t* id, int opcode, va_list campi) {
+    char locale[MESSAGE_BUFFER_LEN];
+    char* buffer;
+    int len, ret;
+
+    // L'identificativo 0 è riservato alle notifiche
+    ultimo_id++;
+    if (ultimo_id == 0)
+        ultimo_id = 1;
+    *id = ultimo_id;
+
+    len = encode_message(locale, &buffer, versione_server, *id, opcode, campi);
+    if (len < 0)
+        return len;
+
+    // Le richieste più lunghe della soglia di compressione vengono compresse con il codec negoziato
+    ret = compress_message(locale, &buffer, len, versione_server, codec_server);
+    if (ret >= 0) {
+        ret = send_all(server_socket, buffer, ret);
+        if (ret < 0)
+            perror("Errore durante l'invio di una richiesta al server");
+    }
+    free_message_buffer(locale, buffer);
+
+    return ret;
+}
+
+/*
+ * Invia al server la richiesta con l'opcode e i campi indicati: la risposta va ricevuta con receive_from_server().
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_request(int opcode, ...) {
+    va_list campi;
+    int ret;
+
+    va_start(campi, opcode);
+    ret = send_request_with_id(&id_atteso, opcode, campi);
+    va_end(campi);
+
+    return ret;
+}
+
+/*
+ * Se 'messaggio' è la risposta a una richiesta asincrona ne registra l'esito e restituisce 1.
+ * Restituisce 0 se non c'è alcuna richiesta in attesa con il suo identificativo e -1 se la risposta non è
+ * tra quelle attese.
+ */
+int complete_async_request(struct messaggio* messaggio) {
+    struct richiesta_pendente* richiesta;
+    int i, j;
+
+    for (i = 0; i < num_pendenti; i++) {
+        richiesta = &richieste_pendenti[i];
+        if (richiesta->id != messaggio->id)
+            continue;
+
+        for (j = 0; j < richiesta->num_attesi; j++)
+            if (richiesta->attesi[j] == messaggio->opcode)
+                break;
+        if (j == richiesta->num_attesi) {
+            fprintf(stderr, "Ricevuta dal server la risposta inattesa con opcode %d.\n", messaggio->opcode);
+            return -1;
+        }
+
+        richiesta->esito->completata = 1;
+        richiesta->esito->opcode = messaggio->opcode;
+        memcpy(richiesta->esito->interi, messaggio->interi, sizeof(messaggio->interi));
+
+        // Tolgo la richiesta dall'elenco mantenendo l'ordine di invio
+        num_pendenti--;
+        memmove(richiesta, richiesta + 1, (num_pendenti - i) * sizeof(struct richiesta_pendente));
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Annulla tutte le richieste asincrone in attesa: le risposte non arriveranno (per esempio dopo un errore)
+ */
+void cancel_async_requests(void) {
+    int i;
+
+    for (i = 0; i < num_pendenti; i++)
+        richieste_pendenti[i].esito->completata = -1;
+    num_pendenti = 0;
+}
+
+/*
+ * Riceve dal server un messaggio relativo alle richieste asincrone in attesa (la risposta a una di esse o una
+ * notifica) e lo gestisce. Prima di PROTOCOL_PIPELINE il server risponde nell'ordine delle richieste, quindi
+ * il messaggio è la risposta alla richiesta più vecchia.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del server e
+ * un numero negativo in caso di errore.
+ */
+int receive_async_reply(void) {
+    struct richiesta_pendente* prima = &richieste_pendenti[0];
+    struct messaggio messaggio;
+    int ret;
+
+    ret = receive_message(server_socket, versione_server, prima->attesi, prima->num_attesi, &messaggio);
+    if (ret <= 0)
+        return ret;
+
+    if (versione_server != PROTOCOL_LEGACY && is_notification(messaggio.opcode)) {
+        if (handle_server_notification(&messaggio) == 0) {
+            fprintf(stderr, "Ricevuto dal server il messaggio inatteso con opcode %d.\n", messaggio.opcode);
+            return -1;
+        }
+        return 1;
+    }
+
+    if (versione_server < PROTOCOL_PIPELINE)
+        messaggio.id = prima->id;
+    ret = complete_async_request(&messaggio);
+    if (ret == 0)
+        fprintf(stderr, "Ricevuta dal server la risposta a una richiesta sconosciuta (%u).\n", messaggio.id);
+
+    return ret == 1 ? 1 : -1;
+}
+
+/*
+ * Aspetta le risposte di tutte le richieste asincrone in attesa, gestendo nel frattempo le notifiche del server.
+ * In caso di errore le richieste ancora in attesa vengono annullate.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del server e
+ * un numero negativo in caso di errore.
+ */
+int wait_async_requests(void) {
+    int ret;
+
+    while (num_pendenti > 0) {
+        ret = receive_async_reply();
+        if (ret <= 0) {
+            cancel_async_requests();
+            return ret;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Invia al server la richiesta con l'opcode e i campi indicati senza aspettarne la risposta, che sarà uno dei
+ * 'num_attesi' messaggi in 'attesi': il suo opcode e i suoi campi interi verranno posti in 'esito' quando arriva
+ * (vedi wait_async_requests()). Così più richieste possono essere in viaggio contemporaneamente e i tempi di
+ * risposta del server si sovrappongono invece di sommarsi. Se ci sono già MAX_PENDING_REQUESTS richieste in
+ * attesa, si aspetta prima la risposta di una di esse.
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_async_request(struct esito_richiesta* esito, const int* attesi, int num_attesi, int opcode, ...) {
+    struct richiesta_pendente* richiesta;
+    va_list campi;
+    int ret;
+
+    while (num_pendenti == MAX_PENDING_REQUESTS) {
+        ret = receive_async_reply();
+        if (ret <= 0) {
+            cancel_async_requests();
+            return -1;
+        }
+    }
+
+    richiesta = &richieste_pendenti[num_pendenti];
+    va_start(campi, opcode);
+    ret = send_request_with_id(&richiesta->id, opcode, campi);
+    va_end(campi);
+    if (ret < 0)
+        return ret;
+
+    richiesta->attesi = attesi;
+    richiesta->num_attesi = num_attesi;
+    richiesta->esito = esito;
+    esito->completata = 0;
+    num_pendenti++;
+
+    return 0;
+}
+
+/*
+ * Aspetta dal server uno dei 'num_attesi' messaggi in 'attesi' come risposta all'ultima richiesta inviata con
+ * send_request() e lo pone in 'messaggio'. Nel protocollo binario le notifiche del server che arrivano nel mezzo
+ * del dialogo vengono gestite e si continua ad aspettare la risposta; lo stesso vale per le risposte alle
+ * richieste asincrone, che prima di PROTOCOL_PIPELINE arrivano per forza prima.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del server e
+ * un numero negativo in caso di errore.
+ */
+int receive_from_server(const int* attesi, int num_attesi, struct messaggio* messaggio) {
+    int i, ret;
+
+    if (versione_server < PROTOCOL_PIPELINE) {
+        ret = wait_async_requests();
+        if (ret <= 0)
+            return ret;
+    }
+
+    for (;;) {
+        ret = receive_message(server_socket, versione_server, attesi, num_attesi, messaggio);
+        if (ret <= 0 || versione_server == PROTOCOL_LEGACY)
+            return ret; // Nel protocollo a stringhe il messaggio è per forza uno di quelli attesi
+
+        // Da PROTOCOL_PIPELINE la risposta può riguardare una richiesta asincrona ancora in attesa
+        if (versione_server >= PROTOCOL_PIPELINE && !is_notification(messaggio->opcode) &&
+            messaggio->id != id_atteso) {
+            ret = complete_async_request(messaggio);
+            if (ret == 1)
+                continue;
+            if (ret == 0)
+                fprintf(stderr, "Ricevuta dal server la risposta a una richiesta sconosciuta (%u).\n", messaggio->id);
+            return -1;
+        }
+
+        for (i = 0; i < num_attesi; i++)
+            if (messaggio->opcode == attesi[i])
+                return ret;
+
+        if (handle_server_notification(messaggio) == 0) {
+            fprintf(stderr, "Ricevuto dal server il messaggio inatteso con opcode %d.\n", messaggio->opcode);
+            return -1;
+        }
+    }
+}
+
+/*
+ * Annuncia al server le funzionalità opzionali supportate (OP_FEATURES) e sceglie il codec con cui comprimere
+ * i messaggi tra quelli supportati da entrambi. Da PROTOCOL_HANDSHAKE si annuncia anche la lunghezza massima
+ * dei frame (OP_CAPABILITIES) e si usa la minore tra quella del device e quella del server.
+ */
+void negotiate_features(void) {
+    const int attesi[] = {OP_FEATURES, OP_CAPABILITIES};
+    struct messaggio risposta;
+    int ret;
+
+    if (versione_server >= PROTOCOL_HANDSHAKE)
+        ret = send_request(OP_CAPABILITIES, versione_server, get_max_frame_len(), supported_features());
+    else
+        ret = send_request(OP_FEATURES, supported_features());
+    if (ret < 0)
+        exit(1);
+
+    ret = receive_from_server(attesi, 2, &risposta);
+    if (ret == 0) { // Disconnessione del server
+        printf("Server disconnesso.\n");
+        exit(0);
+    }
+    if (ret > 0 && risposta.opcode == OP_FEATURES)
+        codec_server = choose_codec(risposta.interi[0]);
+    if (ret > 0 && risposta.opcode == OP_CAPABILITIES) {
+        codec_server = choose_codec(risposta.interi[2]);
+        if (risposta.interi[1] >= MIN_MAX_FRAME_LEN && risposta.interi[1] < get_max_frame_len())
+            set_max_frame_len(risposta.interi[1]);
+    }
+
+    #ifdef DEBUG
+    printf("Codec usato con il server: %s, frame fino a %d byte.\n", codec_name(codec_server), get_max_frame_len());
+    #endif
+}
+
+/*
+ * Propone al server la versione più recente del protocollo (OP_HELLO) e usa quella scelta dal server.
+ * Un server che non conosce OP_HELLO lo ignora senza rispondere: se la risposta non arriva entro
+ * HELLO_TIMEOUT secondi si continua con il protocollo a stringhe.
+ */
+void negotiate_protocol(void) {
+    const int attesi[] = {OP_HELLO};
+    struct messaggio risposta;
+    struct timeval timeout;
+    fd_set server_fds;
+    int ret;
+
+    ret = send_message(server_socket, PROTOCOL_BINARY, 0, OP_HELLO, PROTOCOL_VERSION);
+    if (ret < 0)
+        exit(1);
+
+    // Attendo la risposta del server per al massimo HELLO_TIMEOUT secondi
+    FD_ZERO(&server_fds);
+    FD_SET(server_socket, &server_fds);
+    timeout.tv_sec = HELLO_TIMEOUT;
+    timeout.tv_usec = 0;
+    ret = select(server_socket + 1, &server_fds, NULL, NULL, &timeout);
+    if (ret <= 0) {
+        printf("Il server non supporta il protocollo binario: si usa il protocollo a stringhe.\n");
+        return;
+    }
+
+    // La risposta a OP_HELLO è sempre nel formato binario
+    ret = receive_message(server_socket, PROTOCOL_BINARY, attesi, 1, &risposta);
+    if (ret == 0) { // Disconnessione del server
+        printf("Server disconnesso.\n");
+        exit(0);
+    }
+    if (ret > 0 && risposta.opcode == OP_HELLO && risposta.interi[0] >= PROTOCOL_LEGACY &&
+        risposta.interi[0] <= PROTOCOL_VERSION)
+        versione_server = risposta.interi[0];
+
+    #ifdef DEBUG
+    printf("Versione del protocollo usata con il server: %d.\n", versione_server);
+    #endif
+
+    // Da PROTOCOL_COMPRESSED si negoziano anche i codec di compressione (e da PROTOCOL_HANDSHAKE le altre capacità)
+    if (versione_server >= PROTOCOL_COMPRESSED)
+        negotiate_features();
+}
+
 /*
  * Recupera l'username e la password dal comando ('signup' o 'in') inserito nel terminale.
  * Se trovate, verrà messo nei parametri 'username' e 'password' le credenziali. Altrimenti conterranno solo '\0'.
@@ -192,29 +882,21 @@ void get_username_password_in_command(char* comando, char username[], char passw
 void authenticate_to_server(char* operazione, char* password) {
     int ret;
     char buffer[MAX_MSG_LEN];
+    int registrazione = strcmp(operazione, SIGNUP) == 0; // Indica se l'utente si vuole registrare
+    const int esiti_signup[] = {OP_SIGNED_UP, OP_EXISTING_USERNAME};
+    const int esiti_login[] = {OP_AUTHENTICATED, OP_UNKNOWN_USER, OP_WRONG_PASSWORD};
+    struct messaggio esito; // Esito dell'operazione inviato dal server
 
-    // Invio il comando
-    ret = send_string(server_socket, operazione);
-    if (ret < 0)
-        exit(1);
-
-    // Invio l'username
-    ret = send_string(server_socket, username);
-    if (ret < 0)
-        exit(1);
-
-    // Invio la password
-    ret = send_string(server_socket, password);
-    if (ret < 0)
-        exit(1);
-
-    // Invio la porta del client
-    ret = send_integer(server_socket, client_port);
+    // Invio il comando, l'username, la password e la porta del client
+    ret = send_request(registrazione ? OP_SIGNUP : OP_LOGIN, username, password, client_port);
     if (ret < 0)
         exit(1);
 
     // Ottengo l'esito dell'operazione inviato dal server
-    ret = receive_string(server_socket, buffer);
+    if (registrazione)
+        ret = receive_from_server(esiti_signup, 2, &esito);
+    else
+        ret = receive_from_server(esiti_login, 3, &esito);
     if (ret == 0) { // Disconnessione del server
         socket_disconnection(server_socket);
 
@@ -228,14 +910,14 @@ void authenticate_to_server(char* operazione, char* password) {
         return;
 
     // L'utente si vuole registrare
-    if (strcmp(operazione, SIGNUP) == 0) {
+    if (registrazione) {
         printf("Registrazione in corso...\n");
 
         // Verifico la risposta ottenuta dal server riguardo la validità dell'username
-        if (strcmp(buffer, ALREADY_EXISTING_USERNAME) == 0) {
+        if (esito.opcode == OP_EXISTING_USERNAME) {
             printf("Registrazione negata: esiste già un utente con quell'username.\n");
             return;
-        } else if (strcmp(buffer, SIGNED_UP) == 0) {
+        } else if (esito.opcode == OP_SIGNED_UP) {
             printf("Registrazione eseguita! Esegui il login per usare il tuo account.\n");
             print_auth_commands();
         }
@@ -243,15 +925,19 @@ void authenticate_to_server(char* operazione, char* password) {
         printf("Login in corso...\n");
 
         // Verifico la risposta ottenuta dal server riguardo la correttezza delle credenziali
-        if (strcmp(buffer, UNKNOWN_USER) == 0) {
+        if (esito.opcode == OP_UNKNOWN_USER) {
             printf("Username non valido: non esiste un utente con questo username!\n");
             return;
-        } else if (strcmp(buffer, WRONG_PASSWORD) == 0) {
+        } else if (esito.opcode == OP_WRONG_PASSWORD) {
             printf("Password non corretta.\n");
             return;
-        } else if (strcmp(buffer, AUTHENTICATED) == 0) {
+        } else if (esito.opcode == OP_AUTHENTICATED) {
             printf("Login eseguito!\n");
             logged = 1;
+
+            // I numeri di sequenza proseguono da quelli già usati: lo comunico al server (vedi OP_SESSION)
+            if (versione_server >= PROTOCOL_SESSION && send_request(OP_SESSION, (int) sessione) < 0)
+                exit(1);
             print_all_commands();
         }
     }
@@ -323,9 +1009,12 @@ void wait_for_login(void) {
  * Stampa lo storico della chat con 'interlocutore'
  */
 void print_chat_history(char* interlocutore) {
-    FILE* log; // File contenente i log della chat
+    struct lettore_chat lettore; // Log della chat mappato in memoria
+    struct messaggio_chat messaggio; // Messaggio letto dal log
     char path[PATH_MAX]; // Path del file contenente lo storico della chat
-    char line[MAX_LINE_LEN]; // Riga letta dal file
+    long letti_utente, letti_interlocutore; // Segni di lettura dei due utenti nel log
+    int mio; // Indica se il messaggio corrente è stato inviato da 'username'
+    int letto;
 
     clear_shell_screen();
 
@@ -334,39 +1023,27 @@ void print_chat_history(char* interlocutore) {
     else
         printf("%s è online.\n", interlocutore);
 
-    /*
-     * Se il file non viene trovato, provo a scambiare l'ordine degli username nel nome del file.
-     * Ad esempio, il file di log può essere pippo-pluto.txt ma anche pluto-pippo.txt.
-     */
-    get_chat_log_path(interlocutore, username, path);
-    if (is_file_existing(path) == 0) { // Il file di log non esiste
-        get_chat_log_path(username, interlocutore, path);
-
-        // Se non lo trovo di nuovo significa che non c'è stata alcuna chat tra i due utenti
-        if (is_file_existing(path) == 0) {
-            #ifdef DEBUG
-            printf("Nessuna chat tra '%s' e '%s'. Il file di log verrà creato adesso.\n", username, interlocutore);
-            #endif
-        }
-    }
-    log = open_or_create(path, "r");
-    if (log == NULL)
+    prepare_chat_log(interlocutore, username, path);
+    if (open_chat_reader(&lettore, path) == -1)
         return; // Impossibile accedere al file
 
+    // I messaggi recapitati dal server restano nel log come non letti: sono letti se precedono il segno di lettura
+    letti_utente = get_read_mark(path, username);
+    letti_interlocutore = get_read_mark(path, interlocutore);
+
     // Stampo lo storico della chat
     printf("--------------------------------\n");
     printf("Storico conversazione con '%s':\n", interlocutore);
-    for (;;) {
-        if (fgets(line, MAX_LINE_LEN, log) == NULL)
-            break; // File terminato
-
-        printf("%s", line);
+    while (next_chat_message(&lettore, &messaggio) == 1) {
+        mio = messaggio.len_mittente == (int) strlen(username) &&
+              strncmp(messaggio.mittente, username, messaggio.len_mittente) == 0;
+        letto = messaggio.letto || (long) messaggio.seq <= (mio ? letti_interlocutore : letti_utente);
+        printf("%.*s: %.*s %s\n", messaggio.len_mittente, messaggio.mittente, messaggio.len_testo, messaggio.testo,
+               letto ? READ_MARK : UNREAD_MARK);
     }
     printf("--------------------------------\n");
 
-    if (fclose(log) != 0)
-        fprintf(stderr, "Errore durante la chiusura del log della chat tra '%s' e '%s' : %s\n", username, interlocutore,
-                strerror(errno));
+    close_chat_reader(&lettore);
 }
 
 /*
@@ -406,14 +1083,47 @@ void get_first_command_parameter(char* comando, char* parametro) {
     #endif
 }
 
+// Byte del file condiviso letti alla volta: nel protocollo a stringhe diventano frame per al massimo SHARE_BATCH_LEN byte
+#define SHARE_DATA_LEN (SHARE_BATCH_LEN / (FILE_MSG_SIZE + sizeof(uint16_t)) * FILE_MSG_SIZE)
+
+/*
+ * Invia un blocco di un file condiviso al peer connesso su 'socket': se con il peer si è negoziato
+ * PROTOCOL_HANDSHAKE si inviano i 'len' byte di 'dati' in messaggi OP_FILE_CHUNK (lunghi al massimo quanto
+ * il peer accetta), altrimenti i 'len_lotto' byte di 'lotto' (gli stessi byte nei frame di send_bit()).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_file_block(int socket, char* dati, int len, char* lotto, int len_lotto) {
+    int ret, inviati, pezzo;
+
+    if (versione_peer[socket] < PROTOCOL_HANDSHAKE)
+        return send_all(socket, lotto, len_lotto);
+
+    for (inviati = 0; inviati < len; inviati += pezzo) {
+        // Nel frame ci sono anche l'opcode, l'identificativo e la lunghezza del campo
+        pezzo = max_frame_peer[socket] - 1 - 2 * MAX_VARINT_LEN;
+        if (pezzo > len - inviati)
+            pezzo = len - inviati;
+
+        ret = send_peer_message(socket, OP_FILE_CHUNK, &dati[inviati], pezzo);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
 /*
  * Invia il file (identificato da 'path') a tutti i membri della chat
  */
 void share(char* path) {
     char buffer[FILE_MSG_SIZE];
-    int ret, k;
+    char* dati; // Blocco di al massimo SHARE_DATA_LEN byte del file
+    char* lotto; // Frame (di al massimo FILE_MSG_SIZE byte del file) da inviare con una sola send_all()
+    int ret, k, len_lotto, len;
     FILE* file; // File condiviso
     size_t byte_letti; // Numero di byte letti dal file da condividere
+    size_t inviati;
+    uint16_t network_order_len;
 
     // Verifico che l'interlocutore sia online
     if (destinatario_offline == 1) {
@@ -452,24 +1162,57 @@ void share(char* path) {
         }
     }
 
-    // Leggo tutto il file e invio i byte letti a ogni peer
+    dati = malloc(SHARE_DATA_LEN);
+    lotto = malloc(SHARE_BATCH_LEN);
+    if (dati == NULL || lotto == NULL) {
+        perror("Impossibile allocare il buffer per la condivisione del file");
+        free(dati);
+        free(lotto);
+        return;
+    }
+
+    /*
+     * Leggo tutto il file e invio i byte letti a ogni peer. Il peer riceve un frame (come quelli di send_bit())
+     * ogni FILE_MSG_SIZE byte, ma i frame vengono raccolti in blocchi di SHARE_BATCH_LEN byte e ogni blocco
+     * viene inviato con una sola send_all(), anziché con una system call per frame. Ai peer con cui si è
+     * negoziato PROTOCOL_HANDSHAKE il blocco arriva invece in messaggi OP_FILE_CHUNK, compressi se possibile.
+     */
     file = open_file(path, "rb"); // Apro il file in lettura binaria ('rb' = 'read binary')
-    while ((byte_letti = fread(buffer, 1, FILE_MSG_SIZE, file)) > 0) {
-        for (k = 0; k < peer_number; k++) {
-            ret = send_bit(socket_gruppo[k], buffer, byte_letti);
+    do {
+        byte_letti = fread(dati, 1, SHARE_DATA_LEN, file);
+
+        len_lotto = 0;
+        for (inviati = 0; inviati < byte_letti; inviati += len) {
+            len = byte_letti - inviati < FILE_MSG_SIZE ? byte_letti - inviati : FILE_MSG_SIZE;
+            network_order_len = htons(len);
+            memcpy(&lotto[len_lotto], &network_order_len, sizeof(uint16_t));
+            memcpy(&lotto[len_lotto + sizeof(uint16_t)], &dati[inviati], len);
+            len_lotto += sizeof(uint16_t) + len;
+        }
+
+        for (k = 0; k < peer_number && byte_letti > 0; k++) {
+            ret = send_file_block(socket_gruppo[k], dati, byte_letti, lotto, len_lotto);
             if (ret < 0) { // Errore
+                fprintf(stderr, "Errore durante l'invio del file condiviso sul socket %d.\n", socket_gruppo[k]);
+                free(dati);
+                free(lotto);
                 if (fclose(file) != 0)
                     fprintf(stderr, "Errore durante la chiusura del file condiviso '%s : %s\n", path, strerror(errno));
                 return;
             }
         }
-    }
+    } while (byte_letti > 0);
+    free(dati);
+    free(lotto);
     if (fclose(file) != 0)
         fprintf(stderr, "Errore durante la chiusura del file condiviso '%s : %s\n", path, strerror(errno));
 
     // Notifico a tutti peer che ho terminato l'invio del file
     for (k = 0; k < peer_number; k++) {
-        ret = send_string(socket_gruppo[k], DONE_SHARE);
+        if (versione_peer[socket_gruppo[k]] >= PROTOCOL_HANDSHAKE)
+            ret = send_peer_message(socket_gruppo[k], OP_FILE_END);
+        else
+            ret = send_string(socket_gruppo[k], DONE_SHARE);
         if (ret < 0) // Errore
             return;
     }
@@ -477,6 +1220,67 @@ void share(char* path) {
     printf("File inviato con successo.\n");
 }
 
+/*
+ * Chiede al server quali dei 'num_contatti' contatti in 'contatti' sono online e pone in 'online' 1 per quelli
+ * online e 0 per gli altri. Da PROTOCOL_PRESENCE basta un'unica richiesta (OP_BULK_STATUS) con l'intero elenco;
+ * con le versioni precedenti si invia un OP_USER_STATUS per contatto, senza attendere le risposte.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del server e
+ * un numero negativo in caso di errore.
+ */
+int get_contacts_status(char contatti[][USERNAME_LEN], int num_contatti, int online[]) {
+    const int stati_utente[] = {OP_USER_ONLINE, OP_USER_OFFLINE};
+    const int presenza[] = {OP_BULK_PRESENCE};
+    struct esito_richiesta stati[CONTACT_LIST_SIZE]; // Risposte del server (stato di ciascun contatto)
+    char elenco[CONTACT_LIST_SIZE * USERNAME_LEN]; // Username dei contatti separati da '\n'
+    struct messaggio risposta;
+    int k, attesa, ret = 0, len = 0;
+
+    if (versione_server >= PROTOCOL_PRESENCE) {
+        elenco[0] = '\0';
+        for (k = 0; k < num_contatti; k++)
+            len += sprintf(&elenco[len], k == 0 ? "%s" : "\n%s", contatti[k]);
+
+        ret = send_request(OP_BULK_STATUS, elenco);
+        if (ret < 0) // Errore
+            return ret;
+        ret = receive_from_server(presenza, 1, &risposta);
+        if (ret <= 0) // Errore o disconnessione del server
+            return ret;
+
+        // Il bit k % 8 del byte k / 8 della mappa vale 1 se il k-esimo contatto è online
+        if (risposta.interi[0] < (num_contatti + 7) / 8) {
+            fprintf(stderr, "Ricevuta dal server una mappa degli utenti online incompleta.\n");
+            return -1;
+        }
+        for (k = 0; k < num_contatti; k++)
+            online[k] = (risposta.stringhe[0][k / 8] >> (k % 8)) & 1;
+        return 1;
+    }
+
+    // Nel protocollo a stringhe le richieste formano un elenco, aperto da START_GROUP_CHAT e chiuso da GROUP_CHAT_DONE
+    if (versione_server == PROTOCOL_LEGACY) {
+        ret = send_request(OP_START_GROUP_CHAT);
+        if (ret < 0) // Errore
+            return ret;
+    }
+
+    for (k = 0; k < num_contatti && ret == 0; k++)
+        ret = send_async_request(&stati[k], stati_utente, 2, OP_USER_STATUS, contatti[k]);
+
+    // Attendo le risposte alle richieste inviate (anche se un invio è fallito)
+    attesa = wait_async_requests();
+    if (attesa <= 0) // Errore o disconnessione del server
+        return attesa;
+    if (ret < 0) // Errore
+        return ret;
+    for (k = 0; k < num_contatti; k++)
+        online[k] = stati[k].opcode == OP_USER_ONLINE;
+
+    if (versione_server == PROTOCOL_LEGACY)
+        return send_request(OP_GROUP_CHAT_DONE) < 0 ? -1 : 1;
+    return 1;
+}
+
 /*
  * Invia l'elenco degli utenti che possono essere aggiunti alla chat di gruppo e la crea
  * in base a quali username vuole aggiungere l'utente (dati in input da terminale)
@@ -484,14 +1288,17 @@ void share(char* path) {
 void add_member_to_chat(void) {
     char buffer[MAX_MSG_LEN];
     char appoggio[USERNAME_LEN + 3];
-    int received; // Intero ricevuto su un socket
+    const int esiti_porta[] = {OP_USER_PORT, OP_USER_OFFLINE, OP_PEER_PORT};
+    struct messaggio risposta; // Risposta del server
     int j = 0, k; // Indici per cicli for
     int ret, found = 0;
     char line[USERNAME_LEN]; // Linea letta nella rubrica
     char path[PATH_MAX]; // Path della rubrica
     FILE* rubrica;
+    char contatti[CONTACT_LIST_SIZE][USERNAME_LEN]; // Contatti di cui si chiede al server se sono online
+    int online[CONTACT_LIST_SIZE]; // Stato di ciascun contatto (1 se è online)
+    int num_contatti = 0;
     char utenti_inseribili[CONTACT_LIST_SIZE][USERNAME_LEN]; // Elenco degli utenti online che possono essere aggiunti alla chat
-    struct sockaddr_in interlocutore_addr; // Utente che si vuole aggiungere nella chat
     int socket_p2p; // Socket peer-to-peer per comunicare con un altro dispositivo
 
     // Controllo se il singolo interlocutore attuale è online
@@ -507,17 +1314,12 @@ void add_member_to_chat(void) {
         return;
     }
 
-    // Invio il comando per avviare una chat di gruppo al server
-    ret = send_string(server_socket, START_GROUP_CHAT);
-    if (ret < 0) // Errore
-        return;
-
     clear_shell_line();
     printf("Utenti online che possono essere aggiunti alla chat:\n");
 
-    // Stampo l'elenco degli utenti in rubrica e online (solo questi possono essere aggiunti alla chat di gruppo)
+    // Raccolgo i contatti in rubrica che non sono già nella chat
     rubrica = open_file(path, "r");
-    for (;;) {
+    while (num_contatti < CONTACT_LIST_SIZE) {
         if (fgets(line, USERNAME_LEN, rubrica) == NULL)
             break; // Fine rubrica
         else {
@@ -539,52 +1341,30 @@ void add_member_to_chat(void) {
                 continue;
             }
 
-            // Invio al server l'username che ci dirà se l'utente è online o meno
-            ret = send_string(server_socket, line);
-            if (ret < 0) { // Errore
-                if (fclose(rubrica) != 0)
-                    fprintf(stderr, "Errore durante la chiusura della rubrica di '%s' : %s\n", username,
-                            strerror(errno));
-                continue;
-            }
-            ret = receive_string(server_socket, buffer);
-            if (ret == 0) { // Disconnessione del server
-                socket_disconnection(server_socket);
-
-                if (fclose(rubrica) != 0)
-                    fprintf(stderr, "Errore durante la chiusura della rubrica di '%s' : %s\n", username,
-                            strerror(errno));
-
-                return;
-            }
-            if (ret < 0) { // Errore
-                if (fclose(rubrica) != 0)
-                    fprintf(stderr, "Errore durante la chiusura della rubrica di '%s' : %s\n", username,
-                            strerror(errno));
-
-                continue;
-            }
-
-            // Se l'utente è online, lo inserisco nell'elenco delle persone che possono essere aggiunte alla chat
-            if (strcmp(buffer, USER_ONLINE) == 0) {
-                strcpy(utenti_inseribili[j], line);
-                printf("%d) %s\n", j + 1, utenti_inseribili[j]);
-                j++;
-            }
+            strcpy(contatti[num_contatti], line);
+            num_contatti++;
         }
     }
 
-    // Segnalo al server la fine delle richieste per verificare se un utente è online o meno
-    ret = send_string(server_socket, GROUP_CHAT_DONE);
-    if (ret < 0) { // Errore
-        if (fclose(rubrica) != 0)
-            fprintf(stderr, "Errore durante la chiusura della rubrica di '%s' : %s\n", username, strerror(errno));
+    if (fclose(rubrica) != 0)
+        fprintf(stderr, "Errore durante la chiusura della rubrica di '%s' : %s\n", username, strerror(errno));
 
+    // Chiedo al server quali contatti sono online (solo questi possono essere aggiunti alla chat di gruppo)
+    ret = get_contacts_status(contatti, num_contatti, online);
+    if (ret <= 0) { // Errore o disconnessione del server
+        if (ret == 0)
+            socket_disconnection(server_socket);
         return;
     }
 
-    if (fclose(rubrica) != 0)
-        fprintf(stderr, "Errore durante la chiusura della rubrica di '%s' : %s\n", username, strerror(errno));
+    // Stampo l'elenco dei contatti online, che sono quelli che possono essere aggiunti alla chat
+    for (k = 0; k < num_contatti; k++) {
+        if (online[k] == 1) {
+            strcpy(utenti_inseribili[j], contatti[k]);
+            printf("%d) %s\n", j + 1, utenti_inseribili[j]);
+            j++;
+        }
+    }
 
     // Se non c'è nessun utente che può essere aggiunto
     if (j == 0) {
@@ -621,53 +1401,30 @@ void add_member_to_chat(void) {
      * Per aggiungere l'utente alla chat devo mandargli una richiesta di inserimento (che può accettare o rifiutare).
      * Per fare ciò ho bisogno della porta su cui è in ascolto il client: contatto il server per richiedergliela.
      */
-    ret = send_string(server_socket, CLIENT_PORT_REQUEST);
-    if (ret < 0) // Errore
-        return;
-    ret = send_string(server_socket, utenti_inseribili[k]); // Invio l'username di cui si vuole conoscere la porta
+    ret = send_request(OP_CLIENT_PORT_REQUEST, utenti_inseribili[k]);
     if (ret < 0) // Errore
         return;
 
-    // Il server ci dice prima di tutto se l'utente è ancora online
-    ret = receive_string(server_socket, buffer);
+    // Il server ci dice se l'utente è ancora online e, se lo è, la porta di ascolto del suo client
+    ret = receive_from_server(esiti_porta, 3, &risposta);
     if (ret <= 0) { // Errore o disconnessione del server
         if (ret == 0)
             socket_disconnection(server_socket);
         return;
     }
-    if (strcmp(buffer, USER_ONLINE) != 0) { // L'utente è andato offline nel frattempo
+    if (risposta.opcode == OP_USER_OFFLINE) { // L'utente è andato offline nel frattempo
         printf("L'utente è andato offline.\n");
         return;
     }
 
-    // Ricevo la porta di ascolto del client
-    ret = receive_integer(server_socket, &received);
-    if (ret <= 0) { // Errore o disconnessione del server
-        if (ret == 0)
-            socket_disconnection(server_socket);
-        return;
-    }
-
     /*
      * Creo il socket peer-to-peer con il nuovo interlocutore: i
      * messaggi vengono inviati direttamente senza passare dal server
      */
-    memset(&interlocutore_addr, 0, sizeof(interlocutore_addr));
-    interlocutore_addr.sin_port = htons(received);
-    interlocutore_addr.sin_family = AF_INET;
-    inet_pton(AF_INET, "127.0.0.1", &interlocutore_addr.sin_addr);
-    socket_p2p = socket(AF_INET, SOCK_STREAM, 0);
-    if (socket_p2p == -1) {
-        perror("Errore durante la creazione del socket peer-to-peer");
+    socket_p2p = connect_to_peer(risposta.interi[0],
+                                 risposta.opcode == OP_PEER_PORT ? risposta.interi[1] : PROTOCOL_LEGACY);
+    if (socket_p2p == -1)
         return;
-    }
-
-    // Connessione al peer/interlocutore
-    ret = connect(socket_p2p, (struct sockaddr*) &interlocutore_addr, sizeof(interlocutore_addr));
-    if (ret == -1) {
-        perror("Errore durante la connessione con l'altro peer");
-        return;
-    }
 
     // Invio l'invito a partecipare alla chat di gruppo e il mio username (richiedente)
     ret = send_string(socket_p2p, GROUP_CHAT_INVITE);
@@ -744,50 +1501,180 @@ void add_member_to_chat(void) {
 }
 
 /*
- * Invia il messaggio 'msg' scritto in chat all'interlocutore (tramite 'socket_dest')
+ * Invia il messaggio 'msg' per 'destinatario' sul socket specificato: se è il socket del server (il destinatario
+ * è offline) il messaggio viene registrato dal server, altrimenti è il socket peer-to-peer del destinatario.
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
  */
-void send_chat_message(int socket_dest, char* msg) {
-    char buffer[MAX_MSG_LEN];
+int send_chat_line(int socket, char* destinatario, char* msg) {
     int ret;
 
-    // Se il interlocutore è offline, devo inviare i messaggi al server (che li memorizzerà)
-    if (destinatario_offline == 1) {
-        ret = send_string(socket_dest, OFFLINE_MESSAGE);
-        if (ret < 0) // Errore
-            return;
-        ret = send_string(socket_dest, chat_users[0]);
-        if (ret < 0) // Errore
-            return;
-    } else {
-        // Invio il mio username al peer
-        ret = send_string(socket_dest, username);
-        if (ret < 0) // Errore
-            return;
+    if (socket == server_socket)
+        return send_request(OP_OFFLINE_MESSAGE, destinatario, msg);
+
+    // I peer ricevono i messaggi in un buffer di MAX_MSG_LEN byte
+    if (strlen(msg) >= MAX_MSG_LEN) {
+        printf("Messaggio troppo lungo per '%s': tra peer si possono inviare al massimo %d caratteri.\n", destinatario,
+               MAX_MSG_LEN - 1);
+        return -1;
     }
 
-    // Invio il messaggio
-    ret = send_string(socket_dest, msg);
+    // Invio al peer il mio username e il messaggio (tra peer si usa sempre il protocollo a stringhe)
+    ret = send_string(socket, username);
     if (ret < 0) // Errore
-        return;
+        return ret;
+
+    return send_string(socket, msg);
+}
+
+/*
+ * Per non accavallare richieste, dopo ogni messaggio inviato in chat mi faccio inviare una conferma
+ * (LOGGED_MSG) quando il server/i peer hanno finito di scrivere sul file che contiene la cronologia della chat.
+ * Restituisce 1 se la conferma è arrivata, 0 in caso di disconnessione del socket e
+ * un numero negativo in caso di errore.
+ */
+int receive_chat_ack(int socket) {
+    const int attesi[] = {OP_LOGGED_MSG};
+    struct messaggio risposta;
+    char buffer[MAX_MSG_LEN];
+    int ret;
+
+    if (socket == server_socket)
+        return receive_from_server(attesi, 1, &risposta);
+
+    ret = receive_string(socket, buffer);
+    if (ret > 0 && strcmp(buffer, LOGGED_MSG) != 0)
+        return -1;
+
+    return ret;
+}
+
+/*
+ * Invia il messaggio 'inviato' al k-esimo membro della chat, sul suo socket attuale (se il membro è offline
+ * è il socket del server, che memorizzerà il messaggio).
+ * Restituisce 0 se la conferma arriverà in modo asincrono, 1 se il messaggio è già stato confermato
+ * (i server precedenti a PROTOCOL_SEQUENCED rispondono subito a ogni messaggio) e un valore negativo in caso di errore.
+ */
+int transmit_message(int k, struct messaggio_inviato* inviato) {
+    int ret, socket = socket_gruppo[k];
+
+    inviato->socket = socket;
+    if (socket == server_socket && versione_server >= PROTOCOL_SEQUENCED)
+        return send_request(OP_CHAT_MESSAGE, chat_users[k], inviato->testo, (int) inviato->sequenza);
+
+    ret = send_chat_line(socket, chat_users[k], inviato->testo);
+    if (ret < 0 || socket != server_socket)
+        return ret; // La conferma del peer viene gestita da start_listening()
+
+    // Attendo la conferma di registrazione del messaggio
+    ret = receive_chat_ack(socket);
+    if (ret <= 0) { // Errore o disconnessione del server
+        if (ret == 0)
+            socket_disconnection(socket);
+        else
+            printf("Errore durante la ricezione della risposta '%s' dal server.\n", LOGGED_MSG);
+        return -1;
+    }
+
+    return 1;
+}
+
+/*
+ * Ritrasmette sul socket attuale del k-esimo membro della chat i messaggi non confermati
+ * che gli erano stati inviati su 'socket' (che si è disconnesso)
+ */
+void retransmit_window(int k, int socket) {
+    struct finestra_invio* finestra = &finestre[k];
+    int i = 0;
+
+    while (i < finestra->num) {
+        if (finestra->messaggi[i].socket == socket && transmit_message(k, &finestra->messaggi[i]) != 0)
+            remove_sent_message(k, i); // Già confermato o impossibile da inviare
+        else
+            i++;
+    }
+}
+
+/*
+ * Attende la conferma del messaggio più vecchio in attesa nella finestra di invio del k-esimo membro della chat.
+ * Restituisce 1 se la conferma è arrivata, altrimenti (errore o disconnessione) un valore negativo.
+ */
+int wait_for_ack(int k) {
+    struct messaggio_inviato* primo = &finestre[k].messaggi[0];
+    int ret, num = finestre[k].num;
+
+    // La conferma del server arriva come notifica
+    if (primo->socket == server_socket) {
+        while (finestre[k].num == num && server_offline == 0 && primo->socket == server_socket)
+            server_notification();
+        return finestre[k].num < num ? 1 : -1;
+    }
+
+    ret = receive_chat_ack(primo->socket);
+    if (ret <= 0) { // Errore o disconnessione del peer
+        if (ret == 0)
+            socket_disconnection(primo->socket);
+        else
+            printf("Errore durante la ricezione della risposta '%s' da un peer.\n", LOGGED_MSG);
+        return -1;
+    }
+
+    acknowledge_peer_message(primo->socket);
+    return 1;
+}
+
+/*
+ * Invia il messaggio 'msg' al k-esimo membro della chat senza attendere la conferma di registrazione:
+ * si attende solo se ci sono già SEND_WINDOW messaggi non confermati
+ */
+void send_to_member(int k, char* msg) {
+    struct finestra_invio* finestra = &finestre[k];
+    struct messaggio_inviato* inviato;
+
+    while (finestra->num == SEND_WINDOW)
+        if (wait_for_ack(k) < 0)
+            return;
 
-    /*
-     * Per non accavallare richieste mi faccio inviare un messaggio quando
-     * il server/i peer hanno finito di scrivere sul file che contiene
-     * la cronologia della chat
-     */
-    ret = receive_string(socket_dest, buffer);
-    if (ret <= 0) { // Errore o disconnessione del peer
-        if (ret == 0)
-            socket_disconnection(socket_dest);
+    inviato = &finestra->messaggi[finestra->num];
+    inviato->testo = strdup(msg);
+    if (inviato->testo == NULL) {
+        perror("Impossibile memorizzare il messaggio inviato");
         return;
     }
-    if (strcmp(buffer, LOGGED_MSG) != 0) {
-        printf("Errore durante la ricezione della risposta '%s' da un peer.\n'", LOGGED_MSG);
-        return;
+    inviato->sequenza = ++ultima_sequenza;
+
+    // Il messaggio resta nella finestra finché non arriva la conferma
+    if (transmit_message(k, inviato) == 0)
+        finestra->num++;
+    else
+        free(inviato->testo);
+}
+
+/*
+ * Attende la conferma di tutti i messaggi inviati ai membri della chat e svuota le finestre di invio
+ */
+void flush_send_windows(void) {
+    int k;
+
+    for (k = 0; k < GROUP_SIZE; k++) {
+        while (k < peer_number && finestre[k].num > 0)
+            if (wait_for_ack(k) < 0)
+                break;
+
+        // I messaggi rimasti non potranno più essere confermati
+        while (finestre[k].num > 0)
+            remove_sent_message(k, 0);
     }
+}
+
+/*
+ * Invia il messaggio 'msg' scritto in chat all'interlocutore
+ */
+void send_chat_message(char* msg) {
+    // Se il interlocutore è offline, il suo socket è quello del server (che memorizzerà i messaggi)
+    send_to_member(0, msg);
 
     #ifdef DEBUG
-    printf("Messaggio '%s' inviato con successo sul socket %d.\n", msg, socket_dest);
+    printf("Messaggio '%s' inviato sul socket %d.\n", msg, socket_gruppo[0]);
     #endif
 }
 
@@ -795,46 +1682,12 @@ void send_chat_message(int socket_dest, char* msg) {
  * Invia il messaggio scritto in chat ('msg') a tutti i membri della chat di gruppo
  */
 void send_group_message(char* msg) {
-    char buffer[MAX_MSG_LEN];
-    int i, ret;
+    int i;
 
-    // Invia il messaggio a tutti i peer membri della chat di gruppo
+    // Invia il messaggio a tutti i peer membri della chat di gruppo (senza attendere le conferme)
     for (i = 0; i < peer_number; i++) {
-        // Se l'interlocutore è offline, si invia il messaggio al server
-        if (socket_gruppo[i] == server_socket) {
-            ret = send_string(server_socket, OFFLINE_MESSAGE);
-            if (ret < 0) // Errore
-                continue;
-            ret = send_string(server_socket, chat_users[i]);
-            if (ret < 0) // Errore
-                continue;
-        } else {
-            // Invio il mio username al peer
-            ret = send_string(socket_gruppo[i], username);
-            if (ret < 0) // Errore
-                continue;
-        }
-
-        // Invio il messaggio vero e proprio
-        ret = send_string(socket_gruppo[i], msg);
-        if (ret < 0) // Errore
-            continue;
-
-        /*
-         * Per non accavallare richieste mi faccio inviare un messaggio quando
-         * il server/i peer hanno finito di scrivere sul file che contiene
-         * la cronologia della chat
-         */
-        ret = receive_string(socket_gruppo[i], buffer);
-        if (ret <= 0) { // Errore o disconnessione del peer
-            if (ret == 0)
-                socket_disconnection(socket_gruppo[i]);
-            continue;
-        }
-        if (strcmp(buffer, LOGGED_MSG) != 0) {
-            printf("Errore durante la ricezione della risposta '%s' da '%d'.\n", LOGGED_MSG, socket_gruppo[i]);
-            continue;
-        }
+        // Se l'interlocutore è offline, il suo socket è quello del server e il messaggio viene inviato a lui
+        send_to_member(i, msg);
     }
 
     #ifdef DEBUG
@@ -876,6 +1729,9 @@ void close_chat(void) {
     clear_shell_screen();
     printf("Chiusura chat in corso...\n");
 
+    // Attendo la conferma dei messaggi inviati
+    flush_send_windows();
+
     // Se il server è online
     if (server_offline == 0) {
         // Rimuovo tutti i membri nella chat
@@ -929,8 +1785,8 @@ enum CHAT_COMMAND new_chat_message(char* msg) {
         return ADD_PARTECIPANT;
     }
 
-    // Comando di share (eseguibile solo da una chat aperta)
-    if (strncmp(msg, "share ", 6) == 0) {
+    // Comando di share (eseguibile solo da una chat aperta): un messaggio più lungo di un comando non lo è
+    if (strncmp(msg, "share ", 6) == 0 && strlen(msg) < MAX_COMMAND_LEN) {
         // Recupero il nome del file passato come parametro
         get_first_command_parameter(msg, nome_file);
         if (nome_file[0] == '\0')
@@ -952,7 +1808,7 @@ enum CHAT_COMMAND new_chat_message(char* msg) {
     if (in_group_chat == 1)
         send_group_message(msg); // Invio il messaggio a tutti i membri del gruppo
     else // Se la chat in corso non è una chat di gruppo
-        send_chat_message(socket_gruppo[0], msg); // Invio il messaggio all'interlocutore
+        send_chat_message(msg); // Invio il messaggio all'interlocutore
 
     // Pulisco lo schermo e ristampo la conversazione per un miglior effetto visivo
     clear_shell_screen();
@@ -970,12 +1826,23 @@ enum CHAT_COMMAND new_chat_message(char* msg) {
 void add_to_contact_list(char* user, char* contatto) {
     char path[PATH_MAX];
     FILE* rubrica;
+    int tentativi = 0;
 
-    // Apro la rubrica in append
-    get_contact_list_path(user, path);
-    rubrica = open_or_create(path, "a");
-    if (rubrica == NULL)
-        return; // Impossibile accedere al file
+    // Apro la rubrica in append, bloccandola: se lo strumento di migrazione la sposta nel frattempo, la cerco di nuovo
+    do {
+        get_contact_list_path(user, path);
+        rubrica = open_or_create(path, "a");
+        if (rubrica == NULL)
+            return; // Impossibile accedere al file
+        if (lock_file_in_place(fileno(rubrica), path) == 0)
+            break;
+        fclose(rubrica);
+        rubrica = NULL;
+    } while (errno == ESTALE && ++tentativi < 2);
+    if (rubrica == NULL) {
+        fprintf(stderr, "Impossibile bloccare la rubrica '%s' (di '%s') : %s\n", path, user, strerror(errno));
+        return;
+    }
 
     // Registro il nuovo contatto
     fprintf(rubrica, "%s\n", contatto);
@@ -992,26 +1859,22 @@ void add_to_contact_list(char* user, char* contatto) {
  * Comando 'hanging': stampa le informazioni sui messaggi pendenti
  */
 void hanging(void) {
-    char buffer[MAX_MSG_LEN];
+    const int attesi[] = {OP_PENDING, OP_DONE_HANGING};
+    struct messaggio risposta; // Risposta del server
     char timestamp[TIMESTAMP_LEN]; // Timestamp formattato
-    int ret, i = 0;
+    int ret;
     int none = 0; // Serve a verificare se ci sono messaggi pendenti
 
     printf("Verifico se ci sono messaggi pendenti...\n");
 
     // Invio il comando di hanging al server
-    ret = send_string(server_socket, HANGING_COMMAND);
+    ret = send_request(OP_HANGING);
     if (ret < 0) // Errore
         return;
 
     // Ricevo le informazioni sui messaggi pendenti dal server, raggruppate per mittente
     for (;;) {
-        /*
-         * Se i == 0 -> si riceve l'username del mittente
-         * Se i == 1 -> si riceve il numero di messaggi pendenti
-         * Se i == 1 -> si riceve il timestamp del messaggio più recente
-         */
-        ret = receive_string(server_socket, buffer);
+        ret = receive_from_server(attesi, 2, &risposta);
         if (ret == 0) { // Disconnessione del server
             socket_disconnection(server_socket);
 
@@ -1024,21 +1887,13 @@ void hanging(void) {
         if (ret < 0) // Errore
             return;
 
-        if (strcmp(buffer, DONE_HANGING) == 0)
+        if (risposta.opcode == OP_DONE_HANGING)
             break; // Fine messaggi pendenti
 
-        if (i == 0) {
-            printf("'%s' ti ha mandato ", buffer);
-            none = 1;
-            i++;
-        } else if (i == 1) {
-            printf("%s messaggio/i - ", buffer);
-            i++;
-        } else if (i == 2) {
-            format_timestamp(atoi(buffer), timestamp, sizeof(timestamp));
-            printf("%s\n", timestamp);
-            i = 0;
-        }
+        // Il server invia l'username del mittente, il numero di messaggi pendenti e il timestamp del più recente
+        format_timestamp(atoi(risposta.stringhe[2]), timestamp, sizeof(timestamp));
+        printf("'%s' ti ha mandato %s messaggio/i - %s\n", risposta.stringhe[0], risposta.stringhe[1], timestamp);
+        none = 1;
     }
 
     if (none == 0)
@@ -1080,24 +1935,23 @@ int find_user_in_contact_list(char* contatto) {
  * Comando 'show': mostra i messaggi pendenti inviati da 'target_user' all'utente corrente
  */
 void show(char* target_user) {
-    int ret, num_messaggi_pendenti;
-    char buffer[MAX_MSG_LEN];
+    int ret, num_messaggi_pendenti = 0;
+    const int attesi[] = {OP_SHOW_LINE, OP_DONE_SHOW};
+    struct messaggio risposta; // Risposta del server
 
     if (find_user_in_contact_list(target_user) == 0) {
         printf("L'utente non è in rubrica: non puoi fare una show su di lui.\n");
         return;
     }
 
-    ret = send_string(server_socket, SHOW_COMMAND); // Invio al server il comando di show
-    if (ret < 0)
-        return;
-    ret = send_string(server_socket, target_user); // Invio il mittente dei messaggi che si vogliono leggere
+    // Invio al server il comando di show e il mittente dei messaggi che si vogliono leggere
+    ret = send_request(OP_SHOW, target_user);
     if (ret < 0)
         return;
 
     // Ricevo i messaggi pendenti dal server
     for (;;) {
-        ret = receive_string(server_socket, buffer);
+        ret = receive_from_server(attesi, 2, &risposta);
         if (ret == 0) { // Disconnessione del server
             socket_disconnection(server_socket);
 
@@ -1110,11 +1964,11 @@ void show(char* target_user) {
         if (ret < 0) // Errore
             return;
 
-        if (strcmp(buffer, DONE_SHOW) == 0)
+        if (risposta.opcode == OP_DONE_SHOW)
             break; // Fine messaggi pendenti
 
         num_messaggi_pendenti++;
-        printf("%s\n", buffer);
+        printf("%s\n", risposta.stringhe[0]);
     }
 
     // Nessun messaggio pendente
@@ -1128,9 +1982,9 @@ void show(char* target_user) {
 void chat(char* comando) {
     int ret;
     int peer_port; // Porta di ascolto del peer con cui si vuole avviare una chat
-    char buffer[MAX_MSG_LEN];
+    const int attesi[] = {OP_USER_PORT, OP_USER_OFFLINE, OP_PEER_PORT};
+    struct messaggio risposta; // Risposta del server
     int socket_p2p; // Socket peer-to-peer per comunicare con un altro dispositivo
-    struct sockaddr_in destinatario_addr; // Indirizzo del socket del peer con cui si vuole avviare una chat
 
     // Recupero l'username passato come parametro del comando
     get_first_command_parameter(comando, chat_users[0]);
@@ -1145,17 +1999,13 @@ void chat(char* comando) {
 
     printf("Avvio chat in corso...\n");
 
-    // Si invia al server il comando che segnala la volontà di avviare una chat
-    ret = send_string(server_socket, NEW_CHAT_COMMAND);
-    if (ret < 0)
-        return;
-    // Si invia al server l'username dell'utente con cui si vuole avviare una chat
-    ret = send_string(server_socket, chat_users[0]);
+    // Si invia al server il comando che segnala la volontà di avviare una chat e l'username dell'interlocutore
+    ret = send_request(OP_NEW_CHAT, chat_users[0]);
     if (ret < 0)
         return;
 
     // Il server ci dice se l'utente è online o meno
-    ret = receive_string(server_socket, buffer);
+    ret = receive_from_server(attesi, 3, &risposta);
     if (ret == 0) { // Disconnessione del server
         socket_disconnection(server_socket);
 
@@ -1169,28 +2019,16 @@ void chat(char* comando) {
         return;
 
     // Se l'interlocutore è offline, la conversazione avviene col server che memorizza nel log della chat i messaggi
-    if (strcmp(buffer, USER_OFFLINE) == 0) { // Utente offline
+    if (risposta.opcode == OP_USER_OFFLINE) { // Utente offline
         destinatario_offline = 1;
 
         // Imposto il socket per lo scambio dei messaggi a quello del server
         socket_p2p = server_socket;
-    } else if (strcmp(buffer, USER_ONLINE) == 0) { // Utente online
+    } else { // Utente online
         destinatario_offline = 0;
 
         // Se l'utente è online, mi viene mandata la porta su cui è in ascolto il device dell'interlocutore
-        ret = receive_integer(server_socket, &peer_port);
-        if (ret == 0) { // Disconnessione del server
-            socket_disconnection(server_socket);
-
-            /*
-             * Se arriviamo qui non abbiamo chat aperte. Se il server si disconnette
-             * il client non può fare niente, quindi si termina.
-             */
-            exit(0);
-        }
-        if (ret < 0) // Errore
-            return;
-
+        peer_port = risposta.interi[0];
 
         #ifdef DEBUG
         printf("Porta interlocutore: %d.\n", peer_port);
@@ -1200,31 +2038,14 @@ void chat(char* comando) {
          * Creo il socket peer-to-peer con il nuovo interlocutore: i
          * messaggi vengono inviati direttamente senza passare dal server
          */
-        memset(&destinatario_addr, 0, sizeof(destinatario_addr));
-        destinatario_addr.sin_port = htons(peer_port);
-        destinatario_addr.sin_family = AF_INET;
-        inet_pton(AF_INET, "127.0.0.1", &destinatario_addr.sin_addr);
-        socket_p2p = socket(AF_INET, SOCK_STREAM, 0);
-        if (socket_p2p == -1) {
-            perror("Errore durante la creazione del socket peer-to-peer");
-            return;
-        }
-
-        // Connessione al peer/interlocutore
-        ret = connect(socket_p2p, (struct sockaddr*) &destinatario_addr, sizeof(destinatario_addr));
-        if (ret == -1) {
-            perror("Errore nella connessione con l'altro peer");
+        socket_p2p = connect_to_peer(peer_port, risposta.opcode == OP_PEER_PORT ? risposta.interi[1] : PROTOCOL_LEGACY);
+        if (socket_p2p == -1)
             return;
-        }
 
         // Aggiorno il set dei socket monitorati
         FD_SET(socket_p2p, &master);
         if (socket_p2p > fd_max)
             fd_max = socket_p2p;
-    } else {
-        printf("Errore durante la ricezione dal server dello status (online/offline) dell'utente '%s'.\n",
-               chat_users[0]);
-        return;
     }
 
     // Aggiungo il socket peer-to-peer alla lista dei socket che partecipano alla chat
@@ -1249,7 +2070,7 @@ void out(void) {
 
     // Se il server è online, gli comunico il logout
     if (server_offline == 0) {
-        ret = send_string(server_socket, LOGOUT_COMMAND);
+        ret = send_request(OP_LOGOUT);
         if (ret < 0) // Errore
             return;
     } else
@@ -1260,6 +2081,10 @@ void out(void) {
         if (socket_gruppo[i] != server_socket)
             socket_disconnection(socket_gruppo[i]);
 
+    #ifdef DEBUG
+    print_compression_stats();
+    #endif
+
     exit(0);
 }
 
@@ -1349,27 +2174,110 @@ void new_chat_member(int socket) {
 }
 
 /*
- * Invocata quando il server notifica al mittente dei messaggi che il destinatario (inizialmente offline)
- * è tornato online e ha ricevuto i messaggi pendenti inviati in precedenza
+ * Riceve l'elenco dei membri della chat di gruppo dal peer che ha inviato l'invito a parteciparvi (sul socket
+ * specificato) e si connette a ciascuno di essi. Le porte di ascolto dei membri vengono chieste al server tutte
+ * insieme, senza aspettare la risposta a una richiesta prima di inviare la successiva.
+ * Restituisce 1 se la chat di gruppo è pronta, 0 in caso di errore o disconnessione.
  */
-void pending_messages_sent(char* destinatario) {
-    clear_shell_line();
-    printf("Uno o più messaggi inviati a '%s' sono stati consegnati.\n", destinatario);
+int receive_group_members(int socket_invito) {
+    const int porta_membro[] = {OP_MEMBER_PORT, OP_PEER_PORT};
+    struct esito_richiesta porte[GROUP_SIZE]; // Porte di ascolto dei membri ricevute dal server
+    char buffer[MAX_MSG_LEN];
+    int ret, completo, k, primo = peer_number;
+    int socket_p2p; // Socket peer-to-peer per comunicare con un altro dispositivo
 
-    if (in_chat == 1) // Se sono in chat
-        printf("%s>", username);
-    else
-        printf(">");
+    // Ricevo tutti i membri della chat e, per ciascuno, chiedo al server la sua porta di ascolto
+    for (;;) {
+        ret = receive_string(socket_invito, buffer);
+        if (ret <= 0) { // Errore o disconnessione del peer
+            if (ret == 0)
+                socket_disconnection(socket_invito);
+            break;
+        }
 
-    fflush(stdout);
+        // Se sono finiti i membri della chat
+        if (strcmp(buffer, END_MEMBERS) == 0)
+            break;
+
+        // Aggiungo l'utente alla lista dei membri della chat
+        strcpy(chat_users[peer_number], buffer);
+
+        /*
+         * Contatto il server per ricevere porta di ascolto di ogni membro della chat
+         * al fine di stabilirci una connessione peer-to-peer.
+         * Si invia il comando per richiedere la porta e l'username di cui si vuole
+         * conoscere la porta di ascolto: la risposta viene raccolta dopo aver ricevuto tutti i membri.
+         */
+        ret = send_async_request(&porte[peer_number], porta_membro, 2, OP_MEMBER_PORT_REQUEST,
+                                 chat_users[peer_number]);
+        if (ret < 0) // Errore
+            break;
+        peer_number++;
+    }
+    completo = ret > 0;
+    strcpy(chat_users[peer_number], "\0");
+
+    // Ricevo le porte di ascolto dei membri dal server
+    ret = wait_async_requests();
+    if (ret <= 0) { // Errore o disconnessione del server
+        if (ret == 0)
+            socket_disconnection(server_socket);
+        return 0;
+    }
+    if (!completo)
+        return 0;
+
+    for (k = primo; k < peer_number; k++) {
+        if (porte[k].interi[0] == INVALID_SOCKET) {
+            // Il membro è offline: invio i messaggi al server
+            socket_gruppo[k] = server_socket;
+            continue;
+        }
+
+        // Connessione al peer (membro)
+        socket_p2p = connect_to_peer(porte[k].interi[0],
+                                     porte[k].opcode == OP_PEER_PORT ? porte[k].interi[1] : PROTOCOL_LEGACY);
+        if (socket_p2p == -1)
+            break;
+
+        // Aggiorno l'elenco dei socket peer-to-peer dei partecipanti alla chat di gruppo
+        socket_gruppo[k] = socket_p2p;
+
+        printf("Connessione con '%s' eseguita con successo.\n", chat_users[k]);
+
+        // Notifico al membro che sono stato aggiunto alla chat di gruppo
+        ret = send_string(socket_p2p, NEW_MEMBER);
+        if (ret < 0) // Errore
+            break;
+        ret = send_string(socket_p2p, username);
+        if (ret < 0) // Errore
+            break;
+
+        // Aggiorno il set dei socket monitorati
+        FD_SET(socket_p2p, &master);
+        if (socket_p2p > fd_max)
+            fd_max = socket_p2p;
+    }
+
+    // In caso di errore restano nella chat solo i membri a cui mi sono connesso
+    if (k < peer_number) {
+        peer_number = k;
+        strcpy(chat_users[peer_number], "\0");
+        return 0;
+    }
+
+    return 1;
 }
 
 /*
  * Si occupa di ricevere il file condiviso in chat da un peer
  */
 void receive_file_shared(int socket) {
-    int ret;
+    const int attesi[] = {OP_FILE_CHUNK, OP_FILE_END};
+    int ret, len;
     char buffer[FILE_MSG_SIZE];
+    char* dati; // Byte ricevuti ('buffer' o un campo di 'blocco')
+    struct messaggio blocco; // Blocco del file (se con il peer si è negoziato PROTOCOL_HANDSHAKE)
     char path[PATH_MAX]; // Path del file ricevuto
     FILE* file; // File ricevuto
 
@@ -1383,7 +2291,20 @@ void receive_file_shared(int socket) {
 
     // Ricevo il file condiviso
     for (;;) {
-        ret = receive_bit(socket, buffer);
+        if (versione_peer[socket] >= PROTOCOL_HANDSHAKE) {
+            ret = receive_message(socket, versione_peer[socket], attesi, 2, &blocco);
+            if (ret > 0 && blocco.opcode == OP_FILE_END)
+                break; // Fine trasmissione file
+            if (ret > 0 && blocco.opcode != OP_FILE_CHUNK) {
+                fprintf(stderr, "Ricevuto dal peer il messaggio inatteso con opcode %d.\n", blocco.opcode);
+                ret = -1;
+            }
+            dati = blocco.stringhe[0];
+            len = blocco.interi[0];
+        } else {
+            ret = receive_frame(socket, buffer, FILE_MSG_SIZE, &len);
+            dati = buffer;
+        }
         if (ret <= 0) { // Errore o disconnessione del peer
             if (ret == 0)
                 socket_disconnection(socket);
@@ -1393,14 +2314,15 @@ void receive_file_shared(int socket) {
             return;
         }
 
-        if (strncmp(buffer, DONE_SHARE, strlen(DONE_SHARE)) == 0)
-            break; // Fine trasmissione file
+        // Fine trasmissione file (nel protocollo a stringhe)
+        if (dati == buffer && len == strlen(DONE_SHARE) && memcmp(buffer, DONE_SHARE, len) == 0)
+            break;
 
         #ifdef DEBUG
         printf("Scrivo i bit sul file '%s'.\n", path);
         #endif
 
-        fprintf(file, "%s", buffer); // Scrivo i byte ricevuti sul file
+        fwrite(dati, 1, len, file); // Scrivo i byte ricevuti sul file
     }
     if (fclose(file) != 0)
         fprintf(stderr, "Errore durante la chiusura del file ricevuto '%s' : %s\n", path, strerror(errno));
@@ -1414,115 +2336,23 @@ void receive_file_shared(int socket) {
     fflush(stdout);
 }
 
-/*
- * Invocata ogni volta che un utente esegue il login (il server ci invia una notifica). Controlla se l'utente
- * ora online fa parte della chat così che possa stabilirci una nuova connessione peer-to-peer (non passerò
- * più dal server).
- */
-void now_online(void) {
-    char buffer[USERNAME_LEN];
-    int ret, peer_port, i;
-    int socket_p2p; // Socket peer-to-peer per comunicare con un altro device
-    struct sockaddr_in destinatario_addr; // Indirizzo del socket del peer con cui si vuole comunicare
-
-    // Ricevo l'username dell'utente ora online
-    ret = receive_string(server_socket, buffer);
-    if (ret == 0) { // Disconnessione del server
-        socket_disconnection(server_socket);
-
-        /*
-         * Se il server si disconnette e non abbiamo chat in corso o se abbiamo una chat con
-         * un interlocutore offline, il client non può fare niente e dunque può terminare.
-         */
-        if (in_chat == 0 || (in_chat == 1 && destinatario_offline == 1))
-            exit(0);
-
-        return;
-    }
-    if (ret < 0) // Errore
-        return;
-
-    // Ricevo la porta su cui è in ascolto il device dell'utente ora online
-    ret = receive_integer(server_socket, &peer_port);
-    if (ret <= 0) { // Errore o disconnessione del server
-        if (ret == 0)
-            socket_disconnection(server_socket);
-        return;
-    }
-
-    // Controllo se sono in chat con l'utente diventato online
-    if ((in_chat == 1 || in_group_chat == 1) && destinatario_offline == 1) {
-        for (i = 0; i < peer_number; i++) {
-            if (strcmp(chat_users[i], buffer) == 0)
-                break;
-        }
-        if (i == peer_number)
-            return; // Corrispondenza non trovata
-
-        /* Sono in chat con l'utente ora online */
-
-        /*
-         * Creo il socket peer-to-peer con il nuovo interlocutore: i
-         * messaggi vengono inviati direttamente senza passare dal server
-         */
-        memset(&destinatario_addr, 0, sizeof(destinatario_addr));
-        destinatario_addr.sin_port = htons(peer_port);
-        destinatario_addr.sin_family = AF_INET;
-        inet_pton(AF_INET, "127.0.0.1", &destinatario_addr.sin_addr);
-        socket_p2p = socket(AF_INET, SOCK_STREAM, 0);
-        if (socket_p2p == -1) {
-            perror("Errore durante la creazione del socket peer-to-peer");
-            return;
-        }
-
-        // Connessione al peer/interlocutore
-        ret = connect(socket_p2p, (struct sockaddr*) &destinatario_addr, sizeof(destinatario_addr));
-        if (ret == -1) {
-            perror("Errore nella connessione con l'altro peer");
-            return;
-        }
-
-        // Aggiorno il set dei socket monitorati
-        FD_SET(socket_p2p, &master);
-        if (socket_p2p > fd_max)
-            fd_max = socket_p2p;
-
-        // Aggiungo il socket peer-to-peer alla lista dei socket che partecipano alla chat
-        socket_gruppo[i] = socket_p2p;
-
-        destinatario_offline = 0;
-    }
-}
-
 /*
  * Aggiunge un messaggio al log della chat tra l'utente corrente ('username') e 'mittente'
  */
 void write_to_chat_log(char* mittente, char* messaggio) {
     char path[PATH_MAX]; // Path del file di log della chat
-    FILE* log; // File contenente lo storico della chat
-    char appoggio[MAX_LINE_LEN]; // Conterrà la nuova riga da scrivere sul file di log
-
-    /*
-     * Se il file non viene trovato, provo a scambiare l'ordine degli username nel nome del file.
-     * Ad esempio, il file di log può essere pippo-pluto.txt ma anche pluto-pippo.txt.
-     */
-    get_chat_log_path(mittente, username, path);
-    if (is_file_existing(path) == 0) // Il file di log non esiste
-        get_chat_log_path(username, mittente, path);
-    log = open_or_create(path, "a"); // Apro il file in modalità append
-    if (log == NULL)
-        return; // Impossibile accedere al file
+    int tentativi = 0;
 
-    // Contrassegno i messaggi con '**' poiché se arrivo qui sono online e li sto leggendo
-    strcpy(appoggio, mittente);
-    strcat(appoggio, ": ");
-    strcat(appoggio, messaggio);
-    strcat(appoggio, " ");
-    strcat(appoggio, READ_MARK);
+    do {
+        // Il log viene aperto (in append) solo se non lo è già: solo allora può servire convertire il log testuale
+        get_chat_log_path(mittente, username, path);
+        if (is_file_cached(&log_aperti, path) == 0)
+            prepare_chat_log(mittente, username, path);
 
-    fprintf(log, "%s\n", appoggio); // Scrivo sul file il messaggio
-    if (fclose(log) != 0)
-        fprintf(stderr, "Errore durante la chiusura del log della chat '%s' : %s\n", path, strerror(errno));
+        // Registro il messaggio come letto poiché se arrivo qui sono online e lo sto leggendo (il record va sul file)
+        if (append_chat_message(&log_aperti, path, mittente, messaggio, 1, NULL) != NULL)
+            return;
+    } while (errno == ESTALE && ++tentativi < 2); // Il log è stato spostato: lo cerco di nuovo
 }
 
 /*
@@ -1532,7 +2362,8 @@ void start_listening(void) {
     char mittente[USERNAME_LEN];
     char messaggio[MAX_MSG_LEN];
     char buffer[MAX_COMMAND_LEN];
-    int porta; // Porta di ascolto di un peer ricevuta dal server
+    char* linea = NULL; // Riga letta da tastiera (getline() la alloca della lunghezza della riga)
+    size_t dim_linea = 0;
     int ret, len, i, k;
     int found = 0;
     int new_sd; // Contiene un nuovo socket creato
@@ -1540,8 +2371,6 @@ void start_listening(void) {
     struct sockaddr_in mittente_address; // Indirizzo (del socket) del client che ci ha inviato una richieste di connessione
     int listen_socket; // Socket di ascolto per altri peer
     fd_set read_fds; // Set di socket di appoggio
-    int socket_p2p; // Socket peer-to-peer per comunicare con un altro dispositivo
-    struct sockaddr_in destinatario_addr; // Indirizzo di un peer
 
     // Creo il socket di ascolto (protocollo TCP)
     listen_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -1593,6 +2422,13 @@ void start_listening(void) {
             if (i == listen_socket) { // Nuova connessione
                 len = sizeof(mittente_address);
                 new_sd = accept(listen_socket, (struct sockaddr*) &mittente_address, (socklen_t * ) & len);
+                if (new_sd == -1) {
+                    perror("Errore durante l'accettazione di una connessione peer-to-peer");
+                    continue;
+                }
+
+                // Il peer può inviare PEER_HELLO solo come primo comando (vedi sotto)
+                versione_peer[new_sd] = 0;
 
                 // Aggiorno il set dei socket monitorati
                 FD_SET(new_sd, &master);
@@ -1601,29 +2437,38 @@ void start_listening(void) {
             } else if (i == 0) { // Input da tastiera
                 /*
                  * Leggo ciò che è stato inserito nel terminale: non si usa scanf
-                 * perchè questa spezza l'input in più stringhe secondo gli spazi
+                 * perchè questa spezza l'input in più stringhe secondo gli spazi.
+                 * Si usa getline() perché un messaggio incollato in chat può essere molto lungo.
                  */
-                fgets(buffer, MAX_COMMAND_LEN, stdin);
+                if (getline(&linea, &dim_linea, stdin) == -1) {
+                    FD_CLR(0, &master); // Stdin chiuso: non c'è più niente da leggere
+                    continue;
+                }
 
                 // Sostituisco il carattere di new-line (\n) con il terminatore di stringa (\0)
-                remove_new_line(buffer);
+                remove_new_line(linea);
 
                 // Se c'è una chat in corso (1-to-1 o di gruppo non fa differenza)
                 if (in_chat == 1) {
                     printf("%s>", username);
                     fflush(stdout);
 
-                    new_chat_message(buffer);
+                    new_chat_message(linea);
                 } else { // Non sono in una chat: è un comando "esterno" alle chat
-                    run_command(buffer);
+                    // I comandi sono lunghi al massimo MAX_COMMAND_LEN caratteri
+                    if (strlen(linea) >= MAX_COMMAND_LEN)
+                        linea[MAX_COMMAND_LEN - 1] = '\0';
+                    run_command(linea);
                     printf(">");
                     fflush(stdout);
                 }
-            } else { // Ho ricevuto un comando o un messaggio
+            } else if (i == server_socket) { // Notifica del server
+                server_notification();
+            } else { // Ho ricevuto un comando o un messaggio da un peer
 
                 // Ricevo il comando o il mittente (se è un messaggio)
                 ret = receive_string(i, buffer);
-                if (ret == 0) { // Disconnessione di un peer/del server
+                if (ret == 0) { // Disconnessione di un peer
                     socket_disconnection(i);
                     continue;
                 }
@@ -1632,6 +2477,15 @@ void start_listening(void) {
 
                 /* Verifico il comando/messaggio ricevuto */
 
+                // Negoziazione della connessione appena aperta dal peer (altrimenti si usano i comandi a stringhe)
+                if (versione_peer[i] == 0) {
+                    versione_peer[i] = PROTOCOL_LEGACY;
+                    if (strcmp(buffer, PEER_HELLO) == 0) {
+                        accept_peer_hello(i);
+                        continue;
+                    }
+                }
+
                 // Invito ad una chat di gruppo
                 if (strcmp(buffer, GROUP_CHAT_INVITE) == 0) {
                     // Se sono già in chat (1-to-1 o di gruppo), rifiuto l'invito
@@ -1682,123 +2536,26 @@ void start_listening(void) {
                     strcpy(chat_users[peer_number + 1], "\0");
                     peer_number++;
 
-                    // Ricevo tutti i membri della chat da chi mi ha inviato l'invito a partecipare alla chat
-                    for (;;) {
-                        ret = receive_string(i, buffer);
-                        if (ret <= 0) { // Errore o disconnessione del peer
-                            if (ret == 0)
-                                socket_disconnection(i);
-                            break;
-                        }
-
-                        // Se sono finiti i membri della chat
-                        if (strcmp(buffer, END_MEMBERS) == 0) {
-                            strcpy(chat_users[peer_number], "\0");
-                            in_group_chat = 1;
-                            in_chat = 1;
-                            clear_shell_screen();
-                            print_chat_history(mittente);
-                            print_users_in_chat();
-                            printf("%s>", username);
-                            fflush(stdout);
-                            break;
-                        }
-
-                        // Aggiungo l'utente alla lista dei membri della chat
-                        strcpy(chat_users[peer_number], buffer);
-
-                        /*
-                         * Contatto il server per ricevere porta di ascolto di ogni membro della chat
-                         * al fine di stabilirci una connessione peer-to-peer.
-                         * Si invia il comando per richiedere la porta e l'username di cui si vuole
-                         * conoscere la porta di ascolto.
-                         */
-                        ret = send_string(server_socket, MEMBER_PORT_REQUEST);
-                        if (ret < 0) // Errore
-                            break;
-                        ret = send_string(server_socket, chat_users[peer_number]);
-                        if (ret < 0) // Errore
-                            break;
-
-                        // Ricevo la porta di ascolto dell'utente dal server
-                        ret = receive_integer(server_socket, &porta);
-                        if (ret <= 0) { // Errore o disconnessione del server
-                            socket_disconnection(server_socket);
-                            break;
-                        }
-                        if (porta == INVALID_SOCKET) {
-                            // Il membro è offline: invio i messaggi al server
-                            socket_gruppo[peer_number] = server_socket;
-                            peer_number++;
-                            continue;
-                        }
-
-                        // Compilo con i dati dell'altro peer (membro)
-                        memset(&destinatario_addr, 0, sizeof(destinatario_addr));
-                        destinatario_addr.sin_port = htons(porta);
-                        destinatario_addr.sin_family = AF_INET;
-                        inet_pton(AF_INET, "127.0.0.1", &destinatario_addr.sin_addr);
-                        socket_p2p = socket(AF_INET, SOCK_STREAM, 0);
-                        if (socket_p2p == -1) {
-                            perror("Errore durante la creazione di un socket peer-to-peer");
-                            break;
-                        }
-
-                        // Connessione al peer (membro)
-                        ret = connect(socket_p2p, (struct sockaddr*) &destinatario_addr, sizeof(destinatario_addr));
-                        if (ret == -1) {
-                            perror("Errore nella connessione con l'altro peer\n");
-                            break;
-                        }
-
-                        // Aggiorno l'elenco dei socket peer-to-peer dei partecipanti alla chat di gruppo
-                        socket_gruppo[peer_number] = socket_p2p;
-                        peer_number++;
-
-                        printf("Connessione con '%s' eseguita con successo.\n", chat_users[peer_number]);
-
-                        // Notifico al membro che sono stato aggiunto alla chat di gruppo
-                        ret = send_string(socket_p2p, NEW_MEMBER);
-                        if (ret < 0) // Errore
-                            break;
-                        ret = send_string(socket_p2p, username);
-                        if (ret < 0) // Errore
-                            break;
+                    // Ricevo tutti i membri della chat da chi mi ha inviato l'invito e mi connetto a ciascuno di essi
+                    if (receive_group_members(i) == 0)
+                        continue;
 
-                        // Aggiorno il set dei socket monitorati
-                        FD_SET(socket_p2p, &master);
-                        if (socket_p2p > fd_max)
-                            fd_max = socket_p2p;
-                    }
+                    in_group_chat = 1;
+                    in_chat = 1;
+                    clear_shell_screen();
+                    print_chat_history(mittente);
+                    print_users_in_chat();
+                    printf("%s>", username);
+                    fflush(stdout);
+                } else if (strcmp(buffer, LOGGED_MSG) == 0) { // Conferma di un messaggio inviato al peer
+                    acknowledge_peer_message(i);
+                    continue;
                 } else if (strcmp(buffer, NEW_MEMBER) == 0) { // Nuovo membro aggiunto alla chat di gruppo
                     new_chat_member(i);
                     continue;
-                } else if (strcmp(buffer, MESSAGES_SENT) == 0) { // Un utente ha ricevuto i messaggi pendenti
-                    // Ricevo l'username del interlocutore a cui sono arrivati i messaggi pendenti
-                    ret = receive_string(i, buffer);
-                    if (ret == 0) { // Disconnessione del server
-                        socket_disconnection(i);
-
-                        /*
-                         * Se il server si disconnette e non abbiamo chat in corso o se abbiamo una chat con
-                         * un interlocutore offline, il client non può fare niente e dunque può terminare.
-                         */
-                        if (in_chat == 0 || (in_chat == 1 && destinatario_offline == 1))
-                            exit(0);
-
-                        continue;
-                    }
-                    if (ret < 0) // Errore
-                        continue;
-
-                    pending_messages_sent(buffer);
-                    continue;
                 } else if (strcmp(buffer, SHARING_FILE) == 0) { // Condivisione di un file
                     receive_file_shared(i);
                     continue;
-                } else if (strcmp(buffer, NOW_ONLINE) == 0) { // Un utente ha eseguito il login (ed è ora online)
-                    now_online();
-                    continue;
                 } else { // Messaggio in chat
                     strcpy(mittente, buffer); // Ho ricevuto il mittente del messaggio
 
@@ -1880,6 +2637,11 @@ int main(int argc, char* argv[]) {
     } else
         server_port = DEFAULT_SERVER_PORT; // Porta di default
 
+    // La sessione identifica questa esecuzione del device, in cui i numeri di sequenza ripartono da 0
+    sessione = (uint32_t) time(NULL) ^ ((uint32_t) getpid() << 16);
+    if (sessione == 0)
+        sessione = 1;
+
     // Creazione socket per comunicare con il server
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket == -1) {
@@ -1902,8 +2664,13 @@ int main(int argc, char* argv[]) {
 
     printf("************ CONNESSO AL SERVER CON SUCCESSO ************\n");
 
+    // Concordo con il server la versione del protocollo da usare
+    negotiate_protocol();
+
     // Creo le cartelle, se non esistono, necessarie per il funzionamento del device
     create_folders();
+    if (init_file_cache(&log_aperti, CHAT_LOG_CACHE_LEN) == -1)
+        exit(1);
 
     // Stampo i comandi disponibili
     print_auth_commands();
@@ -0,0 +1,102 @@
+/**********************************************
+ *                                            *
+ *     Esportazione testuale dei log chat     *
+ *                                            *
+ **********************************************/
+
+#include <linux/limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "costanti.h"
+#include "util/file.h"
+#include "util/time.h"
+#include "util/log_chat.h"
+
+/*
+ * Stampa il log (binario) della chat tra due utenti nel formato testuale delle versioni precedenti
+ * ("mittente: messaggio (**)" oppure "(*)" se non ancora letto dal destinatario).
+ * Va eseguito dalla stessa cartella del server (o del device) di cui si vuole leggere il log.
+ *
+ * Utilizzo: ./esporta [-v] [-s seq] [-t timestamp] utente1 utente2
+ *  -v: antepone a ogni messaggio il numero di sequenza e l'istante in cui è stato registrato
+ *  -s: parte dal primo messaggio con numero di sequenza maggiore o uguale a 'seq'
+ *  -t: parte dal primo messaggio registrato all'istante 'timestamp' (secondi dall'epoch) o dopo
+ */
+int main(int argc, char* argv[]) {
+    struct lettore_chat lettore;
+    struct messaggio_chat messaggio;
+    char path[PATH_MAX]; // Path del log della chat
+    char timestamp[TIMESTAMP_LEN];
+    char* utente1;
+    char* utente2;
+    long letti_utente1, letti_utente2; // Segni di lettura dei due utenti
+    unsigned long long seq = 0;
+    time_t istante = 0;
+    int verboso = 0, opzione, letto, esito;
+
+    while ((opzione = getopt(argc, argv, "vs:t:")) != -1) {
+        switch (opzione) {
+            case 'v':
+                verboso = 1;
+                break;
+            case 's':
+                seq = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                istante = (time_t) strtoll(optarg, NULL, 10);
+                break;
+            default:
+                fprintf(stderr, "Utilizzo: %s [-v] [-s seq] [-t timestamp] utente1 utente2\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "Utilizzo: %s [-v] [-s seq] [-t timestamp] utente1 utente2\n", argv[0]);
+        return 1;
+    }
+    utente1 = argv[optind];
+    utente2 = argv[optind + 1];
+
+    // Se esiste solo il vecchio log testuale viene convertito (come farebbero server e device)
+    prepare_chat_log(utente1, utente2, path);
+    esito = open_chat_reader(&lettore, path);
+    if (esito == -1)
+        return 1;
+    if (esito == 0) {
+        fprintf(stderr, "Nessun log per la chat tra '%s' e '%s'\n", utente1, utente2);
+        return 1;
+    }
+
+    letti_utente1 = get_read_mark(path, utente1);
+    letti_utente2 = get_read_mark(path, utente2);
+
+    if (seq > 0)
+        seek_chat_sequence(&lettore, seq);
+    if (istante > 0)
+        seek_chat_time(&lettore, istante);
+
+    while (next_chat_message(&lettore, &messaggio) == 1) {
+        // Un messaggio è stato letto dal destinatario se è registrato come letto o precede il suo segno di lettura
+        if (messaggio.len_mittente == (int) strlen(utente1) &&
+            strncmp(messaggio.mittente, utente1, messaggio.len_mittente) == 0)
+            letto = messaggio.letto || (long) messaggio.seq <= letti_utente2;
+        else
+            letto = messaggio.letto || (long) messaggio.seq <= letti_utente1;
+
+        if (verboso) {
+            if (messaggio.timestamp != 0)
+                format_timestamp(messaggio.timestamp, timestamp, sizeof(timestamp));
+            else
+                strcpy(timestamp, "-");
+            printf("#%llu [%s] ", messaggio.seq, timestamp);
+        }
+        printf("%.*s: %.*s %s\n", messaggio.len_mittente, messaggio.mittente, messaggio.len_testo, messaggio.testo,
+               letto ? READ_MARK : UNREAD_MARK);
+    }
+
+    close_chat_reader(&lettore);
+    return 0;
+}
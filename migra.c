@@ -0,0 +1,383 @@
+/**********************************************
+ *                                            *
+ *   Migrazione di rubriche e log in cartelle *
+ *                                            *
+ **********************************************/
+
+#include <linux/limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include "costanti.h"
+#include "util/file.h"
+#include "util/log_chat.h"
+
+/*
+ * Conteggi stampati alla fine della migrazione
+ */
+static int num_log = 0; // Log binari spostati
+static int num_segni = 0; // Segni di lettura spostati
+static int num_rubriche = 0; // Rubriche spostate
+static int num_testuali = 0; // Log testuali convertiti (direttamente nelle sottocartelle)
+static int num_errori = 0;
+
+static int verboso = 0;
+
+/*
+ * Confronta due nomi di file (per qsort() e bsearch())
+ */
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/*
+ * Pone in 'nomi' i nomi (in ordine alfabetico) dei file regolari direttamente in 'cartella' e in 'num' il loro numero.
+ * Elenco e nomi vanno liberati. Restituisce 0 in caso di successo (anche se la cartella non esiste), -1 in caso di errore.
+ * NB: l'elenco viene letto tutto prima di spostare i file, perché readdir() non garantisce nulla su una cartella
+ * modificata durante la lettura.
+ */
+static int list_files(char* cartella, char*** nomi, size_t* num) {
+    char path[PATH_MAX];
+    struct dirent* voce;
+    struct stat info;
+    char** nuovi;
+    size_t dim = 0;
+    DIR* dir;
+
+    *nomi = NULL;
+    *num = 0;
+    dir = opendir(cartella);
+    if (dir == NULL) {
+        if (errno == ENOENT)
+            return 0; // Niente da spostare
+        fprintf(stderr, "Impossibile leggere la cartella '%s' : %s\n", cartella, strerror(errno));
+        return -1;
+    }
+
+    while ((voce = readdir(dir)) != NULL) {
+        // Le sottocartelle (comprese quelle di get_sharded_path()) non vanno toccate
+        if (voce->d_type != DT_REG) {
+            if (voce->d_type != DT_UNKNOWN)
+                continue;
+            snprintf(path, PATH_MAX, "%s%s", cartella, voce->d_name);
+            if (lstat(path, &info) == -1 || !S_ISREG(info.st_mode))
+                continue;
+        }
+
+        if (*num == dim) {
+            dim = dim == 0 ? 1024 : 2 * dim;
+            nuovi = realloc(*nomi, dim * sizeof(char*));
+            if (nuovi == NULL)
+                break;
+            *nomi = nuovi;
+        }
+        (*nomi)[*num] = strdup(voce->d_name);
+        if ((*nomi)[*num] == NULL)
+            break;
+        (*num)++;
+    }
+    closedir(dir);
+
+    if (voce != NULL) {
+        perror("Impossibile allocare l'elenco dei file");
+        return -1;
+    }
+    if (*num > 0)
+        qsort(*nomi, *num, sizeof(char*), compare_names);
+    return 0;
+}
+
+/*
+ * Restituisce 1 se i path 'path1' e 'path2' identificano lo stesso file, altrimenti 0
+ */
+static int is_same_file(char* path1, char* path2) {
+    struct stat info1, info2;
+
+    return stat(path1, &info1) == 0 && stat(path2, &info2) == 0 && info1.st_dev == info2.st_dev &&
+           info1.st_ino == info2.st_ino;
+}
+
+/*
+ * Restituisce 1 se 'nome' termina con 'suffisso', altrimenti 0
+ */
+static int has_suffix(char* nome, char* suffisso) {
+    size_t len = strlen(nome), len_suffisso = strlen(suffisso);
+
+    return len >= len_suffisso && strcmp(nome + len - len_suffisso, suffisso) == 0;
+}
+
+/*
+ * Legge il segno di lettura nel file 'path' (0 se non esiste o non è valido)
+ */
+static long read_mark_file(char* path) {
+    long segno = 0;
+    FILE* file = open_file(path, "r");
+
+    if (file == NULL)
+        return 0;
+    if (fscanf(file, "%ld", &segno) != 1 || segno < 0)
+        segno = 0;
+    fclose(file);
+    return segno;
+}
+
+/*
+ * Collega il segno di lettura 'vecchio' al nuovo path 'nuovo'. Se nel nuovo path c'è già un altro segno (scritto dopo
+ * un'altra migrazione) resta il più avanti dei due. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+static int link_read_mark(char* vecchio, char* nuovo) {
+    long segno;
+    FILE* file;
+
+    if (link(vecchio, nuovo) == 0 || is_same_file(vecchio, nuovo))
+        return 0;
+    if (errno != EEXIST) {
+        fprintf(stderr, "Impossibile spostare il segno di lettura '%s' : %s\n", vecchio, strerror(errno));
+        return -1;
+    }
+
+    segno = read_mark_file(vecchio);
+    if (segno <= read_mark_file(nuovo))
+        return 0;
+    file = open_or_create(nuovo, "w");
+    if (file == NULL)
+        return -1;
+    fprintf(file, "%ld\n", segno);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Errore durante la scrittura del file '%s' : %s\n", nuovo, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Sposta nella sua sottocartella il file 'nomi[i]' di 'cartella' (una rubrica o, se 'segni' è 1, il log di una chat
+ * insieme ai suoi segni di lettura, che in 'nomi' lo seguono) tenendolo bloccato, così server e device che lo stanno
+ * usando se ne accorgono (vedi lock_file_in_place()). I segni di lettura vengono collegati al nuovo path prima del log
+ * e cancellati dopo: chi legge un segno trova sempre almeno una copia (vedi get_read_mark()).
+ */
+static void migrate_file(char* cartella, char** nomi, size_t num, size_t i, int segni) {
+    char vecchio[PATH_MAX]; // Path attuale del file
+    char nuovo[PATH_MAX]; // Path del file nella sua sottocartella
+    char vecchio_segno[PATH_MAX];
+    char nuovo_segno[PATH_MAX];
+    char* nome = nomi[i];
+    size_t len = strlen(nome), j;
+    struct stat info;
+    int fd, collega = 1;
+
+    snprintf(vecchio, PATH_MAX, "%s%s", cartella, nome);
+    get_sharded_path(cartella, nome, nuovo);
+
+    fd = open(vecchio, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) { // Altrimenti lo ha appena spostato (o cancellato) qualcun altro
+            fprintf(stderr, "Impossibile aprire il file '%s' : %s\n", vecchio, strerror(errno));
+            num_errori++;
+        }
+        return;
+    }
+
+    if (lock_file_in_place(fd, vecchio) == -1) {
+        if (errno != ESTALE || flock(fd, LOCK_EX) == -1 || access(vecchio, F_OK) == -1) {
+            close(fd); // Spostato nel frattempo (o non bloccabile)
+            return;
+        }
+
+        /*
+         * Il nuovo path esiste già: è lo stesso file (una migrazione interrotta prima di cancellare il vecchio path)
+         * oppure uno creato nel vecchio path dopo lo spostamento da chi non se n'era ancora accorto, che resta vuoto
+         */
+        if (fstat(fd, &info) == -1 || (!is_same_file(vecchio, nuovo) && info.st_size > 0)) {
+            fprintf(stderr, "Il file '%s' esiste anche in '%s': va controllato a mano\n", vecchio, nuovo);
+            num_errori++;
+            close(fd);
+            return;
+        }
+        collega = 0;
+    }
+
+    if (create_parent_directories(nuovo) == -1) {
+        num_errori++;
+        close(fd);
+        return;
+    }
+
+    // I segni di lettura ("<log>_letti_<utente>.txt") seguono il log nell'ordine alfabetico
+    for (j = i + 1; segni && j < num && strncmp(nomi[j], nome, len) == 0; j++) {
+        if (strncmp(nomi[j] + len, "_letti_", strlen("_letti_")) != 0)
+            continue;
+        snprintf(vecchio_segno, PATH_MAX, "%s%s", cartella, nomi[j]);
+        snprintf(nuovo_segno, PATH_MAX, "%s%s", nuovo, nomi[j] + len);
+        if (access(vecchio_segno, F_OK) == 0 && link_read_mark(vecchio_segno, nuovo_segno) == -1) {
+            num_errori++;
+            close(fd);
+            return;
+        }
+    }
+
+    if (collega && link(vecchio, nuovo) == -1) {
+        fprintf(stderr, "Impossibile spostare il file '%s' in '%s' : %s\n", vecchio, nuovo, strerror(errno));
+        num_errori++;
+        close(fd);
+        return;
+    }
+    unlink(vecchio);
+
+    for (j = i + 1; segni && j < num && strncmp(nomi[j], nome, len) == 0; j++) {
+        if (strncmp(nomi[j] + len, "_letti_", strlen("_letti_")) != 0)
+            continue;
+        snprintf(vecchio_segno, PATH_MAX, "%s%s", cartella, nomi[j]);
+        if (unlink(vecchio_segno) == 0)
+            num_segni++;
+    }
+    close(fd); // Sblocca il file
+
+    if (segni)
+        num_log++;
+    else
+        num_rubriche++;
+    if (verboso)
+        printf("'%s' -> '%s'\n", vecchio, nuovo);
+}
+
+/*
+ * Sposta nella sottocartella del suo log il segno di lettura 'nome' rimasto senza log direttamente in CHAT_LOG_FOLDER
+ * (ad esempio per una migrazione interrotta dopo aver spostato il log)
+ */
+static void migrate_orphan_read_mark(char* nome) {
+    char log[PATH_MAX]; // Nome del log del segno
+    char vecchio[PATH_MAX];
+    char nuovo[PATH_MAX];
+    char* fine = strstr(nome, ".log_letti_") + strlen(".log");
+
+    snprintf(log, PATH_MAX, "%.*s", (int) (fine - nome), nome);
+    strcpy(vecchio, CHAT_LOG_FOLDER);
+    strcat(vecchio, log);
+    if (access(vecchio, F_OK) == 0)
+        return; // Il log è comparso nel frattempo: il segno verrà spostato con lui alla prossima esecuzione
+
+    snprintf(vecchio, PATH_MAX, "%s%s", CHAT_LOG_FOLDER, nome);
+    get_sharded_path(CHAT_LOG_FOLDER, log, nuovo);
+    strcat(nuovo, fine);
+    if (create_parent_directories(nuovo) == -1 || link_read_mark(vecchio, nuovo) == -1) {
+        num_errori++;
+        return;
+    }
+    if (unlink(vecchio) == 0)
+        num_segni++;
+    if (verboso)
+        printf("'%s' -> '%s'\n", vecchio, nuovo);
+}
+
+/*
+ * Converte il log testuale 'nome' (scritto dalle versioni precedenti) nel log binario, che viene creato direttamente
+ * nella sua sottocartella. I due utenti si ricavano dal nome ("utente1-utente2.txt") e dal mittente del primo messaggio.
+ */
+static void convert_text_log(char* nome) {
+    char path[PATH_MAX];
+    char utente[PATH_MAX]; // Mittente del primo messaggio
+    char altro[PATH_MAX]; // L'altro utente della chat
+    char* linea = NULL;
+    size_t dim_linea = 0, len_nome = strlen(nome) - strlen(".txt"), len;
+    char* separatore;
+    FILE* testo;
+
+    snprintf(path, PATH_MAX, "%s%s", CHAT_LOG_FOLDER, nome);
+    testo = open_file(path, "r");
+    if (testo == NULL)
+        return;
+    if (getline(&linea, &dim_linea, testo) == -1 || (separatore = strstr(linea, ": ")) == NULL) {
+        free(linea);
+        fclose(testo);
+        return; // Log vuoto: non si sa di chi è, resta dov'è
+    }
+    fclose(testo);
+    *separatore = '\0';
+    snprintf(utente, PATH_MAX, "%s", linea);
+    free(linea);
+
+    len = strlen(utente);
+    if (len < len_nome && strncmp(nome, utente, len) == 0 && nome[len] == '-')
+        snprintf(altro, PATH_MAX, "%.*s", (int) (len_nome - len - 1), nome + len + 1);
+    else if (len < len_nome && strncmp(nome + len_nome - len, utente, len) == 0 && nome[len_nome - len - 1] == '-')
+        snprintf(altro, PATH_MAX, "%.*s", (int) (len_nome - len - 1), nome);
+    else
+        return; // Il mittente non è uno dei due utenti del nome
+
+    prepare_chat_log(utente, altro, path);
+    snprintf(utente, PATH_MAX, "%s%s", CHAT_LOG_FOLDER, nome);
+    if (access(utente, F_OK) == -1) {
+        num_testuali++;
+        if (verboso)
+            printf("'%s' -> '%s'\n", utente, path);
+    }
+}
+
+/*
+ * Sposta nelle sottocartelle di get_sharded_path() le rubriche e i log delle chat lasciati direttamente nella loro
+ * cartella dalle versioni precedenti. Si può eseguire mentre server e device sono in esecuzione, e di nuovo
+ * se si interrompe. Va eseguito dalla stessa cartella del server (o del device) di cui si vogliono spostare i file.
+ *
+ * Utilizzo: ./migra [-v]
+ *  -v: stampa ogni file spostato
+ */
+int main(int argc, char* argv[]) {
+    char** nomi;
+    size_t num, i;
+    char* chiave;
+    char log[PATH_MAX]; // Nome del log di un segno di lettura
+    int opzione;
+
+    while ((opzione = getopt(argc, argv, "v")) != -1) {
+        if (opzione != 'v') {
+            fprintf(stderr, "Utilizzo: %s [-v]\n", argv[0]);
+            return 1;
+        }
+        verboso = 1;
+    }
+
+    // Log delle chat con i loro segni di lettura
+    if (list_files(CHAT_LOG_FOLDER, &nomi, &num) == -1)
+        return 1;
+    for (i = 0; i < num; i++) {
+        if (has_suffix(nomi[i], ".tmp") || strstr(nomi[i], ".txt_letti_") != NULL)
+            continue; // Log in costruzione o segni di lettura dei log testuali (li gestisce la conversione)
+
+        if (strstr(nomi[i], ".log_letti_") != NULL) {
+            // Il segno si sposta con il suo log, se c'è
+            snprintf(log, PATH_MAX, "%.*s", (int) (strstr(nomi[i], ".log_letti_") + strlen(".log") - nomi[i]),
+                     nomi[i]);
+            chiave = log;
+            if (bsearch(&chiave, nomi, num, sizeof(char*), compare_names) == NULL)
+                migrate_orphan_read_mark(nomi[i]);
+        } else if (has_suffix(nomi[i], ".log")) {
+            migrate_file(CHAT_LOG_FOLDER, nomi, num, i, 1);
+        } else if (has_suffix(nomi[i], ".txt")) {
+            convert_text_log(nomi[i]);
+        }
+    }
+    for (i = 0; i < num; i++)
+        free(nomi[i]);
+    free(nomi);
+
+    // Rubriche
+    if (list_files(CONTACT_LIST_FOLDER, &nomi, &num) == -1)
+        return 1;
+    for (i = 0; i < num; i++)
+        if (has_suffix(nomi[i], ".txt"))
+            migrate_file(CONTACT_LIST_FOLDER, nomi, num, i, 0);
+    for (i = 0; i < num; i++)
+        free(nomi[i]);
+    free(nomi);
+
+    printf("Spostati %d log, %d segni di lettura e %d rubriche; convertiti %d log testuali; %d errori.\n", num_log,
+           num_segni, num_rubriche, num_testuali, num_errori);
+    return num_errori > 0 ? 1 : 0;
+}
@@ -15,71 +15,476 @@
 #include <netinet/in.h>
 #include <errno.h>
 #include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/stat.h>
 #include "struct/registro.h"
+#include "struct/connessione.h"
+#include "struct/show_pendenti.h"
+#include "struct/sequenze.h"
 #include "costanti.h"
 #include "util/messaggi.h"
 #include "util/string.h"
 #include "util/time.h"
 #include "util/file.h"
+#include "util/reactor.h"
+#include "util/protocollo.h"
+#include "util/tabella_hash.h"
+#include "util/commit.h"
+#include "util/log_attivita.h"
+#include "util/journal.h"
+#include "util/snapshot.h"
+#include "archivio/archivio.h"
 
-int server_socket, new_sd, len;
-struct sockaddr_in server_addr, client_addr;
-fd_set master;
-struct record_registro* registro; // Registro del login/logout degli utenti
+/*
+ * Thread che esegue un event loop. Ogni worker ha il proprio socket di ascolto, aperto con SO_REUSEPORT
+ * sulla stessa porta degli altri (è il kernel a distribuire le nuove connessioni tra i worker), e gestisce
+ * da solo i client che accetta.
+ */
+struct worker {
+    int id; // Indice del worker (il worker 0 gira nel thread principale e gestisce anche lo stdin)
+    pthread_t thread; // Thread che esegue l'event loop
+    int listen_socket; // Socket di ascolto del worker
+    struct reactor reactor; // Event loop che monitora il socket di ascolto e i socket dei client del worker
+};
+
+struct worker* workers; // Elenco dei worker
+int num_workers = 1; // Numero di worker (thread) avviati
+__thread struct worker* worker_corrente; // Worker eseguito dal thread corrente
+__thread struct connessione* connessione_corrente; // Connessione di cui il thread corrente sta elaborando le richieste
+
+struct connessione** connessioni; // Connessioni aperte, indicizzate per socket
+int max_connessioni; // Dimensione della tabella delle connessioni (limite dei descrittori aperti)
+
+struct registro registro; // Registro del login/logout degli utenti
+
+/*
+ * Archivio in cui il server conserva utenti, messaggi per gli utenti offline e segni di lettura (vedi
+ * archivio/archivio.h). Il motore si sceglie all'avvio con l'opzione -s.
+ */
+struct archivio* archivio = &archivio_file;
+
+/*
+ * Indice delle credenziali: gli utenti registrati vengono letti dall'archivio una sola volta all'avvio (vedi
+ * load_users()) e da quel momento registrazioni e login vengono verificati in memoria. Le nuove registrazioni
+ * vengono aggiunte all'archivio. Entrambi sono protetti da 'users_lock'.
+ */
+struct tabella_hash credenziali; // Password degli utenti registrati, indicizzate per username
+
+/*
+ * Notifiche di show non recapitate perché il mittente dei messaggi era offline (vedi struct show_pendenti),
+ * indicizzate per username del mittente. Protette da 'show_log_lock'.
+ */
+struct tabella_hash notifiche_show;
+
+/*
+ * Generazione di SHOW_LOG_FILE: ogni volta che il file viene ricreato (vuoto o compattato) la sua prima riga è
+ * "@generazione", con una generazione nuova. Uno snapshot registra la generazione e la lunghezza del file di cui
+ * contiene le notifiche: all'avvio, se il file è ancora quello, se ne rilegge solo il seguito. Protetta da 'show_log_lock'.
+ */
+unsigned long generazione_show = 0;
+
+/*
+ * Ultimi messaggi OP_CHAT_MESSAGE registrati da ogni mittente (vedi struct sequenze_mittente), indicizzati per
+ * username. Non dipendono dalla connessione: un device che si riconnette e ritrasmette i messaggi non confermati
+ * non li fa registrare due volte. Protetti da 'sequenze_lock'.
+ */
+struct tabella_hash sequenze;
+
+/*
+ * Lock sullo stato condiviso tra i worker. Se servono più lock contemporaneamente vanno presi
+ * nell'ordine in cui sono dichiarati qui, seguiti eventualmente da quelli dell'archivio (presi dalle sue
+ * operazioni) e dal lock di una connessione.
+ */
+pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER; // Snapshot dello stato del server (vedi save_snapshot())
+pthread_mutex_t users_lock = PTHREAD_MUTEX_INITIALIZER; // Indice delle credenziali
+pthread_mutex_t registro_lock = PTHREAD_MUTEX_INITIALIZER; // Registro del server
+pthread_mutex_t show_log_lock = PTHREAD_MUTEX_INITIALIZER; // Notifiche di show pendenti
+pthread_mutex_t sequenze_lock = PTHREAD_MUTEX_INITIALIZER; // Ultimi messaggi registrati dai mittenti
+
+/*
+ * Crea la struttura associata alla connessione sul socket specificato e la restituisce.
+ * Restituisce NULL in caso di errore.
+ */
+struct connessione* new_connection(int socket) {
+    struct connessione* connessione;
+
+    if (socket >= max_connessioni) {
+        fprintf(stderr, "Impossibile gestire il socket %d: limite di %d connessioni raggiunto.\n", socket,
+                max_connessioni);
+        return NULL;
+    }
+
+    connessione = malloc(sizeof(struct connessione));
+    if (connessione == NULL) {
+        perror("Impossibile allocare una nuova connessione");
+        return NULL;
+    }
+    connessione->socket = socket;
+    connessione->worker = worker_corrente->id;
+    pthread_mutex_init(&connessione->lock, NULL);
+    connessione->sessione = SESSIONE_ANONIMA;
+    connessione->username[0] = '\0';
+    connessione->versione = PROTOCOL_LEGACY; // Finché il device non invia OP_HELLO
+    connessione->codec = CODEC_NONE; // Finché il device non invia OP_FEATURES
+    connessione->max_frame = get_max_frame_len(); // Finché il device non invia OP_CAPABILITIES
+    connessione->conferma_destinatario[0] = '\0';
+    connessione->epoca = 0; // Finché il device non invia OP_SESSION
+    if (init_receive_buffer(&connessione->ricezione) == -1) {
+        pthread_mutex_destroy(&connessione->lock);
+        free(connessione);
+        return NULL;
+    }
+    connessione->richiesta.stato = RICHIESTA_COMANDO; // In attesa del primo comando
+    connessione->richiesta.comando = -1;
+    connessione->richiesta.id = 0;
+    connessione->richiesta.ricevuti = 0;
+    connessione->richiesta.spazio = NULL;
+    connessione->richiesta.capacita = 0;
+    connessione->espanso = NULL;
+    connessione->capacita_espanso = 0;
+    init_send_queue(&connessione->uscita);
+    connessione->eventi = REACTOR_READ | REACTOR_EDGE;
+    connessione->sospesa = 0;
+
+    connessioni[socket] = connessione;
+    return connessione;
+}
+
+/*
+ * Restituisce la connessione associata al socket specificato, o NULL se non esiste
+ */
+struct connessione* get_connection(int socket) {
+    if (socket < 0 || socket >= max_connessioni)
+        return NULL;
+
+    return connessioni[socket];
+}
+
+/*
+ * Libera la struttura associata alla connessione sul socket specificato
+ */
+void free_connection(int socket) {
+    struct connessione* connessione = get_connection(socket);
+
+    if (connessione == NULL)
+        return;
+
+    connessioni[socket] = NULL;
+    pthread_mutex_destroy(&connessione->lock);
+    free_send_queue(&connessione->uscita);
+    free_receive_buffer(&connessione->ricezione);
+    free(connessione->richiesta.spazio);
+    free(connessione->espanso);
+    free(connessione);
+}
+
+/*
+ * Chiude la sessione della connessione specificata, anche se è gestita da un altro worker: la connessione non esegue
+ * più comandi e viene chiusa dal suo worker, che si accorge della chiusura grazie a shutdown().
+ * NB: se la connessione non è del worker corrente, il chiamante deve possedere 'registro_lock' (il worker della
+ * connessione lo prende prima di liberarla).
+ */
+void close_session(struct connessione* connessione) {
+    // La sessione potrebbe essere già stata chiusa (logout o chiusura precedente)
+    if (__atomic_exchange_n(&connessione->sessione, SESSIONE_CHIUSA, __ATOMIC_RELAXED) == SESSIONE_CHIUSA)
+        return;
+
+    if (shutdown(connessione->socket, SHUT_RDWR) == -1)
+        perror("Impossibile chiudere la connessione di un client");
+}
+
+/*
+ * Restituisce l'username dell'utente che ha eseguito il login sulla connessione del socket specificato.
+ * Va invocata dal worker che gestisce la connessione, solo per le sessioni autenticate.
+ */
+char* session_username(int socket) {
+    return get_connection(socket)->username;
+}
+
+/*
+ * Aggiorna gli eventi monitorati sul socket della connessione: la lettura se il client non è sospeso,
+ * la scrittura se ci sono byte in coda o se il client è sospeso (così il worker che lo gestisce viene
+ * svegliato quando può riprendere a leggere). Si usa il reactor del worker proprietario, anche se
+ * il chiamante è un altro worker.
+ * NB: il chiamante deve possedere il lock della connessione.
+ */
+void update_events(struct connessione* connessione) {
+    uint32_t eventi = REACTOR_EDGE;
+
+    if (!connessione->sospesa)
+        eventi |= REACTOR_READ;
+    if (connessione->uscita.in_coda > 0 || connessione->sospesa)
+        eventi |= REACTOR_WRITE;
+
+    if (eventi == connessione->eventi)
+        return;
+
+    if (reactor_modify(&workers[connessione->worker].reactor, connessione->socket, eventi) == -1)
+        perror("Impossibile aggiornare gli eventi monitorati sul socket di un client");
+    else
+        connessione->eventi = eventi;
+}
+
+/*
+ * Invia, senza bloccarsi, i frame nella coda di invio della connessione. Quelli che il socket non
+ * accetta subito verranno inviati quando il socket tornerà pronto in scrittura.
+ * Restituisce il numero di byte rimasti in coda o un valore negativo in caso di errore.
+ * NB: il chiamante deve possedere il lock della connessione.
+ */
+int flush_connection(struct connessione* connessione) {
+    int ret;
+
+    ret = flush_send_queue(connessione->socket, &connessione->uscita);
+    update_events(connessione);
+
+    return ret;
+}
+
+/*
+ * Acquisisce il lock sugli invii del socket specificato, così che più campi possano essere
+ * accodati uno dopo l'altro senza che altri worker si inseriscano nel mezzo
+ */
+void lock_connection(int socket) {
+    struct connessione* connessione = get_connection(socket);
+    if (connessione != NULL)
+        pthread_mutex_lock(&connessione->lock);
+}
+
+/*
+ * Rilascia il lock sugli invii del socket specificato. Le risposte al client di cui si stanno elaborando
+ * le richieste vengono inviate tutte insieme al termine dell'elaborazione (vedi client_input()), mentre
+ * i frame accodati per gli altri client (per esempio le notifiche) vengono inviati subito.
+ */
+void unlock_connection(int socket) {
+    struct connessione* connessione = get_connection(socket);
+    if (connessione == NULL)
+        return;
+
+    if (connessione != connessione_corrente)
+        flush_connection(connessione);
+    pthread_mutex_unlock(&connessione->lock);
+}
+
+/*
+ * Invia al client connesso sul socket specificato il messaggio con l'opcode e i campi indicati, codificato
+ * con la versione del protocollo negoziata con il device. Il messaggio viene accodato per intero con il lock
+ * della connessione, quindi non si mescola con gli invii degli altri worker.
+ * Le risposte portano l'identificativo della richiesta in corso sulla connessione, le notifiche (inviate
+ * anche a connessioni gestite da altri worker) l'identificativo 0. Se il device ha negoziato un codec
+ * (OP_FEATURES), i messaggi più lunghi della soglia di compressione vengono inviati compressi.
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int reply_message(int socket, int opcode, ...) {
+    struct connessione* connessione = get_connection(socket);
+    char locale[MESSAGE_BUFFER_LEN];
+    char* buffer;
+    va_list campi;
+    uint32_t id, corpo;
+    int len;
+
+    if (connessione == NULL)
+        return -1;
+
+    id = is_notification(opcode) ? 0 : connessione->richiesta.id;
+    va_start(campi, opcode);
+    len = encode_message(locale, &buffer, connessione->versione, id, opcode, campi);
+    va_end(campi);
+    if (len < 0)
+        return len;
+
+    // Il device scarterebbe un frame più lungo di quanto ha annunciato con OP_CAPABILITIES
+    if (connessione->versione >= PROTOCOL_VARINT && decode_varint(buffer, len, &corpo) > 0 &&
+        corpo > (uint32_t) connessione->max_frame) {
+        fprintf(stderr, "Impossibile inviare al device sul socket %d il messaggio con opcode %d: frame più lungo "
+                "di %d byte.\n", socket, opcode, connessione->max_frame);
+        free_message_buffer(locale, buffer);
+        return -1;
+    }
+
+    len = compress_message(locale, &buffer, len, connessione->versione, connessione->codec);
+    if (len >= 0) {
+        lock_connection(socket);
+        if (connessione->uscita.in_coda > 0 && connessione->uscita.in_coda + len > SEND_QUEUE_MAX) {
+            // Il client non legge ciò che gli viene inviato: invece di accodare senza limiti si chiude la connessione
+            fprintf(stderr, "Il client sul socket %d ha %d byte in attesa di essere inviati: la connessione viene "
+                    "chiusa.\n", socket, connessione->uscita.in_coda);
+            close_session(connessione);
+            len = -1;
+        } else {
+            len = queue_bytes(&connessione->uscita, buffer, len);
+        }
+        unlock_connection(socket);
+    }
+    free_message_buffer(locale, buffer);
+
+    return len;
+}
+
+/*
+ * Inizializza il registro vuoto per al massimo 'max_socket' socket.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_register(int max_socket) {
+    if (init_hash_table(&registro.utenti, 0) == -1)
+        return -1;
+
+    registro.per_socket = calloc(max_socket, sizeof(struct record_registro*));
+    if (registro.per_socket == NULL) {
+        perror("Impossibile allocare il registro del server");
+        return -1;
+    }
+    registro.max_socket = max_socket;
+    registro.primo = registro.ultimo = NULL;
+    registro.online = registro.ultimo_online = NULL;
+
+    return 0;
+}
 
 /*
  * Verifica se l'utente specificato è nel registro. Se è presente viene restituito
  * il record corrispondente nel registro, altrimenti 0.
+ * NB: il chiamante deve possedere 'registro_lock'.
  */
 struct record_registro* find_user_in_register(char* username) {
+    return find_in_hash_table(&registro.utenti, username);
+}
+
+/*
+ * Segna come online l'utente del record specificato, connesso su 'socket'.
+ * Se l'utente era già online su un'altra connessione, quella sessione viene chiusa.
+ * NB: il chiamante deve possedere 'registro_lock'.
+ */
+void set_user_online(struct record_registro* record, int socket) {
+    // Un utente che rifà il login da un altro device non è più raggiungibile dal vecchio socket, né può più usarlo
+    if (record->logout_timestamp == 0 && record->socket != INVALID_SOCKET && record->socket != socket &&
+        registro.per_socket[record->socket] == record) {
+        registro.per_socket[record->socket] = NULL;
+        if (get_connection(record->socket) != NULL)
+            close_session(get_connection(record->socket));
+
+        #ifdef DEBUG
+        printf("L'utente '%s' ha rifatto il login: la sessione sul socket %d viene chiusa.\n", record->username,
+               record->socket);
+        #endif
+    }
+
+    // Lo inserisco in fondo all'elenco degli utenti online (se non c'è già)
+    if (record->logout_timestamp != 0) {
+        record->prev_online = registro.ultimo_online;
+        record->next_online = NULL;
+        if (registro.ultimo_online != NULL)
+            registro.ultimo_online->next_online = record;
+        else
+            registro.online = record;
+        registro.ultimo_online = record;
+    }
+
+    record->socket = socket;
+    record->login_timestamp = time(NULL); // Timestamp corrente
+    record->logout_timestamp = 0; // Utente online
+    registro.per_socket[socket] = record;
+}
+
+/*
+ * Segna come offline l'utente del record specificato.
+ * NB: il chiamante deve possedere 'registro_lock'.
+ */
+void set_user_offline(struct record_registro* record) {
+    if (record->logout_timestamp != 0)
+        return; // Già offline
+
+    // Lo tolgo dall'elenco degli utenti online
+    if (record->prev_online != NULL)
+        record->prev_online->next_online = record->next_online;
+    else
+        registro.online = record->next_online;
+    if (record->next_online != NULL)
+        record->next_online->prev_online = record->prev_online;
+    else
+        registro.ultimo_online = record->prev_online;
+
+    if (record->socket != INVALID_SOCKET && registro.per_socket[record->socket] == record)
+        registro.per_socket[record->socket] = NULL;
+    record->logout_timestamp = time(NULL); // Timestamp corrente
+    record->socket = INVALID_SOCKET; // Socket inesistente
+}
+
+/*
+ * Inserisce nel registro del server, offline, un utente ripristinato dallo snapshot con la porta, la versione del
+ * protocollo e i timestamp di login e logout specificati.
+ * NB: il chiamante deve possedere 'registro_lock'.
+ */
+void restore_register_entry(const char* username, int client_port, int versione, time_t login, time_t logout) {
     struct record_registro* record;
 
-    // Controllo se ci sono utenti registrati
-    if (!registro)
-        return 0;
+    record = malloc(sizeof(struct record_registro));
+    if (record == NULL) {
+        perror("Impossibile allocare un record del registro");
+        return;
+    }
+    snprintf(record->username, USERNAME_LEN, "%s", username);
+    if (insert_into_hash_table(&registro.utenti, record->username, record) == -1) {
+        free(record);
+        return;
+    }
+    record->port = client_port;
+    record->versione = versione;
+    record->socket = INVALID_SOCKET;
+    record->login_timestamp = login;
+    record->logout_timestamp = logout;
+    record->prev_online = record->next_online = NULL;
+
+    // Lo inserisco in coda alla lista
+    record->next = NULL;
+    if (registro.ultimo != NULL)
+        registro.ultimo->next = record;
+    else
+        registro.primo = record;
+    registro.ultimo = record;
+}
 
-    // Scorro il registro del server
-    for (record = registro; record != NULL; record = record->next)
-        if (strcmp(record->username, username) == 0)
-            return record;
+/*
+ * Copia in 'copia' il record del registro relativo all'utente specificato.
+ * Restituisce 1 se l'utente è presente nel registro, altrimenti 0.
+ */
+int get_register_entry(char* username, struct record_registro* copia) {
+    struct record_registro* record;
 
-    return 0;
+    pthread_mutex_lock(&registro_lock);
+    record = find_user_in_register(username);
+    if (record != 0)
+        *copia = *record;
+    pthread_mutex_unlock(&registro_lock);
+
+    return record != 0;
 }
 
 /*
  * Controlla se l'utente specificato è online. Se lo è restituisce 1, altrimenti 0.
  */
 int is_user_online(char* user) {
+    struct record_registro record;
 
     // Cerco l'utente nel registro
-    struct record_registro* record = find_user_in_register(user);
-    if (record == 0)
+    if (get_register_entry(user, &record) == 0)
         return 0;
 
     // L'utente è online se il timestamp di logout è 0
-    return record->logout_timestamp == 0 ? 1 : 0;
+    return record.logout_timestamp == 0 ? 1 : 0;
 }
 
 /*
- * Registra sul file di log il login/logout ('operazione') dell'utente
+ * Registra sul file di log il login/logout ('operazione') dell'utente.
+ * La scrittura è asincrona: l'attività viene solo accodata e la scrive il thread del log.
  */
 void log_user_activity(char* username, char* operazione) {
-    char timestamp[TIMESTAMP_LEN];
-    FILE* log;
-
-    // Apro il file in append
-    log = open_or_create(ACTIVITY_LOG_FILE, "a");
-    if (log == NULL)
-        return; // Impossibile accedere al file
-
-    // Registro l'attività dell'utente al timestamp corrente
-    format_timestamp(time(NULL), timestamp, sizeof(timestamp));
-    fprintf(log, "[%s] %s di %s\n", timestamp, operazione, username);
-    if (fclose(log) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file di log '%s' : %s\n", ACTIVITY_LOG_FILE, strerror(errno));
+    log_activity(username, operazione);
 
     #ifdef DEBUG
-    printf("[%s] Login di '%s' registrato sul file '%s'.\n", timestamp, username, ACTIVITY_LOG_FILE);
+    printf("%s di '%s' accodato per il file '%s'.\n", operazione, username, ACTIVITY_LOG_FILE);
     #endif
 }
 
@@ -88,22 +493,16 @@ void log_user_activity(char* username, char* operazione) {
  * Se non lo trova si pone solo il terminatore di stringa (\0).
  */
 void find_username_from_socket(int socket, char* username) {
-    struct record_registro* appoggio;
-
-    // Controllo se ci sono utenti registrati
-    if (!registro) {
-        username[0] = '\0';
-        return;
-    }
+    struct record_registro* record;
 
-    // Scorro il registro del server
-    for (appoggio = registro; appoggio != NULL; appoggio = appoggio->next) {
-        if (appoggio->socket == socket) {
-            strcpy(username, appoggio->username);
-            return;
-        }
-    }
     username[0] = '\0';
+    pthread_mutex_lock(&registro_lock);
+
+    record = (socket >= 0 && socket < registro.max_socket) ? registro.per_socket[socket] : NULL;
+    if (record != NULL)
+        strcpy(username, record->username);
+
+    pthread_mutex_unlock(&registro_lock);
 }
 
 /*
@@ -111,8 +510,23 @@ void find_username_from_socket(int socket, char* username) {
  * Se lo trova restituisce il socket, altrimenti -1.
  */
 int find_socket_from_username(char* username) {
-    struct record_registro* record = find_user_in_register(username); // Cerco l'username nel registro
-    return record == 0 ? -1 : record->socket;
+    struct record_registro record;
+
+    // Cerco l'username nel registro
+    return get_register_entry(username, &record) == 0 ? -1 : record.socket;
+}
+
+/*
+ * Invia al device sul socket specificato la porta di ascolto del peer descritto da 'peer' (una copia del suo
+ * record nel registro). Da PROTOCOL_HANDSHAKE si invia OP_PEER_PORT, con anche la versione del protocollo del
+ * peer; altrimenti il messaggio con l'opcode indicato (OP_USER_PORT o OP_MEMBER_PORT).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int reply_peer_port(int socket, int opcode, struct record_registro* peer) {
+    if (get_connection(socket)->versione >= PROTOCOL_HANDSHAKE)
+        return reply_message(socket, OP_PEER_PORT, peer->port, peer->port == INVALID_SOCKET ? 0 : peer->versione);
+
+    return reply_message(socket, opcode, peer->port);
 }
 
 /*
@@ -122,15 +536,18 @@ void print_register(void) {
     char timestamp[TIMESTAMP_LEN];
     struct record_registro* appoggio;
 
+    pthread_mutex_lock(&registro_lock);
+
     // Controllo se ci sono utenti registrati
-    if (!registro) {
+    if (registro.primo == NULL) {
+        pthread_mutex_unlock(&registro_lock);
         printf("Nessun utente si è ancora collegato al server :(\n");
         return;
     }
 
     printf("**********************************\n");
     printf("Registro:\n");
-    for (appoggio = registro; appoggio != NULL; appoggio = appoggio->next) { // Scorro il registro del server
+    for (appoggio = registro.primo; appoggio != NULL; appoggio = appoggio->next) { // Scorro il registro del server
         printf("-- Username: %s\n", appoggio->username);
         printf("Socket: %d\n", appoggio->socket);
 
@@ -142,19 +559,22 @@ void print_register(void) {
         printf("Logout: %s\n", appoggio->logout_timestamp != 0 ? timestamp : "NULL");
     }
     printf("**********************************\n");
+
+    pthread_mutex_unlock(&registro_lock);
 }
 
 /*
  * Aggiorna il timestamp di logout dell'utente al timestamp corrente
  */
 void update_logout_timestamp(char* username) {
+    struct record_registro* record;
 
     // Cerco l'username nel registro
-    struct record_registro* record = find_user_in_register(username);
-    if (record != 0) {
-        record->logout_timestamp = time(NULL); // Timestamp corrente
-        record->socket = INVALID_SOCKET; // Socket inesistente
-    }
+    pthread_mutex_lock(&registro_lock);
+    record = find_user_in_register(username);
+    if (record != 0)
+        set_user_offline(record);
+    pthread_mutex_unlock(&registro_lock);
 
     #ifdef DEBUG
     print_register(); // Stampa il registro del server
@@ -163,18 +583,26 @@ void update_logout_timestamp(char* username) {
 
 /*
  * Chiude il socket di un client che si è disconnesso (recv ha restituito 0)
- * e imposta il timestamp di logout (pari al timestamp corrente)
+ * e imposta il timestamp di logout (pari al timestamp corrente).
+ * Deve essere invocata dal worker che gestisce la connessione.
  */
 void client_disconnection(int socket) {
     char username[USERNAME_LEN];
 
+    /*
+     * Aggiorno il timestamp di logout prima di chiudere il socket: gli altri worker inviano
+     * notifiche solo agli utenti online nel registro (consultandolo con 'registro_lock'),
+     * quindi da qui in poi nessuno userà più la connessione.
+     */
+    find_username_from_socket(socket, username);
+    if (username[0] != '\0')
+        update_logout_timestamp(username);
+
+    reactor_remove(&worker_corrente->reactor, socket);
+    free_connection(socket);
     close(socket);
-    FD_CLR(socket, &master);
 
-    // Aggiorno il timestamp di logout
-    find_username_from_socket(socket, username);
     if (username[0] != '\0') {
-        update_logout_timestamp(username);
         log_user_activity(username, "LOGOUT");
 
         #ifdef DEBUG
@@ -194,7 +622,8 @@ void print_auth_commands(void) {
     printf("--------- COMANDI DISPONIBILI ---------\n");
     printf("1) help -> mostra i dettagli dei comandi\n");
     printf("2) list -> mostra un elenco degli utenti connessi\n");
-    printf("3) esc -> chiude il server\n");
+    printf("3) stats -> mostra le statistiche della compressione, dei commit su disco, del journal e del log delle attività\n");
+    printf("4) esc -> chiude il server\n");
 }
 
 /*
@@ -205,7 +634,8 @@ void help(void) {
     printf("GUIDA SUI COMANDI:\n");
     printf("1) help -> Mostra questo menù\n");
     printf("2) list -> Mostra l’elenco degli utenti connessi, indicando username, timestamp di connessione e numero di porta nel formato \"username*timestamp*porta\"\n");
-    printf("3) esc -> Termina il server. La terminazione del server non impedisce alle chat in corso di proseguire. Se il server è disconnesso, nessun utente può più fare login. Gli utenti che si disconnettono in seguito a ciò salvano l'istante di disconnessione, per poi mandarlo al server quando entrambe le parti tornano online\n");
+    printf("3) stats -> Mostra quanti frame sono stati compressi, il rapporto di compressione e il tempo di CPU speso a comprimere e decomprimere; inoltre mostra quanti commit su disco sono stati eseguiti, quante scritture contengono in media e quanto durano, quanti record sono stati scritti nel journal e quanti checkpoint eseguiti, e quante voci del log delle attività vengono scritte insieme\n");
+    printf("4) esc -> Termina il server. La terminazione del server non impedisce alle chat in corso di proseguire. Se il server è disconnesso, nessun utente può più fare login. Gli utenti che si disconnettono in seguito a ciò salvano l'istante di disconnessione, per poi mandarlo al server quando entrambe le parti tornano online\n");
     printf("**********************************\n");
 }
 
@@ -216,8 +646,11 @@ void list(void) {
     char timestamp[TIMESTAMP_LEN]; // Contiene il timestamp formattato
     struct record_registro* record;
 
+    pthread_mutex_lock(&registro_lock);
+
     // Controllo se ci sono utenti registrati
-    if (!registro) {
+    if (registro.primo == NULL) {
+        pthread_mutex_unlock(&registro_lock);
         printf("Nessun utente si è ancora collegato al server :(\n");
         return;
     }
@@ -225,11 +658,8 @@ void list(void) {
     printf("**********************************\n");
     printf("Elenco di utenti online (username*timestamp di login*porta):\n");
 
-    // Scorro il registro del server
-    for (record = registro; record != NULL; record = record->next) {
-        if (record->logout_timestamp != 0) // L'utente è online se logout == 0
-            continue;
-
+    // Scorro solo gli utenti online
+    for (record = registro.online; record != NULL; record = record->next_online) {
         /*
          * Converte il timestamp nel formato "giorno-mese-anno"
          * Fonte: https://stackoverflow.com/a/3673291
@@ -239,190 +669,354 @@ void list(void) {
         printf("%s*%s*%d\n", record->username, timestamp, record->port);
     }
     printf("**********************************\n");
+
+    pthread_mutex_unlock(&registro_lock);
 }
 
 /*
- * Comando 'esc': termina il server
+ * Scrive nello snapshot ('contesto') le credenziali dell'utente 'chiave'
  */
-void esc(void) {
-    printf("Chiusura del server in corso...\n");
-    sleep(3);
-    close(server_socket);
-    exit(0);
+void write_user_snapshot(const char* chiave, void* valore, void* contesto) {
+    write_snapshot_string(contesto, chiave);
+    write_snapshot_string(contesto, valore);
 }
 
 /*
- * Aspetto le credenziali (username e password) e la porta dal client (sul socket specificato).
- * Una volta ricevute vengono messe in 'username', 'password' e 'porta'.
+ * Scrive nello snapshot ('contesto') le notifiche di show pendenti del mittente 'chiave'
  */
-void credential_reception(int socket, char* username, char* password, int* porta) {
+void write_show_snapshot(const char* chiave, void* valore, void* contesto) {
+    struct show_pendenti* pendenti = valore;
+    struct show_pendente* record;
+    uint32_t num_destinatari = 0;
+
+    for (record = pendenti->primo; record != NULL; record = record->next)
+        num_destinatari++;
+
+    write_snapshot_string(contesto, chiave);
+    write_snapshot_u32(contesto, num_destinatari);
+    for (record = pendenti->primo; record != NULL; record = record->next) {
+        write_snapshot_string(contesto, record->destinatario);
+        write_snapshot_u32(contesto, record->numero);
+    }
+}
+
+/*
+ * Scrive lo snapshot dello stato del server (vedi util/snapshot.h): il motore dell'archivio, il registro, le notifiche
+ * di show pendenti (con la generazione e la lunghezza di SHOW_LOG_FILE da cui provengono) e le credenziali, seguite
+ * dalle sezioni dell'archivio, che rende lo snapshot definitivo. Ogni sezione del server si scrive sotto il proprio
+ * lock; l'archivio fotografa il suo stato mentre le credenziali sono ancora bloccate, così non registra utenti che non
+ * sono nello snapshot, e lo scrive e sincronizza senza lock. Il registro precede le credenziali: chi vi compare
+ * si è registrato prima.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'snapshot_lock'.
+ */
+int save_snapshot(void) {
+    struct scrittura_snapshot snapshot;
+    struct record_registro* record;
+    struct stat info;
     int ret;
 
-    // Ricevo l'username
-    ret = receive_string(socket, username);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
+    if (archivio->snapshot == NULL)
+        return 0; // Il motore non usa gli snapshot
+    if (begin_snapshot(&snapshot, SNAPSHOT_FILE) == -1)
+        return -1;
+
+    begin_snapshot_section(&snapshot, SNAPSHOT_SERVER);
+    write_snapshot_string(&snapshot, archivio->nome);
+
+    pthread_mutex_lock(&registro_lock);
+    begin_snapshot_section(&snapshot, SNAPSHOT_REGISTER);
+    write_snapshot_u32(&snapshot, registro.utenti.num_elementi);
+    for (record = registro.primo; record != NULL; record = record->next) {
+        write_snapshot_string(&snapshot, record->username);
+        write_snapshot_u32(&snapshot, record->port);
+        write_snapshot_u32(&snapshot, record->versione);
+        write_snapshot_u64(&snapshot, record->login_timestamp);
+        write_snapshot_u64(&snapshot, record->logout_timestamp);
     }
-
-    // Ricevo la password
-    ret = receive_string(socket, password);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
+    pthread_mutex_unlock(&registro_lock);
+
+    // Le righe del file si scrivono sotto 'show_log_lock': l'indice corrisponde al file fino alla lunghezza attuale
+    pthread_mutex_lock(&show_log_lock);
+    begin_snapshot_section(&snapshot, SNAPSHOT_SHOW);
+    write_snapshot_u64(&snapshot, generazione_show);
+    write_snapshot_u64(&snapshot, stat(SHOW_LOG_FILE, &info) == 0 ? info.st_size : 0);
+    write_snapshot_u32(&snapshot, notifiche_show.num_elementi);
+    visit_hash_table(&notifiche_show, write_show_snapshot, &snapshot);
+    pthread_mutex_unlock(&show_log_lock);
+
+    pthread_mutex_lock(&users_lock);
+    begin_snapshot_section(&snapshot, SNAPSHOT_USERS);
+    write_snapshot_u32(&snapshot, credenziali.num_elementi);
+    visit_hash_table(&credenziali, write_user_snapshot, &snapshot);
+    ret = archivio->prepare_snapshot();
+    pthread_mutex_unlock(&users_lock);
+
+    if (ret == -1) {
+        abort_snapshot(&snapshot);
+        return -1;
     }
+    ret = archivio->snapshot(&snapshot);
 
     #ifdef DEBUG
-    printf("Username: '%s', password: '%s'.\n", username, password);
+    if (ret == 0)
+        printf("Snapshot dello stato del server scritto su '%s'.\n", SNAPSHOT_FILE);
     #endif
 
-    // Ricevo la porta di ascolto del client
-    ret = receive_integer(socket, porta);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
-    }
+    return ret;
 }
 
 /*
- * Stampa il file contenente i messaggi pendenti
+ * Thread degli snapshot: ne scrive uno ogni SNAPSHOT_INTERVAL secondi, così i worker non si fermano a scriverli
+ * (l'ultimo lo scrive esc() alla chiusura)
  */
-void print_hanging_list(void) {
-    FILE* file; // File contenente tutti i messaggi pendenti ancora da recapitare
-    char line[MAX_LINE_LEN]; // Riga letta dal file
-
-    file = open_file(OFFLINE_MSG_FILE, "r");
-    if (file == NULL)
-        return; // File inesistente/inaccessibile
-
-    printf("Contenuto del file '%s':\n", OFFLINE_MSG_FILE);
-
-    // Stampo riga per riga tutto il file
+void* snapshot_loop(void* arg) {
+    (void) arg;
     for (;;) {
-        if (fgets(line, MAX_LINE_LEN, file) == NULL)
-            break; // Fine file
-
-        printf("'%s'\n", line);
+        sleep(SNAPSHOT_INTERVAL);
+        pthread_mutex_lock(&snapshot_lock);
+        save_snapshot();
+        pthread_mutex_unlock(&snapshot_lock);
     }
 
-    if (fclose(file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", OFFLINE_MSG_FILE, strerror(errno));
+    return NULL;
 }
 
 /*
- * Creo una riga per l'utente specificato nel file dei messaggi pendenti.
- * In questa riga saranno memorizzati i messaggi a lui inviati mentre è offline.
+ * Avvia il thread degli snapshot, se il motore dell'archivio li usa.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
  */
-void insert_into_hanging_list(char* username) {
-    FILE* file; // File contenente i messaggi pendenti (inviati mentre un giocatore è offline)
+int start_snapshot_thread(void) {
+    pthread_t thread;
 
-    // Apro il file in append
-    file = open_or_create(OFFLINE_MSG_FILE, "a");
-    if (file == NULL)
-        return; // Impossibile accedere al file
+    if (archivio->snapshot == NULL)
+        return 0;
+    if (pthread_create(&thread, NULL, snapshot_loop, NULL) != 0) {
+        perror("Impossibile avviare il thread degli snapshot");
+        return -1;
+    }
+    pthread_detach(thread);
 
-    fprintf(file, "%s\nlist:\n", username);
+    return 0;
+}
 
-    #ifdef DEBUG
-    printf("Username '%s' scritto sul file dei messaggi pendenti.\n", username);
-    #endif
+/*
+ * Aspetta il commit della scrittura nell'archivio con il turno specificato, poi lascia che l'archivio esegua
+ * il checkpoint se serve.
+ * Restituisce 0 in caso di successo, -1 se la scrittura potrebbe non essere su disco.
+ * Va invocata dopo aver rilasciato i lock.
+ */
+int wait_for_storage(long turno) {
+    int ret = wait_for_commit(turno);
 
-    if (fclose(file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", OFFLINE_MSG_FILE, strerror(errno));
+    archivio->checkpoint(0);
+    return ret;
+}
 
-    #ifdef DEBUG
-    print_hanging_list();
-    #endif
+/*
+ * Comando 'esc': termina il server
+ */
+void esc(void) {
+    int i;
+
+    printf("Chiusura del server in corso...\n");
+    flush_activity_log(); // Le attività ancora in coda vengono scritte sul file...
+    archivio->checkpoint(1); // ...l'archivio rende definitive le sue scritture (così al riavvio non c'è niente da riapplicare)...
+    pthread_mutex_lock(&snapshot_lock);
+    save_snapshot(); // ...lo stato del server finisce nello snapshot, da cui riparte al riavvio...
+    pthread_mutex_unlock(&snapshot_lock);
+    flush_commits(); // ...e le scritture non ancora su disco vengono sincronizzate prima di uscire
+    sleep(3);
+    for (i = 0; i < num_workers; i++)
+        close(workers[i].listen_socket);
+    exit(0);
 }
 
 /*
- * Comando 'signup' lato client: registra l'utente
+ * Aggiunge all'indice delle credenziali un utente letto dall'archivio ('contesto' conta gli errori)
  */
-void signup(int socket) {
-    int ret;
-    char username[USERNAME_LEN]; // Username ricevuto dal client
-    char password[PASSWORD_LEN]; // Password ricevuta dal client
-    int client_port; // Porta di ascolto del client
-    FILE* file; // File contenente tutti gli utenti registrati (con le relative password)
-    char line[MAX_LINE_LEN]; // Riga letta dal file
+void add_user(char* username, char* password, void* contesto) {
+    int* errori = contesto;
+    char* copia;
 
-    // Recupero username, password e porta di ascolto inviate dal client
-    credential_reception(socket, username, password, &client_port);
+    // Se l'username compare più volte vale la prima volta, come quando il file veniva letto a ogni login
+    if (find_in_hash_table(&credenziali, username) != NULL)
+        return;
 
-    file = open_or_create(USERS_FILE, "r");
-    if (file == NULL)
-        return; // Impossibile accedere al file
+    copia = strdup(password);
+    if (copia == NULL || insert_into_hash_table(&credenziali, username, copia) == -1) {
+        perror("Impossibile caricare le credenziali degli utenti");
+        free(copia);
+        (*errori)++;
+    }
+}
 
-    /*
-     * Verifico se l'username è già stato preso da un altro utente: leggo tutto
-     * il file (riga per riga) finché non trovo 'username' (se presente)
-     */
-    for (;;) {
-        if (fgets(line, MAX_LINE_LEN, file) == NULL)
-            break; // Fine file
-        else {
-            // Recupero l'username dalla riga
-            strcpy(line, strtok(line, " "));
-            if (strcmp(line, username) == 0) { // Se ho già un utente con quel nome
-                #ifdef DEBUG
-                printf("Esiste già un utente con l'username '%s'!\n", username);
-                #endif
+/*
+ * Apre l'ultimo snapshot del server (SNAPSHOT_FILE), se c'è ed è stato scritto con lo stesso motore dell'archivio.
+ * Restituisce 'snapshot' se è stato aperto, altrimenti NULL.
+ */
+struct lettura_snapshot* open_server_snapshot(struct lettura_snapshot* snapshot) {
+    struct cursore_snapshot cursore;
+    const char* motore;
 
-                // Segnala al client che esiste già un utente con quell'username
-                ret = send_string(socket, ALREADY_EXISTING_USERNAME);
-                if (ret < 0) { // Errore
-                    if (fclose(file) != 0)
-                        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", USERS_FILE, strerror(errno));
-                    return;
-                }
+    if (archivio->snapshot == NULL || open_snapshot(snapshot, SNAPSHOT_FILE) != 1)
+        return NULL;
 
-                if (fclose(file) != 0)
-                    fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", USERS_FILE, strerror(errno));
-                return;
-            }
-        }
+    if (find_snapshot_section(snapshot, SNAPSHOT_SERVER, 1, &cursore) == 0) {
+        motore = read_snapshot_string(&cursore);
+        if (motore != NULL && strcmp(motore, archivio->nome) == 0)
+            return snapshot;
     }
-    if (fclose(file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", USERS_FILE, strerror(errno));
 
-    // Apro il file in append
-    file = open_file(USERS_FILE, "a");
-    if (file == NULL)
-        return; // File inaccessibile
+    printf("Lo snapshot '%s' non è stato scritto dall'archivio '%s': viene ignorato.\n", SNAPSHOT_FILE, archivio->nome);
+    close_snapshot(snapshot);
+    return NULL;
+}
 
-    // Scrivo l'utente sul file
-    fprintf(file, "%s %s\n", username, password);
+/*
+ * Ripristina dallo snapshot le credenziali degli utenti e il registro, in cui tutti gli utenti ripartono offline
+ * (quelli che erano online risultano disconnessi all'istante dello snapshot).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int restore_server_state(struct lettura_snapshot* snapshot) {
+    struct cursore_snapshot cursore;
+    const char* username;
+    const char* password;
+    uint32_t num, porta, versione;
+    time_t login, logout;
+    int errori = 0;
+
+    if (snapshot == NULL)
+        return 0;
 
-    #ifdef DEBUG
-    printf("L'utente '%s' si è registrato.\n", username);
-    #endif
+    // Senza le credenziali dello snapshot l'archivio non avrebbe tutti gli utenti
+    if (find_snapshot_section(snapshot, SNAPSHOT_USERS, 1, &cursore) == -1) {
+        fprintf(stderr, "Lo snapshot non contiene le credenziali degli utenti.\n");
+        return -1;
+    }
+    for (num = read_snapshot_u32(&cursore); num > 0 && !cursore.errore; num--) {
+        username = read_snapshot_string(&cursore);
+        password = read_snapshot_string(&cursore);
+        if (!cursore.errore)
+            add_user((char*) username, (char*) password, &errori);
+    }
+    if (cursore.errore || errori > 0) {
+        fprintf(stderr, "Impossibile ripristinare le credenziali degli utenti dallo snapshot.\n");
+        return -1;
+    }
 
-    // Segnalo al client che l'utente è stato registrato con successo
-    ret = send_string(socket, SIGNED_UP);
-    if (ret < 0) { // Errore
-        if (fclose(file) != 0)
-            fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", USERS_FILE, strerror(errno));
-        return;
+    // Il registro serve solo per i comandi del server: se manca si riparte vuoti
+    if (find_snapshot_section(snapshot, SNAPSHOT_REGISTER, 1, &cursore) == -1)
+        return 0;
+    for (num = read_snapshot_u32(&cursore); num > 0 && !cursore.errore; num--) {
+        username = read_snapshot_string(&cursore);
+        porta = read_snapshot_u32(&cursore);
+        versione = read_snapshot_u32(&cursore);
+        login = (time_t) read_snapshot_u64(&cursore);
+        logout = (time_t) read_snapshot_u64(&cursore);
+        if (!cursore.errore && find_user_in_register((char*) username) == NULL)
+            restore_register_entry(username, porta, versione, login, logout != 0 ? logout : snapshot->istante);
     }
 
-    if (fclose(file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", USERS_FILE, strerror(errno));
+    #ifdef DEBUG
+    printf("Ripristinati dallo snapshot %u utenti e %u record del registro.\n", credenziali.num_elementi,
+           registro.utenti.num_elementi);
+    #endif
 
-    // Creo una riga per l'utente nel file che contiene i messaggi pendenti
-    insert_into_hanging_list(username);
+    return 0;
 }
 
 /*
- * Verifica che il comando (lato server) esista e lo esegue
+ * Carica in memoria le credenziali degli utenti registrati nell'archivio (oltre a quelle ripristinate dallo snapshot).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
  */
-void run_server_command(char* buffer) {
-    remove_new_line(buffer); // Sostituisco il carattere new-line (\n) con il terminatore di stringa (\0)
+int load_users(void) {
+    int errori = 0;
+
+    if (archivio->load_users(add_user, &errori) == -1 || errori > 0)
+        return -1;
 
     #ifdef DEBUG
-    // Comando 'registro': stampa la lista degli utenti registrati
+    printf("Caricate le credenziali di %u utenti.\n", credenziali.num_elementi);
+    #endif
+
+    return 0;
+}
+
+/*
+ * Comando 'signup' lato client: registra l'utente
+ */
+void signup(int socket, struct richiesta* richiesta) {
+    int ret;
+    char* username = richiesta->stringhe[0]; // Username ricevuto dal client
+    char* password = richiesta->stringhe[1]; // Password ricevuta dal client
+    char* copia; // Password memorizzata nell'indice delle credenziali
+    long turno; // Turno del commit della registrazione
+
+    #ifdef DEBUG
+    printf("Username: '%s', password: '%s', porta: %d.\n", username, password, richiesta->interi[2]);
+    #endif
+
+    // La verifica dell'username e la scrittura del nuovo utente devono avvenire senza interruzioni
+    pthread_mutex_lock(&users_lock);
+
+    // Verifico se l'username è già stato preso da un altro utente
+    if (find_in_hash_table(&credenziali, username) != NULL) {
+        #ifdef DEBUG
+        printf("Esiste già un utente con l'username '%s'!\n", username);
+        #endif
+
+        pthread_mutex_unlock(&users_lock);
+
+        // Segnala al client che esiste già un utente con quell'username
+        reply_message(socket, OP_EXISTING_USERNAME);
+        return;
+    }
+
+    copia = strdup(password);
+    if (copia == NULL) {
+        perror("Impossibile registrare il nuovo utente");
+        pthread_mutex_unlock(&users_lock);
+        return;
+    }
+
+    /*
+     * Scrivo l'utente nell'archivio: la registrazione viene confermata solo quando è su disco (qualunque sia la
+     * politica dei commit). Il commit si aspetta senza il lock, così più registrazioni concorrenti condividono lo
+     * stesso commit.
+     */
+    turno = archivio->put_user(username, password);
+    if (turno == -1) {
+        free(copia);
+        pthread_mutex_unlock(&users_lock);
+        return;
+    }
+    if (insert_into_hash_table(&credenziali, username, copia) == -1)
+        free(copia); // L'utente è comunque nell'archivio: sarà nell'indice dal prossimo avvio
+
+    pthread_mutex_unlock(&users_lock);
+
+    if (wait_for_storage(turno) == -1)
+        return; // La registrazione potrebbe non essere su disco: non la confermo
+
+    #ifdef DEBUG
+    printf("L'utente '%s' si è registrato.\n", username);
+    #endif
+
+    // Segnalo al client che l'utente è stato registrato con successo
+    ret = reply_message(socket, OP_SIGNED_UP);
+    if (ret < 0) // Errore
+        return;
+}
+
+/*
+ * Verifica che il comando (lato server) esista e lo esegue
+ */
+void run_server_command(char* buffer) {
+    remove_new_line(buffer); // Sostituisco il carattere new-line (\n) con il terminatore di stringa (\0)
+
+    #ifdef DEBUG
+    // Comando 'registro': stampa la lista degli utenti registrati
     if (strcmp(buffer, "registro") == 0) {
         print_register();
     } else
@@ -432,6 +1026,12 @@ void run_server_command(char* buffer) {
         help();
     else if (strcmp("list", buffer) == 0)
         list();
+    else if (strcmp("stats", buffer) == 0) {
+        print_compression_stats();
+        print_commit_stats();
+        print_journal_stats();
+        print_activity_log_stats();
+    }
     else if (strcmp("esc", buffer) == 0)
         esc();
     else {
@@ -441,258 +1041,502 @@ void run_server_command(char* buffer) {
 }
 
 /*
- * Riceve la stringa 'list' derivante dal file con i messaggi pendenti e la elabora per mandare
- * a chi ha eseguito il comando 'hanging' le informazioni richieste
+ * Implementa la funzionalità di hanging: invia sul socket specificato il riepilogo dei messaggi pendenti
+ * indirizzati a 'destinatario', raggruppati per mittente. Una volta inviato, il riepilogo viene azzerato.
  */
-void send_pending_messages(int socket, char* list) {
-    int ret, i, j = 0, user_found = 0, number_found = 0;
-    char user[USERNAME_LEN];
+void hanging(int socket, char* destinatario) {
+    struct coda_offline riepilogo = {NULL, NULL, 0}; // Riepilogo tolto dall'archivio
+    struct mittente_offline* record;
     char numero[MAX_MSG_LEN]; // Numero messaggi pendenti
-    char time[MAX_MSG_LEN]; // Timestamp ultimo messaggio
+    char ultimo[MAX_MSG_LEN]; // Timestamp ultimo messaggio
 
-    for (i = 5; i < MAX_LINE_LEN; i++) { // i=5 perché ho 'list:' in testa
-        if (list[i] == ':') { // Ho terminato di leggere un campo
-            if (user_found == 0) { // Ho finito di leggere l'utente
-                user[j] = '\0';
-                user_found = 1;
-                j = 0;
+    // L'archivio registra il recapito e consegna il riepilogo
+    wait_for_storage(archivio->pending_summary(destinatario, &riepilogo));
 
-                // Invio l'username
-                ret = send_string(socket, user);
-                if (ret < 0) // Errore
-                    return;
+    // Invio mittente, numero di messaggi pendenti e timestamp del più recente
+    for (record = riepilogo.primo; record != NULL; record = record->next) {
+        sprintf(numero, "%d", record->numero);
+        sprintf(ultimo, "%d", (int) record->ultimo);
+        if (reply_message(socket, OP_PENDING, record->username, numero, ultimo) < 0)
+            break; // Errore
+    }
+    free_offline_summary(&riepilogo);
 
-                continue;
-            } else if (number_found == 0) { // Ho finito di leggere il numero di messaggi pendenti
-                number_found = 1;
-                numero[j] = '\0';
-                j = 0;
+    reply_message(socket, OP_DONE_HANGING);
+}
 
-                // Invio il numero di messaggi pendenti
-                ret = send_string(socket, numero);
-                if (ret < 0) // Errore
-                    return;
+/*
+ * Inserisce l'utente, il socket, la porta e la versione del protocollo specificati nel registro del server.
+ * NB: il chiamante deve possedere 'registro_lock'.
+ */
+void add_to_register(char* username, int socket, int client_port, int versione) {
+    struct record_registro* new_user;
 
-                continue;
-            } else { // Ho finito di leggere il timestamp
-                time[j] = '\0';
-                user_found = 0;
-                number_found = 0;
-                j = 0;
+    // Alloco il nuovo elemento e lo indicizzo per username
+    new_user = (void*) malloc(sizeof(struct record_registro));
+    if (new_user == NULL) {
+        perror("Impossibile allocare un record del registro");
+        return;
+    }
+    strcpy(new_user->username, username);
+    if (insert_into_hash_table(&registro.utenti, new_user->username, new_user) == -1) {
+        free(new_user);
+        return;
+    }
+    new_user->port = client_port;
+    new_user->versione = versione;
+    new_user->socket = INVALID_SOCKET;
+    new_user->logout_timestamp = 1; // Non ancora nell'elenco degli utenti online
+
+    // Lo inserisco in coda alla lista
+    new_user->next = NULL;
+    if (registro.ultimo != NULL)
+        registro.ultimo->next = new_user;
+    else
+        registro.primo = new_user;
+    registro.ultimo = new_user;
 
-                // Invio il timestamp
-                ret = send_string(socket, time);
-                if (ret < 0) // Errore
-                    return;
+    set_user_online(new_user, socket);
+}
 
-                continue;
-            }
-        }
+/*
+ * Aggiorna il record di 'user' nel registro del server con il socket, la porta e la versione del protocollo
+ * specificati. Inoltre imposta il timestamp di login al timestamp corrente e il timestamp di logout a 0 (= utente online).
+ * NB: il chiamante deve possedere 'registro_lock'.
+ */
+void update_register_entry(int socket, char* user, int porta_client, int versione) {
+    struct record_registro* record = find_user_in_register(user);
+
+    if (record == NULL)
+        return;
 
-        if (user_found == 0) // Sto leggendo il mittente
-            user[j++] = list[i];
-        else if (number_found == 0) // Sto leggendo il numero di messaggi pendenti
-            numero[j++] = list[i];
-        else // Sto leggendo il timestamp del messaggio più recente
-            time[j++] = list[i];
+    record->port = porta_client;
+    record->versione = versione;
+    set_user_online(record, socket);
+}
 
-        // Linea (= messaggi pendenti) finita
-        if (list[i] == '\0') {
-            ret = send_string(socket, DONE_HANGING);
-            if (ret < 0) // Errore
-                return;
+/*
+ * Aggiorna le notifiche di show pendenti di 'mittente' per 'destinatario': se 'somma' è 1 ne aggiunge 'numero',
+ * altrimenti le imposta a 'numero' (0 le elimina). Aggiorna solo l'indice in memoria, non il file.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve possedere 'show_log_lock'.
+ */
+int update_show_index(char* mittente, char* destinatario, int numero, int somma) {
+    struct show_pendenti* pendenti;
+    struct show_pendente** posizione;
+    struct show_pendente* record;
+
+    pendenti = find_in_hash_table(&notifiche_show, mittente);
+    if (pendenti == NULL) {
+        if (numero <= 0)
+            return 0; // Niente da eliminare
+
+        pendenti = calloc(1, sizeof(struct show_pendenti));
+        if (pendenti == NULL || insert_into_hash_table(&notifiche_show, mittente, pendenti) == -1) {
+            perror("Impossibile allocare le notifiche di show pendenti");
+            free(pendenti);
+            return -1;
+        }
+    }
 
+    // Cerco il destinatario tra quelli con notifiche pendenti
+    for (posizione = &pendenti->primo; *posizione != NULL; posizione = &(*posizione)->next)
+        if (strcmp((*posizione)->destinatario, destinatario) == 0)
             break;
+
+    record = *posizione;
+    if (record == NULL) {
+        if (numero <= 0)
+            return 0;
+
+        record = calloc(1, sizeof(struct show_pendente));
+        if (record == NULL) {
+            perror("Impossibile allocare una notifica di show pendente");
+            return -1;
         }
+        snprintf(record->destinatario, USERNAME_LEN, "%s", destinatario);
+        *posizione = record; // In fondo alla lista
     }
+
+    record->numero = somma ? record->numero + numero : numero;
+    if (record->numero > 0)
+        return 0;
+
+    // Non ci sono più notifiche per il destinatario (né, se era l'ultimo, per il mittente)
+    *posizione = record->next;
+    free(record);
+    if (pendenti->primo == NULL)
+        free(remove_from_hash_table(&notifiche_show, mittente));
+    return 0;
 }
 
 /*
- * Implementa la funzionalità di hanging: cerca tra i messaggi pendenti quelli indirizzati a 'destinatario'
- * e li invia sul socket specificato, raggruppati per mittente.
+ * Aggiunge in fondo al file delle notifiche di show la riga che registra un aggiornamento dell'indice
+ * (vedi struct show_pendenti): 'numero' è -1 per una nuova notifica, altrimenti il nuovo numero di notifiche.
+ * Se l'indice è rimasto vuoto il file viene invece ricreato vuoto (con una nuova generazione).
+ * Restituisce il turno del commit della scrittura.
+ * NB: il chiamante deve possedere 'show_log_lock'.
  */
-void hanging(int socket, char* destinatario) {
-    int i = 0, j = 0;
-    FILE* file; // File contenente i messaggi pendenti
-    FILE* tmp_file; // File temporaneo di appoggio
-    char tmp_file_path[PATH_MAX]; // Path del file temporaneo
-    char line[MAX_LINE_LEN]; // Riga letta dal file
+long append_to_show_log(char* mittente, char* destinatario, int numero) {
+    FILE* file;
+    long turno; // Turno del commit della scrittura
 
-    // Se il file non esiste, allora non ci sono messaggi pendenti
-    file = open_file(OFFLINE_MSG_FILE, "r");
-    if (file == NULL) {
-        send_string(socket, DONE_HANGING);
-        return;
+    // Nessuna notifica pendente: le righe precedenti non servono più
+    file = open_or_create(SHOW_LOG_FILE, notifiche_show.num_elementi == 0 ? "w" : "a");
+    if (file == NULL)
+        return -1; // File inaccessibile
+
+    if (notifiche_show.num_elementi == 0)
+        fprintf(file, "@%lu\n", ++generazione_show);
+    else {
+        if (numero < 0)
+            fprintf(file, "%s:%s\n", mittente, destinatario);
+        else
+            fprintf(file, "%s:%s:%d\n", mittente, destinatario, numero);
     }
+    turno = commit_append(file, SHOW_LOG_FILE, 0);
 
-    // Apro il scrittura il file di appoggio
-    strcpy(tmp_file_path, OFFLINE_MSG_FILE);
-    strcat(tmp_file_path, "_bk.txt");
-    tmp_file = open_or_create(tmp_file_path, "w");
-    if (tmp_file == NULL)
-        return; // File inaccessibile
+    if (fclose(file) != 0)
+        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", SHOW_LOG_FILE, strerror(errno));
+    return turno;
+}
 
-    // Scorro il file riga per riga alla ricerca del destinatario dei messaggi
-    for (;;) {
-        if (fgets(line, MAX_LINE_LEN, file) == NULL)
-            break; // Fine file
+/*
+ * Aggiunge alle notifiche di show pendenti una notifica di avvenuta consegna di messaggi pendenti
+ * che non è stata consegnata poiché il mittente dei messaggi recapitati è offline
+ */
+long add_show_notify(char* mittente, char* destinatario) {
+    long turno; // Turno del commit della scrittura
 
-        // Sostituisco il carattere new-line (\n) nella riga letta con il terminatore di stringa (\0)
-        remove_new_line(line);
+    pthread_mutex_lock(&show_log_lock);
 
-        // Controllo se sono alla riga di 'destinatario'
-        if (strcmp(line, destinatario) == 0 && i % 2 == 0) {
-            /* La prossima riga contiene i campi da inviare */
+    // Aggiorno l'indice e registro la notifica sul file
+    if (update_show_index(mittente, destinatario, 1, 1) == -1) {
+        pthread_mutex_unlock(&show_log_lock);
+        return -1;
+    }
+    turno = append_to_show_log(mittente, destinatario, -1);
 
-            j = 1;
-            fprintf(tmp_file, "%s\n", line);
-        } else if (j == 1) {
-            // Invio le informazioni sui messaggi pendenti
-            send_pending_messages(socket, line);
-            fprintf(tmp_file, "%s\n", "list:");
-            j = 0;
-        } else
-            fprintf(tmp_file, "%s\n", line); // Mantengo la riga originale
+    pthread_mutex_unlock(&show_log_lock);
+    return turno;
+}
 
-        i++;
+/*
+ * Toglie dall'indice le notifiche di show pendenti di 'mittente' (solo quelle per 'destinatario' se è diverso da
+ * NULL), registrandolo sul file, e le restituisce. Restituisce NULL se non ce ne sono.
+ * NB: il chiamante deve liberare la lista restituita.
+ */
+struct show_pendente* take_show_notifies(char* mittente, char* destinatario) {
+    struct show_pendenti* pendenti;
+    struct show_pendente** posizione;
+    struct show_pendente* presi = NULL; // Notifiche tolte dall'indice
+    struct show_pendente* record;
+
+    pthread_mutex_lock(&show_log_lock);
+
+    // Se il mittente non ha notifiche pendenti non si tocca il file
+    pendenti = find_in_hash_table(&notifiche_show, mittente);
+    if (pendenti == NULL) {
+        pthread_mutex_unlock(&show_log_lock);
+        return NULL;
     }
 
-    if (fclose(file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file dei messaggi pendenti '%s' : %s\n", OFFLINE_MSG_FILE,
-                strerror(errno));
-    if (fclose(tmp_file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file temporaneo '%s' : %s\n", tmp_file_path, strerror(errno));
+    if (destinatario == NULL) { // Tutte le notifiche del mittente
+        presi = pendenti->primo;
+        free(remove_from_hash_table(&notifiche_show, mittente));
+    } else { // Solo quelle per il destinatario
+        for (posizione = &pendenti->primo; *posizione != NULL; posizione = &(*posizione)->next) {
+            if (strcmp((*posizione)->destinatario, destinatario) == 0) {
+                presi = *posizione;
+                *posizione = presi->next;
+                presi->next = NULL;
+                break;
+            }
+        }
+        if (pendenti->primo == NULL)
+            free(remove_from_hash_table(&notifiche_show, mittente));
+    }
 
-    // Elimino il vecchio file di log e rinomino quello temporaneo (che prenderà il posto del vecchio)
-    if (remove(OFFLINE_MSG_FILE) == -1)
-        perror("Errore in hanging() durante la cancellazione del vecchio file dei messaggi pendenti");
-    if (rename(tmp_file_path, OFFLINE_MSG_FILE) == -1)
-        perror("Errore mentre si tentava di rinominare il file di log temporaneo");
+    // Le notifiche prese vengono azzerate anche sul file (non serve aspettare il commit: al peggio si ripetono)
+    for (record = presi; record != NULL; record = record->next)
+        append_to_show_log(mittente, record->destinatario, 0);
+
+    pthread_mutex_unlock(&show_log_lock);
+    return presi;
 }
 
 /*
- * Inserisce l'utente, il socket e la porta specificati nel registro del server
+ * Notifica a 'mittente' l'invio di un messaggio che aveva mandato quando 'destinatario' era offline
  */
-void add_to_register(char* username, int socket, int client_port) {
-    struct record_registro* appoggio = registro;
-    struct record_registro* new_user;
+void notify_reception(char* mittente, char* destinatario) {
+    struct record_registro* record;
+    long turno = 0; // Turno del commit della notifica salvata
 
-    // Se la lista è vuota
-    if (registro == NULL) {
-        // Inizializzo la lista e inserisco il nuovo elemento
-        registro = (void*) malloc(sizeof(struct record_registro));
-        strcpy(registro->username, username);
-        registro->socket = socket;
-        registro->login_timestamp = time(NULL); // Timestamp corrente
-        registro->logout_timestamp = 0; // Utente online
-        registro->port = client_port;
-        registro->next = NULL;
-    } else {
-        // Trovo la coda della lista (posizione vuota)
-        while (appoggio->next != NULL)
-            appoggio = appoggio->next;
+    // Il registro resta bloccato durante l'invio: così il mittente non può disconnettersi nel frattempo
+    pthread_mutex_lock(&registro_lock);
+    record = find_user_in_register(mittente);
+
+    // Se il mittente dei messaggi recapitati è online invio la notifica di invio
+    if (record != 0 && record->logout_timestamp == 0)
+        reply_message(record->socket, OP_MESSAGES_SENT, destinatario); // Destinatario che ha ricevuto i messaggi
+    else // Il mittente dei messaggi è offline: devo salvare la notifica da inviargli
+        turno = add_show_notify(mittente, destinatario);
+
+    pthread_mutex_unlock(&registro_lock);
+    wait_for_commit(turno);
+}
+
+/*
+ * Invia a 'mittente' la notifica di ricezione dei messaggi pendenti che aveva inviato
+ * a 'destinatario' mentre questo era offline
+ */
+void send_past_show(char* mittente, char* destinatario) {
+    struct show_pendente* presi;
+    int notifiche;
+
+    presi = take_show_notifies(mittente, destinatario);
+    if (presi == NULL)
+        return; // Nessuna notifica da inviare
+    notifiche = presi->numero;
+    free(presi);
+
+    // Invio le notifiche (se il mittente è andato offline nel frattempo, vengono registrate di nuovo)
+    for (; notifiche > 0; notifiche--)
+        notify_reception(mittente, destinatario);
+}
+
+/*
+ * Invia in un colpo solo all'utente appena autenticato sul socket specificato tutte le notifiche di show che
+ * non gli erano state recapitate perché era offline (una per destinatario)
+ */
+void send_pending_show(int socket, char* username) {
+    struct show_pendente* presi;
+    struct show_pendente* record;
+
+    presi = take_show_notifies(username, NULL);
+    while (presi != NULL) {
+        record = presi;
+        presi = record->next;
+        reply_message(socket, OP_MESSAGES_SENT, record->destinatario);
+        free(record);
+    }
+}
+
+/*
+ * Scrive sul file 'contesto' una riga "mittente:destinatario:N" per ogni destinatario delle notifiche pendenti
+ * del mittente 'chiave'
+ */
+void write_show_notifies(const char* chiave, void* valore, void* contesto) {
+    struct show_pendenti* pendenti = valore;
+    struct show_pendente* record;
+
+    for (record = pendenti->primo; record != NULL; record = record->next)
+        fprintf((FILE*) contesto, "%s:%s:%d\n", chiave, record->destinatario, record->numero);
+}
 
-        // Alloco e inserisco il nuovo elemento
-        new_user = (void*) malloc(sizeof(struct record_registro));
-        strcpy(new_user->username, username);
-        new_user->socket = socket;
-        new_user->login_timestamp = time(NULL); // Timestamp corrente
-        new_user->logout_timestamp = 0; // Utente online
-        new_user->port = client_port;
-        new_user->next = NULL;
-        appoggio->next = new_user;
+/*
+ * Ripristina l'indice delle notifiche di show pendenti dalla sezione dello snapshot (dopo generazione e lunghezza del file).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int restore_show_notifies(struct cursore_snapshot* cursore) {
+    const char* mittente;
+    const char* destinatario;
+    uint32_t num, num_destinatari, numero;
+
+    for (num = read_snapshot_u32(cursore); num > 0 && !cursore->errore; num--) {
+        mittente = read_snapshot_string(cursore);
+        for (num_destinatari = read_snapshot_u32(cursore); num_destinatari > 0 && !cursore->errore; num_destinatari--) {
+            destinatario = read_snapshot_string(cursore);
+            numero = read_snapshot_u32(cursore);
+            if (!cursore->errore && update_show_index((char*) mittente, (char*) destinatario, numero, 0) == -1)
+                return -1;
+        }
     }
 
-    #ifdef DEBUG
-    print_register(); // Stampa il registro del server
-    #endif
+    return cursore->errore ? -1 : 0;
 }
 
 /*
- * Aggiorna il record di 'user' nel registro del server con il socket e la porta specificati.
- * Inoltre imposta il timestamp di login al timestamp corrente e il timestamp di logout a 0 (= utente online).
+ * Carica in memoria le notifiche di show pendenti rileggendo SHOW_LOG_FILE (vedi struct show_pendenti), poi
+ * riscrive il file con una sola riga per coppia mittente-destinatario. Se il file è quello di cui lo snapshot
+ * contiene le notifiche, queste si ripristinano dallo snapshot e del file si rilegge solo il seguito.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
  */
-void update_register_entry(int socket, char* user, int porta_client) {
-    struct record_registro* appoggio;
+int load_show_notifies(struct lettura_snapshot* snapshot) {
+    FILE* file;
+    char* linea = NULL; // Riga letta dal file
+    size_t dim_linea = 0;
+    char* mittente;
+    char* destinatario;
+    char* numero;
+    char tmp_file_path[PATH_MAX]; // Path del file temporaneo
+    struct cursore_snapshot cursore = {NULL, NULL, 1};
+    struct stat info;
+    unsigned long generazione = 0; // Generazione del file (0 se il file non la riporta)
+    uint64_t generazione_snapshot = 0, lunghezza = 0; // Generazione e lunghezza del file nello snapshot
 
-    for (appoggio = registro; appoggio != NULL; appoggio = appoggio->next) {
-        if (strcmp(appoggio->username, user) == 0) {
-            appoggio->login_timestamp = time(NULL); // Timestamp corrente
-            appoggio->logout_timestamp = 0; // Utente online
-            appoggio->socket = socket;
-            appoggio->port = porta_client;
-            break;
+    if (init_hash_table(&notifiche_show, 0) == -1)
+        return -1;
+
+    if (snapshot != NULL && find_snapshot_section(snapshot, SNAPSHOT_SHOW, 1, &cursore) == 0) {
+        generazione_snapshot = read_snapshot_u64(&cursore);
+        lunghezza = read_snapshot_u64(&cursore);
+    }
+    generazione_show = generazione_snapshot; // Le nuove generazioni devono essere diverse da quella dello snapshot
+
+    file = open_file(SHOW_LOG_FILE, "r");
+    if (file == NULL)
+        return 0; // Nessuna notifica pendente
+
+    // La prima riga riporta la generazione del file (manca in quelli scritti dalle versioni precedenti)
+    if (getline(&linea, &dim_linea, file) != -1 && linea[0] == '@')
+        generazione = strtoul(linea + 1, NULL, 10);
+    else
+        rewind(file);
+    if (generazione > generazione_show)
+        generazione_show = generazione;
+
+    // Se il file è quello dello snapshot, le righe fino alla lunghezza registrata sono già nell'indice dello snapshot
+    if (generazione != 0 && generazione == generazione_snapshot && !cursore.errore &&
+        fstat(fileno(file), &info) == 0 && (uint64_t) info.st_size >= lunghezza) {
+        if (restore_show_notifies(&cursore) == -1 || fseek(file, lunghezza, SEEK_SET) == -1) {
+            fprintf(stderr, "Impossibile ripristinare le notifiche di show dallo snapshot.\n");
+            free(linea);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    while (getline(&linea, &dim_linea, file) != -1) {
+        remove_new_line(linea);
+        mittente = strtok(linea, ":");
+        destinatario = strtok(NULL, ":");
+        numero = strtok(NULL, ":");
+        if (mittente == NULL || destinatario == NULL)
+            continue; // Riga non valida
+
+        // Senza numero la riga è una nuova notifica
+        if (update_show_index(mittente, destinatario, numero == NULL ? 1 : atoi(numero), numero == NULL) == -1) {
+            free(linea);
+            fclose(file);
+            return -1;
         }
     }
+    free(linea);
+    if (fclose(file) != 0)
+        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", SHOW_LOG_FILE, strerror(errno));
+
+    // Compatto il file: una riga con il numero di notifiche per ogni coppia
+    strcpy(tmp_file_path, SHOW_LOG_FILE);
+    strcat(tmp_file_path, "_bk.txt");
+    file = open_or_create(tmp_file_path, "w");
+    if (file == NULL)
+        return 0; // Resta il file non compattato
+
+    fprintf(file, "@%lu\n", ++generazione_show);
+    visit_hash_table(&notifiche_show, write_show_notifies, file);
+
+    if (fclose(file) != 0)
+        fprintf(stderr, "Errore durante la chiusura del file temporaneo '%s' : %s\n", tmp_file_path, strerror(errno));
+    if (rename(tmp_file_path, SHOW_LOG_FILE) == -1)
+        perror("Errore mentre si tentava di rinominare il file delle notifiche di show compattato");
 
     #ifdef DEBUG
-    print_register(); // Stampa il registro del server
+    printf("Caricate le notifiche di show pendenti di %u utenti.\n", notifiche_show.num_elementi);
     #endif
+
+    return 0;
 }
 
 /*
- * Implementa la funzionalità di login: controlla che l'username esista e che la password sia corretta.
- * Notifica poi a tutti i client che un nuovo utente è online.
+ * Dimentica i messaggi registrati di un mittente: i suoi numeri di sequenza ripartono da capo nella sessione indicata.
+ * NB: il chiamante deve possedere 'sequenze_lock'.
  */
-void in(int socket) {
-    int ret;
-    char username[USERNAME_LEN];
-    char password[PASSWORD_LEN];
-    int client_port; // Porta di ascolto del client
-    FILE* users; // File contenente tutti gli utenti registrati (e le relative password)
-    char line[MAX_LINE_LEN]; // Riga letta dal file
-    char tmp_user[USERNAME_LEN]; // Username nella riga letta
-    char tmp_pass[PASSWORD_LEN]; // Password nella riga letta
-    char appoggio[MAX_MSG_LEN];
-    int found = 0; // Indica se esiste un utente con l'username specificato
-    struct record_registro* record;
+void forget_sequences(struct sequenze_mittente* mittente, uint32_t sessione) {
+    struct sequenza_registrata* registrato;
 
-    // Recupero l'username, la password e la porta di ascolto dal client
-    credential_reception(socket, username, password, &client_port);
+    while (mittente->registrati != NULL) {
+        registrato = mittente->registrati;
+        mittente->registrati = registrato->next;
+        free(registrato);
+    }
+    mittente->sessione = sessione;
+}
 
-    // Se il file non esiste, sicuramente non c'è nessun utente registrato
-    if (is_file_existing(USERS_FILE) == 0) {
-        ret = send_string(socket, UNKNOWN_USER); // Invio risposta: username non trovato (non esiste)
-        if (ret < 0) // Errore
-            return;
-        return;
+/*
+ * Restituisce l'ultimo messaggio registrato da 'mittente' per 'destinatario' nella sessione 'sessione' del suo
+ * device, creandolo (con numero di sequenza 0) se non c'è. Se i messaggi registrati appartengono a un'altra
+ * sessione vengono prima dimenticati. Restituisce NULL in caso di errore.
+ * NB: il chiamante deve possedere 'sequenze_lock'.
+ */
+struct sequenza_registrata* get_recorded_sequence(char* mittente, uint32_t sessione, char* destinatario) {
+    struct sequenze_mittente* registrati;
+    struct sequenza_registrata* registrato;
+
+    registrati = find_in_hash_table(&sequenze, mittente);
+    if (registrati == NULL) {
+        registrati = calloc(1, sizeof(struct sequenze_mittente));
+        if (registrati == NULL || insert_into_hash_table(&sequenze, mittente, registrati) == -1) {
+            perror("Impossibile registrare i numeri di sequenza di un mittente");
+            free(registrati);
+            return NULL;
+        }
+        registrati->sessione = sessione;
     }
+    if (registrati->sessione != sessione)
+        forget_sequences(registrati, sessione);
 
-    // Apro il file in lettura
-    users = open_file(USERS_FILE, "r");
-    if (users == NULL)
-        return; // File inaccessibile
+    for (registrato = registrati->registrati; registrato != NULL; registrato = registrato->next)
+        if (strcmp(registrato->destinatario, destinatario) == 0)
+            return registrato;
 
-    // Leggo il file riga per riga alla ricerca dell'username specificato
-    for (;;) {
-        if (fgets(line, MAX_LINE_LEN, users) == NULL)
-            break; // Fine file
+    registrato = calloc(1, sizeof(struct sequenza_registrata));
+    if (registrato == NULL) {
+        perror("Impossibile registrare il numero di sequenza del messaggio");
+        return NULL;
+    }
+    strcpy(registrato->destinatario, destinatario);
+    registrato->next = registrati->registrati;
+    registrati->registrati = registrato;
 
-        // Ricavo l'username e la password dalla riga
-        strcpy(tmp_user, strtok(line, " "));
-        strcpy(tmp_pass, strtok(NULL, "\n")); // Arriva fino a fine stringa così da consentire passphrase
-        remove_new_line(tmp_pass); // Sostituisco il carattere new-line (\n) con il terminatore di stringa (\0)
+    return registrato;
+}
 
-        #ifdef DEBUG
-        printf("Username: '%s', password: '%s'.\n", tmp_user, tmp_pass);
-        #endif
+/*
+ * Implementa la funzionalità di login: controlla che l'username esista e che la password sia corretta.
+ * Notifica poi a tutti i client che un nuovo utente è online.
+ */
+void in(int socket, struct richiesta* richiesta) {
+    int ret;
+    char* username = richiesta->stringhe[0];
+    char* password = richiesta->stringhe[1];
+    int client_port = richiesta->interi[2]; // Porta di ascolto del client
+    char* registrata; // Password con cui l'utente si è registrato
+    int found, corretta; // Indicano se esiste un utente con l'username specificato e se la password è la sua
+    struct record_registro* record;
+    struct connessione* connessione;
+    struct sequenze_mittente* registrati; // Messaggi registrati dall'utente (vedi OP_SESSION)
 
-        // Controllo se l'username nella riga corrisponde a quello inviato dal client
-        if (strcmp(tmp_user, username) == 0) {
-            found = 1;
-            break;
-        }
-    }
+    #ifdef DEBUG
+    printf("Username: '%s', password: '%s'.\n", username, password);
+    #endif
+
+    // Cerco l'username nell'indice delle credenziali
+    pthread_mutex_lock(&users_lock);
+    registrata = find_in_hash_table(&credenziali, username);
+    found = registrata != NULL;
+    corretta = found && strcmp(password, registrata) == 0;
+    pthread_mutex_unlock(&users_lock);
 
     if (found == 0) { // Username non trovato (non esiste)
-        ret = send_string(socket, UNKNOWN_USER);
+        ret = reply_message(socket, OP_UNKNOWN_USER);
         if (ret < 0) // Errore
             return;
         return;
     }
 
-    if (strcmp(password, tmp_pass) != 0) { // Password errata
-        ret = send_string(socket, WRONG_PASSWORD);
+    if (!corretta) { // Password errata
+        ret = reply_message(socket, OP_WRONG_PASSWORD);
         if (ret < 0) // Errore
             return;
         return;
@@ -700,80 +1544,115 @@ void in(int socket) {
 
     /* Password corretta */
 
+    /*
+     * Aggiornamento del registro, risposta e notifica agli altri client avvengono con il registro bloccato:
+     * così nessun altro worker può notificare qualcosa al nuovo client prima che riceva l'esito del login.
+     */
+    pthread_mutex_lock(&registro_lock);
+
     // Inserisco l'utente nel registro o aggiorno il suo record (se c'è già)
+    connessione = get_connection(socket);
     if (find_user_in_register(username) == 0)
-        add_to_register(username, socket, client_port);
+        add_to_register(username, socket, client_port, connessione->versione);
     else
-        update_register_entry(socket, username, client_port);
+        update_register_entry(socket, username, client_port, connessione->versione);
 
-    // Invio risposta: credenziali corrette, login avvenuto con successo
-    ret = send_string(socket, AUTHENTICATED);
-    if (ret < 0) // Errore
-        return;
+    // La sessione del device è ora autenticata
+    connessione->sessione = SESSIONE_AUTENTICATA;
+    strcpy(connessione->username, username);
 
-    // Registro il login dell'utente nel file di log
-    log_user_activity(username, "LOGIN");
+    /*
+     * Finché il device non invia OP_SESSION i suoi messaggi appartengono alla sessione 0, che termina qui: i numeri
+     * di sequenza di un device che non la invia ripartono a ogni login
+     */
+    connessione->epoca = 0;
+    pthread_mutex_lock(&sequenze_lock);
+    registrati = find_in_hash_table(&sequenze, username);
+    if (registrati != NULL && registrati->sessione == 0)
+        forget_sequences(registrati, 0);
+    pthread_mutex_unlock(&sequenze_lock);
 
-    // Controllo se il registro è vuoto
-    if (!registro)
+    // Invio risposta: credenziali corrette, login avvenuto con successo
+    ret = reply_message(socket, OP_AUTHENTICATED);
+    if (ret < 0) { // Errore
+        pthread_mutex_unlock(&registro_lock);
         return;
+    }
 
-    // Comunico a tutti i client online il login del nuovo client
-    for (record = registro; record != NULL; record = record->next) {
+    // Comunico a tutti i client online il login del nuovo client (scorrendo solo gli utenti online)
+    for (record = registro.online; record != NULL; record = record->next_online) {
 
-        // Se il client è online e non è il client che si è appena connesso
-        if (record->logout_timestamp == 0 && strcmp(record->username, username) != 0) {
+        // Se non è il client che si è appena connesso
+        if (strcmp(record->username, username) == 0)
+            continue;
 
-            // Invio il segnale che notifica che un nuovo utente è ora online
-            strcpy(appoggio, NOW_ONLINE);
-            ret = send_string(record->socket, appoggio);
-            if (ret < 0) // Errore
-                continue;
+        // Username e porta del nuovo utente (da PROTOCOL_HANDSHAKE anche la versione del protocollo del suo device)
+        if (record->versione >= PROTOCOL_HANDSHAKE)
+            reply_message(record->socket, OP_PEER_ONLINE, username, client_port, connessione->versione);
+        else
+            reply_message(record->socket, OP_NOW_ONLINE, username, client_port);
+    }
 
-            // Invio l'username dell'utente che si è appena collegato
-            ret = send_string(record->socket, username);
-            if (ret < 0) // Errore
-                continue;
+    pthread_mutex_unlock(&registro_lock);
 
-            // Invio la porta dell'utente che si è appena collegato
-            ret = send_integer(record->socket, client_port);
-            if (ret < 0) // Errore
-                continue;
-        }
-    }
+    // Registro il login dell'utente nel file di log
+    log_user_activity(username, "LOGIN");
+
+    // Le notifiche di show arrivate mentre l'utente era offline vengono inviate tutte subito (il protocollo
+    // a stringhe non ammette notifiche durante i dialoghi: a quei device arrivano quando avviano la chat)
+    if (connessione->versione != PROTOCOL_LEGACY)
+        send_pending_show(socket, username);
 
     #ifdef DEBUG
+    print_register(); // Stampa il registro del server
     printf("'%s' ha eseguito il login.\n", username);
     #endif
 }
 
 /*
  * Funzione invocata quando un client vuole creare una chat di gruppo.
- * Si occupa di ricevere una serie di username dal client e rispondere
- * dicendo se sono online o meno.
+ * Il client invia una serie di username (terminata da GROUP_CHAT_DONE, o un OP_USER_STATUS per
+ * username nel protocollo binario): per ognuno si risponde dicendo se è online o meno.
  */
-void group_chat(int socket) {
-    int ret;
-    char buffer[MAX_MSG_LEN];
-    struct record_registro* utente;
-
-    for (;;) {
-        ret = receive_string(socket, buffer);
-        if (ret <= 0) { // Errore o disconnessione del client
-            if (ret == 0)
-                client_disconnection(socket);
-            return;
-        }
+void group_chat(int socket, struct richiesta* richiesta) {
+    struct record_registro utente;
+    int found;
 
-        if (strcmp(buffer, GROUP_CHAT_DONE) == 0)
-            break;
+    // Si informa il client se l'utente è online o offline
+    found = get_register_entry(richiesta->stringhe[0], &utente);
+    reply_message(socket, found == 0 || utente.logout_timestamp != 0 ? OP_USER_OFFLINE : OP_USER_ONLINE);
+}
 
-        // Si informa il client se l'utente è online o offline
-        utente = find_user_in_register(buffer);
-        ret = send_string(socket, utente == 0 || utente->logout_timestamp != 0 ? USER_OFFLINE : USER_ONLINE);
-        if (ret < 0) // Errore
-            return;
+/*
+ * Come group_chat(), ma per un intero elenco di username (separati da '\n') ricevuto con un'unica richiesta
+ * OP_BULK_STATUS: si risponde con un solo messaggio contenente la mappa degli utenti online e le loro porte.
+ */
+void bulk_status(int socket, struct richiesta* richiesta) {
+    char presenza[(CONTACT_LIST_SIZE + 7) / 8]; // Un bit per utente: 1 se è online
+    char porte[CONTACT_LIST_SIZE * sizeof(uint16_t)]; // Porte di ascolto degli utenti online
+    struct record_registro* record;
+    char* utente, * resto;
+    uint16_t porta;
+    int i, online = 0;
+
+    memset(presenza, 0, sizeof(presenza));
+
+    // Il registro viene bloccato una volta sola per l'intero elenco
+    pthread_mutex_lock(&registro_lock);
+    utente = strtok_r(richiesta->stringhe[0], "\n", &resto);
+    for (i = 0; utente != NULL && i < CONTACT_LIST_SIZE; i++) {
+        record = find_user_in_register(utente);
+        if (record != 0 && record->logout_timestamp == 0) {
+            presenza[i / 8] |= 1 << (i % 8);
+            porta = htons(record->port);
+            memcpy(&porte[online * sizeof(uint16_t)], &porta, sizeof(uint16_t));
+            online++;
+        }
+        utente = strtok_r(NULL, "\n", &resto);
     }
+    pthread_mutex_unlock(&registro_lock);
+
+    reply_message(socket, OP_BULK_PRESENCE, presenza, (i + 7) / 8, porte, online * (int) sizeof(uint16_t));
 }
 
 /*
@@ -781,169 +1660,39 @@ void group_chat(int socket) {
  * Si occupa di ricevere l'username di cui il client vuole conoscere la porta e risponde
  * dicendo innanzitutto se l'utente è ancora online e, se lo è, qual è la sua porta di ascolto.
  */
-void insert_into_group_chat(int socket) {
+void insert_into_group_chat(int socket, struct richiesta* richiesta) {
     int ret;
-    char buffer[MAX_MSG_LEN];
-    struct record_registro* utente;
-
-    // Si ricevere l'username di cui si vuole conoscere la porta
-    ret = receive_string(socket, buffer);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
-    }
+    char* buffer = richiesta->stringhe[0]; // Username di cui si vuole conoscere la porta
+    struct record_registro utente;
 
     /*
      * Se l'utente è online, si notifica e si invia la porta.
      * Se l'utente è offline, si notifica ciò e basta.
      */
-    utente = find_user_in_register(buffer);
-    if (utente == 0 || utente->logout_timestamp != 0) {
-        ret = send_string(socket, USER_OFFLINE);
+    if (get_register_entry(buffer, &utente) == 0 || utente.logout_timestamp != 0) {
+        ret = reply_message(socket, OP_USER_OFFLINE);
         if (ret < 0) // Errore
             return;
     } else {
-        ret = send_string(socket, USER_ONLINE);
-        if (ret < 0) // Errore
-            return;
-
-        ret = send_integer(socket, utente->port);
+        ret = reply_peer_port(socket, OP_USER_PORT, &utente);
         if (ret < 0) // Errore
             return;
     }
 }
 
 /*
- * Aggiunge al file di log delle show una notifica di avvenuta consegna di messaggi pendenti
- * che non è stata consegnata poiché il mittente dei messaggi recapitati è offline
+ * Invocata quando un client vuole avviare una nuova chat 1-to-1.
+ * Si occupa di ricevere l'username con cui si vuole avviare la chat e di controllare
+ * se è online o meno (comunicandolo all'utente che vuole avviare la chat).
  */
-void add_show_notify(char* mittente, char* destinatario) {
-    FILE* file;
-    char appoggio[MAX_LINE_LEN];
-
-    // Apro il file in append
-    file = open_or_create(SHOW_LOG_FILE, "a");
-    if (file == NULL)
-        return; // File inaccessibile
+void chat(int socket, struct richiesta* richiesta) {
+    int ret, i;
+    char* username = session_username(socket); // Utente che vuole avviare la chat
+    char* destinatario = richiesta->stringhe[0]; // Utente con cui si vuole avviare la chat
+    struct record_registro record; // Record nel registro dell'utente con cui si vuole conversare
+    int found; // Indica se l'utente con cui si vuole conversare è nel registro
 
-    // Registro la notifica pendente
-    strcpy(appoggio, mittente); // Mittente dei messaggi: dovrà ricevere la notifica
-    strcat(appoggio, ":");
-    strcat(appoggio, destinatario); // Ricevente dei messaggi: ha ricevuto i messaggi pendenti
-    fprintf(file, "%s\n", appoggio);
-
-    if (fclose(file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", SHOW_LOG_FILE, strerror(errno));
-}
-
-/*
- * Notifica a 'mittente' l'invio di un messaggio che aveva mandato quando 'destinatario' era offline
- */
-void notify_reception(char* mittente, char* destinatario) {
-    int ret;
-    struct record_registro* record = find_user_in_register(mittente);
-
-    // Se il mittente dei messaggi recapitati è online invio la notifica di invio
-    if (record != 0 && record->logout_timestamp == 0) {
-
-        // Invio la notifica di invio dei messaggi pendenti
-        ret = send_string(record->socket, MESSAGES_SENT);
-        if (ret < 0) //Errore
-            return;
-
-        // Invio il destinatario che ha ricevuto i messaggi pendenti
-        ret = send_string(record->socket, destinatario);
-        if (ret < 0) //Errore
-            return;
-    } else // Il mittente dei messaggi è offline: devo salvare la notifica da inviargli
-        add_show_notify(mittente, destinatario);
-}
-
-/*
- * Invia a 'mittente' la notifica di ricezione dei messaggi pendenti che aveva inviato
- * a 'destinatario' mentre questo era offline
- */
-void send_past_show(char* mittente, char* destinatario) {
-    FILE* show_log;
-    FILE* tmp_file; // File temporaneo di appoggio
-    char tmp_file_path[PATH_MAX]; // Path del file temporaneo
-    char line[MAX_LINE_LEN]; // Riga letta dal file
-    char appoggio[MAX_LINE_LEN];
-
-    // Se il file non esiste sicuramente non ci sono notifiche da inviare
-    if (is_file_existing(SHOW_LOG_FILE) == 0)
-        return;
-
-    // Apro il file in lettura
-    show_log = open_file(SHOW_LOG_FILE, "r");
-    if (show_log == NULL)
-        return; // File inaccessibile
-
-    // Apro il scrittura il file di appoggio
-    strcpy(tmp_file_path, SHOW_LOG_FILE);
-    strcat(tmp_file_path, "_bk.txt");
-    tmp_file = open_or_create(tmp_file_path, "w");
-    if (tmp_file == NULL)
-        return; // File inaccessibile
-
-    strcpy(appoggio, mittente);
-    strcat(appoggio, ":");
-    strcat(appoggio, destinatario);
-
-    // Scorro il file riga per riga alla ricerca di 'mittente' e 'destinatario'
-    for (;;) {
-        if (fgets(line, MAX_LINE_LEN, show_log) == NULL)
-            break; // Fine file
-
-        // Sostituisco il carattere new-line (\n) con il terminatore di stringa (\0)
-        remove_new_line(line);
-
-        // Verifico se sono alla linea corretta ('mittente:destinatario')
-        if (strncmp(line, appoggio, strlen(appoggio)) == 0)
-            notify_reception(mittente, destinatario); // Invio la notifica
-        else
-            fprintf(tmp_file, "%s\n", line); // Lascio la riga inalterata
-    }
-
-    if (fclose(show_log) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", SHOW_LOG_FILE, strerror(errno));
-    if (fclose(tmp_file) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file temporaneo '%s' : %s\n", tmp_file_path, strerror(errno));
-
-    // Elimino il vecchio file e rinomino quello temporaneo (che prenderà il posto del vecchio)
-    if (remove(SHOW_LOG_FILE) == -1)
-        perror("Errore durante la cancellazione del vecchio file contenente le notifiche di show pendenti");
-    if (rename(tmp_file_path, SHOW_LOG_FILE) == -1)
-        perror("Errore mentre si tentava di rinominare il file di log temporaneo");
-}
-
-/*
- * Invocata quando un client vuole avviare una nuova chat 1-to-1.
- * Si occupa di ricevere l'username con cui si vuole avviare la chat e di controllare
- * se è online o meno (comunicandolo all'utente che vuole avviare la chat).
- */
-void chat(int socket) {
-    int ret, i;
-    char username[USERNAME_LEN]; // Utente che vuole avviare la chat
-    char destinatario[USERNAME_LEN]; // Utente con cui si vuole avviare la chat
-    struct record_registro* record; // Record nel registro dell'utente con cui si vuole conversare
-
-    // Ricevo l'username dell'utente con cui si vuole avviare una chat
-    ret = receive_string(socket, destinatario);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
-    }
-    record = find_user_in_register(destinatario);
-
-    // Trovo l'username del mittente (che vuole avviare una chat)
-    find_username_from_socket(socket, username);
-    if (username[0] == '\0') {
-        printf("Errore in chat(): nessun utente associato al socket.\n");
-        return;
-    }
+    found = get_register_entry(destinatario, &record);
 
     /*
      * Se il destinatario è offline, lo comunico al mittente.
@@ -951,9 +1700,9 @@ void chat(int socket) {
      * Se l'invio della comunicazione fallisce, si prova ad inviarla per 3
      * volte (come da specifiche).
      */
-    if (record == 0 || record->logout_timestamp != 0) {
+    if (found == 0 || record.logout_timestamp != 0) {
         for (i = 0; i < 3; i++) {
-            ret = send_string(socket, USER_OFFLINE);
+            ret = reply_message(socket, OP_USER_OFFLINE);
             if (ret >= 0) // Send andata a buon fine
                 break;
         }
@@ -962,15 +1711,12 @@ void chat(int socket) {
             return;
     } else {
         for (i = 0; i < 3; i++) {
-            ret = send_string(socket, USER_ONLINE);
+            ret = reply_peer_port(socket, OP_USER_PORT, &record);
             if (ret >= 0) // Send andata a buon fine
                 break;
         }
-        if (ret < 0) // Errore in tutti i tentativi
-            return;
 
-        ret = send_integer(socket, record->port);
-        if (ret < 0) // Errore
+        if (ret < 0) // Errore in tutti i tentativi
             return;
     }
 
@@ -979,425 +1725,729 @@ void chat(int socket) {
 }
 
 /*
- * Implementa la funzionalità di show: invia i messaggi pendenti e aggiorna il log della chat
- * inserendo il segno che indica che il messaggio è stato letto (quest'ultima parte è una
- * semplificazione ottenuta dalla condivisione dei log delle chat tra client e server).
+ * Stato di show() mentre scorre i messaggi della chat
  */
-void show(int socket) {
-    int ret;
-    char esecutore[USERNAME_LEN]; // Utente che ha eseguito la show()
-    char mittente[USERNAME_LEN]; // Utente che ha inviato i messaggi pendenti che si vogliono leggere
-    char appoggio[USERNAME_LEN];
-    char path[PATH_MAX]; // File contenente i log della chat
-    char tmp_file_path[PATH_MAX]; // File temporaneo
-    FILE* log; // File contenente i log della chat
-    FILE* log_tmp; // File temporaneo
-    char linea[MAX_LINE_LEN]; // Riga letta da file
-    char out[MAX_LINE_LEN]; // Riga da scrivere sul file
-    int none_sent = 1; // Indica se sono stati trovati o meno messaggi pendenti
-
-    // Trovo l'utente che ha inviato la show grazie al socket che è stato utilizzato per inviare il comando di show
-    find_username_from_socket(socket, esecutore);
-    if (esecutore[0] == '\0') {
-        printf("Errore nella show(): nessun utente associato al socket.\n");
-        return;
-    }
+struct lettura_show {
+    int socket; // Socket dell'esecutore della show()
+    char* mittente; // Utente di cui si inviano i messaggi
+    int max; // Lunghezza massima di una riga inviabile al device
+    char* out; // Riga da inviare al device
+    int dim_out;
+    unsigned long long ultimo; // Numero di sequenza dell'ultimo messaggio della chat
+    int none_sent; // Indica se sono stati trovati o meno messaggi pendenti
+};
 
-    // Ricevo il mittente dei messaggi pendenti che si vogliono leggere
-    ret = receive_string(socket, mittente);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
+/*
+ * Invia al device che ha eseguito la show() un messaggio della chat ('contesto' è la struct lettura_show),
+ * se è un messaggio non letto da parte del mittente
+ */
+void send_show_line(struct messaggio_chat* messaggio, void* contesto) {
+    struct lettura_show* lettura = contesto;
+
+    lettura->ultimo = messaggio->seq;
+
+    // Invio solo i messaggi non letti che sono da parte del mittente
+    if (messaggio->letto || messaggio->len_mittente != (int) strlen(lettura->mittente) ||
+        strncmp(messaggio->mittente, lettura->mittente, messaggio->len_mittente) != 0)
         return;
-    }
 
-    /*
-     * Se il file non viene trovato, provo a scambiare l'ordine degli username nel nome del file.
-     * Ad esempio, il file di log può essere pippo-pluto.txt ma anche pluto-pippo.txt.
-     */
-    get_chat_log_path(mittente, esecutore, path);
-    if (is_file_existing(path) == 0) // Il file di log non esiste
-        get_chat_log_path(esecutore, mittente, path);
-
-    // Se non c'è uno storico della chat, sicuramente non ci sono messaggi pendenti
-    log = open_file(path, "r");
-    if (log == NULL) {
-        send_string(socket, DONE_SHOW);
+    // Il device riceve la riga "mittente: messaggio" con il segno di messaggio letto
+    if (reserve_buffer(&lettura->out, &lettura->dim_out,
+                       messaggio->len_mittente + messaggio->len_testo + strlen(READ_MARK) + 4) == -1)
         return;
-    }
+    sprintf(lettura->out, "%.*s: %.*s %s", messaggio->len_mittente, messaggio->mittente, messaggio->len_testo,
+            messaggio->testo, READ_MARK);
 
-    // File di appoggio temporaneo
-    strcpy(tmp_file_path, path);
-    strcat(tmp_file_path, "_tmp.txt");
+    // Mando al client i messaggi pendenti che aveva (troncati, se il suo protocollo non li può trasportare)
+    if ((int) strlen(lettura->out) > lettura->max)
+        lettura->out[lettura->max] = '\0';
+    if (reply_message(lettura->socket, OP_SHOW_LINE, lettura->out) < 0)
+        return; // Errore
 
-    // Apro il file temporaneo in modalità append
-    log_tmp = open_or_create(tmp_file_path, "a");
-    if (log_tmp == NULL) { // Impossibile accedere al file
-        send_string(socket, DONE_SHOW);
+    lettura->none_sent = 0;
+}
 
-        if (fclose(log) != 0)
-            fprintf(stderr, "Errore durante la chiusura del file di log della chat '%s' : %s\n", path, strerror(errno));
+/*
+ * Implementa la funzionalità di show: invia i messaggi pendenti e sposta il segno di lettura dell'esecutore
+ * sull'ultimo messaggio della chat. L'archivio riparte direttamente dal messaggio successivo al segno:
+ * i messaggi precedenti non vengono riletti.
+ */
+void show(int socket, struct richiesta* richiesta) {
+    int ret;
+    char* esecutore = session_username(socket); // Utente che ha eseguito la show()
+    char* mittente = richiesta->stringhe[0]; // Utente che ha inviato i messaggi pendenti che si vogliono leggere
+    struct lettura_show lettura = {socket, mittente, 0, NULL, 0, 0, 1};
+    int versione = get_connection(socket)->versione; // Versione del protocollo usata dal device
+    long letti; // Segno di lettura dell'esecutore (numero di sequenza dell'ultimo messaggio letto)
+    long turno = 0; // Turno del commit del nuovo segno di lettura
+
+    // I device che usano il protocollo a stringhe ricevono le righe in un buffer di MAX_MSG_LEN byte (terminatore compreso)
+    lettura.max = versione == PROTOCOL_LEGACY ? MAX_MSG_LEN - 1 : max_field_len(versione);
+
+    // Scorro i messaggi successivi al segno di lettura (se non c'è uno storico della chat non ce ne sono)
+    letti = archivio->read_mark(esecutore, mittente);
+    archivio->read_range(mittente, esecutore, letti + 1, send_show_line, &lettura);
+    free(lettura.out);
 
+    // Tutti i messaggi fino alla fine della chat sono stati letti: sposto il segno
+    if ((long) lettura.ultimo > letti)
+        turno = archivio->mark_read(esecutore, mittente, (long) lettura.ultimo);
+
+    // Comunico al client che sono finiti i messaggi pendenti
+    wait_for_storage(turno);
+    ret = reply_message(socket, OP_DONE_SHOW);
+    if (ret < 0) // Errore
         return;
-    }
 
-    // Appoggio contiene 'mittente:'
-    strcpy(appoggio, mittente);
-    strcat(appoggio, ":");
+    // Se c'erano dei messaggi pendenti, comunico al mittente dei messaggi la ricezione da parte del destinatario
+    if (lettura.none_sent == 0)
+        notify_reception(mittente, esecutore);
+}
 
-    for (;;) { // Scorro il file di log contenente lo storico della chat
-        if (fgets(linea, MAX_LINE_LEN, log) == NULL)
-            break; // File terminato
+/*
+ * Registra nell'archivio un nuovo messaggio inviato da 'mittente' per 'destinatario' mentre questo era offline:
+ * se il destinatario è registrato il messaggio finisce anche tra i suoi messaggi pendenti.
+ * Restituisce il turno del commit della scrittura, da passare a wait_for_storage().
+ */
+long new_pending_message(char* mittente, char* destinatario, char* messaggio) {
+    int registrato;
 
-        // Se il messaggio è stato letto
-        if (strstr(linea, READ_MARK) != NULL) {
-            fprintf(log_tmp, "%s", linea); // Lascio la riga inalterata
-            continue;
-        }
+    // I messaggi pendenti vengono registrati solo per gli utenti registrati
+    pthread_mutex_lock(&users_lock);
+    registrato = find_in_hash_table(&credenziali, destinatario) != NULL;
+    pthread_mutex_unlock(&users_lock);
+
+    return archivio->append_message(mittente, destinatario, messaggio, registrato);
+}
 
-        /* Messaggio non letto */
+/*
+ * Invocata quando un client invia un messaggio di una chat al server (poiché il destinatario è offline).
+ * Si occupa di ricevere il destinatario e il messaggio dal client e di registrare il nuovo messaggio
+ * nell'archivio (chat e messaggi pendenti).
+ */
+void new_message(int socket, struct richiesta* richiesta) {
+    int ret;
+    char* destinatario = richiesta->stringhe[0]; // Destinatario del messaggio
+    char* messaggio = richiesta->stringhe[1]; // Messaggio spedito
+    char* mittente = session_username(socket); // Mittente del messaggio
 
-        // Aggiorno solo le line che sono da parte del mittente
-        if (strncmp(linea, appoggio, strlen(appoggio)) == 0) {
-            memset(out, 0, sizeof(out)); // Ripulisco ogni volta il buffer
+    #ifdef DEBUG
+    printf("Nuovo messaggio di una chat inviato da '%s' per '%s': '%s'.\n", mittente, destinatario, messaggio);
+    #endif
 
-            // Inserisco il segno per segnalare che adesso il messaggio è letto
-            strncpy(out, linea, strstr(linea, UNREAD_MARK) - linea);
-            strcat(out, READ_MARK);
-            fprintf(log_tmp, "%s\n", out); // Scrivo la nuova riga sul file temporaneo
+    // Registro il messaggio (come non letto) nell'archivio: nella chat e tra i messaggi pendenti di 'destinatario'
+    wait_for_storage(new_pending_message(mittente, destinatario, messaggio));
 
-            #ifdef DEBUG
-            printf("Segnato il messaggio '%s' come letto nel file '%s'.", out, path);
-            #endif
+    // Segnala il completamento della registrazione del messaggio sui file
+    ret = reply_message(socket, OP_LOGGED_MSG);
+    if (ret < 0) // Errore
+        return;
+}
 
-            // Mando al client i messaggi pendenti che aveva
-            ret = send_string(socket, out);
-            if (ret < 0) // Errore
-                continue;
+/*
+ * Invia al device la conferma cumulativa dei messaggi OP_CHAT_MESSAGE registrati e non ancora confermati
+ */
+void send_pending_ack(struct connessione* connessione) {
+    if (connessione->conferma_destinatario[0] == '\0')
+        return;
 
-            none_sent = 0;
-        } else
-            fprintf(log_tmp, "%s", linea); // Lascio inalterata la riga
-    }
+    reply_message(connessione->socket, OP_MESSAGES_ACKED, connessione->conferma_destinatario,
+                  (int) connessione->conferma_sequenza);
+    connessione->conferma_destinatario[0] = '\0';
+}
 
-    if (fclose(log) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file di log della chat '%s' : %s\n", path, strerror(errno));
-    if (fclose(log_tmp) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file temporaneo di log '%s' : %s\n", tmp_file_path,
-                strerror(errno));
+/*
+ * Come new_message(), ma il messaggio porta il suo numero di sequenza nella conversazione e non riceve una risposta
+ * immediata: la conferma è cumulativa e viene inviata da send_pending_ack() (vedi OP_MESSAGES_ACKED).
+ * I messaggi già registrati nella stessa sessione del device (ritrasmessi dopo la disconnessione di un peer o dopo
+ * una riconnessione al server) non vengono registrati di nuovo, ma solo confermati; un messaggio che non è stato
+ * possibile registrare non viene confermato.
+ */
+void chat_message(int socket, struct richiesta* richiesta) {
+    struct connessione* connessione = get_connection(socket);
+    char* destinatario = richiesta->stringhe[0]; // Destinatario del messaggio
+    char* mittente = session_username(socket); // Mittente del messaggio
+    uint32_t sequenza = richiesta->interi[2]; // Numero di sequenza del messaggio
+    struct sequenza_registrata* registrato; // Ultimo messaggio registrato per 'destinatario'
+    int nuovo; // Vale 1 se il messaggio non è ancora stato registrato
+
+    // Nessun utente ha un username così lungo (e non starebbe nella conferma)
+    if (strlen(destinatario) >= USERNAME_LEN)
+        return;
 
-    // Elimino il vecchio file di log e rinomino quello temporaneo (che prenderà il posto del vecchio)
-    if (remove(path) == -1)
-        perror("Errore durante la cancellazione del vecchio file di log della chat");
-    if (rename(tmp_file_path, path) == -1)
-        perror("Errore mentre si tentava di rinominare il file di log temporaneo");
+    #ifdef DEBUG
+    printf("Nuovo messaggio %u di una chat inviato da '%s' per '%s': '%s'.\n", (uint32_t) richiesta->interi[2],
+           mittente, destinatario, richiesta->stringhe[1]);
+    #endif
 
-    // Comunico al client che sono finiti i messaggi pendenti
-    ret = send_string(socket, DONE_SHOW);
-    if (ret < 0) // Errore
+    pthread_mutex_lock(&sequenze_lock);
+    registrato = get_recorded_sequence(mittente, connessione->epoca, destinatario);
+    nuovo = registrato != NULL && sequenza > registrato->sequenza;
+    pthread_mutex_unlock(&sequenze_lock);
+    if (registrato == NULL)
         return;
 
-    // Se c'erano dei messaggi pendenti, comunico al mittente dei messaggi la ricezione da parte del destinatario
-    if (none_sent == 0)
-        notify_reception(mittente, esecutore);
+    if (nuovo) {
+        // Registro il messaggio come new_message() (senza 'sequenze_lock': l'attesa del commit può essere lunga)
+        if (wait_for_storage(new_pending_message(mittente, destinatario, richiesta->stringhe[1])) == -1) {
+            fprintf(stderr, "Impossibile registrare il messaggio %u inviato da '%s' per '%s'.\n", sequenza, mittente,
+                    destinatario);
+            return;
+        }
+
+        // Nel frattempo i messaggi registrati potrebbero essere stati dimenticati: il record va cercato di nuovo
+        pthread_mutex_lock(&sequenze_lock);
+        registrato = get_recorded_sequence(mittente, connessione->epoca, destinatario);
+        if (registrato != NULL && sequenza > registrato->sequenza)
+            registrato->sequenza = sequenza;
+        pthread_mutex_unlock(&sequenze_lock);
+    }
+    #ifdef DEBUG
+    else
+        printf("Il messaggio %u inviato da '%s' per '%s' era già stato registrato.\n", sequenza, mittente, destinatario);
+    #endif
+
+    // Se c'è una conferma in sospeso per un'altra conversazione la invio subito
+    if (strcmp(connessione->conferma_destinatario, destinatario) != 0)
+        send_pending_ack(connessione);
+    else if (connessione->conferma_sequenza > sequenza)
+        return; // La conferma in sospeso copre già il messaggio
+    strcpy(connessione->conferma_destinatario, destinatario);
+    connessione->conferma_sequenza = sequenza;
 }
 
 /*
- * Cerca in 'line' (riga del file contenente i messaggi pendenti) le informazioni sui
- * messaggi pendenti inviati da 'mittente'. Se li trova, aggiorna il timestamp del messaggio
- * più recente e il contatore dei messaggi pendenti, altrimenti crea una nuova entry.
- * 'line' non viene modificata: l'aggiornamento viene riflettuto in 'result'.
+ * Il device annuncia le funzionalità opzionali che supporta (OP_FEATURES): si risponde con quelle supportate
+ * anche dal server e da quel momento i messaggi per il device vengono compressi con il codec scelto
  */
-void update_pendent_user_list(char* line, char* mittente, char* result) {
-    int k, i = 0;
-    char* start;
-    char utente[USERNAME_LEN];
-    char appoggio[MAX_LINE_LEN];
-    char appoggio_numero[MAX_LINE_LEN];
-    char appoggio_timestamp[TIMESTAMP_LEN];
-    char old_line[MAX_LINE_LEN];
+void features(int socket, struct richiesta* richiesta) {
+    struct connessione* connessione = get_connection(socket);
+    int funzionalita = richiesta->interi[0] & supported_features();
 
-    strcpy(utente, ":");
-    strcat(utente, mittente);
-    strcat(utente, ":");
-    start = strstr(line, utente);
+    // La risposta non viene compressa: il device saprà decomprimere solo dopo averla ricevuta
+    reply_message(socket, OP_FEATURES, funzionalita);
+    connessione->codec = choose_codec(funzionalita);
 
-    // Se ci sono già dei messaggi pendenti da 'mittente', aggiorno solo i campi
-    if (start != NULL) {
-        // 'appoggio' contiene i campi relativi ai messaggi pendenti inviati da 'mittente'
-        strcpy(appoggio, start);
+    #ifdef DEBUG
+    printf("Il device sul socket %d usa il codec '%s'.\n", socket, codec_name(connessione->codec));
+    #endif
+}
 
-        // Recupero la parte iniziale della riga
-        strcpy(old_line, line);
-        old_line[strlen(line) - strlen(start) + 1] = '\0';
+/*
+ * Il device annuncia le sue capacità (OP_CAPABILITIES): si risponde con quelle in comune (la versione già
+ * negoziata con OP_HELLO, la lunghezza massima dei frame minore e le funzionalità supportate da entrambi).
+ * Da quel momento i messaggi per il device vengono compressi con il codec scelto e non superano la sua
+ * lunghezza massima dei frame.
+ */
+void capabilities(int socket, struct richiesta* richiesta) {
+    struct connessione* connessione = get_connection(socket);
+    int max_frame = richiesta->interi[1];
+    int funzionalita = richiesta->interi[2] & supported_features();
+
+    // Il device deve accettare almeno le richieste più lunghe previste dal protocollo (vedi MIN_MAX_FRAME_LEN)
+    if (max_frame < MIN_MAX_FRAME_LEN)
+        max_frame = MIN_MAX_FRAME_LEN;
+    if (max_frame > get_max_frame_len())
+        max_frame = get_max_frame_len();
+
+    // La risposta non viene compressa: il device saprà decomprimere solo dopo averla ricevuta
+    reply_message(socket, OP_CAPABILITIES, connessione->versione, max_frame, funzionalita);
+    connessione->max_frame = max_frame;
+    connessione->codec = choose_codec(funzionalita);
 
-        // Quando trovo ':' dopo il mittente avrò finito di leggere il contatore dei messaggi pendenti
-        for (k = strlen(mittente) + 2; appoggio[k] != ':'; k++) {
-            appoggio_numero[i] = appoggio[k];
-            i++;
-        }
-        appoggio_numero[i] = '\0';
+    #ifdef DEBUG
+    printf("Il device sul socket %d accetta frame fino a %d byte e usa il codec '%s'.\n", socket, max_frame,
+           codec_name(connessione->codec));
+    #endif
+}
 
-        k++; // Aumento k (mi sono fermato su ':' nello scorrimento precedente)
+/*
+ * Il device comunica la sua sessione (OP_SESSION): i numeri di sequenza dei suoi messaggi proseguono da quelli
+ * registrati nella stessa sessione, anche se arrivati su un'altra connessione
+ */
+void session(int socket, struct richiesta* richiesta) {
+    get_connection(socket)->epoca = (uint32_t) richiesta->interi[0];
 
-        // Quando trovo ':' dopo il contatore avrò finito di leggere il timestamp del messaggio pendente più recente
-        for (; appoggio[k] != ':'; k++) {}
+    #ifdef DEBUG
+    printf("Il device di '%s' è nella sessione %u.\n", session_username(socket), (uint32_t) richiesta->interi[0]);
+    #endif
+}
 
-        /* Fine campi relativi a 'mittente' */
+/*
+ * Invocata quando un utente viene aggiunto alla chat di gruppo.
+ * Si occupa di fornire le porte di ascolto dei membri del gruppo.
+ */
+void new_chat_member(int socket, struct richiesta* richiesta) {
+    int ret;
+    char* membro = richiesta->stringhe[0];
+    struct record_registro record;
+    int found; // Indica se il membro è nel registro
 
-        // Converto da stringhe a interi
-        sprintf(appoggio_timestamp, "%d", (int) time(NULL)); // Timestamp corrente
-        sprintf(appoggio_numero, "%d", atoi(appoggio_numero) + 1);
-        fflush(stdout);
+    // Invio la porta di ascolto
+    found = get_register_entry(membro, &record);
+    if (found == 0 || record.logout_timestamp != 0) // Membro offline
+        record.port = INVALID_SOCKET;
+    ret = reply_peer_port(socket, OP_MEMBER_PORT, &record);
+    if (ret < 0) // Errore
+        return;
+}
 
-        // Ricompongo la riga con i campi aggiornati
-        strcpy(result, old_line); // Parte iniziale della riga
-        strcat(result, mittente);
-        strcat(result, ":");
-        strcat(result, appoggio_numero);
-        strcat(result, ":");
-        strcat(result, appoggio_timestamp);
-        strcat(result, &appoggio[k]); // Parte rimanente della riga
-    } else {
-        remove_new_line(line); // Sostituisco il carattere new-line (\n) con il terminatore di stringa (\0)
+/*
+ * Comando 'hanging' lato client: invia i messaggi pendenti dell'utente connesso sul socket
+ */
+void hanging_command(int socket, struct richiesta* richiesta) {
+    hanging(socket, session_username(socket));
+}
 
-        // Aggiungo i campi in fondo alla lista
-        strcpy(result, line); // Riga originale
-        strcat(result, mittente);
-        strcat(result, ":1:"); // 1 solo messaggio pendente
-        sprintf(appoggio_numero, "%d:", (int) time(NULL)); // Timestamp corrente
-        strcat(result, appoggio_numero);
-    }
+/*
+ * Comando 'out' lato client: la connessione viene chiusa una volta elaborati i frame già ricevuti
+ */
+void logout_command(int socket, struct richiesta* richiesta) {
+    get_connection(socket)->sessione = SESSIONE_CHIUSA;
 }
 
 /*
- * Registra nel file dei messaggi pendenti un nuovo messaggio inviato da 'mittente' per 'destinatario'.
- * In particolare, se ci sono già dei messaggi pendenti per 'destinatario' da 'mittente',
- * aggiorna il timestamp del messaggio più recente e il contatore dei messaggi pendenti,
- * altrimenti crea un'entry nel file.
+ * Comando che un client può inviare al server. Nel protocollo a stringhe, dopo il nome del comando il client
+ * invia i campi descritti da 'campi' (un carattere per campo: 's' per una stringa, 'i' per un intero) e il
+ * comando viene eseguito solo quando tutti i campi sono arrivati. Nel protocollo binario il comando arriva
+ * in un unico frame: l'opcode seguito dai campi.
  */
-void new_pending_message(char* destinatario, char* mittente) {
-    char tmp_file_path[PATH_MAX]; // File temporaneo
-    FILE* hanging_list; // File contenente i messaggi temporanei
-    FILE* hanging_tmp; // File temporaneo
-    char line[MAX_LINE_LEN]; // Riga letta dal file
-    char out[MAX_LINE_LEN]; // Riga da scrivere sul file
-    int i = 0, j = 0;
+struct comando_client {
+    char* nome; // Nome del comando inviato dal client (protocollo a stringhe; NULL se esiste solo nel protocollo binario)
+    int opcode; // Opcode del comando (protocollo binario)
+    char* campi; // Campi che seguono il nome del comando
+    /*
+     * Se diverso da NULL, i campi formano un elenco: vengono ripetuti (e il comando eseguito per ogni
+     * elemento) finché il client non invia questa stringa al posto del primo campo. Nel protocollo
+     * binario ogni elemento è un comando a sé.
+     */
+    char* terminatore;
+    int autenticazione; // Vale 1 se il comando può essere eseguito solo dopo il login
+    void (*esegui)(int socket, struct richiesta* richiesta); // Funzione che esegue il comando
+};
+
+// Tabella dei comandi accettati dal server
+const struct comando_client comandi_client[] = {
+    {SIGNUP, OP_SIGNUP, "ssi", NULL, 0, signup},
+    {LOGIN, OP_LOGIN, "ssi", NULL, 0, in},
+    {HANGING_COMMAND, OP_HANGING, "", NULL, 1, hanging_command},
+    {LOGOUT_COMMAND, OP_LOGOUT, "", NULL, 0, logout_command},
+    {NEW_CHAT_COMMAND, OP_NEW_CHAT, "s", NULL, 1, chat},
+    {SHOW_COMMAND, OP_SHOW, "s", NULL, 1, show},
+    {OFFLINE_MESSAGE, OP_OFFLINE_MESSAGE, "ss", NULL, 1, new_message},
+    {START_GROUP_CHAT, OP_USER_STATUS, "s", GROUP_CHAT_DONE, 1, group_chat},
+    {CLIENT_PORT_REQUEST, OP_CLIENT_PORT_REQUEST, "s", NULL, 1, insert_into_group_chat},
+    {MEMBER_PORT_REQUEST, OP_MEMBER_PORT_REQUEST, "s", NULL, 1, new_chat_member},
+    {NULL, OP_BULK_STATUS, "s", NULL, 1, bulk_status},
+    {NULL, OP_CHAT_MESSAGE, "ssi", NULL, 1, chat_message},
+    {NULL, OP_FEATURES, "i", NULL, 0, features},
+    {NULL, OP_CAPABILITIES, "iii", NULL, 0, capabilities},
+    {NULL, OP_SESSION, "i", NULL, 1, session}
+};
+#define NUM_COMANDI_CLIENT (sizeof(comandi_client) / sizeof(comandi_client[0]))
 
-    // Apro il file dei messaggi pendenti in lettura
-    hanging_list = open_or_create(OFFLINE_MSG_FILE, "r");
-    if (hanging_list == NULL)
-        return; // Impossibile accedere al file
+/*
+ * Cerca nella tabella dei comandi quello con il nome specificato (lungo 'lunghezza' byte, senza terminatore).
+ * Restituisce l'indice del comando o -1 se non esiste.
+ */
+int find_client_command(char* nome, int lunghezza) {
+    int i;
 
-    // File di appoggio temporaneo
-    strcpy(tmp_file_path, OFFLINE_MSG_FILE);
-    strcat(tmp_file_path, "_tmp.txt");
+    for (i = 0; i < NUM_COMANDI_CLIENT; i++)
+        if (comandi_client[i].nome != NULL && strlen(comandi_client[i].nome) == lunghezza &&
+            memcmp(comandi_client[i].nome, nome, lunghezza) == 0)
+            return i;
 
-    // Apro il file temporaneo in scrittura
-    hanging_tmp = open_file(tmp_file_path, "w");
-    if (hanging_tmp == NULL) { // Impossibile accedere al file
-        if (fclose(hanging_list) != 0)
-            fprintf(stderr, "Errore durante la chiusura del file di log della chat '%s' : %s\n", OFFLINE_MSG_FILE,
-                    strerror(errno));
+    return -1;
+}
 
-        return;
-    }
+/*
+ * Cerca nella tabella dei comandi quello con l'opcode specificato.
+ * Restituisce l'indice del comando o -1 se non esiste.
+ */
+int find_client_opcode(int opcode) {
+    int i;
 
-    // Scorro il file finché non trovo il interlocutore
-    for (;;) {
-        if (fgets(line, MAX_LINE_LEN, hanging_list) == NULL)
-            break; // Fine file
+    for (i = 0; i < NUM_COMANDI_CLIENT; i++)
+        if (comandi_client[i].opcode == opcode)
+            return i;
 
-        remove_new_line(line); // Sostituisco il carattere new-line (\n) con il terminatore di stringa (\0)
+    return -1;
+}
 
-        // Controllo la riga per verificare se sono a quella di 'destinatario'
-        if (strcmp(line, destinatario) == 0 && i % 2 == 0) {
-            /* La prossima riga contiene il campi da aggiornare */
+/*
+ * Esegue il comando di cui sono arrivati tutti i campi e porta la richiesta nello stato successivo:
+ * il prossimo elemento dell'elenco (se il comando ne prevede uno) o un nuovo comando.
+ */
+void run_client_command(struct connessione* connessione) {
+    struct richiesta* richiesta = &connessione->richiesta;
+    const struct comando_client* comando = &comandi_client[richiesta->comando];
 
-            fprintf(hanging_tmp, "%s\n", line); // Lascio la riga inalterata
-            j = 1;
-        } else if (j == 1) {
-            // Registra nuovo messaggio pendente
-            update_pendent_user_list(line, mittente, out);
-            fprintf(hanging_tmp, "%s\n", out);
-            j--;
-        } else
-            fprintf(hanging_tmp, "%s\n", line); // Lascio la riga inalterata
+    richiesta->ricevuti = 0;
+    if (comando->terminatore != NULL && connessione->versione == PROTOCOL_LEGACY)
+        richiesta->stato = RICHIESTA_ELENCO;
+    else
+        richiesta->stato = RICHIESTA_COMANDO;
 
-        i++;
+    // I comandi riservati agli utenti autenticati vengono ignorati se il device non ha eseguito il login
+    if (comando->autenticazione && connessione->sessione != SESSIONE_AUTENTICATA) {
+        #ifdef DEBUG
+        // I comandi introdotti con il protocollo binario non hanno un nome
+        if (comando->nome != NULL)
+            printf("Comando '%s' ricevuto sul socket %d prima del login: viene ignorato.\n", comando->nome,
+                   connessione->socket);
+        else
+            printf("Comando con opcode %d ricevuto sul socket %d prima del login: viene ignorato.\n", comando->opcode,
+                   connessione->socket);
+        #endif
+        return;
     }
 
-    if (fclose(hanging_list) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file dei messaggi pendenti '%s' : %s\n", OFFLINE_MSG_FILE,
-                strerror(errno));
-    if (fclose(hanging_tmp) != 0)
-        fprintf(stderr, "Errore durante la chiusura del file temporaneo '%s' : %s\n", tmp_file_path, strerror(errno));
-
-    // Elimino il vecchio file di log e rinomino quello temporaneo (che prenderà il posto del vecchio)
-    if (remove(OFFLINE_MSG_FILE) == -1)
-        perror("Errore in new_pending_message() durante la cancellazione del vecchio file dei messaggi pendenti");
-    if (rename(tmp_file_path, OFFLINE_MSG_FILE) == -1)
-        perror("Errore mentre si tentava di rinominare il file di log temporaneo");
+    comando->esegui(connessione->socket, richiesta);
 }
 
 /*
- * Aggiunge un messaggio al log della chat tra 'mittente' e 'destinatario'
+ * Gestisce il messaggio OP_HELLO con cui il device propone la versione del protocollo: si sceglie la
+ * minore tra quella proposta e PROTOCOL_VERSION e la si comunica al device (sempre nel formato binario,
+ * che il device sa interpretare dal momento che ha inviato OP_HELLO). I messaggi successivi vengono
+ * codificati con la versione scelta.
+ * Restituisce 1 in caso di successo e -1 se il messaggio non è valido.
  */
-void write_to_chat_log(char* mittente, char* destinatario, char* messaggio) {
-    char path[PATH_MAX]; // Path del file di log della chat
-    FILE* log; // File contenente lo storico della chat
-    char appoggio[MAX_LINE_LEN]; // Conterrà la nuova riga da scrivere sul file di log
+int negotiate_protocol(struct connessione* connessione, struct frame* frame) {
+    struct richiesta* richiesta = &connessione->richiesta;
+    char buffer[MESSAGE_BUFFER_LEN];
+    int len;
 
-    /*
-     * Se il file non viene trovato, provo a scambiare l'ordine degli username nel nome del file.
-     * Ad esempio, il file di log può essere pippo-pluto.txt ma anche pluto-pippo.txt.
-     */
-    get_chat_log_path(mittente, destinatario, path);
-    if (is_file_existing(path) == 0) // Il file di log non esiste
-        get_chat_log_path(destinatario, mittente, path);
-    log = open_or_create(path, "a"); // Apro il file in modalità append
-    if (log == NULL)
-        return; // Impossibile accedere al file
+    if (decode_fields(find_message_type(OP_HELLO)->campi, PROTOCOL_BINARY, &frame->dati[1], frame->lunghezza - 1, NULL,
+                      richiesta->stringhe, richiesta->interi) == -1 || richiesta->interi[0] < PROTOCOL_LEGACY)
+        return -1;
+
+    connessione->versione = richiesta->interi[0] < PROTOCOL_VERSION ? richiesta->interi[0] : PROTOCOL_VERSION;
 
-    // Contrassegno i messaggi con '*' poiché se arrivo qui l'utente è offline (altrimenti la gestirebbe il client)
-    strcpy(appoggio, mittente);
-    strcat(appoggio, ": ");
-    strcat(appoggio, messaggio);
-    strcat(appoggio, " ");
-    strcat(appoggio, UNREAD_MARK);
+    #ifdef DEBUG
+    printf("Il device sul socket %d usa la versione %d del protocollo.\n", connessione->socket, connessione->versione);
+    #endif
+
+    len = build_message(buffer, PROTOCOL_BINARY, 0, OP_HELLO, connessione->versione);
+    pthread_mutex_lock(&connessione->lock);
+    len = queue_bytes(&connessione->uscita, buffer, len);
+    pthread_mutex_unlock(&connessione->lock);
 
-    fprintf(log, "%s\n", appoggio);
-    if (fclose(log) != 0)
-        fprintf(stderr, "Errore durante la chiusura del log della chat '%s' : %s\n", path, strerror(errno));
+    return len < 0 ? -1 : 1;
 }
 
 /*
- * Invocata quando un client invia un messaggio di una chat al server (poiché il destinatario è offline).
- * Si occupa di ricevere il destinatario e il messaggio dal client e di registrare il nuovo messaggio
- * sui file (chat e messaggi pendenti).
+ * Elabora il prossimo frame di un device che usa il protocollo binario: il frame contiene l'opcode e tutti
+ * i campi del comando, che viene quindi eseguito subito. Da PROTOCOL_PIPELINE il device può inviare più
+ * richieste senza attendere le risposte: vengono eseguite nell'ordine di arrivo e le risposte di ciascuna
+ * portano il suo identificativo.
+ * Restituisce 1 se è stato elaborato un frame, 0 se il buffer non contiene un frame completo
+ * e -1 in caso di errore di protocollo.
  */
-void new_message(int socket) {
-    int ret;
-    char messaggio[MAX_MSG_LEN]; // Messaggio spedito
-    char mittente[USERNAME_LEN]; // Mittente del messaggio
-    char destinatario[USERNAME_LEN]; // Destinatario del messaggio
-
-    // Ricevo il destinatario del messaggio
-    ret = receive_string(socket, destinatario);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
+int process_binary_frame(struct connessione* connessione) {
+    struct richiesta* richiesta = &connessione->richiesta;
+    struct frame frame;
+    int ret, opcode, intestazione;
+
+    // Dalla versione PROTOCOL_VARINT la lunghezza del frame è un varint
+    ret = next_frame(&connessione->ricezione, connessione->versione >= PROTOCOL_VARINT ? FRAME_VARINT : FRAME_STRINGA,
+                     &frame);
+    if (ret <= 0)
+        return ret;
+
+    // Un messaggio compresso viene decompresso e poi elaborato come gli altri
+    if (expand_message(connessione->versione, &frame.dati, &frame.lunghezza, &connessione->espanso,
+                       &connessione->capacita_espanso) == -1)
+        return -1;
+    intestazione = decode_header(connessione->versione, frame.dati, frame.lunghezza, &opcode, &richiesta->id);
+    if (intestazione == -1)
+        return -1; // Mancano l'opcode o l'identificativo
+
+    richiesta->comando = find_client_opcode(opcode);
+    if (richiesta->comando == -1) {
+        #ifdef DEBUG
+        printf("Ricevuto l'opcode sconosciuto %d sul socket %d: viene ignorato.\n", opcode, connessione->socket);
+        #endif
+        return 1;
     }
 
-    // Ricevo il messaggio
-    ret = receive_string(socket, messaggio);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
+    // I campi vengono copiati in uno spazio della dimensione del frame
+    if (reserve_buffer(&richiesta->spazio, &richiesta->capacita, frame.lunghezza + MAX_CAMPI) == -1)
+        return -1;
+    if (decode_fields(comandi_client[richiesta->comando].campi, connessione->versione, &frame.dati[intestazione],
+                      frame.lunghezza - intestazione, richiesta->spazio, richiesta->stringhe, richiesta->interi) == -1) {
+        fprintf(stderr, "Ricevuto sul socket %d un comando con campi non validi.\n", connessione->socket);
+        return -1;
     }
 
-    find_username_from_socket(socket, mittente);
-    if (mittente[0] == '\0') {
-        printf("Errore in new_message(): nessun utente associato al socket.\n");
-        return;
+    run_client_command(connessione);
+
+    // Lo spazio occupato da una richiesta molto grande non viene trattenuto dopo l'esecuzione
+    if (richiesta->capacita > RECEIVE_BUFFER_LEN) {
+        free(richiesta->spazio);
+        richiesta->spazio = NULL;
+        richiesta->capacita = 0;
     }
+    return 1;
+}
 
-    #ifdef DEBUG
-    printf("Nuovo messaggio di una chat inviato da '%s' per '%s': '%s'.\n", mittente, destinatario, messaggio);
-    #endif
+/*
+ * Elabora il prossimo frame nel buffer di ricezione della connessione facendo avanzare la macchina
+ * a stati della richiesta in corso (vedi 'enum stato_richiesta'): il frame può essere il nome di un
+ * nuovo comando, un campo del comando ricevuto o un elemento di un elenco. Quando tutti i campi sono
+ * arrivati il comando viene eseguito. Se il device ha negoziato il protocollo binario ogni frame è
+ * un comando completo (vedi process_binary_frame()).
+ * Restituisce 1 se è stato elaborato un frame, 0 se il buffer non contiene un frame completo
+ * e -1 in caso di errore di protocollo.
+ */
+int process_frame(struct connessione* connessione) {
+    struct richiesta* richiesta = &connessione->richiesta;
+    const struct comando_client* comando;
+    struct frame frame;
+    int ret, tipo, i;
+
+    if (connessione->versione != PROTOCOL_LEGACY)
+        return process_binary_frame(connessione);
+
+    switch (richiesta->stato) {
+        case RICHIESTA_COMANDO: // Il frame contiene il nome di un nuovo comando
+            ret = next_frame(&connessione->ricezione, FRAME_STRINGA, &frame);
+            if (ret <= 0)
+                return ret;
+
+            // Nessun nome di comando inizia con il byte 0: è la richiesta di negoziare il protocollo
+            if (frame.lunghezza > 0 && frame.dati[0] == OP_HELLO)
+                return negotiate_protocol(connessione, &frame);
+
+            richiesta->comando = find_client_command(frame.dati, frame.lunghezza);
+            richiesta->ricevuti = 0;
+            if (richiesta->comando == -1) {
+                #ifdef DEBUG
+                printf("Ricevuto un comando sconosciuto sul socket %d: viene ignorato.\n", connessione->socket);
+                #endif
+                return 1;
+            }
 
-    // Registro un nuovo messaggio pendente per 'mittente'
-    new_pending_message(destinatario, mittente);
+            // Nel protocollo a stringhe ogni campo è lungo al massimo MAX_MSG_LEN byte
+            if (reserve_buffer(&richiesta->spazio, &richiesta->capacita, MAX_CAMPI * (MAX_MSG_LEN + 1)) == -1)
+                return -1;
+            for (i = 0; i < MAX_CAMPI; i++)
+                richiesta->stringhe[i] = &richiesta->spazio[i * (MAX_MSG_LEN + 1)];
+
+            // Un comando senza campi viene eseguito subito
+            if (comandi_client[richiesta->comando].campi[0] == '\0')
+                run_client_command(connessione);
+            else
+                richiesta->stato = RICHIESTA_CAMPI;
+            return 1;
+
+        case RICHIESTA_CAMPI: // Il frame contiene un campo del comando in corso
+        case RICHIESTA_ELENCO: // Il frame contiene un campo di un elemento dell'elenco (o il terminatore)
+            comando = &comandi_client[richiesta->comando];
+            tipo = comando->campi[richiesta->ricevuti] == 'i' ? FRAME_INTERO : FRAME_STRINGA;
+
+            ret = next_frame(&connessione->ricezione, tipo, &frame);
+            if (ret <= 0)
+                return ret;
+            if (frame.lunghezza > MAX_MSG_LEN) {
+                fprintf(stderr, "Ricevuto sul socket %d un campo più lungo di %d byte.\n", connessione->socket,
+                        MAX_MSG_LEN);
+                return -1;
+            }
 
-    // Scrivo il messaggio (come non letto) nei log della chat tra 'mittente' e 'destinatario'
-    write_to_chat_log(mittente, destinatario, messaggio);
+            if (tipo == FRAME_INTERO)
+                richiesta->interi[richiesta->ricevuti] = frame.intero;
+            else {
+                memcpy(richiesta->stringhe[richiesta->ricevuti], frame.dati, frame.lunghezza);
+                richiesta->stringhe[richiesta->ricevuti][frame.lunghezza] = '\0';
+            }
+            richiesta->ricevuti++;
 
-    // Segnala il completamento della registrazione del messaggio sui file
-    ret = send_string(socket, LOGGED_MSG);
-    if (ret < 0) // Errore
-        return;
+            // Fine dell'elenco: si torna ad attendere un nuovo comando
+            if (richiesta->stato == RICHIESTA_ELENCO && richiesta->ricevuti == 1 &&
+                strcmp(richiesta->stringhe[0], comando->terminatore) == 0) {
+                richiesta->stato = RICHIESTA_COMANDO;
+                return 1;
+            }
+
+            // Se sono arrivati tutti i campi eseguo il comando
+            if (richiesta->ricevuti == strlen(comando->campi))
+                run_client_command(connessione);
+            else
+                richiesta->stato = RICHIESTA_CAMPI;
+            return 1;
+    }
+
+    return -1;
 }
 
 /*
- * Invocata quando un utente viene aggiunto alla chat di gruppo.
- * Si occupa di fornire le porte di ascolto dei membri del gruppo.
+ * Controlla se la coda di invio della connessione ha superato SEND_QUEUE_HIGH anche dopo aver provato
+ * a svuotarla: in tal caso il client non legge le risposte abbastanza in fretta e si smette di elaborare
+ * le sue richieste finché la coda non scende sotto SEND_QUEUE_LOW (vedi client_output()).
+ * Restituisce 1 se il client è sospeso, altrimenti 0.
  */
-void new_chat_member(int socket) {
-    int ret;
-    char membro[USERNAME_LEN];
-    struct record_registro* record;
+int suspend_if_congested(struct connessione* connessione) {
+    pthread_mutex_lock(&connessione->lock);
 
-    // Ricevo l'username del membro
-    ret = receive_string(socket, membro);
-    if (ret <= 0) { // Errore o disconnessione del client
-        if (ret == 0)
-            client_disconnection(socket);
-        return;
+    if (connessione->uscita.in_coda >= SEND_QUEUE_HIGH && flush_connection(connessione) >= SEND_QUEUE_HIGH) {
+        connessione->sospesa = 1;
+        update_events(connessione);
+
+        #ifdef DEBUG
+        printf("Client sul socket %d sospeso: %d byte in attesa di essere inviati.\n", connessione->socket,
+               connessione->uscita.in_coda);
+        #endif
     }
 
-    // Invio la porta di ascolto
-    record = find_user_in_register(membro);
-    ret = send_integer(socket, record == 0 || record->logout_timestamp != 0 ? INVALID_SOCKET : record->port);
-    if (ret < 0) // Errore
-        return;
+    pthread_mutex_unlock(&connessione->lock);
+
+    return connessione->sospesa;
 }
 
 /*
- * Verifica che il comando inviato dal client esista e lo esegue
+ * Gestisce i dati in arrivo dal client connesso sul socket specificato: legge tutti i byte disponibili
+ * (il socket è monitorato in modalità edge-triggered) ed elabora tutti i frame completi. I frame
+ * incompleti restano nel buffer della connessione fino alla prossima notifica, così un client lento
+ * non blocca il worker. Le risposte accodate vengono inviate tutte insieme al termine.
+ * Restituisce -1 se la connessione è stata chiusa, altrimenti 0.
  */
-void run_client_command(int socket, char* comando) {
-    char username[USERNAME_LEN];
+int client_input(int socket) {
+    struct connessione* connessione = get_connection(socket);
+    int pieno, ret = 0;
 
-    if (strcmp(comando, SIGNUP) == 0)
-        signup(socket);
-    else if (strcmp(comando, LOGIN) == 0)
-        in(socket);
-    else if (strcmp(comando, HANGING_COMMAND) == 0) {
-        find_username_from_socket(socket, username);
-        if (username[0] != '\0')
-            hanging(socket, username);
-        else
-            printf("Errore in run_client_command(): nessun utente associato al socket.\n");
-    } else if (strcmp(comando, LOGOUT_COMMAND) == 0)
+    // Un client sospeso viene ripreso solo per chiudere la connessione (vedi close_session())
+    if (connessione == NULL || (connessione->sospesa && connessione->sessione != SESSIONE_CHIUSA))
+        return 0;
+
+    connessione_corrente = connessione;
+    do {
+        pieno = fill_receive_buffer(socket, &connessione->ricezione);
+        if (pieno < 0)
+            break;
+
+        // Elaboro tutti i frame completi presenti nel buffer, a meno che il client non venga sospeso
+        while (connessione->sessione != SESSIONE_CHIUSA && !suspend_if_congested(connessione) &&
+               (ret = process_frame(connessione)) == 1) {}
+    } while (pieno == 1 && ret == 0 && !connessione->sospesa && !connessione->ricezione.chiuso &&
+             connessione->sessione != SESSIONE_CHIUSA);
+    connessione_corrente = NULL;
+
+    // Confermo i messaggi registrati e invio le risposte accodate durante l'elaborazione
+    send_pending_ack(connessione);
+    pthread_mutex_lock(&connessione->lock);
+    flush_connection(connessione);
+    pthread_mutex_unlock(&connessione->lock);
+
+    // Errore, frame non valido, disconnessione del client o logout
+    if (pieno < 0 || ret < 0 || connessione->ricezione.chiuso || connessione->sessione == SESSIONE_CHIUSA) {
         client_disconnection(socket);
-    else if (strcmp(comando, NEW_CHAT_COMMAND) == 0)
-        chat(socket);
-    else if (strcmp(comando, SHOW_COMMAND) == 0)
-        show(socket);
-    else if (strcmp(comando, OFFLINE_MESSAGE) == 0)
-        new_message(socket);
-    else if (strcmp(comando, START_GROUP_CHAT) == 0)
-        group_chat(socket);
-    else if (strcmp(comando, CLIENT_PORT_REQUEST) == 0)
-        insert_into_group_chat(socket);
-    else if (strcmp(comando, MEMBER_PORT_REQUEST) == 0)
-        new_chat_member(socket);
+        return -1;
+    }
+
+    return 0;
 }
 
-int main(int argc, char** argv) {
-    fd_set read_fds; // Set contenente i socket pronti lasciati dalla select()
-    int fd_max; // Massimo socket ID
-    int porta; // Porta del server
-    int i, ret;
-    char buffer[MAX_MSG_LEN];
+/*
+ * Gestisce il socket del client quando torna pronto in scrittura: invia i frame rimasti in coda e,
+ * se il client era sospeso e la coda è scesa sotto SEND_QUEUE_LOW, riprende a elaborare le sue richieste.
+ * Restituisce -1 se la connessione è stata chiusa, altrimenti 0.
+ */
+int client_output(int socket) {
+    struct connessione* connessione = get_connection(socket);
+    int riprendi;
 
-    // Si usa la porta passata come parametro all'avvio o quella di default se non viene specificata
-    if (argv[1] != NULL) {
-        porta = strtol(argv[1], NULL, 10);
-        if (porta < 1024) {
-            printf("Le prime 1024 porte sono riservate\n");
-            exit(1);
+    if (connessione == NULL)
+        return 0;
+
+    pthread_mutex_lock(&connessione->lock);
+    flush_connection(connessione);
+
+    riprendi = connessione->sospesa && connessione->uscita.in_coda < SEND_QUEUE_LOW;
+    if (riprendi) {
+        connessione->sospesa = 0;
+        update_events(connessione);
+    }
+    pthread_mutex_unlock(&connessione->lock);
+
+    // Elaboro le richieste rimaste nel buffer e quelle arrivate nel frattempo
+    if (riprendi)
+        return client_input(socket);
+
+    return 0;
+}
+
+/*
+ * Accetta tutte le connessioni in attesa sul socket di ascolto del worker corrente. Il socket di ascolto
+ * è non bloccante e monitorato in modalità edge-triggered, quindi si accetta finché la coda non è vuota.
+ */
+void accept_connections(void) {
+    int new_sd;
+    socklen_t len;
+    struct sockaddr_in client_addr;
+
+    for (;;) {
+        len = sizeof(client_addr);
+        new_sd = accept(worker_corrente->listen_socket, (struct sockaddr*) &client_addr, &len);
+        if (new_sd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("Errore durante l'accettazione di una connessione");
+            return; // Nessun'altra connessione in attesa
         }
-    } else
-        porta = DEFAULT_SERVER_PORT;
 
-    // Creazione socket di ascolto (protocollo TCP)
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket == -1) {
+        // Il socket del client è non bloccante: le risposte vengono inviate con la coda di invio della connessione
+        if (fcntl(new_sd, F_SETFL, fcntl(new_sd, F_GETFL) | O_NONBLOCK) == -1) {
+            perror("Impossibile rendere non bloccante il socket del nuovo client");
+            close(new_sd);
+            continue;
+        }
+
+        // Creo la struttura associata alla connessione
+        if (new_connection(new_sd) == NULL) {
+            close(new_sd);
+            continue;
+        }
+
+        // Aggiungo il nuovo socket a quelli monitorati dal worker (edge-triggered: client_input() legge fino a EAGAIN)
+        if (reactor_add(&worker_corrente->reactor, new_sd, REACTOR_READ | REACTOR_EDGE) == -1) {
+            perror("Impossibile monitorare il socket del nuovo client");
+            free_connection(new_sd);
+            close(new_sd);
+            continue;
+        }
+
+        #ifdef DEBUG
+        printf("Nuovo client connesso al server (socket %d, worker %d)\n", new_sd, worker_corrente->id);
+        printf(">");
+        fflush(stdout);
+        #endif
+    }
+}
+
+/*
+ * Crea il socket di ascolto e l'event loop del worker specificato.
+ * Il socket è aperto con SO_REUSEPORT, così che tutti i worker possano ascoltare sulla stessa porta.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int worker_init(struct worker* worker, int id, int porta) {
+    struct sockaddr_in server_addr;
+    int opzione = 1;
+
+    worker->id = id;
+
+    // Creazione socket di ascolto (protocollo TCP) non bloccante
+    worker->listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (worker->listen_socket == -1) {
         perror("Errore durante la creazione del socket di ascolto");
-        exit(1);
+        return -1;
+    }
+
+    // Più socket possono essere in ascolto sulla stessa porta: il kernel bilancia le connessioni tra di loro
+    if (setsockopt(worker->listen_socket, SOL_SOCKET, SO_REUSEPORT, &opzione, sizeof(opzione)) == -1) {
+        perror("Errore durante l'impostazione di SO_REUSEPORT");
+        return -1;
     }
 
     // Bind e listen
@@ -1405,79 +2455,232 @@ int main(int argc, char** argv) {
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(porta);
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    ret = bind(server_socket, (struct sockaddr*) &server_addr, sizeof(server_addr));
-    if (ret < 0) {
+    if (bind(worker->listen_socket, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0) {
         perror("Errore durante la bind");
-        exit(-1);
+        return -1;
     }
-    ret = listen(server_socket, QUEUE_LEN);
-    if (ret < 0) {
+    if (listen(worker->listen_socket, SERVER_QUEUE_LEN) < 0) {
         perror("Errore durante la listen");
-        exit(-1);
+        return -1;
     }
 
-    printf("************ SERVER STARTED ************\n");
+    // Inizializzo l'event loop del worker
+    if (reactor_init(&worker->reactor, MAX_EVENTS) == -1)
+        return -1;
 
-    // Inizializzo i set per I/O multiplexing
-    FD_ZERO(&master);
-    FD_ZERO(&read_fds);
-    FD_SET(server_socket, &master); // Monitoro il socket di ascolto
-    FD_SET(0, &master); // Monitoro lo stdin
-    fd_max = server_socket;
+    // Monitoro il socket di ascolto (edge-triggered: a ogni notifica si svuota la coda delle connessioni)
+    if (reactor_add(&worker->reactor, worker->listen_socket, REACTOR_READ | REACTOR_EDGE) == -1) {
+        perror("Impossibile monitorare il socket di ascolto");
+        return -1;
+    }
 
-    // Stampa la lista di comandi disponibili
-    print_auth_commands();
-    printf(">");
-    fflush(stdout);
+    return 0;
+}
+
+/*
+ * Event loop di un worker: gestisce le nuove connessioni, i comandi dei client che ha accettato
+ * e, solo per il worker 0, i comandi inseriti nello stdin
+ */
+void* worker_loop(void* arg) {
+    int i, n, fd;
+    uint32_t eventi; // Eventi verificatisi su un descrittore pronto
+    char buffer[MAX_MSG_LEN];
+
+    worker_corrente = (struct worker*) arg;
 
     while (1) {
-        read_fds = master; // Dopo la select() conterrà solo i socket pronti
-        ret = select(fd_max + 1, &read_fds, NULL, NULL, NULL);
-        if (ret == -1) {
-            perror("Errore nella select()");
+        n = reactor_wait(&worker_corrente->reactor, -1); // Restituisce solo i descrittori pronti
+        if (n == -1)
             continue; // Salto all'iterazione continua in assenza di errori fatali
-        }
 
-        // Cerco il/i socket pronto/i
-        for (i = 0; i <= fd_max; i++) {
-            if (!FD_ISSET(i, &read_fds))
-                continue;
+        for (i = 0; i < n; i++) {
+            fd = reactor_ready_fd(&worker_corrente->reactor, i);
+            eventi = reactor_ready_events(&worker_corrente->reactor, i);
 
-            if (i == 0) { // Input da tastiera
-                fgets(buffer, MAX_COMMAND_LEN, stdin);
+            if (fd == STDIN_FILENO) { // Input da tastiera
+                if (fgets(buffer, MAX_COMMAND_LEN, stdin) == NULL) {
+                    // Stdin chiuso (EOF): smetto di monitorarlo, il server continua a servire i client
+                    reactor_remove(&worker_corrente->reactor, STDIN_FILENO);
+                    continue;
+                }
 
                 // Valida il comando inserito e lo esegue
                 run_server_command(buffer);
 
                 printf(">");
                 fflush(stdout);
-            } else if (i == server_socket) { // Socket di ascolto: ricevuta richiesta di connessione
-                len = sizeof(client_addr);
-                new_sd = accept(server_socket, (struct sockaddr*) &client_addr, (socklen_t * ) & len);
+            } else if (fd == worker_corrente->listen_socket) { // Socket di ascolto: richieste di connessione
+                accept_connections();
+            } else { // Socket di comunicazione con un client
+                // Socket pronto in scrittura: invio le risposte rimaste in coda
+                if ((eventi & REACTOR_WRITE) && client_output(fd) == -1)
+                    continue; // Connessione chiusa
+
+                // Dati in arrivo dal client (o disconnessione)
+                if (eventi & (REACTOR_READ | REACTOR_HANGUP))
+                    client_input(fd);
+            }
+        }
+    }
 
-                // Aggiorno il set dei socket
-                FD_SET(new_sd, &master);
-                if (new_sd > fd_max)
-                    fd_max = new_sd;
+    return NULL;
+}
 
-                #ifdef DEBUG
-                printf("Nuovo client connesso al server\n");
-                printf(">");
-                fflush(stdout);
-                #endif
-            } else { // Socket di comunicazione: ricevuto un comando dal client
+/*
+ * Stampa la sintassi per avviare il server
+ */
+void print_usage(char* programma) {
+    printf("Uso: %s [-t numero_thread] [-m byte] [-z byte] [-c none|always|millisecondi] [-s file|memoria|log] [porta]\n",
+           programma);
+    printf("-t -> numero di worker (thread con un proprio event loop) che servono i client (default 1, 0 = uno per core)\n");
+    printf("-m -> lunghezza massima di un frame dei device che usano lunghezze varint (default %d)\n", DEFAULT_MAX_FRAME_LEN);
+    printf("-z -> lunghezza minima di un messaggio da comprimere per i device che lo supportano (default %d)\n",
+           COMPRESSION_THRESHOLD);
+    printf("-c -> durabilità delle scritture su file: none (default) le lascia al sistema operativo, always risponde\n");
+    printf("      solo dopo averle sincronizzate su disco, un numero N le sincronizza ogni N ms (vedi il comando 'stats')\n");
+    printf("-s -> archivio dei dati del server: file (default) usa i file di testo e i log delle chat letti anche dai device,\n");
+    printf("      memoria tiene tutto in memoria (per le prove di carico: si perde alla chiusura), log aggiunge ogni operazione\n");
+    printf("      in fondo a un unico file; con memoria e log i device non trovano nei loro log i messaggi registrati dal server\n");
+}
 
-                // Ricevo il comando eseguito dal client
-                ret = receive_string(i, buffer);
-                if (ret <= 0) { // Errore o disconnessione del client
-                    if (ret == 0)
-                        client_disconnection(i);
-                    continue;
+int main(int argc, char** argv) {
+    int porta; // Porta del server
+    int i, opzione, max_frame, soglia;
+    struct lettura_snapshot stato; // Ultimo snapshot dello stato del server
+    struct lettura_snapshot* snapshot;
+    enum politica_commit politica = COMMIT_NONE; // Durabilità delle scritture su file
+    int intervallo = 0; // Millisecondi tra due commit (solo con COMMIT_INTERVAL)
+
+    // Opzioni dell'avvio (prima della porta)
+    while ((opzione = getopt(argc, argv, "t:m:z:c:s:")) != -1) {
+        switch (opzione) {
+            case 't':
+                num_workers = strtol(optarg, NULL, 10);
+                if (num_workers == 0)
+                    num_workers = sysconf(_SC_NPROCESSORS_ONLN); // Un worker per ogni core
+                if (num_workers < 1) {
+                    printf("Il numero di thread deve essere positivo.\n");
+                    exit(1);
                 }
+                break;
+            case 'm':
+                // Un frame deve poter contenere almeno quanto si può inviare con i frame a 16 bit
+                max_frame = strtol(optarg, NULL, 10);
+                if (max_frame < MIN_MAX_FRAME_LEN) {
+                    printf("La lunghezza massima di un frame deve essere almeno %d byte.\n", MIN_MAX_FRAME_LEN);
+                    exit(1);
+                }
+                set_max_frame_len(max_frame);
+                break;
+            case 'z':
+                soglia = strtol(optarg, NULL, 10);
+                if (soglia < 0) {
+                    printf("La soglia di compressione non può essere negativa.\n");
+                    exit(1);
+                }
+                set_compression_threshold(soglia);
+                break;
+            case 'c':
+                if (strcmp(optarg, "none") == 0)
+                    politica = COMMIT_NONE;
+                else if (strcmp(optarg, "always") == 0)
+                    politica = COMMIT_ALWAYS;
+                else {
+                    politica = COMMIT_INTERVAL;
+                    intervallo = strtol(optarg, NULL, 10);
+                    if (intervallo < 1) {
+                        printf("La politica dei commit deve essere 'none', 'always' o un numero positivo di millisecondi.\n");
+                        exit(1);
+                    }
+                }
+                break;
+            case 's':
+                archivio = find_storage_engine(optarg);
+                if (archivio == NULL) {
+                    printf("L'archivio deve essere 'file', 'memoria' o 'log'.\n");
+                    exit(1);
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
 
-                // Verifico ed eseguo il comando ricevuto
-                run_client_command(i, buffer);
-            }
+    // Si usa la porta passata come parametro all'avvio o quella di default se non viene specificata
+    if (optind < argc) {
+        porta = strtol(argv[optind], NULL, 10);
+        if (porta < 1024) {
+            printf("Le prime 1024 porte sono riservate\n");
+            exit(1);
+        }
+    } else
+        porta = DEFAULT_SERVER_PORT;
+
+    // Un client che chiude la connessione mentre gli si inviano dati non deve terminare il server (SIGPIPE)
+    signal(SIGPIPE, SIG_IGN);
+
+    // Permetto al server di gestire più dei 1024 descrittori concessi di default
+    max_connessioni = raise_fd_limit();
+    if (max_connessioni == -1)
+        max_connessioni = FD_SETSIZE;
+    connessioni = calloc(max_connessioni, sizeof(struct connessione*));
+    workers = calloc(num_workers, sizeof(struct worker));
+    if (connessioni == NULL || workers == NULL) {
+        perror("Impossibile allocare le strutture del server");
+        exit(1);
+    }
+    if (init_register(max_connessioni) == -1 || init_hash_table(&credenziali, 0) == -1 ||
+        init_hash_table(&sequenze, 0) == -1)
+        exit(1);
+
+    if (init_group_commit(politica, intervallo) == -1 || start_activity_logger(ACTIVITY_LOG_FILE) == -1)
+        exit(1);
+
+    /*
+     * Lo stato del server riparte dall'ultimo snapshot, se c'è, e l'archivio dalle scritture successive: l'avvio non
+     * rilegge tutta la storia. Le credenziali vengono lette una volta sola: da qui in poi registrazioni e login non
+     * rileggono l'archivio.
+     */
+    snapshot = open_server_snapshot(&stato);
+    if (restore_server_state(snapshot) == -1 || load_show_notifies(snapshot) == -1 || archivio->open(snapshot) == -1 ||
+        load_users() == -1 || start_snapshot_thread() == -1)
+        exit(1);
+
+    #ifdef DEBUG
+    printf("Archivio: '%s'.\n", archivio->nome);
+    #endif
+
+    // Ogni worker ha il proprio socket di ascolto e il proprio event loop
+    for (i = 0; i < num_workers; i++)
+        if (worker_init(&workers[i], i, porta) == -1)
+            exit(1);
+
+    printf("************ SERVER STARTED ************\n");
+    #ifdef DEBUG
+    printf("Worker avviati: %d.\n", num_workers);
+    #endif
+
+    // Il worker 0 monitora anche lo stdin (se non è un terminale o una pipe, per esempio /dev/null, la console non è disponibile)
+    if (reactor_add(&workers[0].reactor, STDIN_FILENO, REACTOR_READ) == -1)
+        printf("Lo stdin non può essere monitorato: console di amministrazione disabilitata.\n");
+
+    // Avvio gli altri worker in thread separati
+    for (i = 1; i < num_workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]) != 0) {
+            perror("Impossibile avviare un worker");
+            exit(1);
         }
     }
+
+    // Stampa la lista di comandi disponibili
+    print_auth_commands();
+    printf(">");
+    fflush(stdout);
+
+    // Il thread principale esegue il worker 0
+    workers[0].thread = pthread_self();
+    worker_loop(&workers[0]);
+
+    return 0;
 }
\ No newline at end of file
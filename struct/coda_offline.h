@@ -0,0 +1,25 @@
+#include <time.h>
+#include "../costanti.h"
+
+/*
+ * Messaggi pendenti inviati da un mittente a un utente offline
+ */
+struct mittente_offline {
+    char username[USERNAME_LEN]; // Username del mittente
+    int numero; // Numero di messaggi pendenti
+    time_t ultimo; // Timestamp del messaggio pendente più recente
+    struct mittente_offline* next; // Mittente successivo (nell'ordine del primo messaggio)
+};
+
+/*
+ * Coda dei messaggi pendenti di un destinatario. Su disco è un file in cui ogni messaggio aggiunge in fondo
+ * una riga "mittente numero timestamp journal" (il numero del record del journal che l'ha registrato, assente
+ * nelle righe scritte dalle versioni precedenti); 'hanging' lo riscrive con la sola riga "@journal".
+ * In memoria se ne tiene il riepilogo per mittente, così registrare un messaggio costa una sola scrittura in append
+ * e 'hanging' non deve rileggere il file.
+ */
+struct coda_offline {
+    struct mittente_offline* primo; // Primo mittente (NULL se non ci sono messaggi pendenti)
+    struct mittente_offline* ultimo; // Ultimo mittente
+    unsigned int applicato; // Ultimo record del journal applicato alla coda (0 se nessuno)
+};
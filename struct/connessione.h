@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <pthread.h>
+#include "../util/messaggi.h"
+
+/*
+ * Stato della sessione di un device
+ */
+enum stato_sessione {
+    SESSIONE_ANONIMA, // Il device non ha ancora eseguito il login: può solo registrarsi o autenticarsi
+    SESSIONE_AUTENTICATA, // Login eseguito: la connessione è associata a un utente
+    SESSIONE_CHIUSA // Il device ha eseguito il logout: la connessione verrà chiusa
+};
+
+/*
+ * Stato del dialogo in corso con un device. Ogni frame ricevuto fa avanzare la macchina a stati:
+ * COMANDO -> CAMPI -> (esecuzione) -> COMANDO, oppure, per i comandi che ricevono un elenco,
+ * ELENCO -> (esecuzione per ogni elemento) -> ... -> terminatore -> COMANDO.
+ */
+enum stato_richiesta {
+    RICHIESTA_COMANDO, // In attesa del nome di un nuovo comando
+    RICHIESTA_CAMPI, // In attesa dei campi del comando ricevuto
+    RICHIESTA_ELENCO // In attesa del primo campo del prossimo elemento dell'elenco (o del terminatore)
+};
+
+/*
+ * Richiesta di un device in fase di ricezione: il comando e i campi arrivati finora.
+ * I campi vengono accumulati frame dopo frame e il comando viene eseguito solo quando sono completi.
+ */
+struct richiesta {
+    enum stato_richiesta stato; // Stato del dialogo
+    int comando; // Indice del comando nella tabella dei comandi del server (-1 se sconosciuto)
+    uint32_t id; // Identificativo della richiesta (da PROTOCOL_PIPELINE), ripetuto in tutte le risposte
+    int ricevuti; // Numero di campi già ricevuti
+    char* stringhe[MAX_CAMPI]; // Campi di tipo stringa (nella posizione del campo, puntano dentro 'spazio')
+    int interi[MAX_CAMPI]; // Campi di tipo intero (nella posizione del campo)
+    char* spazio; // Caratteri dei campi di tipo stringa: viene allocato della dimensione della richiesta
+    int capacita; // Dimensione di 'spazio'
+};
+
+/*
+ * Stato che il server mantiene per ogni connessione con un device
+ */
+struct connessione {
+    int socket; // Socket della connessione
+    int worker; // Indice del worker (thread) che gestisce la connessione
+    enum stato_sessione sessione; // Stato della sessione
+    char username[USERNAME_LEN]; // Utente che ha eseguito il login (se la sessione è autenticata)
+    int versione; // Versione del protocollo negoziata con il device (vedi OP_HELLO)
+    int codec; // Codec con cui si comprimono i messaggi per il device (CODEC_NONE finché non si negozia OP_FEATURES)
+    int max_frame; // Lunghezza massima dei frame (con lunghezza varint) che il device accetta (vedi OP_CAPABILITIES)
+
+    /*
+     * Conferma cumulativa (OP_MESSAGES_ACKED) dei messaggi OP_CHAT_MESSAGE registrati e non ancora confermati:
+     * viene inviata quando arriva un messaggio per un'altra conversazione o dopo aver elaborato tutti i frame
+     * disponibili, così una raffica di messaggi riceve una sola conferma
+     */
+    char conferma_destinatario[USERNAME_LEN]; // Destinatario dei messaggi da confermare ("" se non ce ne sono)
+    uint32_t conferma_sequenza; // Numero di sequenza dell'ultimo messaggio registrato
+    uint32_t epoca; // Sessione del device a cui appartengono i numeri di sequenza (vedi OP_SESSION; 0 se non l'ha inviata)
+
+    /*
+     * Serializza gli invii sul socket: un worker può inviare notifiche (per esempio NOW_ONLINE)
+     * anche ai client gestiti da un altro worker, e una notifica composta da più campi non deve
+     * mescolarsi con le risposte inviate dal worker proprietario.
+     */
+    pthread_mutex_t lock;
+
+    struct buffer_ricezione ricezione; // Byte ricevuti dal device e stato del parser dei frame
+    struct richiesta richiesta; // Richiesta in corso di ricezione
+    char* espanso; // Corpo decompresso dell'ultimo messaggio compresso ricevuto (vedi OP_COMPRESSED)
+    int capacita_espanso; // Dimensione di 'espanso'
+
+    struct coda_invio uscita; // Frame in attesa di essere inviati al device (protetta da 'lock')
+    uint32_t eventi; // Eventi attualmente monitorati sul socket (protetto da 'lock')
+    int sospesa; // Vale 1 se la lettura delle richieste è sospesa perché la coda di invio è troppo piena
+};
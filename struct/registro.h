@@ -1,8 +1,10 @@
 #include "../costanti.h"
+#include "../util/tabella_hash.h"
 
 struct record_registro {
     char username[USERNAME_LEN]; // Username dell'utente
     int port; // Porta di ascolto di un device
+    int versione; // Versione del protocollo negoziata con il device (comunicata ai peer da PROTOCOL_HANDSHAKE)
 
     /*
      * Socket di un device (grazie a questo posso individuare quale utente mi sta inviando messaggi).
@@ -12,5 +14,24 @@ struct record_registro {
 
     time_t login_timestamp; // Timestamp di login
     time_t logout_timestamp; // Timestamp di logout. Vale 0 se l'utente è online.
-    struct record_registro* next; // Elemento successivo (è una lista)
+    struct record_registro* next; // Record successivo nell'ordine di inserimento nel registro
+
+    // Record precedente e successivo nell'elenco degli utenti online (solo se l'utente è online)
+    struct record_registro* prev_online;
+    struct record_registro* next_online;
+};
+
+/*
+ * Registro del server: ogni record è raggiungibile in tempo costante sia dall'username (tabella hash) sia dal
+ * socket del device (tabella indicizzata per socket). Gli utenti online formano un elenco a parte, così chi
+ * deve raggiungerli tutti (il comando 'list' e la notifica dei login) non scorre anche quelli offline.
+ */
+struct registro {
+    struct tabella_hash utenti; // Record indicizzati per username
+    struct record_registro** per_socket; // Record dell'utente connesso su ciascun socket (NULL se non c'è)
+    int max_socket; // Dimensione di 'per_socket'
+    struct record_registro* primo; // Primo record inserito (i record formano una lista nell'ordine di inserimento)
+    struct record_registro* ultimo; // Ultimo record inserito
+    struct record_registro* online; // Primo utente online (gli altri seguono tramite 'next_online')
+    struct record_registro* ultimo_online; // Ultimo utente online
 };
@@ -0,0 +1,22 @@
+#include <stdint.h>
+#include "../costanti.h"
+
+/*
+ * Numero di sequenza dell'ultimo messaggio OP_CHAT_MESSAGE registrato per un destinatario
+ */
+struct sequenza_registrata {
+    char destinatario[USERNAME_LEN];
+    uint32_t sequenza;
+    struct sequenza_registrata* next;
+};
+
+/*
+ * Messaggi OP_CHAT_MESSAGE registrati per un mittente. I numeri di sequenza crescono per tutta la sessione del suo
+ * device (vedi OP_SESSION), anche attraverso le riconnessioni: quando il mittente inizia una nuova sessione i numeri
+ * ripartono da capo e quelli registrati vengono dimenticati. La sessione 0 è quella dei device che non inviano
+ * OP_SESSION e termina al login successivo.
+ */
+struct sequenze_mittente {
+    uint32_t sessione; // Sessione del device a cui si riferiscono i numeri di sequenza
+    struct sequenza_registrata* registrati; // Ultimo messaggio registrato di ogni conversazione (lista)
+};
@@ -0,0 +1,20 @@
+#include "../costanti.h"
+
+/*
+ * Notifiche di show non ancora recapitate a un mittente, per uno dei destinatari che hanno letto i suoi messaggi
+ */
+struct show_pendente {
+    char destinatario[USERNAME_LEN]; // Destinatario che ha letto i messaggi pendenti
+    int numero; // Numero di notifiche non recapitate
+    struct show_pendente* next; // Destinatario successivo (nell'ordine della prima notifica)
+};
+
+/*
+ * Notifiche di show non recapitate a un mittente. Su disco c'è un unico file (SHOW_LOG_FILE) in cui ogni
+ * evento aggiunge in fondo una riga: "mittente:destinatario" per una nuova notifica, "mittente:destinatario:N"
+ * quando le notifiche della coppia diventano N (0 una volta recapitate); la prima riga, "@generazione", distingue
+ * il file da quelli precedenti (vedi generazione_show nel server). Il file viene riletto solo all'avvio.
+ */
+struct show_pendenti {
+    struct show_pendente* primo; // Primo destinatario (NULL se non ci sono notifiche da recapitare)
+};
@@ -0,0 +1,259 @@
+/**********************************************
+ *                                            *
+ *       Test del journal delle scritture     *
+ *                                            *
+ **********************************************/
+
+#include <linux/limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../util/journal.h"
+
+#define PRIMO_NUMERO 0xFFFFFFFDu // Numero del primo record: durante il test la numerazione riprende da 1
+#define MAX_LETTI 16 // Record riapplicati che il test registra
+
+int errori = 0; // Controlli falliti
+char path[PATH_MAX]; // Path del journal (il secondo segmento è "path.1")
+char path_segmento[PATH_MAX]; // Path del secondo segmento
+unsigned int letti[MAX_LETTI]; // Numeri dei record riapplicati all'apertura, in ordine
+int num_letti = 0;
+int campi_corretti = 1; // Vale 0 se un record riapplicato non contiene i campi con cui è stato scritto
+
+/*
+ * Segnala il controllo fallito se 'condizione' è falsa
+ */
+void check(int condizione, char* descrizione) {
+    if (condizione)
+        return;
+    fprintf(stderr, "Controllo fallito: %s\n", descrizione);
+    errori++;
+}
+
+/*
+ * Pone in 'campo' il primo campo del record numero 'numero'
+ */
+void record_field(unsigned int numero, char* campo) {
+    sprintf(campo, "record %u", numero);
+}
+
+/*
+ * Registra il record riapplicato da open_journal() e controlla i suoi campi
+ */
+void collect_record(struct record_journal* record, void* contesto) {
+    char campo[32];
+
+    record_field(record->numero, campo);
+    campi_corretti = campi_corretti && record->tipo == 1 && record->num_campi == 2 &&
+                     strcmp(record->campi[0], campo) == 0 && strcmp(record->campi[1], "dati") == 0;
+    if (num_letti < MAX_LETTI)
+        letti[num_letti] = record->numero;
+    num_letti++;
+}
+
+/*
+ * Apre il journal e controlla che siano stati riapplicati, in ordine, i record 'attesi'
+ */
+void open_and_check(const unsigned int* attesi, int num) {
+    int i, ordinati;
+
+    check(open_journal(path, collect_record, NULL) == 0, "apertura del journal");
+    check(num_letti == num, "numero di record riapplicati");
+    for (i = 0, ordinati = 1; i < num && i < num_letti; i++)
+        ordinati = ordinati && letti[i] == attesi[i];
+    check(ordinati, "ordine dei record riapplicati");
+    check(campi_corretti, "campi dei record riapplicati");
+}
+
+/*
+ * Aggiunge al journal un record e controlla che riceva il numero 'atteso'
+ */
+void append_record(unsigned int atteso) {
+    struct record_journal record;
+    char campo[32];
+
+    record_field(atteso, campo);
+    record.tipo = 1;
+    record.timestamp = time(NULL);
+    record.num_campi = 2;
+    record.campi[0] = campo;
+    record.campi[1] = "dati";
+    check(append_to_journal(&record) != -1 && record.numero == atteso, "numero del record aggiunto");
+}
+
+/*
+ * Elimina gli ultimi 'byte' byte del file 'path'
+ */
+void truncate_tail(char* path, off_t byte) {
+    struct stat info;
+
+    check(stat(path, &info) == 0 && truncate(path, info.st_size - byte) == 0, "troncamento del journal");
+}
+
+/*
+ * Modifica un byte del record con il campo 'campo' nel file 'path' (il record non è più integro)
+ */
+void corrupt_record(char* path, char* campo) {
+    char contenuto[4096];
+    size_t len, dim_campo = strlen(campo) + 1, pos;
+    FILE* file;
+
+    file = fopen(path, "r+");
+    if (file == NULL) {
+        check(0, "apertura del segmento da modificare");
+        return;
+    }
+    len = fread(contenuto, 1, sizeof(contenuto), file);
+    for (pos = 0; pos + dim_campo <= len && memcmp(contenuto + pos, campo, dim_campo) != 0; pos++)
+        ;
+    check(pos + dim_campo <= len, "record da modificare");
+    if (pos + dim_campo <= len) {
+        fseek(file, pos, SEEK_SET);
+        fputc('R', file);
+    }
+    fclose(file);
+}
+
+/*
+ * Scrive l'intestazione di un journal vuoto il cui primo record è 'primo' (stesso formato di util/journal.c)
+ */
+void create_journal(uint32_t primo) {
+    uint32_t intestazione[2] = {primo, 0};
+    FILE* file;
+
+    file = fopen(path, "w");
+    check(file != NULL && fwrite("JOURNAL1", 1, 8, file) == 8 && fwrite(intestazione, sizeof(intestazione), 1, file) == 1,
+          "creazione del journal");
+    if (file != NULL)
+        fclose(file);
+}
+
+/*
+ * Prima esecuzione: i record arrivano a 0xFFFFFFFF, poi un checkpoint fa proseguire le scritture (da 1) nell'altro
+ * segmento e il processo termina prima di concluderlo: entrambi i segmenti contengono record
+ */
+void write_both_segments(void) {
+    const unsigned int attesi[] = {0};
+
+    create_journal(PRIMO_NUMERO);
+    open_and_check(attesi, 0);
+    check(get_last_journal_record() == PRIMO_NUMERO - 1, "ultimo record di un journal senza record");
+    append_record(PRIMO_NUMERO);
+    append_record(PRIMO_NUMERO + 1);
+    append_record(PRIMO_NUMERO + 2);
+    check(get_last_journal_record() == UINT32_MAX, "ultimo record prima della nuova numerazione");
+    check(begin_journal_checkpoint() == 0, "inizio del checkpoint");
+    append_record(1);
+    append_record(2);
+    append_record(3);
+    check(get_first_journal_record() == PRIMO_NUMERO, "primo record durante il checkpoint");
+}
+
+/*
+ * Il journal viene riaperto: prima i record del vecchio segmento, poi quelli del segmento corrente
+ */
+void replay_both_segments(void) {
+    const unsigned int attesi[] = {PRIMO_NUMERO, PRIMO_NUMERO + 1, PRIMO_NUMERO + 2, 1, 2, 3};
+
+    open_and_check(attesi, 6);
+    check(get_first_journal_record() == PRIMO_NUMERO, "primo record dopo la riapertura");
+    check(get_last_journal_record() == 3, "ultimo record dopo la riapertura");
+}
+
+/*
+ * Il record 2 non è integro (CRC errato): si riapplicano solo i record precedenti e il numero 2 viene riassegnato
+ */
+void replay_corrupted(void) {
+    const unsigned int attesi[] = {PRIMO_NUMERO, PRIMO_NUMERO + 1, PRIMO_NUMERO + 2, 1};
+
+    open_and_check(attesi, 4);
+    append_record(2);
+}
+
+/*
+ * Il record 2 è troncato: viene eliminato e il numero 2 riassegnato. Il checkpoint concluso svuota il vecchio segmento.
+ */
+void replay_truncated(void) {
+    const unsigned int attesi[] = {PRIMO_NUMERO, PRIMO_NUMERO + 1, PRIMO_NUMERO + 2, 1};
+
+    open_and_check(attesi, 4);
+    append_record(2);
+    check(begin_journal_checkpoint() == 0 && end_journal_checkpoint() == 0, "checkpoint");
+}
+
+/*
+ * Dopo il checkpoint restano solo i record del segmento corrente
+ */
+void replay_after_checkpoint(void) {
+    const unsigned int attesi[] = {1, 2};
+
+    open_and_check(attesi, 2);
+    check(get_first_journal_record() == 1, "primo record dopo il checkpoint");
+    check(get_last_journal_record() == 2, "ultimo record dopo il checkpoint");
+}
+
+/*
+ * Esegue 'fase' in un processo figlio (lo stato del journal è del processo: ogni fase lo riapre da capo, come il server
+ * al riavvio). Se nel figlio fallisce un controllo si segnala la fase 'nome'.
+ */
+void run_phase(void (*fase)(void), char* nome) {
+    pid_t figlio;
+    int stato;
+
+    fflush(stdout);
+    fflush(stderr);
+    figlio = fork();
+    if (figlio == 0) {
+        errori = 0; // Si contano solo i controlli della fase
+        fase();
+        exit(errori > 0 ? 1 : 0);
+    }
+    check(figlio != -1 && waitpid(figlio, &stato, 0) == figlio && WIFEXITED(stato) && WEXITSTATUS(stato) == 0, nome);
+}
+
+/*
+ * Scrive un journal in due segmenti con una numerazione che riprende da 1, lo riapre più volte dopo averne
+ * danneggiato (CRC) o troncato l'ultimo record e controlla l'ordine dei record riapplicati.
+ * Il journal viene scritto in una cartella temporanea, cancellata alla fine.
+ */
+int main(void) {
+    char cartella[] = "/tmp/test_journal.XXXXXX";
+
+    if (mkdtemp(cartella) == NULL) {
+        perror("Impossibile preparare il test");
+        return 1;
+    }
+    snprintf(path, PATH_MAX, "%s/journal", cartella);
+    snprintf(path_segmento, PATH_MAX, "%s/journal.1", cartella);
+
+    run_phase(write_both_segments, "fase: scrittura in due segmenti");
+    run_phase(replay_both_segments, "fase: riapertura con due segmenti");
+    corrupt_record(path_segmento, "record 2");
+    run_phase(replay_corrupted, "fase: riapertura con un record danneggiato");
+    truncate_tail(path_segmento, 3);
+    run_phase(replay_truncated, "fase: riapertura con un record troncato");
+    run_phase(replay_after_checkpoint, "fase: riapertura dopo il checkpoint");
+
+    // Confronto dei numeri dei record in aritmetica modulare
+    check(is_journal_record_applied(5, 5) && is_journal_record_applied(4, 5) && !is_journal_record_applied(6, 5),
+          "record applicati");
+    check(!is_journal_record_applied(1, 0), "nessun record applicato");
+    check(is_journal_record_applied(UINT32_MAX, 1) && !is_journal_record_applied(1, UINT32_MAX) &&
+          !is_journal_record_applied(2, UINT32_MAX), "record applicati dopo la nuova numerazione");
+
+    remove(path);
+    remove(path_segmento);
+    rmdir(cartella);
+
+    if (errori > 0) {
+        fprintf(stderr, "Test del journal: %d controlli falliti.\n", errori);
+        return 1;
+    }
+    printf("Test del journal superati.\n");
+    return 0;
+}
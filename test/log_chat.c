@@ -0,0 +1,136 @@
+/**********************************************
+ *                                            *
+ *      Test del log binario delle chat       *
+ *                                            *
+ **********************************************/
+
+#include <linux/limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../util/cache_file.h"
+#include "../util/log_chat.h"
+
+#define NUM_MESSAGGI 2100 // Più di due segmenti: il log contiene due piedi
+#define PRIMO_TIMESTAMP 1000000 // Istante del primo messaggio (ogni messaggio è registrato un secondo dopo il precedente)
+
+int errori = 0; // Controlli falliti
+
+/*
+ * Segnala il controllo fallito se 'condizione' è falsa
+ */
+void check(int condizione, char* descrizione) {
+    if (condizione)
+        return;
+    fprintf(stderr, "Controllo fallito: %s\n", descrizione);
+    errori++;
+}
+
+/*
+ * Pone in 'testo' il testo del messaggio numero 'seq'
+ */
+void message_text(unsigned long long seq, char* testo) {
+    sprintf(testo, "messaggio %llu", seq);
+}
+
+/*
+ * Rilegge dall'inizio il log 'path' e controlla che contenga, in ordine, i messaggi da 1 a 'ultimo' scritti dal test.
+ * Controlla poi che la ricerca per numero di sequenza e per istante (che usa i piedi dei segmenti) trovi 'cercato'.
+ */
+void check_log(char* path, unsigned long long ultimo, unsigned long long cercato) {
+    struct lettore_chat lettore;
+    struct messaggio_chat messaggio;
+    char testo[64];
+    unsigned long long seq = 0;
+    int ordinati = 1;
+
+    check(open_chat_reader(&lettore, path) == 1, "apertura del log");
+    while (next_chat_message(&lettore, &messaggio)) {
+        seq++;
+        message_text(seq, testo);
+        ordinati = ordinati && messaggio.seq == seq && messaggio.timestamp == PRIMO_TIMESTAMP + (time_t) seq &&
+                   messaggio.len_testo == strlen(testo) && memcmp(messaggio.testo, testo, messaggio.len_testo) == 0 &&
+                   messaggio.len_mittente == 5 && memcmp(messaggio.mittente, seq % 2 ? "alice" : "bob__", 5) == 0;
+    }
+    check(ordinati, "messaggi riletti in ordine e integri");
+    check(seq == ultimo, "numero di messaggi riletti");
+
+    seek_chat_sequence(&lettore, cercato);
+    check(next_chat_message(&lettore, &messaggio) && messaggio.seq == cercato, "ricerca per numero di sequenza");
+    seek_chat_time(&lettore, PRIMO_TIMESTAMP + (time_t) cercato);
+    check(next_chat_message(&lettore, &messaggio) && messaggio.seq == cercato, "ricerca per istante");
+    close_chat_reader(&lettore);
+
+    check(last_chat_journal_record(path) == ultimo, "ultimo record del journal registrato nel log");
+}
+
+/*
+ * Aggiunge al log 'path' i messaggi da 'primo' a 'ultimo' (il record del journal di ogni messaggio è il suo numero)
+ */
+void append_messages(struct cache_file* cache, char* path, unsigned long long primo, unsigned long long ultimo) {
+    char testo[64];
+    unsigned long long seq;
+
+    for (seq = primo; seq <= ultimo; seq++) {
+        message_text(seq, testo);
+        if (append_journaled_chat_message(cache, path, seq % 2 ? "alice" : "bob__", testo,
+                                          PRIMO_TIMESTAMP + (time_t) seq, seq) == NULL) {
+            check(0, "scrittura di un messaggio");
+            return;
+        }
+    }
+}
+
+/*
+ * Elimina gli ultimi 'byte' byte del file 'path'
+ */
+void truncate_tail(char* path, off_t byte) {
+    struct stat info;
+
+    check(stat(path, &info) == 0 && truncate(path, info.st_size - byte) == 0, "troncamento del log");
+}
+
+/*
+ * Scrive un log con più segmenti, lo rilegge, ne tronca l'ultimo record a metà (come un crash durante la scrittura)
+ * e controlla che i lettori ignorino il record troncato e che la scrittura successiva lo sostituisca.
+ * Il log viene scritto in una cartella temporanea, cancellata alla fine.
+ */
+int main(void) {
+    char cartella[] = "/tmp/test_log_chat.XXXXXX";
+    char path[PATH_MAX]; // Path del log
+    struct cache_file cache;
+
+    if (mkdtemp(cartella) == NULL || init_file_cache(&cache, 4) == -1) {
+        perror("Impossibile preparare il test");
+        return 1;
+    }
+    snprintf(path, PATH_MAX, "%s/alice-bob", cartella);
+
+    // Scrittura e rilettura
+    append_messages(&cache, path, 1, NUM_MESSAGGI);
+    close_cached_file(&cache, path);
+    check_log(path, NUM_MESSAGGI, 1500);
+
+    // Record troncato in fondo al log (mancano la lunghezza finale e un byte del testo): i lettori lo ignorano
+    truncate_tail(path, 5);
+    check_log(path, NUM_MESSAGGI - 1, 1500);
+
+    // La scrittura successiva elimina il record troncato e la numerazione riprende da lì
+    append_messages(&cache, path, NUM_MESSAGGI, NUM_MESSAGGI + 1);
+    close_cached_file(&cache, path);
+    check_log(path, NUM_MESSAGGI + 1, NUM_MESSAGGI);
+
+    free_file_cache(&cache);
+    remove(path);
+    rmdir(cartella);
+
+    if (errori > 0) {
+        fprintf(stderr, "Test del log delle chat: %d controlli falliti.\n", errori);
+        return 1;
+    }
+    printf("Test del log delle chat superati.\n");
+    return 0;
+}
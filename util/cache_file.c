@@ -0,0 +1,145 @@
+/************************************************************
+ *                                                          *
+ *          Cache LRU di file aperti in append              *
+ *                                                          *
+ ************************************************************/
+
+#include "cache_file.h"
+#include "file.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Inizializza una cache vuota che tiene aperti al massimo 'capacita' file.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_file_cache(struct cache_file* cache, unsigned int capacita) {
+    if (init_hash_table(&cache->aperti, capacita) == -1)
+        return -1;
+
+    cache->recente = NULL;
+    cache->vecchio = NULL;
+    cache->capacita = capacita > 0 ? capacita : 1;
+    return 0;
+}
+
+/*
+ * Toglie l'elemento dalla lista dei file in ordine di utilizzo
+ */
+static void unlink_cached_file(struct cache_file* cache, struct file_aperto* elemento) {
+    if (elemento->prev != NULL)
+        elemento->prev->next = elemento->next;
+    else
+        cache->recente = elemento->next;
+    if (elemento->next != NULL)
+        elemento->next->prev = elemento->prev;
+    else
+        cache->vecchio = elemento->prev;
+}
+
+/*
+ * Inserisce l'elemento in testa alla lista dei file in ordine di utilizzo (= usato più di recente)
+ */
+static void push_cached_file(struct cache_file* cache, struct file_aperto* elemento) {
+    elemento->prev = NULL;
+    elemento->next = cache->recente;
+    if (cache->recente != NULL)
+        cache->recente->prev = elemento;
+    else
+        cache->vecchio = elemento;
+    cache->recente = elemento;
+}
+
+/*
+ * Chiude il file dell'elemento e lo libera (l'elemento deve essere già fuori dalla tabella e dalla lista)
+ */
+static void free_cached_file(struct file_aperto* elemento) {
+    if (fclose(elemento->file) != 0)
+        fprintf(stderr, "Errore durante la chiusura del file '%s' : %s\n", elemento->path, strerror(errno));
+    free(elemento);
+}
+
+/*
+ * Restituisce il file 'path' aperto in append (creandolo se non esiste), aprendolo solo se non è già nella cache.
+ * Il file è aperto anche in lettura ("a+"): chi scrive può rileggerne la fine (con pread() o mmap()).
+ * Restituisce NULL se non è possibile accedere al file.
+ * NB: i dati scritti restano nel buffer del file finché non si invoca fflush().
+ */
+FILE* get_cached_file(struct cache_file* cache, char* path) {
+    struct file_aperto* elemento;
+    size_t len;
+
+    // Se è già aperto lo segno come usato più di recente
+    elemento = find_in_hash_table(&cache->aperti, path);
+    if (elemento != NULL) {
+        unlink_cached_file(cache, elemento);
+        push_cached_file(cache, elemento);
+        return elemento->file;
+    }
+
+    // Se la cache è piena chiudo il file usato meno di recente
+    if (cache->aperti.num_elementi >= cache->capacita) {
+        elemento = cache->vecchio;
+        unlink_cached_file(cache, elemento);
+        remove_from_hash_table(&cache->aperti, elemento->path);
+        free_cached_file(elemento);
+    }
+
+    len = strlen(path) + 1;
+    elemento = malloc(sizeof(struct file_aperto) + len);
+    if (elemento == NULL) {
+        perror("Impossibile allocare un elemento della cache dei file");
+        return NULL;
+    }
+    memcpy(elemento->path, path, len);
+
+    elemento->file = open_or_create(path, "a+");
+    if (elemento->file == NULL) {
+        free(elemento);
+        return NULL;
+    }
+
+    if (insert_into_hash_table(&cache->aperti, path, elemento) == -1) {
+        free_cached_file(elemento);
+        return NULL;
+    }
+    push_cached_file(cache, elemento);
+
+    return elemento->file;
+}
+
+/*
+ * Restituisce 1 se il file 'path' è aperto nella cache, altrimenti 0
+ */
+int is_file_cached(struct cache_file* cache, char* path) {
+    return find_in_hash_table(&cache->aperti, path) != NULL ? 1 : 0;
+}
+
+/*
+ * Chiude il file 'path' se è nella cache (ad esempio prima di rinominarlo o cancellarlo)
+ */
+void close_cached_file(struct cache_file* cache, char* path) {
+    struct file_aperto* elemento = remove_from_hash_table(&cache->aperti, path);
+
+    if (elemento == NULL)
+        return;
+
+    unlink_cached_file(cache, elemento);
+    free_cached_file(elemento);
+}
+
+/*
+ * Chiude tutti i file della cache e la libera
+ */
+void free_file_cache(struct cache_file* cache) {
+    struct file_aperto* elemento;
+
+    while (cache->recente != NULL) {
+        elemento = cache->recente;
+        cache->recente = elemento->next;
+        free_cached_file(elemento);
+    }
+    cache->vecchio = NULL;
+    free_hash_table(&cache->aperti, NULL);
+}
@@ -0,0 +1,64 @@
+/************************************************************
+ *                                                          *
+ *          Cache LRU di file aperti in append              *
+ *                                                          *
+ ************************************************************/
+
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <stdio.h>
+#include "tabella_hash.h"
+
+/*
+ * File aperto nella cache
+ */
+struct file_aperto {
+    FILE* file;
+    struct file_aperto* prev; // File usato più di recente
+    struct file_aperto* next; // File usato meno di recente
+    char path[]; // Path del file (terminato), allocato insieme all'elemento
+};
+
+/*
+ * Cache dei file aperti in append, indicizzati per path. Quando è piena viene chiuso il file usato meno di recente,
+ * così i file su cui si scrive spesso restano aperti e non si paga un'apertura a ogni scrittura.
+ * NB: la cache non è thread-safe.
+ */
+struct cache_file {
+    struct tabella_hash aperti; // struct file_aperto* indicizzati per path
+    struct file_aperto* recente; // File usato più di recente
+    struct file_aperto* vecchio; // File usato meno di recente
+    unsigned int capacita; // Numero massimo di file aperti
+};
+
+/*
+ * Inizializza una cache vuota che tiene aperti al massimo 'capacita' file.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_file_cache(struct cache_file* cache, unsigned int capacita);
+
+/*
+ * Restituisce il file 'path' aperto in append (creandolo se non esiste), aprendolo solo se non è già nella cache.
+ * Il file è aperto anche in lettura ("a+"): chi scrive può rileggerne la fine (con pread() o mmap()).
+ * Restituisce NULL se non è possibile accedere al file.
+ * NB: i dati scritti restano nel buffer del file finché non si invoca fflush().
+ */
+FILE* get_cached_file(struct cache_file* cache, char* path);
+
+/*
+ * Restituisce 1 se il file 'path' è aperto nella cache, altrimenti 0
+ */
+int is_file_cached(struct cache_file* cache, char* path);
+
+/*
+ * Chiude il file 'path' se è nella cache (ad esempio prima di rinominarlo o cancellarlo)
+ */
+void close_cached_file(struct cache_file* cache, char* path);
+
+/*
+ * Chiude tutti i file della cache e la libera
+ */
+void free_file_cache(struct cache_file* cache);
+
+#endif
@@ -0,0 +1,273 @@
+/************************************************************
+ *                                                          *
+ *         Scritture su disco con commit di gruppo          *
+ *                                                          *
+ ************************************************************/
+
+#include "commit.h"
+#include "tabella_hash.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define TURNI_ERRORE 64 // Turni di cui si ricorda l'esito (chi aspetta viene svegliato subito dopo il proprio commit)
+
+static enum politica_commit politica = COMMIT_NONE;
+static long intervallo_ns; // Durata massima della raccolta di un commit con COMMIT_INTERVAL
+
+/*
+ * Stato dei commit, protetto da 'commit_lock'. Le scritture si accumulano nel turno in raccolta: quando il thread dei
+ * commit lo prende in carico inizia il turno successivo, quindi chi scrive durante un commit finisce nel prossimo.
+ */
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nuove_scritture = PTHREAD_COND_INITIALIZER; // Segnalata al thread dei commit
+static pthread_cond_t commit_terminato = PTHREAD_COND_INITIALIZER; // Segnalata a chi aspetta un commit
+static struct tabella_hash sporchi; // File scritti nel turno in raccolta: path -> descrittore duplicato (+1)
+static unsigned long long scritture_turno; // Scritture del turno in raccolta
+static int urgenti; // Scritture del turno in raccolta di cui qualcuno aspetta il commit
+static struct timespec scadenza; // Istante entro cui va eseguito il commit del turno in raccolta (COMMIT_INTERVAL)
+static long turno_corrente = 1; // Turno in raccolta
+static long turno_completato = 0; // Ultimo turno sincronizzato
+static char errore_turno[TURNI_ERRORE]; // Esito degli ultimi turni (1 = sincronizzazione fallita)
+static struct statistiche_commit statistiche;
+
+/*
+ * Restituisce l'istante corrente (orologio monotono) in nanosecondi
+ */
+static unsigned long long monotonic_ns(void) {
+    struct timespec istante;
+
+    clock_gettime(CLOCK_MONOTONIC, &istante);
+    return (unsigned long long) istante.tv_sec * 1000000000ULL + istante.tv_nsec;
+}
+
+/*
+ * Sincronizza e chiude il descrittore duplicato di un file del commit ('contesto' conta gli errori)
+ */
+static void sync_file(const char* path, void* valore, void* contesto) {
+    int fd = (int) (intptr_t) valore - 1;
+
+    if (fdatasync(fd) == -1) {
+        fprintf(stderr, "Impossibile sincronizzare il file '%s' : %s\n", path, strerror(errno));
+        (*(int*) contesto)++;
+    }
+    close(fd);
+}
+
+/*
+ * Thread dei commit: aspetta che ci sia un turno da sincronizzare, lo prende in carico e sincronizza i suoi file
+ */
+static void* commit_loop(void* arg) {
+    struct tabella_hash file; // File del turno preso in carico
+    unsigned long long scritture, num_file, inizio, durata;
+    long turno;
+    int errori;
+
+    (void) arg;
+    pthread_mutex_lock(&commit_lock);
+    for (;;) {
+        // Con COMMIT_INTERVAL si aspetta la scadenza del turno, a meno che qualcuno non aspetti già il commit
+        while (scritture_turno == 0 || (politica == COMMIT_INTERVAL && urgenti == 0)) {
+            if (scritture_turno == 0)
+                pthread_cond_wait(&nuove_scritture, &commit_lock);
+            else if (pthread_cond_timedwait(&nuove_scritture, &commit_lock, &scadenza) == ETIMEDOUT)
+                break;
+        }
+
+        // Prendo in carico il turno in raccolta e ne inizio uno nuovo
+        file = sporchi;
+        if (init_hash_table(&sporchi, 0) == -1) {
+            sporchi = file; // Riprovo più tardi con la stessa tabella
+            pthread_mutex_unlock(&commit_lock);
+            sleep(1);
+            pthread_mutex_lock(&commit_lock);
+            continue;
+        }
+        scritture = scritture_turno;
+        turno = turno_corrente++;
+        scritture_turno = 0;
+        urgenti = 0;
+        pthread_mutex_unlock(&commit_lock);
+
+        // Sincronizzo i file senza il lock: intanto gli altri thread continuano a scrivere nel turno successivo
+        errori = 0;
+        inizio = monotonic_ns();
+        visit_hash_table(&file, sync_file, &errori);
+        durata = monotonic_ns() - inizio;
+        num_file = file.num_elementi;
+        free_hash_table(&file, NULL);
+
+        pthread_mutex_lock(&commit_lock);
+        errore_turno[turno % TURNI_ERRORE] = errori > 0;
+        turno_completato = turno;
+        statistiche.commit++;
+        statistiche.scritture += scritture;
+        statistiche.file += num_file;
+        statistiche.ns_commit += durata;
+        if (durata > statistiche.ns_commit_max)
+            statistiche.ns_commit_max = durata;
+        if (errori > 0)
+            statistiche.errori++;
+        pthread_cond_broadcast(&commit_terminato);
+    }
+
+    return NULL;
+}
+
+/*
+ * Imposta la politica di durabilità ('intervallo_ms' è usato solo da COMMIT_INTERVAL) e avvia il thread dei commit.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_group_commit(enum politica_commit politica_scelta, int intervallo_ms) {
+    pthread_t thread;
+
+    politica = politica_scelta;
+    intervallo_ns = (long) intervallo_ms * 1000000L;
+    if (init_hash_table(&sporchi, 0) == -1)
+        return -1;
+
+    // Il thread serve anche con COMMIT_NONE: le scritture durabili vengono comunque sincronizzate
+    if (pthread_create(&thread, NULL, commit_loop, NULL) != 0) {
+        perror("Impossibile avviare il thread dei commit");
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+/*
+ * Da invocare dopo aver scritto su 'file' (identificato da 'path'), prima di chiuderlo: svuota il buffer del file e,
+ * se la politica lo richiede, lo aggiunge al prossimo commit. Se 'durabile' è 1 la scrittura viene sincronizzata
+ * qualunque sia la politica. Restituisce il turno da passare a wait_for_commit() (0 se non bisogna aspettare)
+ * o -1 in caso di errore.
+ */
+long commit_append(FILE* file, char* path, int durabile) {
+    int fd, attesa = durabile || politica == COMMIT_ALWAYS;
+    long turno;
+
+    if (fflush(file) != 0) {
+        fprintf(stderr, "Errore durante la scrittura del file '%s' : %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (politica == COMMIT_NONE && !durabile)
+        return 0;
+
+    pthread_mutex_lock(&commit_lock);
+
+    // Il file viene sincronizzato una volta sola per turno. Il descrittore viene duplicato: chi scrive può chiudere il file.
+    if (find_in_hash_table(&sporchi, path) == NULL) {
+        fd = dup(fileno(file));
+        if (fd == -1 || insert_into_hash_table(&sporchi, path, (void*) (intptr_t) (fd + 1)) == -1) {
+            perror("Impossibile aggiungere il file al commit");
+            if (fd != -1)
+                close(fd);
+            pthread_mutex_unlock(&commit_lock);
+            return -1;
+        }
+    }
+
+    // La prima scrittura del turno fissa la sua scadenza (e sveglia il thread dei commit, che può dormire senza limite)
+    if (scritture_turno++ == 0) {
+        clock_gettime(CLOCK_REALTIME, &scadenza); // pthread_cond_timedwait() usa CLOCK_REALTIME
+        scadenza.tv_sec += (scadenza.tv_nsec + intervallo_ns) / 1000000000L;
+        scadenza.tv_nsec = (scadenza.tv_nsec + intervallo_ns) % 1000000000L;
+        pthread_cond_signal(&nuove_scritture);
+    }
+    if (attesa && urgenti++ == 0)
+        pthread_cond_signal(&nuove_scritture);
+    turno = turno_corrente;
+
+    pthread_mutex_unlock(&commit_lock);
+
+    return attesa ? turno : 0;
+}
+
+/*
+ * Aspetta che la scrittura con il turno specificato sia su disco. Conviene invocarla dopo aver rilasciato i lock,
+ * così anche gli altri thread possono scrivere e unirsi al commit.
+ * Restituisce 0 in caso di successo, -1 se la sincronizzazione (o la scrittura del turno) è fallita.
+ */
+int wait_for_commit(long turno) {
+    unsigned long long inizio;
+    int ret;
+
+    if (turno <= 0)
+        return turno;
+
+    inizio = monotonic_ns();
+    pthread_mutex_lock(&commit_lock);
+    while (turno_completato < turno)
+        pthread_cond_wait(&commit_terminato, &commit_lock);
+    ret = errore_turno[turno % TURNI_ERRORE] ? -1 : 0;
+    statistiche.attese++;
+    statistiche.ns_attesa += monotonic_ns() - inizio;
+    pthread_mutex_unlock(&commit_lock);
+
+    return ret;
+}
+
+/*
+ * Sincronizza subito tutte le scritture non ancora su disco e aspetta che il commit termini (ad esempio alla chiusura)
+ */
+void flush_commits(void) {
+    long turno = 0;
+
+    pthread_mutex_lock(&commit_lock);
+    if (scritture_turno > 0) {
+        turno = turno_corrente;
+        urgenti++;
+        pthread_cond_signal(&nuove_scritture);
+    }
+    pthread_mutex_unlock(&commit_lock);
+
+    wait_for_commit(turno);
+}
+
+/*
+ * Restituisce il nome della politica specificata
+ */
+char* commit_policy_name(enum politica_commit politica_scelta) {
+    switch (politica_scelta) {
+        case COMMIT_INTERVAL:
+            return "a intervalli";
+        case COMMIT_ALWAYS:
+            return "a ogni scrittura";
+        default:
+            return "nessuna sincronizzazione";
+    }
+}
+
+/*
+ * Copia in 'copia' le statistiche dei commit
+ */
+void get_commit_stats(struct statistiche_commit* copia) {
+    pthread_mutex_lock(&commit_lock);
+    *copia = statistiche;
+    pthread_mutex_unlock(&commit_lock);
+}
+
+/*
+ * Stampa le statistiche dei commit
+ */
+void print_commit_stats(void) {
+    struct statistiche_commit copia;
+
+    get_commit_stats(&copia);
+
+    printf("Commit su disco (politica: %s", commit_policy_name(politica));
+    if (politica == COMMIT_INTERVAL)
+        printf(", ogni %ld ms", intervallo_ns / 1000000L);
+    printf("):\n");
+    printf("- commit: %llu (%llu falliti), %.2f scritture e %.2f file per commit\n", copia.commit, copia.errori,
+           copia.commit > 0 ? (double) copia.scritture / copia.commit : 0.0,
+           copia.commit > 0 ? (double) copia.file / copia.commit : 0.0);
+    printf("- durata di un commit: media %.3f ms, massima %.3f ms\n",
+           copia.commit > 0 ? copia.ns_commit / 1e6 / copia.commit : 0.0, copia.ns_commit_max / 1e6);
+    printf("- scritture in attesa del commit: %llu, attesa media %.3f ms\n", copia.attese,
+           copia.attese > 0 ? copia.ns_attesa / 1e6 / copia.attese : 0.0);
+}
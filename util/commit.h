@@ -0,0 +1,78 @@
+/************************************************************
+ *                                                          *
+ *         Scritture su disco con commit di gruppo          *
+ *                                                          *
+ ************************************************************/
+
+#ifndef COMMIT_H
+#define COMMIT_H
+
+#include <stdio.h>
+
+/*
+ * Politica di durabilità delle scritture. I file scritti vengono sincronizzati su disco (fdatasync()) da un thread
+ * dedicato, che sincronizza con un solo commit tutti i file scritti da quando è iniziato il commit precedente:
+ * più sono le scritture concorrenti, più grandi sono i commit e meno sincronizzazioni servono per scrittura.
+ */
+enum politica_commit {
+    COMMIT_NONE, // Nessuna sincronizzazione: le scritture arrivano su disco quando lo decide il sistema operativo
+    COMMIT_INTERVAL, // Un commit ogni N millisecondi: chi scrive non aspetta, si perdono al più N ms di scritture
+    COMMIT_ALWAYS // Chi scrive aspetta il commit che contiene la sua scrittura (commit di gruppo)
+};
+
+/*
+ * Statistiche (dall'avvio del programma) dei commit
+ */
+struct statistiche_commit {
+    unsigned long long commit; // Commit eseguiti
+    unsigned long long scritture; // Scritture sincronizzate dai commit
+    unsigned long long file; // File sincronizzati dai commit (un file scritto più volte nello stesso commit conta una volta)
+    unsigned long long ns_commit; // Durata complessiva dei commit
+    unsigned long long ns_commit_max; // Durata del commit più lungo
+    unsigned long long attese; // Scritture che hanno aspettato il proprio commit
+    unsigned long long ns_attesa; // Tempo complessivo di attesa di chi ha scritto
+    unsigned long long errori; // Commit in cui almeno un file non è stato sincronizzato
+};
+
+/*
+ * Imposta la politica di durabilità ('intervallo_ms' è usato solo da COMMIT_INTERVAL) e avvia il thread dei commit.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_group_commit(enum politica_commit politica, int intervallo_ms);
+
+/*
+ * Da invocare dopo aver scritto su 'file' (identificato da 'path'), prima di chiuderlo: svuota il buffer del file e,
+ * se la politica lo richiede, lo aggiunge al prossimo commit. Se 'durabile' è 1 la scrittura viene sincronizzata
+ * qualunque sia la politica. Restituisce il turno da passare a wait_for_commit() (0 se non bisogna aspettare)
+ * o -1 in caso di errore.
+ */
+long commit_append(FILE* file, char* path, int durabile);
+
+/*
+ * Aspetta che la scrittura con il turno specificato sia su disco. Conviene invocarla dopo aver rilasciato i lock,
+ * così anche gli altri thread possono scrivere e unirsi al commit.
+ * Restituisce 0 in caso di successo, -1 se la sincronizzazione (o la scrittura del turno) è fallita.
+ */
+int wait_for_commit(long turno);
+
+/*
+ * Sincronizza subito tutte le scritture non ancora su disco e aspetta che il commit termini (ad esempio alla chiusura)
+ */
+void flush_commits(void);
+
+/*
+ * Restituisce il nome della politica specificata
+ */
+char* commit_policy_name(enum politica_commit politica);
+
+/*
+ * Copia in 'copia' le statistiche dei commit
+ */
+void get_commit_stats(struct statistiche_commit* copia);
+
+/*
+ * Stampa le statistiche dei commit
+ */
+void print_commit_stats(void);
+
+#endif
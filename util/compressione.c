@@ -0,0 +1,382 @@
+/************************************************************
+ *                                                          *
+ *        Compressione dei dati scambiati sui socket        *
+ *                                                          *
+ ************************************************************/
+
+#include "compressione.h"
+#include "../costanti.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+ * Formato del codec LZ: una serie di sequenze, ciascuna composta da
+ * - un byte con il numero di letterali (4 bit alti) e la lunghezza della ripetizione meno LZ_MIN_MATCH (4 bit bassi);
+ *   il valore 15 indica che la lunghezza prosegue nei byte successivi (sommati finché non si trova un byte diverso da 255)
+ * - i letterali (byte copiati così come sono)
+ * - la distanza della ripetizione (2 byte, little endian) e la sua eventuale lunghezza estesa.
+ * L'ultima sequenza contiene solo i letterali: i dati compressi terminano subito dopo.
+ */
+#define LZ_HASH_BITS 12 // Bit dell'indice della tabella delle posizioni già viste
+#define LZ_MIN_MATCH 4 // Lunghezza minima di una ripetizione
+#define LZ_MAX_OFFSET 65535 // Distanza massima di una ripetizione
+
+static int soglia_compressione = COMPRESSION_THRESHOLD; // Lunghezza minima dei dati da comprimere
+
+/*
+ * Statistiche della compressione: vengono aggiornate con operazioni atomiche perché nel server
+ * comprimono e decomprimono tutti i worker
+ */
+static struct statistiche_compressione statistiche;
+
+/*
+ * Restituisce il tempo di CPU consumato finora dal thread chiamante, in nanosecondi
+ */
+static unsigned long long thread_cpu_time(void) {
+    struct timespec istante;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &istante) == -1)
+        return 0;
+    return (unsigned long long) istante.tv_sec * 1000000000ULL + istante.tv_nsec;
+}
+
+/*
+ * Somma 'valore' al contatore delle statistiche indicato
+ */
+static void add_stat(unsigned long long* contatore, unsigned long long valore) {
+    __atomic_fetch_add(contatore, valore, __ATOMIC_RELAXED);
+}
+
+/*
+ * Restituisce le funzionalità (FEATURE_*) supportate da questo programma
+ */
+int supported_features(void) {
+    #ifdef USE_ZLIB
+    return FEATURE_LZ | FEATURE_ZLIB;
+    #else
+    return FEATURE_LZ;
+    #endif
+}
+
+/*
+ * Sceglie il codec da usare tra quelli indicati da 'funzionalita' (supportati da entrambe le parti).
+ * Restituisce CODEC_NONE se non ce n'è nessuno.
+ */
+int choose_codec(int funzionalita) {
+    funzionalita &= supported_features();
+
+    // zlib è disponibile solo se è stato scelto in fase di compilazione: in tal caso si preferisce il suo rapporto
+    if (funzionalita & FEATURE_ZLIB)
+        return CODEC_ZLIB;
+    if (funzionalita & FEATURE_LZ)
+        return CODEC_LZ;
+    return CODEC_NONE;
+}
+
+/*
+ * Restituisce il nome del codec specificato
+ */
+char* codec_name(int codec) {
+    switch (codec) {
+        case CODEC_LZ:
+            return "lz";
+        case CODEC_ZLIB:
+            return "zlib";
+        default:
+            return "nessuno";
+    }
+}
+
+/*
+ * Imposta la soglia di compressione: i dati più corti di 'soglia' byte vengono inviati senza compressione
+ */
+void set_compression_threshold(int soglia) {
+    soglia_compressione = soglia;
+}
+
+/*
+ * Restituisce la soglia di compressione
+ */
+int get_compression_threshold(void) {
+    return soglia_compressione;
+}
+
+/*
+ * Legge 4 byte (anche non allineati)
+ */
+static uint32_t read_u32(const unsigned char* dati) {
+    uint32_t valore;
+
+    memcpy(&valore, dati, sizeof(uint32_t));
+    return valore;
+}
+
+/*
+ * Restituisce la posizione nella tabella delle posizioni dei 4 byte 'valore'
+ */
+static int lz_hash(uint32_t valore) {
+    return (valore * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * Scrive in 'uscita' la parte estesa di una lunghezza che nel byte iniziale della sequenza vale 15.
+ * Restituisce la nuova posizione in 'uscita' o -1 se non c'è spazio.
+ */
+static int lz_write_length(unsigned char* uscita, int pos, int max, int len) {
+    for (; len >= 255; len -= 255) {
+        if (pos >= max)
+            return -1;
+        uscita[pos++] = 255;
+    }
+    if (pos >= max)
+        return -1;
+    uscita[pos++] = len;
+
+    return pos;
+}
+
+/*
+ * Scrive in 'uscita' (a partire da 'pos') una sequenza con 'num_letterali' letterali e una ripetizione
+ * lunga 'match' byte a distanza 'distanza' ('match' vale 0 per l'ultima sequenza).
+ * Restituisce la nuova posizione in 'uscita' o -1 se non c'è spazio.
+ */
+static int lz_write_sequence(unsigned char* uscita, int pos, int max, const unsigned char* letterali,
+                             int num_letterali, int distanza, int match) {
+    if (pos >= max)
+        return -1;
+    uscita[pos++] = (num_letterali < 15 ? num_letterali : 15) << 4 |
+                    (match == 0 ? 0 : match - LZ_MIN_MATCH < 15 ? match - LZ_MIN_MATCH : 15);
+
+    if (num_letterali >= 15 && (pos = lz_write_length(uscita, pos, max, num_letterali - 15)) == -1)
+        return -1;
+    if (num_letterali > max - pos)
+        return -1;
+    memcpy(&uscita[pos], letterali, num_letterali);
+    pos += num_letterali;
+
+    if (match == 0)
+        return pos;
+
+    if (max - pos < 2)
+        return -1;
+    uscita[pos++] = distanza & 0xff;
+    uscita[pos++] = distanza >> 8;
+    if (match - LZ_MIN_MATCH >= 15 && (pos = lz_write_length(uscita, pos, max, match - LZ_MIN_MATCH - 15)) == -1)
+        return -1;
+
+    return pos;
+}
+
+/*
+ * Comprime 'len' byte con il codec LZ. Restituisce la lunghezza dei dati compressi o -1 se non stanno in 'max' byte.
+ */
+static int lz_compress(const unsigned char* dati, int len, unsigned char* uscita, int max) {
+    int posizioni[1 << LZ_HASH_BITS]; // Ultima posizione in cui sono stati visti 4 byte con lo stesso indice
+    int i = 0, inizio_letterali = 0, pos = 0, h, candidato, match;
+
+    for (h = 0; h < (1 << LZ_HASH_BITS); h++)
+        posizioni[h] = -1;
+
+    while (i + LZ_MIN_MATCH <= len) {
+        h = lz_hash(read_u32(&dati[i]));
+        candidato = posizioni[h];
+        posizioni[h] = i;
+        if (candidato < 0 || i - candidato > LZ_MAX_OFFSET || read_u32(&dati[candidato]) != read_u32(&dati[i])) {
+            i++;
+            continue;
+        }
+
+        // Estendo la ripetizione il più possibile
+        for (match = LZ_MIN_MATCH; i + match < len && dati[candidato + match] == dati[i + match]; match++)
+            ;
+
+        pos = lz_write_sequence(uscita, pos, max, &dati[inizio_letterali], i - inizio_letterali, i - candidato, match);
+        if (pos == -1)
+            return -1;
+        i += match;
+        inizio_letterali = i;
+    }
+
+    // Gli ultimi byte sono letterali
+    return lz_write_sequence(uscita, pos, max, &dati[inizio_letterali], len - inizio_letterali, 0, 0);
+}
+
+/*
+ * Legge la parte estesa di una lunghezza e la somma a '*lunghezza'.
+ * Restituisce la nuova posizione in 'dati' o -1 se i dati terminano prima o la lunghezza supera 'max'.
+ */
+static int lz_read_length(const unsigned char* dati, int pos, int len, int* lunghezza, int max) {
+    unsigned char byte;
+
+    do {
+        if (pos >= len)
+            return -1;
+        byte = dati[pos++];
+        *lunghezza += byte;
+        if (*lunghezza > max)
+            return -1;
+    } while (byte == 255);
+
+    return pos;
+}
+
+/*
+ * Decomprime 'len' byte compressi con il codec LZ.
+ * Restituisce la lunghezza dei dati decompressi o -1 se non sono validi o non stanno in 'max' byte.
+ */
+static int lz_decompress(const unsigned char* dati, int len, unsigned char* uscita, int max) {
+    int i = 0, pos = 0, num_letterali, match, distanza, k;
+    unsigned char sequenza;
+
+    while (i < len) {
+        sequenza = dati[i++];
+
+        num_letterali = sequenza >> 4;
+        if (num_letterali == 15 && (i = lz_read_length(dati, i, len, &num_letterali, max)) == -1)
+            return -1;
+        if (num_letterali > len - i || num_letterali > max - pos)
+            return -1;
+        memcpy(&uscita[pos], &dati[i], num_letterali);
+        i += num_letterali;
+        pos += num_letterali;
+
+        if (i == len)
+            break; // Ultima sequenza: solo letterali
+
+        if (len - i < 2)
+            return -1;
+        distanza = dati[i] | dati[i + 1] << 8;
+        i += 2;
+        if (distanza == 0 || distanza > pos)
+            return -1;
+
+        match = sequenza & 15;
+        if (match == 15 && (i = lz_read_length(dati, i, len, &match, max)) == -1)
+            return -1;
+        match += LZ_MIN_MATCH;
+        if (match > max - pos)
+            return -1;
+
+        // La ripetizione può sovrapporsi ai byte che sta producendo: si copia un byte alla volta
+        for (k = 0; k < match; k++, pos++)
+            uscita[pos] = uscita[pos - distanza];
+    }
+
+    return pos;
+}
+
+/*
+ * Verifica se vale la pena comprimere 'len' byte con 'codec' (i dati più corti della soglia vengono inviati
+ * senza compressione). Restituisce 1 se i dati vanno compressi, altrimenti 0.
+ */
+int should_compress(int codec, int len) {
+    if (codec == CODEC_NONE)
+        return 0;
+
+    if (len < soglia_compressione) {
+        add_stat(&statistiche.frame_sotto_soglia, 1);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Comprime i 'len' byte di 'dati' con 'codec', ponendo il risultato in 'uscita' (di 'max' byte).
+ * Restituisce la lunghezza dei dati compressi o -1 se non stanno in 'max' byte (i dati vanno inviati
+ * senza compressione).
+ */
+int compress_data(int codec, char* dati, int len, char* uscita, int max) {
+    unsigned long long inizio;
+    int ret = -1;
+    #ifdef USE_ZLIB
+    uLongf len_zlib = max;
+    #endif
+
+    inizio = thread_cpu_time();
+    if (codec == CODEC_LZ)
+        ret = lz_compress((unsigned char*) dati, len, (unsigned char*) uscita, max);
+    #ifdef USE_ZLIB
+    else if (codec == CODEC_ZLIB && compress2((Bytef*) uscita, &len_zlib, (Bytef*) dati, len, Z_BEST_SPEED) == Z_OK)
+        ret = len_zlib;
+    #endif
+    add_stat(&statistiche.ns_compressione, thread_cpu_time() - inizio);
+
+    if (ret <= 0) {
+        add_stat(&statistiche.frame_incomprimibili, 1);
+        return -1;
+    }
+
+    add_stat(&statistiche.frame_compressi, 1);
+    add_stat(&statistiche.byte_originali, len);
+    add_stat(&statistiche.byte_compressi, ret);
+    return ret;
+}
+
+/*
+ * Decomprime i 'len' byte di 'dati' (compressi con 'codec'), ponendo il risultato in 'uscita' (di 'max' byte).
+ * Restituisce la lunghezza dei dati decompressi o -1 se i dati non sono validi o non stanno in 'max' byte.
+ */
+int decompress_data(int codec, char* dati, int len, char* uscita, int max) {
+    unsigned long long inizio;
+    int ret = -1;
+    #ifdef USE_ZLIB
+    uLongf len_zlib = max;
+    #endif
+
+    inizio = thread_cpu_time();
+    if (codec == CODEC_LZ)
+        ret = lz_decompress((unsigned char*) dati, len, (unsigned char*) uscita, max);
+    #ifdef USE_ZLIB
+    else if (codec == CODEC_ZLIB && uncompress((Bytef*) uscita, &len_zlib, (Bytef*) dati, len) == Z_OK)
+        ret = len_zlib;
+    #endif
+    add_stat(&statistiche.ns_decompressione, thread_cpu_time() - inizio);
+
+    if (ret == -1) {
+        fprintf(stderr, "Ricevuti dati compressi con il codec '%s' non validi.\n", codec_name(codec));
+        return -1;
+    }
+
+    add_stat(&statistiche.frame_decompressi, 1);
+    add_stat(&statistiche.byte_decompressi, ret);
+    return ret;
+}
+
+/*
+ * Pone in 'statistiche' una copia delle statistiche della compressione
+ */
+void get_compression_stats(struct statistiche_compressione* copia) {
+    unsigned long long* sorgente = (unsigned long long*) &statistiche;
+    unsigned long long* destinazione = (unsigned long long*) copia;
+    int i;
+
+    for (i = 0; i < (int) (sizeof(statistiche) / sizeof(unsigned long long)); i++)
+        destinazione[i] = __atomic_load_n(&sorgente[i], __ATOMIC_RELAXED);
+}
+
+/*
+ * Stampa le statistiche della compressione: rapporto di compressione e tempo di CPU
+ */
+void print_compression_stats(void) {
+    struct statistiche_compressione copia;
+
+    get_compression_stats(&copia);
+
+    printf("Compressione (codec supportati: %s%s, soglia %d byte):\n", codec_name(CODEC_LZ),
+           supported_features() & FEATURE_ZLIB ? ", zlib" : "", soglia_compressione);
+    printf("- frame compressi: %llu (%llu byte -> %llu byte, rapporto %.2f)\n", copia.frame_compressi,
+           copia.byte_originali, copia.byte_compressi,
+           copia.byte_originali > 0 ? (double) copia.byte_compressi / copia.byte_originali : 1.0);
+    printf("- frame inviati senza compressione: %llu sotto la soglia, %llu incomprimibili\n",
+           copia.frame_sotto_soglia, copia.frame_incomprimibili);
+    printf("- tempo di CPU per la compressione: %.3f ms (%.1f MB/s)\n", copia.ns_compressione / 1e6,
+           copia.ns_compressione > 0 ? copia.byte_originali * 1e3 / copia.ns_compressione : 0.0);
+    printf("- frame decompressi: %llu (%llu byte), tempo di CPU: %.3f ms\n", copia.frame_decompressi,
+           copia.byte_decompressi, copia.ns_decompressione / 1e6);
+}
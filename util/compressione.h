@@ -0,0 +1,94 @@
+/************************************************************
+ *                                                          *
+ *        Compressione dei dati scambiati sui socket        *
+ *                                                          *
+ ************************************************************/
+
+#ifndef COMPRESSIONE_H
+#define COMPRESSIONE_H
+
+/*
+ * Codec di compressione. Il codec usato viene scritto in ogni frame compresso, quindi chi riceve non
+ * deve sapere in anticipo quale ha scelto il mittente (purché lo supporti).
+ */
+#define CODEC_NONE 0 // Dati non compressi
+#define CODEC_LZ 1 // Codec LZ interno: veloce, adatto anche ai messaggi brevi
+#define CODEC_ZLIB 2 // zlib (solo se compilato con 'make ZLIB=1'): rapporto migliore, più lento
+
+/*
+ * Funzionalità opzionali annunciate durante la negoziazione: un bit per ogni codec supportato
+ */
+#define FEATURE_LZ (1 << (CODEC_LZ - 1))
+#define FEATURE_ZLIB (1 << (CODEC_ZLIB - 1))
+
+/*
+ * Statistiche (dall'avvio del programma) della compressione, per valutare la soglia e il codec
+ */
+struct statistiche_compressione {
+    unsigned long long frame_compressi; // Frame inviati compressi
+    unsigned long long frame_sotto_soglia; // Frame inviati senza compressione perché più corti della soglia
+    unsigned long long frame_incomprimibili; // Frame inviati senza compressione perché non si riducevano
+    unsigned long long byte_originali; // Byte dei frame compressi prima della compressione
+    unsigned long long byte_compressi; // Byte dei frame compressi dopo la compressione
+    unsigned long long ns_compressione; // Tempo di CPU speso a comprimere (anche per i frame incomprimibili)
+    unsigned long long frame_decompressi; // Frame compressi ricevuti
+    unsigned long long byte_decompressi; // Byte ottenuti decomprimendo i frame ricevuti
+    unsigned long long ns_decompressione; // Tempo di CPU speso a decomprimere
+};
+
+/*
+ * Restituisce le funzionalità (FEATURE_*) supportate da questo programma
+ */
+int supported_features(void);
+
+/*
+ * Sceglie il codec da usare tra quelli indicati da 'funzionalita' (supportati da entrambe le parti).
+ * Restituisce CODEC_NONE se non ce n'è nessuno.
+ */
+int choose_codec(int funzionalita);
+
+/*
+ * Restituisce il nome del codec specificato
+ */
+char* codec_name(int codec);
+
+/*
+ * Imposta la soglia di compressione: i dati più corti di 'soglia' byte vengono inviati senza compressione
+ */
+void set_compression_threshold(int soglia);
+
+/*
+ * Restituisce la soglia di compressione
+ */
+int get_compression_threshold(void);
+
+/*
+ * Verifica se vale la pena comprimere 'len' byte con 'codec' (i dati più corti della soglia vengono inviati
+ * senza compressione). Restituisce 1 se i dati vanno compressi, altrimenti 0.
+ */
+int should_compress(int codec, int len);
+
+/*
+ * Comprime i 'len' byte di 'dati' con 'codec', ponendo il risultato in 'uscita' (di 'max' byte).
+ * Restituisce la lunghezza dei dati compressi o -1 se non stanno in 'max' byte (i dati vanno inviati
+ * senza compressione).
+ */
+int compress_data(int codec, char* dati, int len, char* uscita, int max);
+
+/*
+ * Decomprime i 'len' byte di 'dati' (compressi con 'codec'), ponendo il risultato in 'uscita' (di 'max' byte).
+ * Restituisce la lunghezza dei dati decompressi o -1 se i dati non sono validi o non stanno in 'max' byte.
+ */
+int decompress_data(int codec, char* dati, int len, char* uscita, int max);
+
+/*
+ * Pone in 'statistiche' una copia delle statistiche della compressione
+ */
+void get_compression_stats(struct statistiche_compressione* statistiche);
+
+/*
+ * Stampa le statistiche della compressione: rapporto di compressione e tempo di CPU
+ */
+void print_compression_stats(void);
+
+#endif
@@ -0,0 +1,39 @@
+/************************************************************
+ *                                                          *
+ *                  CRC-32 dei dati su disco                *
+ *                                                          *
+ ************************************************************/
+
+#include "crc.h"
+#include <pthread.h>
+
+static uint32_t tabella_crc[256];
+static pthread_once_t tabella_pronta = PTHREAD_ONCE_INIT;
+
+/*
+ * Prepara la tabella del CRC-32 (polinomio IEEE 802.3)
+ */
+static void init_crc_table(void) {
+    uint32_t crc;
+    int i, j;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        tabella_crc[i] = crc;
+    }
+}
+
+/*
+ * Aggiorna il CRC-32 (polinomio IEEE 802.3) 'crc' con 'len' byte di 'dati'. Il calcolo parte da 0xFFFFFFFF e il CRC
+ * finale è il complemento del valore ottenuto.
+ */
+uint32_t update_crc(uint32_t crc, const void* dati, size_t len) {
+    const unsigned char* byte = dati;
+
+    pthread_once(&tabella_pronta, init_crc_table); // La tabella si prepara una sola volta, anche tra più thread
+    while (len-- > 0)
+        crc = tabella_crc[(crc ^ *byte++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
@@ -0,0 +1,19 @@
+/************************************************************
+ *                                                          *
+ *                  CRC-32 dei dati su disco                *
+ *                                                          *
+ ************************************************************/
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Aggiorna il CRC-32 (polinomio IEEE 802.3) 'crc' con 'len' byte di 'dati'. Il calcolo parte da 0xFFFFFFFF e il CRC
+ * finale è il complemento del valore ottenuto.
+ */
+uint32_t update_crc(uint32_t crc, const void* dati, size_t len);
+
+#endif
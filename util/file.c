@@ -7,17 +7,134 @@
 #include "file.h"
 #include "../costanti.h"
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <unistd.h>
 #include <errno.h>
+#include <libgen.h>
+
+/*
+ * Restituisce l'hash (FNV-1a a 32 bit) di 'nome', da cui dipende la sottocartella del file: non deve cambiare,
+ * altrimenti i file già scritti non si trovano più
+ */
+static uint32_t name_hash(char* nome) {
+    uint32_t hash = 2166136261u;
+
+    for (; *nome != '\0'; nome++) {
+        hash ^= (unsigned char) *nome;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Pone in 'path' il path del file 'nome' nelle sottocartelle di 'cartella': "cartella/ab/cd/nome", dove ab e cd sono
+ * i primi due byte (in esadecimale) dell'hash di 'nome'
+ */
+void get_sharded_path(char* cartella, char* nome, char* path) {
+    uint32_t hash = name_hash(nome);
+
+    snprintf(path, PATH_MAX, "%s%02x/%02x/%s", cartella, (unsigned int) (hash >> 24), (unsigned int) (hash >> 16) & 0xFF,
+             nome);
+}
+
+/*
+ * Se 'path' è il path di un file direttamente nella sua cartella (non in una sottocartella di get_sharded_path()),
+ * pone in 'spostato' il path che il file ha dopo la migrazione e restituisce 1, altrimenti restituisce 0
+ */
+int get_migrated_path(char* path, char* spostato) {
+    char cartella[PATH_MAX];
+    char* nome = strrchr(path, '/');
+    size_t len;
+
+    if (nome == NULL)
+        return 0;
+    nome++;
+    len = nome - path;
+    snprintf(cartella, PATH_MAX, "%.*s", (int) len, path);
+    get_sharded_path(cartella, nome, spostato);
+
+    // Se il file è già nella sua sottocartella, le ultime due cartelle del path ("ab/cd/") sono quelle dell'hash del nome
+    if (len >= 6 && strncmp(path + len - 6, spostato + strlen(spostato) - strlen(nome) - 6, 6) == 0)
+        return 0;
+    return 1;
+}
+
+/*
+ * Pone in 'path' il path del file 'nome' di 'cartella': quello nelle sottocartelle (vedi get_sharded_path()), a meno
+ * che il file sia ancora direttamente in 'cartella' (dove lo hanno scritto le versioni precedenti) e non sia ancora
+ * stato spostato dallo strumento di migrazione. Lo strumento crea il nuovo path prima di cancellare il vecchio:
+ * il file si trova sempre in almeno uno dei due.
+ */
+static void resolve_path(char* cartella, char* nome, char* path) {
+    char vecchio[PATH_MAX]; // Path direttamente in 'cartella'
+
+    get_sharded_path(cartella, nome, path);
+    if (access(path, F_OK) == 0)
+        return;
+
+    snprintf(vecchio, PATH_MAX, "%s%s", cartella, nome);
+    if (access(vecchio, F_OK) == 0)
+        strcpy(path, vecchio);
+}
+
+/*
+ * Crea le cartelle che devono contenere il file 'path', se non esistono già.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int create_parent_directories(char* path) {
+    char cartella[PATH_MAX];
+    char* separatore;
+
+    snprintf(cartella, PATH_MAX, "%s", path);
+    for (separatore = strchr(cartella + 1, '/'); separatore != NULL; separatore = strchr(separatore + 1, '/')) {
+        *separatore = '\0';
+        if (mkdir(cartella, S_IRWXU | S_IRWXG | S_IRWXO) == -1 && errno != EEXIST) {
+            fprintf(stderr, "Impossibile creare la cartella '%s' : %s\n", cartella, strerror(errno));
+            return -1;
+        }
+        *separatore = '/';
+    }
+    return 0;
+}
+
+/*
+ * Blocca in modo esclusivo (flock()) il file aperto sul descrittore 'fd' e verifica che 'path' lo identifichi ancora
+ * (e non sia stato spostato dallo strumento di migrazione). Restituisce 0 se il file è bloccato e al suo posto,
+ * -1 altrimenti (con errno ESTALE se è stato spostato: il file non resta bloccato e va cercato di nuovo).
+ */
+int lock_file_in_place(int fd, char* path) {
+    struct stat aperto, attuale;
+    char spostato[PATH_MAX]; // Path del file dopo la migrazione
+
+    if (flock(fd, LOCK_EX) == -1)
+        return -1;
+
+    /*
+     * Lo strumento sposta il file mentre lo tiene bloccato: se ora 'path' è un altro file (o non c'è) oppure esiste
+     * già il nuovo path (chi ha aperto il vecchio path dopo lo spostamento ha creato un file nuovo), si è arrivati tardi
+     */
+    if (fstat(fd, &aperto) == 0 && stat(path, &attuale) == 0 && aperto.st_dev == attuale.st_dev &&
+        aperto.st_ino == attuale.st_ino && (get_migrated_path(path, spostato) == 0 || access(spostato, F_OK) == -1))
+        return 0;
+
+    flock(fd, LOCK_UN);
+    errno = ESTALE;
+    return -1;
+}
 
 /*
  * Crea il path del file contenente la rubrica dell'utente 'username' e lo inserisce in 'path'
  */
 void get_contact_list_path(char* username, char* path) {
-    strcpy(path, CONTACT_LIST_FOLDER);
-    strcat(path, username);
-    strcat(path, ".txt");
+    char nome[PATH_MAX]; // Nome del file della rubrica
+
+    snprintf(nome, PATH_MAX, "%s.txt", username);
+    resolve_path(CONTACT_LIST_FOLDER, nome, path);
 
     #ifdef DEBUG
     printf("Path della rubrica di %s: '%s'.\n", username, path);
@@ -25,17 +142,181 @@ void get_contact_list_path(char* username, char* path) {
 }
 
 /*
- * Crea il path del file contenente i log della chat intercorsa tra 'utente1' e 'utente2' e lo inserisce in 'path'
+ * Pone in 'nome' il nome della chat tra 'utente1' e 'utente2' ("utente1-utente2"), che non dipende dall'ordine dei due
+ * utenti: l'username minore (in ordine alfabetico) è il primo
+ */
+void get_chat_name(char* utente1, char* utente2, char* nome) {
+    if (strcmp(utente1, utente2) > 0)
+        snprintf(nome, PATH_MAX, "%s-%s", utente2, utente1);
+    else
+        snprintf(nome, PATH_MAX, "%s-%s", utente1, utente2);
+}
+
+/*
+ * Crea il path del file contenente i log (binari, vedi util/log_chat.h) della chat intercorsa tra 'utente1' e 'utente2'
+ * e lo inserisce in 'path'. Il nome del file è quello della chat (vedi get_chat_name()).
  */
 void get_chat_log_path(char* utente1, char* utente2, char* path) {
+    char nome[PATH_MAX]; // Nome del file del log
+
+    get_chat_name(utente1, utente2, nome);
+    strcat(nome, ".log");
+    resolve_path(CHAT_LOG_FOLDER, nome, path);
+
+    #ifdef DEBUG
+    printf("Path del log della chat tra %s e %s: '%s'.\n", utente1, utente2, path);
+    #endif
+}
+
+/*
+ * Come get_chat_log_path(), ma per il log testuale scritto dalle versioni precedenti (direttamente in CHAT_LOG_FOLDER)
+ */
+void get_text_chat_log_path(char* utente1, char* utente2, char* path) {
+    char nome[PATH_MAX]; // Nome della chat
+
+    get_chat_name(utente1, utente2, nome);
     strcpy(path, CHAT_LOG_FOLDER);
-    strcat(path, utente1);
-    strcat(path, "-");
-    strcat(path, utente2);
+    strcat(path, nome);
+    strcat(path, ".txt");
+}
+
+/*
+ * Crea il path del file contenente il segno di lettura di 'lettore' nel log della chat 'log_path' (accanto al log)
+ */
+void get_read_mark_path(char* log_path, char* lettore, char* path) {
+    strcpy(path, log_path);
+    strcat(path, "_letti_");
+    strcat(path, lettore);
     strcat(path, ".txt");
+}
+
+/*
+ * Se il log testuale della chat tra 'utente1' e 'utente2' non esiste ma esiste con i due username in ordine inverso
+ * (come poteva crearlo una versione precedente), lo rinomina (insieme ai segni di lettura) con il path di
+ * get_text_chat_log_path()
+ */
+void fix_chat_log_name(char* utente1, char* utente2) {
+    char path[PATH_MAX];
+    char vecchio[PATH_MAX]; // Path con gli username in ordine inverso
+    char mark_path[PATH_MAX];
+    char vecchio_mark_path[PATH_MAX];
+
+    get_text_chat_log_path(utente1, utente2, path);
+    if (access(path, F_OK) == 0)
+        return; // Il log ha già il nome corretto
+
+    strcpy(vecchio, CHAT_LOG_FOLDER);
+    strcat(vecchio, strcmp(utente1, utente2) > 0 ? utente1 : utente2);
+    strcat(vecchio, "-");
+    strcat(vecchio, strcmp(utente1, utente2) > 0 ? utente2 : utente1);
+    strcat(vecchio, ".txt");
+    if (strcmp(vecchio, path) == 0 || rename(vecchio, path) == -1)
+        return; // Nessun log con il vecchio nome
 
     #ifdef DEBUG
-    printf("Path del log della chat tra %s e %s: '%s'.\n", utente1, utente2, path);
+    printf("Log della chat '%s' rinominato in '%s'.\n", vecchio, path);
+    #endif
+
+    // Anche i segni di lettura seguono il log
+    get_read_mark_path(vecchio, utente1, vecchio_mark_path);
+    get_read_mark_path(path, utente1, mark_path);
+    rename(vecchio_mark_path, mark_path);
+    get_read_mark_path(vecchio, utente2, vecchio_mark_path);
+    get_read_mark_path(path, utente2, mark_path);
+    rename(vecchio_mark_path, mark_path);
+}
+
+/*
+ * Restituisce il segno di lettura di 'lettore' nel log della chat 'log_path': i messaggi a lui indirizzati fino a
+ * questo numero di sequenza sono già stati letti (nei log testuali era l'offset della fine dell'ultimo messaggio letto).
+ * Se il log è stato appena spostato dallo strumento di migrazione, il segno viene cercato nel nuovo path.
+ * Restituisce 0 se 'lettore' non ha ancora letto nulla.
+ */
+long get_read_mark(char* log_path, char* lettore) {
+    char path[PATH_MAX];
+    char spostato[PATH_MAX]; // Path del log dopo la migrazione
+    long offset = 0;
+    FILE* file;
+
+    get_read_mark_path(log_path, lettore, path);
+    file = open_file(path, "r");
+    if (file == NULL && get_migrated_path(log_path, spostato) == 1) {
+        // Lo strumento di migrazione copia i segni di lettura nel nuovo path prima di cancellare i vecchi
+        get_read_mark_path(spostato, lettore, path);
+        file = open_file(path, "r");
+    }
+    if (file == NULL)
+        return 0;
+
+    if (fscanf(file, "%ld", &offset) != 1 || offset < 0)
+        offset = 0;
+    fclose(file);
+
+    return offset;
+}
+
+/*
+ * Sposta il segno di lettura di 'lettore' nel log della chat 'log_path' al valore specificato, con il log bloccato.
+ * Restituisce 0 in caso di successo, -1 in caso di errore (con errno ESTALE se il log è stato spostato).
+ */
+int set_read_mark(char* log_path, char* lettore, long segno) {
+    char path[PATH_MAX];
+    char spostato[PATH_MAX]; // Path del log dopo la migrazione
+    FILE* file;
+    int fd, ret;
+
+    // Il segno segue il log quando viene spostato: lo si scrive col log bloccato (se il log non c'è, non si sposta)
+    fd = open(log_path, O_RDONLY);
+    if (fd == -1 && errno == ENOENT && get_migrated_path(log_path, spostato) == 1)
+        errno = ESTALE; // Il log era direttamente nella cartella: è appena stato spostato
+    if (fd == -1 && errno != ENOENT)
+        return -1;
+    if (fd != -1 && lock_file_in_place(fd, log_path) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    get_read_mark_path(log_path, lettore, path);
+    file = open_or_create(path, "w");
+    if (file == NULL) {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    ret = fprintf(file, "%ld\n", segno);
+    if (fclose(file) != 0 || ret < 0) {
+        fprintf(stderr, "Errore durante la scrittura del file '%s' : %s\n", path, strerror(errno));
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    if (fd != -1)
+        close(fd); // Sblocca il log
+    return ret;
+}
+
+/*
+ * Cancella il segno di lettura di 'lettore' nel log della chat 'log_path'
+ */
+void remove_read_mark(char* log_path, char* lettore) {
+    char path[PATH_MAX];
+
+    get_read_mark_path(log_path, lettore, path);
+    remove(path);
+}
+
+/*
+ * Crea il path del file contenente la coda dei messaggi pendenti per l'utente 'username' e lo inserisce in 'path'
+ */
+void get_offline_queue_path(char* username, char* path) {
+    strcpy(path, OFFLINE_QUEUE_FOLDER);
+    strcat(path, username);
+    strcat(path, ".txt");
+
+    #ifdef DEBUG
+    printf("Path della coda dei messaggi pendenti di %s: '%s'.\n", username, path);
     #endif
 }
 
@@ -96,6 +377,8 @@ FILE* open_or_create(char* path, char* mode) {
 
         // Provo a creare il file (eventualmente di nuovo, per esempio nel caso di mode="a")
         file = fopen(path, "a");
+        if (file == NULL && errno == ENOENT && create_parent_directories(path) == 0)
+            file = fopen(path, "a"); // Mancava la cartella (ad esempio la sottocartella di get_sharded_path())
 
         #ifdef DEBUG
         printf("Tentativo di creazione del file '%s'.\n", path);
@@ -185,4 +468,23 @@ int create_directory(char* path) {
     printf("Cartella creata con successo.\n");
     #endif
     return ret;
+}
+
+/*
+ * Sincronizza su disco la cartella che contiene 'path', così la creazione (o il rename()) del file è definitiva.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int sync_parent_directory(char* path) {
+    char copia[PATH_MAX];
+    int fd, ret;
+
+    strcpy(copia, path);
+    fd = open(dirname(copia), O_RDONLY | O_DIRECTORY);
+    ret = fd == -1 ? -1 : fsync(fd);
+    if (ret == -1)
+        fprintf(stderr, "Impossibile sincronizzare la cartella del file '%s' : %s\n", path, strerror(errno));
+    if (fd != -1)
+        close(fd);
+
+    return ret;
 }
\ No newline at end of file
@@ -6,16 +6,98 @@
 
 #include <stdio.h>
 
+/*
+ * Le rubriche (CONTACT_LIST_FOLDER) e i log delle chat (CHAT_LOG_FOLDER) non stanno direttamente nella loro cartella,
+ * che con milioni di file diventerebbe lenta da consultare, ma in due livelli di sottocartelle che dipendono
+ * dall'hash del nome del file (vedi get_sharded_path()). I file lasciati direttamente nella cartella dalle versioni
+ * precedenti si continuano a usare finché lo strumento di migrazione (migra.c) non li sposta, anche mentre server
+ * e device sono in esecuzione: lo strumento sposta un file tenendolo bloccato (flock()), quindi chi lo modifica
+ * lo blocca con lock_file_in_place() e, se nel frattempo è stato spostato, ne ricalcola il path.
+ */
+
+/*
+ * Pone in 'path' il path del file 'nome' nelle sottocartelle di 'cartella': "cartella/ab/cd/nome", dove ab e cd sono
+ * i primi due byte (in esadecimale) dell'hash di 'nome'
+ */
+void get_sharded_path(char* cartella, char* nome, char* path);
+
+/*
+ * Se 'path' è il path di un file direttamente nella sua cartella (non in una sottocartella di get_sharded_path()),
+ * pone in 'spostato' il path che il file ha dopo la migrazione e restituisce 1, altrimenti restituisce 0
+ */
+int get_migrated_path(char* path, char* spostato);
+
+/*
+ * Crea le cartelle che devono contenere il file 'path', se non esistono già.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int create_parent_directories(char* path);
+
+/*
+ * Blocca in modo esclusivo (flock()) il file aperto sul descrittore 'fd' e verifica che 'path' lo identifichi ancora
+ * (e non sia stato spostato dallo strumento di migrazione). Restituisce 0 se il file è bloccato e al suo posto,
+ * -1 altrimenti (con errno ESTALE se è stato spostato: il file non resta bloccato e va cercato di nuovo).
+ */
+int lock_file_in_place(int fd, char* path);
+
 /*
  * Crea il path del file contenente la rubrica dell'utente 'username' e lo inserisce in 'path'
  */
 void get_contact_list_path(char* username, char* path);
 
 /*
- * Crea il path del file contenente i log della chat intercorsa tra 'utente1' e 'utente2' e lo inserisce in 'path'
+ * Pone in 'nome' il nome della chat tra 'utente1' e 'utente2' ("utente1-utente2"), che non dipende dall'ordine dei due
+ * utenti: l'username minore (in ordine alfabetico) è il primo
+ */
+void get_chat_name(char* utente1, char* utente2, char* nome);
+
+/*
+ * Crea il path del file contenente i log (binari, vedi util/log_chat.h) della chat intercorsa tra 'utente1' e 'utente2'
+ * e lo inserisce in 'path'. Il nome del file è quello della chat (vedi get_chat_name()).
  */
 void get_chat_log_path(char* utente1, char* utente2, char* path);
 
+/*
+ * Come get_chat_log_path(), ma per il log testuale scritto dalle versioni precedenti (direttamente in CHAT_LOG_FOLDER)
+ */
+void get_text_chat_log_path(char* utente1, char* utente2, char* path);
+
+/*
+ * Se il log testuale della chat tra 'utente1' e 'utente2' non esiste ma esiste con i due username in ordine inverso
+ * (come poteva crearlo una versione precedente), lo rinomina (insieme ai segni di lettura) con il path di
+ * get_text_chat_log_path()
+ */
+void fix_chat_log_name(char* utente1, char* utente2);
+
+/*
+ * Crea il path del file contenente il segno di lettura di 'lettore' nel log della chat 'log_path' (accanto al log)
+ */
+void get_read_mark_path(char* log_path, char* lettore, char* path);
+
+/*
+ * Restituisce il segno di lettura di 'lettore' nel log della chat 'log_path': i messaggi a lui indirizzati fino a
+ * questo numero di sequenza sono già stati letti (nei log testuali era l'offset della fine dell'ultimo messaggio letto).
+ * Se il log è stato appena spostato dallo strumento di migrazione, il segno viene cercato nel nuovo path.
+ * Restituisce 0 se 'lettore' non ha ancora letto nulla.
+ */
+long get_read_mark(char* log_path, char* lettore);
+
+/*
+ * Sposta il segno di lettura di 'lettore' nel log della chat 'log_path' al valore specificato, con il log bloccato.
+ * Restituisce 0 in caso di successo, -1 in caso di errore (con errno ESTALE se il log è stato spostato).
+ */
+int set_read_mark(char* log_path, char* lettore, long segno);
+
+/*
+ * Cancella il segno di lettura di 'lettore' nel log della chat 'log_path'
+ */
+void remove_read_mark(char* log_path, char* lettore);
+
+/*
+ * Crea il path del file contenente la coda dei messaggi pendenti per l'utente 'username' e lo inserisce in 'path'
+ */
+void get_offline_queue_path(char* username, char* path);
+
 /*
  * Crea il path del file 'filename' nella cartella dei file condivisi dell'utente 'username' e lo inserisce in 'path'
  */
@@ -33,7 +115,8 @@ void get_received_file_path(char* destinatario, char* path);
 int is_file_existing(char* path);
 
 /*
- * Apre il file identificato dal percorso 'path' con la modalità 'mode'. Se non esiste, il file viene creato.
+ * Apre il file identificato dal percorso 'path' con la modalità 'mode'. Se non esiste, il file viene creato
+ * (insieme alle cartelle che lo devono contenere, se mancano).
  * Restituisce il puntatore al file o NULL se non è possibile accedere al file.
  * NB: ricordarsi di chiudere il file una volta terminato il suo uso!
  */
@@ -56,4 +139,10 @@ int create_empty_file(char* path);
  * Crea la cartella al percorso specificato. Se la cartella esiste già, la funzione non fa niente.
  * Restituisce 0 in caso di successo, -1 in caso di errore.
  */
-int create_directory(char* path);
\ No newline at end of file
+int create_directory(char* path);
+
+/*
+ * Sincronizza su disco la cartella che contiene 'path', così la creazione (o il rename()) del file è definitiva.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int sync_parent_directory(char* path);
\ No newline at end of file
@@ -0,0 +1,648 @@
+/************************************************************
+ *                                                          *
+ *        Journal (write-ahead log) delle scritture         *
+ *                                                          *
+ ************************************************************/
+
+#include "journal.h"
+#include "file.h"
+#include "commit.h"
+#include "tabella_hash.h"
+#include "crc.h"
+#include "../costanti.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define JOURNAL_MAGIC "JOURNAL1" // Primi byte del journal (identificano il formato)
+#define LEN_MAGIC 8
+
+/*
+ * Intestazione del file. Il primo record ha numero 'primo', i successivi numeri consecutivi: un record con un numero
+ * diverso da quello atteso (ad esempio rimasto da prima dell'ultimo checkpoint) segna la fine del journal.
+ */
+struct intestazione_journal {
+    char magic[LEN_MAGIC];
+    uint32_t primo;
+    uint32_t riservato;
+};
+
+/*
+ * Intestazione di un record, seguita dai campi (stringhe terminate, in tutto 'lunghezza' byte).
+ * Il CRC è calcolato sull'intestazione (con 'crc' a 0) e sui campi.
+ */
+struct intestazione_record {
+    uint32_t lunghezza;
+    uint32_t crc;
+    uint32_t numero;
+    uint8_t tipo;
+    uint8_t num_campi;
+    uint16_t riservato;
+    int64_t timestamp;
+};
+
+/*
+ * Segmento del journal. I record si aggiungono sempre al segmento corrente; l'altro contiene i record precedenti al
+ * checkpoint in corso, finché i loro file derivati non sono sincronizzati, oppure è vuoto (con 'primo' a 0 su disco),
+ * pronto a diventare il segmento corrente al prossimo checkpoint.
+ */
+struct segmento_journal {
+    FILE* file;
+    char path[PATH_MAX];
+    uint32_t primo; // Numero del primo record del segmento (0 se il segmento è vuoto)
+};
+
+/*
+ * Stato del journal, protetto da 'journal_lock'
+ */
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct segmento_journal segmenti[2]; // Il file 'path' e il file "path.1" (vedi open_journal())
+static int corrente = 0; // Indice del segmento in cui si aggiungono i record
+static int vecchio = 0; // Indica se l'altro segmento contiene ancora i record precedenti all'ultimo checkpoint
+static int riserva = 0; // Indica se l'altro segmento è vuoto e sincronizzato, pronto per il prossimo checkpoint
+static int in_corso = 0; // Indica se c'è un checkpoint in corso (vedi begin_journal_checkpoint())
+static uint32_t prossimo = 1; // Numero del prossimo record
+static long dim_journal; // Byte del segmento corrente occupati da record integri (intestazione compresa)
+static struct tabella_hash derivati; // File derivati modificati dall'ultimo checkpoint (path -> non usato)
+static int derivati_pronti = 0; // Indica se 'derivati' è stata inizializzata
+static struct tabella_hash da_sincronizzare; // File derivati che il checkpoint in corso sincronizza (fuori dal lock)
+static int da_sincronizzare_pronti = 0; // Indica se 'da_sincronizzare' è stata inizializzata
+static struct statistiche_journal statistiche;
+
+/*
+ * Restituisce il CRC di un record (intestazione e campi)
+ */
+static uint32_t record_crc(struct intestazione_record* intestazione, const char* dati) {
+    struct intestazione_record copia = *intestazione;
+
+    copia.crc = 0;
+    return ~update_crc(update_crc(0xFFFFFFFF, &copia, sizeof(copia)), dati, intestazione->lunghezza);
+}
+
+/*
+ * Restituisce il numero del record che segue il record 'numero' (0 non si usa mai)
+ */
+static uint32_t next_number(uint32_t numero) {
+    return numero + 1 == 0 ? 1 : numero + 1;
+}
+
+/*
+ * Scompone i campi di un record letto dal file. Restituisce 0 se sono validi, -1 altrimenti.
+ */
+static int parse_fields(struct record_journal* record, char* dati, uint32_t lunghezza) {
+    uint32_t pos = 0;
+    int i;
+
+    if (record->num_campi > JOURNAL_MAX_CAMPI)
+        return -1;
+    for (i = 0; i < record->num_campi; i++) {
+        if (pos >= lunghezza)
+            return -1;
+        record->campi[i] = dati + pos;
+        pos += strnlen(dati + pos, lunghezza - pos) + 1;
+    }
+
+    // I campi devono occupare esattamente il record ed essere terminati
+    return pos == lunghezza && (lunghezza == 0 || dati[lunghezza - 1] == '\0') ? 0 : -1;
+}
+
+/*
+ * Restituisce il numero del primo record scritto nell'intestazione del segmento, 0 se il segmento è vuoto o illeggibile
+ */
+static uint32_t read_segment_header(struct segmento_journal* segmento) {
+    struct intestazione_journal intestazione;
+
+    if (pread(fileno(segmento->file), &intestazione, sizeof(intestazione), 0) != sizeof(intestazione) ||
+        memcmp(intestazione.magic, JOURNAL_MAGIC, LEN_MAGIC) != 0)
+        return 0;
+
+    return intestazione.primo;
+}
+
+/*
+ * Scrive l'intestazione del segmento con il numero del suo primo record ('primo', 0 per un segmento vuoto).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+static int write_segment_header(struct segmento_journal* segmento, uint32_t primo) {
+    struct intestazione_journal intestazione;
+
+    memcpy(intestazione.magic, JOURNAL_MAGIC, LEN_MAGIC);
+    intestazione.primo = primo;
+    intestazione.riservato = 0;
+    if (fflush(segmento->file) != 0 ||
+        pwrite(fileno(segmento->file), &intestazione, sizeof(intestazione), 0) != sizeof(intestazione)) {
+        fprintf(stderr, "Impossibile scrivere l'intestazione del journal '%s' : %s\n", segmento->path, strerror(errno));
+        return -1;
+    }
+
+    segmento->primo = primo;
+    return 0;
+}
+
+/*
+ * Svuota il segmento (i suoi record non servono più) e lo sincronizza, così può diventare il segmento corrente.
+ * Prima si azzera il numero del primo record, poi si tronca il file: se il troncamento non arriva su disco, all'avvio
+ * i vecchi record vengono comunque ignorati. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+static int empty_segment(struct segmento_journal* segmento) {
+    if (write_segment_header(segmento, 0) == -1)
+        return -1;
+
+    if (ftruncate(fileno(segmento->file), sizeof(struct intestazione_journal)) == -1 ||
+        fseek(segmento->file, sizeof(struct intestazione_journal), SEEK_SET) == -1 ||
+        fdatasync(fileno(segmento->file)) == -1) {
+        fprintf(stderr, "Impossibile svuotare il journal '%s' : %s\n", segmento->path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Invoca 'applica' su ogni record integro del segmento, in ordine, a partire dal suo primo record.
+ * Restituisce i byte del file occupati dai record integri (intestazione compresa).
+ */
+static long replay_segment(struct segmento_journal* segmento,
+                           void (*applica)(struct record_journal* record, void* contesto), void* contesto) {
+    struct intestazione_record voce;
+    struct record_journal record;
+    long dim = sizeof(struct intestazione_journal);
+    char* dati = NULL;
+    uint32_t dim_dati = 0;
+    char* nuovi;
+
+    prossimo = segmento->primo;
+    fseek(segmento->file, dim, SEEK_SET);
+    while (fread(&voce, sizeof(voce), 1, segmento->file) == 1 && voce.numero == prossimo) {
+        if (voce.lunghezza > dim_dati) {
+            nuovi = realloc(dati, voce.lunghezza);
+            if (nuovi == NULL)
+                break;
+            dati = nuovi;
+            dim_dati = voce.lunghezza;
+        }
+        if (fread(dati, 1, voce.lunghezza, segmento->file) != voce.lunghezza || record_crc(&voce, dati) != voce.crc)
+            break; // Record troncato
+
+        record.numero = voce.numero;
+        record.tipo = voce.tipo;
+        record.timestamp = (time_t) voce.timestamp;
+        record.num_campi = voce.num_campi;
+        if (parse_fields(&record, dati, voce.lunghezza) == -1)
+            break;
+        applica(&record, contesto);
+
+        dim += sizeof(voce) + voce.lunghezza;
+        prossimo = next_number(prossimo);
+        statistiche.riapplicati++;
+    }
+    free(dati);
+
+    return dim;
+}
+
+/*
+ * Apre il journal 'path' (creandolo se non esiste) e invoca 'applica' su ogni record integro che contiene, in ordine.
+ * Un eventuale record troncato in fondo (crash durante la scrittura) viene eliminato. Va invocata una sola volta,
+ * prima di scrivere nel journal. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int open_journal(char* path, void (*applica)(struct record_journal* record, void* contesto), void* contesto) {
+    struct segmento_journal* attuale;
+    int i;
+
+    if (!derivati_pronti && init_hash_table(&derivati, 0) == -1)
+        return -1;
+    derivati_pronti = 1;
+
+    // Il primo segmento è il file 'path' (l'unico nelle versioni precedenti), il secondo è "path.1"
+    for (i = 0; i < 2; i++) {
+        snprintf(segmenti[i].path, PATH_MAX, i == 0 ? "%s" : "%s.1", path);
+        segmenti[i].file = open_or_create(segmenti[i].path, "r+");
+        if (segmenti[i].file == NULL) {
+            if (i == 1)
+                fclose(segmenti[0].file);
+            return -1;
+        }
+        segmenti[i].primo = read_segment_header(&segmenti[i]);
+    }
+
+    /*
+     * Se entrambi i segmenti contengono record, il server si è interrotto durante un checkpoint: prima si riapplicano
+     * i record del segmento più vecchio, che verrà svuotato dal prossimo checkpoint
+     */
+    vecchio = segmenti[0].primo != 0 && segmenti[1].primo != 0;
+    if (vecchio)
+        corrente = (int32_t) (segmenti[1].primo - segmenti[0].primo) > 0 ? 1 : 0;
+    else
+        corrente = segmenti[1].primo != 0 ? 1 : 0;
+    attuale = &segmenti[corrente];
+    if (vecchio)
+        replay_segment(&segmenti[1 - corrente], applica, contesto);
+
+    // Journal nuovo (o illeggibile): si scrive l'intestazione
+    if (attuale->primo == 0 && (ftruncate(fileno(attuale->file), 0) == -1 || write_segment_header(attuale, 1) == -1)) {
+        perror("Impossibile scrivere l'intestazione del journal");
+        fclose(segmenti[0].file);
+        fclose(segmenti[1].file);
+        return -1;
+    }
+
+    // Riapplico i record integri, nell'ordine in cui sono stati scritti
+    dim_journal = replay_segment(attuale, applica, contesto);
+
+    // Quello che segue l'ultimo record integro non serve più
+    if (ftruncate(fileno(attuale->file), dim_journal) == -1 || fseek(attuale->file, dim_journal, SEEK_SET) == -1) {
+        perror("Impossibile troncare il journal");
+        fclose(segmenti[0].file);
+        fclose(segmenti[1].file);
+        return -1;
+    }
+
+    // L'altro segmento, se non contiene record, viene preparato per il primo checkpoint
+    riserva = !vecchio && empty_segment(&segmenti[1 - corrente]) == 0 && sync_parent_directory(path) == 0;
+
+    #ifdef DEBUG
+    printf("Journal '%s' aperto: riapplicati %llu record.\n", path, statistiche.riapplicati);
+    #endif
+
+    return 0;
+}
+
+/*
+ * Aggiunge al journal il record specificato (tipo, timestamp e campi) e ne imposta il numero.
+ * Restituisce il turno del commit della scrittura (vedi wait_for_commit()) o -1 in caso di errore.
+ * NB: i record di operazioni che toccano gli stessi file derivati vanno scritti e applicati sotto lo stesso lock,
+ * così nei file i record compaiono nell'ordine del journal.
+ */
+long append_to_journal(struct record_journal* record) {
+    struct intestazione_record voce;
+    struct segmento_journal* segmento;
+    size_t len[JOURNAL_MAX_CAMPI];
+    uint32_t crc;
+    long turno;
+    int i, errore = 0;
+
+    if (record->num_campi > JOURNAL_MAX_CAMPI)
+        return -1;
+
+    voce.lunghezza = 0;
+    for (i = 0; i < record->num_campi; i++) {
+        len[i] = strlen(record->campi[i]) + 1;
+        voce.lunghezza += len[i];
+    }
+    voce.crc = 0;
+    voce.tipo = record->tipo;
+    voce.num_campi = record->num_campi;
+    voce.riservato = 0;
+    voce.timestamp = record->timestamp;
+
+    pthread_mutex_lock(&journal_lock);
+
+    segmento = &segmenti[corrente];
+    voce.numero = prossimo;
+    crc = update_crc(0xFFFFFFFF, &voce, sizeof(voce));
+    for (i = 0; i < record->num_campi; i++)
+        crc = update_crc(crc, record->campi[i], len[i]);
+    voce.crc = ~crc;
+
+    // Intestazione e campi finiscono sul file con un'unica scrittura (quella di commit_append())
+    errore = fwrite(&voce, sizeof(voce), 1, segmento->file) != 1;
+    for (i = 0; i < record->num_campi && !errore; i++)
+        errore = fwrite(record->campi[i], 1, len[i], segmento->file) != len[i];
+    turno = errore ? -1 : commit_append(segmento->file, segmento->path, 0);
+
+    if (turno == -1) {
+        // Il record non è stato scritto per intero: lo elimino, così i successivi restano leggibili
+        fprintf(stderr, "Errore durante la scrittura del journal '%s' : %s\n", segmento->path, strerror(errno));
+        fflush(segmento->file);
+        if (ftruncate(fileno(segmento->file), dim_journal) == -1 || fseek(segmento->file, dim_journal, SEEK_SET) == -1)
+            perror("Impossibile ripristinare il journal");
+    } else {
+        record->numero = prossimo;
+        prossimo = next_number(prossimo);
+        dim_journal += sizeof(voce) + voce.lunghezza;
+        statistiche.record++;
+        statistiche.byte += sizeof(voce) + voce.lunghezza;
+    }
+
+    pthread_mutex_unlock(&journal_lock);
+    return turno;
+}
+
+/*
+ * Chiede il commit durabile dei record scritti finora, qualunque sia la politica dei commit.
+ * Restituisce il turno del commit (vedi wait_for_commit()) o -1 in caso di errore.
+ */
+long sync_journal(void) {
+    long turno;
+
+    pthread_mutex_lock(&journal_lock);
+    turno = commit_append(segmenti[corrente].file, segmenti[corrente].path, 1);
+    pthread_mutex_unlock(&journal_lock);
+
+    return turno;
+}
+
+/*
+ * Aggiunge 'path' ai file derivati da sincronizzare al prossimo checkpoint (il valore non si usa)
+ * NB: il chiamante deve possedere 'journal_lock'.
+ */
+static void add_derived_file(const char* path, void* valore, void* contesto) {
+    (void) valore;
+    (void) contesto;
+    if (!derivati_pronti && init_hash_table(&derivati, 0) == 0)
+        derivati_pronti = 1;
+    if (derivati_pronti && find_in_hash_table(&derivati, path) == NULL)
+        insert_into_hash_table(&derivati, path, &derivati); // Il valore non si usa (basta che non sia NULL)
+}
+
+/*
+ * Segnala che il file derivato 'path' è stato modificato e va sincronizzato al prossimo checkpoint
+ */
+void mark_derived_file(char* path) {
+    pthread_mutex_lock(&journal_lock);
+    add_derived_file(path, NULL, NULL);
+    pthread_mutex_unlock(&journal_lock);
+}
+
+/*
+ * Turni dei commit di una sincronizzazione dei file derivati
+ */
+struct sincronizzazione {
+    long primo_turno;
+    long ultimo_turno;
+    int errori;
+    int file; // File di cui è stato chiesto il commit
+};
+
+/*
+ * Chiede il commit durabile del file derivato 'path' ('contesto' è la struct sincronizzazione)
+ */
+static void commit_derived_file(const char* path, void* valore, void* contesto) {
+    struct sincronizzazione* sincronizzazione = contesto;
+    char spostato[PATH_MAX]; // Path del file dopo la migrazione (vedi util/file.h)
+    FILE* file;
+    long turno;
+
+    (void) valore;
+    file = open_file((char*) path, "r");
+    if (file == NULL && get_migrated_path((char*) path, spostato) == 1)
+        file = open_file(spostato, "r"); // Il file è stato spostato nella sua sottocartella
+    if (file == NULL)
+        return; // Il file è stato cancellato nel frattempo
+
+    turno = commit_append(file, (char*) path, 1);
+    fclose(file);
+    if (turno == -1) {
+        sincronizzazione->errori++;
+        return;
+    }
+    if (sincronizzazione->primo_turno == 0)
+        sincronizzazione->primo_turno = turno;
+    sincronizzazione->ultimo_turno = turno;
+    sincronizzazione->file++;
+}
+
+/*
+ * Sincronizza i file derivati della tabella (i commit sono di gruppo: si aspettano tutti insieme).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+static int sync_files(struct tabella_hash* tabella) {
+    struct sincronizzazione sincronizzazione = {0, 0, 0, 0};
+    long turno;
+
+    visit_hash_table(tabella, commit_derived_file, &sincronizzazione);
+    for (turno = sincronizzazione.primo_turno; turno > 0 && turno <= sincronizzazione.ultimo_turno; turno++)
+        if (wait_for_commit(turno) == -1)
+            sincronizzazione.errori++;
+
+    pthread_mutex_lock(&journal_lock);
+    statistiche.file_sincronizzati += sincronizzazione.file;
+    pthread_mutex_unlock(&journal_lock);
+
+    return sincronizzazione.errori > 0 ? -1 : 0;
+}
+
+/*
+ * Sincronizza su disco i file derivati modificati finora
+ * Restituisce 0 in caso di successo, -1 se qualche file non è stato sincronizzato.
+ */
+int sync_derived_files(void) {
+    struct tabella_hash tabella;
+    int ret;
+
+    // I file da sincronizzare vengono presi dalla tabella sotto il lock, ma sincronizzati dopo averlo rilasciato
+    pthread_mutex_lock(&journal_lock);
+    if (!derivati_pronti || derivati.num_elementi == 0) {
+        pthread_mutex_unlock(&journal_lock);
+        return 0;
+    }
+    tabella = derivati;
+    derivati_pronti = init_hash_table(&derivati, 0) == 0;
+    pthread_mutex_unlock(&journal_lock);
+
+    ret = sync_files(&tabella);
+    if (ret == -1) { // I file restano da sincronizzare
+        pthread_mutex_lock(&journal_lock);
+        visit_hash_table(&tabella, add_derived_file, NULL);
+        pthread_mutex_unlock(&journal_lock);
+    }
+    free_hash_table(&tabella, NULL);
+
+    return ret;
+}
+
+/*
+ * Indica se conviene eseguire un checkpoint (il journal ha superato JOURNAL_CHECKPOINT_LEN byte e non c'è già
+ * un checkpoint in corso)
+ */
+int journal_needs_checkpoint(void) {
+    int ret;
+
+    pthread_mutex_lock(&journal_lock);
+    ret = segmenti[corrente].file != NULL && !in_corso && dim_journal > JOURNAL_CHECKPOINT_LEN;
+    pthread_mutex_unlock(&journal_lock);
+
+    return ret;
+}
+
+/*
+ * Inizia un checkpoint: i record successivi si aggiungono all'altro segmento (che il checkpoint precedente ha lasciato
+ * vuoto) e i file derivati modificati finora vengono messi da parte per end_journal_checkpoint().
+ * Restituisce 0 se il checkpoint è iniziato, 1 se non serve o ce n'è già uno in corso, -1 in caso di errore.
+ * NB: il chiamante deve impedire che si applichino record mentre la invoca, così i file derivati dei record del
+ * vecchio segmento sono tutti tra quelli messi da parte.
+ */
+int begin_journal_checkpoint(void) {
+    int ret = 0;
+
+    pthread_mutex_lock(&journal_lock);
+
+    if (segmenti[corrente].file == NULL || in_corso ||
+        (!vecchio && dim_journal == sizeof(struct intestazione_journal) && derivati.num_elementi == 0)) {
+        pthread_mutex_unlock(&journal_lock);
+        return 1; // Journal vuoto e nessun file da sincronizzare, o checkpoint già in corso
+    }
+
+    // Se il vecchio segmento contiene ancora record (checkpoint fallito o interrotto) si riprova a svuotare quello
+    if (!vecchio && dim_journal > sizeof(struct intestazione_journal)) {
+        if (!riserva) {
+            fprintf(stderr, "Il journal '%s' non è pronto per il checkpoint.\n", segmenti[1 - corrente].path);
+            ret = -1;
+        } else if (write_segment_header(&segmenti[1 - corrente], prossimo) == -1) {
+            ret = -1;
+        } else {
+            corrente = 1 - corrente;
+            vecchio = 1;
+            riserva = 0;
+            dim_journal = sizeof(struct intestazione_journal);
+        }
+    }
+
+    if (ret == 0) {
+        da_sincronizzare = derivati;
+        da_sincronizzare_pronti = derivati_pronti;
+        derivati_pronti = init_hash_table(&derivati, 0) == 0;
+        in_corso = 1;
+    }
+
+    pthread_mutex_unlock(&journal_lock);
+    return ret;
+}
+
+/*
+ * Conclude il checkpoint iniziato da begin_journal_checkpoint(): sincronizza i file derivati messi da parte e svuota
+ * il vecchio segmento. Se la sincronizzazione fallisce il vecchio segmento non viene svuotato e i file restano da
+ * sincronizzare. Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: va invocata senza impedire che si applichino record: le scritture proseguono nel segmento corrente.
+ */
+int end_journal_checkpoint(void) {
+    int fd, svuota, ret = 0;
+
+    // Nessun altro usa 'da_sincronizzare' finché il checkpoint è in corso
+    if (da_sincronizzare_pronti)
+        ret = sync_files(&da_sincronizzare);
+
+    pthread_mutex_lock(&journal_lock);
+    fd = fileno(segmenti[corrente].file);
+    svuota = vecchio;
+    pthread_mutex_unlock(&journal_lock);
+
+    /*
+     * Prima di svuotare il vecchio segmento, l'intestazione del segmento corrente (da cui prosegue la numerazione dei
+     * record) deve essere su disco
+     */
+    if (ret == 0 && svuota && fdatasync(fd) == -1) {
+        perror("Impossibile sincronizzare il journal");
+        ret = -1;
+    }
+    if (ret == 0 && svuota)
+        ret = empty_segment(&segmenti[1 - corrente]);
+
+    pthread_mutex_lock(&journal_lock);
+    if (ret == 0 && svuota) {
+        vecchio = 0;
+        riserva = 1;
+        statistiche.checkpoint++;
+    }
+    if (ret == -1 && da_sincronizzare_pronti) // I file restano da sincronizzare
+        visit_hash_table(&da_sincronizzare, add_derived_file, NULL);
+    if (da_sincronizzare_pronti)
+        free_hash_table(&da_sincronizzare, NULL);
+    da_sincronizzare_pronti = 0;
+    in_corso = 0;
+    pthread_mutex_unlock(&journal_lock);
+
+    #ifdef DEBUG
+    if (ret == 0 && svuota)
+        printf("Checkpoint del journal eseguito: il primo record è il numero %u.\n",
+               (unsigned int) segmenti[corrente].primo);
+    #endif
+
+    return ret;
+}
+
+/*
+ * Abbandona il checkpoint iniziato da begin_journal_checkpoint() senza svuotare il vecchio segmento, che verrà svuotato
+ * dal prossimo checkpoint; i file derivati messi da parte restano da sincronizzare
+ */
+void abort_journal_checkpoint(void) {
+    pthread_mutex_lock(&journal_lock);
+    if (da_sincronizzare_pronti) {
+        visit_hash_table(&da_sincronizzare, add_derived_file, NULL);
+        free_hash_table(&da_sincronizzare, NULL);
+    }
+    da_sincronizzare_pronti = 0;
+    in_corso = 0;
+    pthread_mutex_unlock(&journal_lock);
+}
+
+/*
+ * Indica se il record 'numero' è già stato applicato a un file derivato in cui l'ultimo record applicato è 'applicato'
+ * (0 se nessuno). I numeri si confrontano in aritmetica modulare, così restano validi anche dopo che si sono esauriti.
+ */
+int is_journal_record_applied(unsigned int numero, unsigned int applicato) {
+    return applicato != 0 && (int32_t) ((uint32_t) numero - (uint32_t) applicato) <= 0;
+}
+
+/*
+ * Restituisce il numero del primo record del journal: i record precedenti sono stati eliminati dai checkpoint
+ */
+unsigned int get_first_journal_record(void) {
+    uint32_t numero;
+
+    pthread_mutex_lock(&journal_lock);
+    numero = vecchio ? segmenti[1 - corrente].primo : segmenti[corrente].primo;
+    pthread_mutex_unlock(&journal_lock);
+
+    return numero;
+}
+
+/*
+ * Restituisce il numero dell'ultimo record scritto nel journal (0 se non ne è mai stato scritto nessuno)
+ */
+unsigned int get_last_journal_record(void) {
+    uint32_t numero;
+
+    pthread_mutex_lock(&journal_lock);
+
+    // Dopo 0xFFFFFFFF la numerazione riprende da 1: 'prossimo' vale 1 anche nel journal in cui non si è scritto niente
+    if (prossimo != 1)
+        numero = prossimo - 1;
+    else if (vecchio || dim_journal > sizeof(struct intestazione_journal))
+        numero = UINT32_MAX;
+    else
+        numero = 0;
+
+    pthread_mutex_unlock(&journal_lock);
+
+    return numero;
+}
+
+/*
+ * Copia in 'copia' le statistiche del journal
+ */
+void get_journal_stats(struct statistiche_journal* copia) {
+    pthread_mutex_lock(&journal_lock);
+    *copia = statistiche;
+    pthread_mutex_unlock(&journal_lock);
+}
+
+/*
+ * Stampa le statistiche del journal
+ */
+void print_journal_stats(void) {
+    struct statistiche_journal copia;
+
+    get_journal_stats(&copia);
+
+    printf("Journal:\n");
+    printf("- record scritti: %llu (%llu byte), riapplicati all'avvio: %llu\n", copia.record, copia.byte,
+           copia.riapplicati);
+    printf("- checkpoint: %llu, file derivati sincronizzati: %llu\n", copia.checkpoint, copia.file_sincronizzati);
+}
@@ -0,0 +1,134 @@
+/************************************************************
+ *                                                          *
+ *        Journal (write-ahead log) delle scritture         *
+ *                                                          *
+ ************************************************************/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <time.h>
+
+#define JOURNAL_MAX_CAMPI 4 // Numero massimo di campi di un record
+
+/*
+ * Ogni operazione che modifica più file (ad esempio la registrazione di un messaggio per un utente offline, che
+ * finisce sia nel log della chat sia nella coda dei messaggi pendenti) viene prima registrata in un solo record del
+ * journal, con una sola scrittura in append: è il record a renderla definitiva. I file derivati vengono poi aggiornati
+ * senza sincronizzarli; lo sono tutti insieme al checkpoint, dopo il quale il journal riparte vuoto.
+ * Il journal è diviso in due segmenti: il checkpoint fa proseguire le scritture nell'altro segmento e sincronizza i
+ * file derivati senza fermarle, poi svuota il segmento con i record precedenti (vedi begin_journal_checkpoint()).
+ * All'avvio i record rimasti nel journal vengono riapplicati: chi li applica deve riconoscere quelli già presenti
+ * nei file derivati, che quindi registrano il numero dell'ultimo record applicato (vedi is_journal_record_applied()).
+ */
+
+/*
+ * Record del journal. I campi sono stringhe terminate.
+ */
+struct record_journal {
+    unsigned int numero; // Numero del record: cresce di 1 a ogni record (anche dopo un checkpoint), mai 0
+    int tipo; // Tipo di operazione (deciso da chi scrive il journal)
+    time_t timestamp; // Istante in cui è stato registrato
+    int num_campi;
+    char* campi[JOURNAL_MAX_CAMPI];
+};
+
+/*
+ * Statistiche (dall'avvio del programma) del journal
+ */
+struct statistiche_journal {
+    unsigned long long record; // Record scritti
+    unsigned long long byte; // Byte scritti
+    unsigned long long riapplicati; // Record trovati nel journal all'avvio
+    unsigned long long checkpoint; // Checkpoint eseguiti
+    unsigned long long file_sincronizzati; // File derivati sincronizzati dai checkpoint
+};
+
+/*
+ * Apre il journal 'path' (creandolo se non esiste) e invoca 'applica' su ogni record integro che contiene, in ordine.
+ * Un eventuale record troncato in fondo (crash durante la scrittura) viene eliminato. Va invocata una sola volta,
+ * prima di scrivere nel journal. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int open_journal(char* path, void (*applica)(struct record_journal* record, void* contesto), void* contesto);
+
+/*
+ * Aggiunge al journal il record specificato (tipo, timestamp e campi) e ne imposta il numero.
+ * Restituisce il turno del commit della scrittura (vedi wait_for_commit()) o -1 in caso di errore.
+ * NB: i record di operazioni che toccano gli stessi file derivati vanno scritti e applicati sotto lo stesso lock,
+ * così nei file i record compaiono nell'ordine del journal.
+ */
+long append_to_journal(struct record_journal* record);
+
+/*
+ * Chiede il commit durabile dei record scritti finora, qualunque sia la politica dei commit.
+ * Restituisce il turno del commit (vedi wait_for_commit()) o -1 in caso di errore.
+ */
+long sync_journal(void);
+
+/*
+ * Segnala che il file derivato 'path' è stato modificato e va sincronizzato al prossimo checkpoint
+ */
+void mark_derived_file(char* path);
+
+/*
+ * Sincronizza su disco i file derivati modificati finora
+ * Restituisce 0 in caso di successo, -1 se qualche file non è stato sincronizzato.
+ */
+int sync_derived_files(void);
+
+/*
+ * Indica se conviene eseguire un checkpoint (il journal ha superato JOURNAL_CHECKPOINT_LEN byte e non c'è già
+ * un checkpoint in corso)
+ */
+int journal_needs_checkpoint(void);
+
+/*
+ * Inizia un checkpoint: i record successivi si aggiungono all'altro segmento (che il checkpoint precedente ha lasciato
+ * vuoto) e i file derivati modificati finora vengono messi da parte per end_journal_checkpoint().
+ * Restituisce 0 se il checkpoint è iniziato, 1 se non serve o ce n'è già uno in corso, -1 in caso di errore.
+ * NB: il chiamante deve impedire che si applichino record mentre la invoca, così i file derivati dei record del
+ * vecchio segmento sono tutti tra quelli messi da parte.
+ */
+int begin_journal_checkpoint(void);
+
+/*
+ * Conclude il checkpoint iniziato da begin_journal_checkpoint(): sincronizza i file derivati messi da parte e svuota
+ * il vecchio segmento. Se la sincronizzazione fallisce il vecchio segmento non viene svuotato e i file restano da
+ * sincronizzare. Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: va invocata senza impedire che si applichino record: le scritture proseguono nel segmento corrente.
+ */
+int end_journal_checkpoint(void);
+
+/*
+ * Abbandona il checkpoint iniziato da begin_journal_checkpoint() senza svuotare il vecchio segmento, che verrà svuotato
+ * dal prossimo checkpoint; i file derivati messi da parte restano da sincronizzare
+ */
+void abort_journal_checkpoint(void);
+
+/*
+ * Indica se il record 'numero' è già stato applicato a un file derivato in cui l'ultimo record applicato è 'applicato'
+ * (0 se nessuno). I numeri si confrontano in aritmetica modulare, così restano validi anche dopo che si sono esauriti.
+ */
+int is_journal_record_applied(unsigned int numero, unsigned int applicato);
+
+/*
+ * Restituisce il numero del primo record del journal: i record precedenti sono stati eliminati dai checkpoint
+ */
+unsigned int get_first_journal_record(void);
+
+/*
+ * Restituisce il numero dell'ultimo record scritto nel journal (0 se non ne è mai stato scritto nessuno)
+ */
+unsigned int get_last_journal_record(void);
+
+/*
+ * Copia in 'copia' le statistiche del journal
+ */
+void get_journal_stats(struct statistiche_journal* copia);
+
+/*
+ * Stampa le statistiche del journal
+ */
+void print_journal_stats(void);
+
+#endif
@@ -0,0 +1,192 @@
+/************************************************************
+ *                                                          *
+ *         Log asincrono delle attività degli utenti        *
+ *                                                          *
+ ************************************************************/
+
+#include "log_attivita.h"
+#include "file.h"
+#include "time.h"
+#include "commit.h"
+#include "../costanti.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define OPERAZIONE_LEN 16 // Lunghezza massima del nome di un'attività
+
+/*
+ * Attività accodata in attesa di essere scritta
+ */
+struct voce_attivita {
+    time_t timestamp; // Istante dell'attività
+    char username[USERNAME_LEN]; // Utente che l'ha svolta
+    char operazione[OPERAZIONE_LEN]; // Tipo di attività (ad esempio "LOGIN")
+    struct voce_attivita* next; // Voce accodata prima di questa
+};
+
+/*
+ * Coda senza lock: chi registra un'attività inserisce la voce in testa con una compare-and-swap, il thread del log
+ * preleva in un colpo solo l'intera lista (scambiando la testa con NULL) e la inverte per scriverla in ordine.
+ * Dato che la lista viene sempre prelevata tutta, non c'è il problema ABA delle estrazioni di un solo elemento.
+ */
+static struct voce_attivita* testa = NULL;
+static unsigned long long accodate = 0; // Voci accodate finora (aggiornato con operazioni atomiche)
+static sem_t risveglio; // Segnalato a ogni inserimento in una coda vuota: il thread del log dorme finché non arriva una voce
+
+static FILE* file_log; // Usato solo dal thread del log
+static char* path_log;
+
+/*
+ * Avanzamento delle scritture, protetto da 'log_lock' (serve solo a chi aspetta che il log sia scritto)
+ */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t voci_scritte = PTHREAD_COND_INITIALIZER;
+static unsigned long long scritte = 0; // Voci prelevate e scritte dal thread del log
+static struct statistiche_log statistiche;
+
+/*
+ * Thread del log: preleva le voci accodate, le scrive tutte e ne chiede il commit
+ */
+static void* logger_loop(void* arg) {
+    struct voce_attivita* lista;
+    struct voce_attivita* invertita;
+    struct voce_attivita* voce;
+    time_t secondo = -1; // Secondo a cui si riferisce 'timestamp': le voci dello stesso secondo non lo riformattano
+    char timestamp[TIMESTAMP_LEN];
+    unsigned long long num_voci;
+
+    (void) arg;
+    for (;;) {
+        if (sem_wait(&risveglio) == -1)
+            continue; // Interrotto da un segnale
+
+        lista = __atomic_exchange_n(&testa, NULL, __ATOMIC_ACQUIRE);
+        if (lista == NULL)
+            continue;
+
+        // La lista è dalla più recente alla meno recente: la inverto
+        invertita = NULL;
+        while (lista != NULL) {
+            voce = lista;
+            lista = voce->next;
+            voce->next = invertita;
+            invertita = voce;
+        }
+
+        num_voci = 0;
+        while (invertita != NULL) {
+            voce = invertita;
+            invertita = voce->next;
+            if (voce->timestamp != secondo) {
+                format_timestamp(voce->timestamp, timestamp, sizeof(timestamp));
+                secondo = voce->timestamp;
+            }
+            fprintf(file_log, "[%s] %s di %s\n", timestamp, voce->operazione, voce->username);
+            free(voce);
+            num_voci++;
+        }
+
+        // Un solo commit per tutte le voci prelevate (ad aspettarlo è solo questo thread)
+        wait_for_commit(commit_append(file_log, path_log, 0));
+
+        pthread_mutex_lock(&log_lock);
+        scritte += num_voci;
+        statistiche.voci += num_voci;
+        statistiche.blocchi++;
+        pthread_cond_broadcast(&voci_scritte);
+        pthread_mutex_unlock(&log_lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Apre in append il file identificato da 'path' e avvia il thread che ci scrive le attività.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int start_activity_logger(char* path) {
+    pthread_t thread;
+
+    file_log = open_or_create(path, "a");
+    if (file_log == NULL)
+        return -1;
+    path_log = path;
+
+    if (sem_init(&risveglio, 0, 0) == -1) {
+        perror("Impossibile inizializzare il log delle attività");
+        fclose(file_log);
+        return -1;
+    }
+    if (pthread_create(&thread, NULL, logger_loop, NULL) != 0) {
+        perror("Impossibile avviare il thread del log delle attività");
+        fclose(file_log);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+/*
+ * Accoda l'attività 'operazione' dell'utente 'username' con il timestamp corrente. Non si blocca mai.
+ */
+void log_activity(const char* username, const char* operazione) {
+    struct voce_attivita* voce;
+
+    voce = malloc(sizeof(struct voce_attivita));
+    if (voce == NULL) {
+        __atomic_fetch_add(&statistiche.perse, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    voce->timestamp = time(NULL);
+    snprintf(voce->username, sizeof(voce->username), "%s", username);
+    snprintf(voce->operazione, sizeof(voce->operazione), "%s", operazione);
+
+    // Inserimento in testa: se fallisce un altro thread ha inserito nel frattempo e 'voce->next' contiene la nuova testa
+    voce->next = __atomic_load_n(&testa, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&testa, &voce->next, voce, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&accodate, 1, __ATOMIC_RELEASE);
+
+    // Se la coda era vuota il thread del log potrebbe dormire (altrimenti ha già un risveglio in sospeso)
+    if (voce->next == NULL)
+        sem_post(&risveglio);
+}
+
+/*
+ * Aspetta che tutte le attività accodate finora siano scritte sul file (ad esempio alla chiusura)
+ */
+void flush_activity_log(void) {
+    unsigned long long obiettivo = __atomic_load_n(&accodate, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&log_lock);
+    while (scritte < obiettivo)
+        pthread_cond_wait(&voci_scritte, &log_lock);
+    pthread_mutex_unlock(&log_lock);
+}
+
+/*
+ * Copia in 'copia' le statistiche del log delle attività
+ */
+void get_activity_log_stats(struct statistiche_log* copia) {
+    pthread_mutex_lock(&log_lock);
+    *copia = statistiche;
+    pthread_mutex_unlock(&log_lock);
+    copia->perse = __atomic_load_n(&statistiche.perse, __ATOMIC_RELAXED);
+}
+
+/*
+ * Stampa le statistiche del log delle attività
+ */
+void print_activity_log_stats(void) {
+    struct statistiche_log copia;
+
+    get_activity_log_stats(&copia);
+
+    printf("Log delle attività:\n");
+    printf("- voci scritte: %llu in %llu scritture (%.2f voci per scrittura), voci perse: %llu\n", copia.voci,
+           copia.blocchi, copia.blocchi > 0 ? (double) copia.voci / copia.blocchi : 0.0, copia.perse);
+}
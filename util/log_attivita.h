@@ -0,0 +1,51 @@
+/************************************************************
+ *                                                          *
+ *         Log asincrono delle attività degli utenti        *
+ *                                                          *
+ ************************************************************/
+
+#ifndef LOG_ATTIVITA_H
+#define LOG_ATTIVITA_H
+
+/*
+ * Le attività (login/logout) vengono accodate in una coda senza lock e scritte su file da un thread dedicato,
+ * che tiene il file sempre aperto e scrive in un colpo solo tutte le voci accodate nel frattempo:
+ * chi registra un'attività non tocca mai il file e non aspetta il disco.
+ */
+
+/*
+ * Statistiche (dall'avvio del programma) del log delle attività
+ */
+struct statistiche_log {
+    unsigned long long voci; // Voci scritte sul file
+    unsigned long long blocchi; // Scritture sul file (ciascuna con tutte le voci accodate fino a quel momento)
+    unsigned long long perse; // Voci non registrate per mancanza di memoria
+};
+
+/*
+ * Apre in append il file identificato da 'path' e avvia il thread che ci scrive le attività.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int start_activity_logger(char* path);
+
+/*
+ * Accoda l'attività 'operazione' dell'utente 'username' con il timestamp corrente. Non si blocca mai.
+ */
+void log_activity(const char* username, const char* operazione);
+
+/*
+ * Aspetta che tutte le attività accodate finora siano scritte sul file (ad esempio alla chiusura)
+ */
+void flush_activity_log(void);
+
+/*
+ * Copia in 'copia' le statistiche del log delle attività
+ */
+void get_activity_log_stats(struct statistiche_log* copia);
+
+/*
+ * Stampa le statistiche del log delle attività
+ */
+void print_activity_log_stats(void);
+
+#endif
@@ -0,0 +1,624 @@
+/************************************************************
+ *                                                          *
+ *            Log binario segmentato delle chat             *
+ *                                                          *
+ ************************************************************/
+
+#include "log_chat.h"
+#include "file.h"
+#include "../costanti.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#define CHAT_LOG_MAGIC "CHATLOG1" // Primi byte di ogni log (identificano il formato)
+#define LEN_MAGIC 8
+#define CHAT_SEGMENT_LEN 1024 // Messaggi di un segmento
+#define CHAT_INDEX_STEP 64 // Ogni quanti messaggi di un segmento c'è una voce nell'indice del suo piede
+#define NESSUN_RECORD ((size_t) -1)
+
+#define RECORD_MESSAGGIO 1
+#define RECORD_PIEDE 2
+
+/*
+ * Intestazione di un record. Segue il mittente ('len_mittente' byte), i dati ('len_dati' byte: il testo di un
+ * messaggio o il contenuto di un piede) e di nuovo la lunghezza del record (uint32_t).
+ * I campi sono nell'ordine di byte della macchina: il log è letto da chi lo ha scritto.
+ */
+struct intestazione_record {
+    uint32_t lunghezza; // Lunghezza dell'intero record
+    uint8_t tipo; // RECORD_MESSAGGIO o RECORD_PIEDE
+    uint8_t letto; // Segno di lettura del messaggio
+    uint16_t len_mittente;
+    uint32_t len_dati;
+    uint32_t journal; // Record del journal del server che ha registrato il messaggio (0 se nessuno)
+    uint64_t seq; // Numero di sequenza del messaggio (del piede: dell'ultimo messaggio del segmento)
+    int64_t timestamp; // Istante del messaggio (del piede: dell'ultimo messaggio del segmento)
+};
+
+/*
+ * Contenuto di un piede, seguito da 'num_indice' struct voce_indice
+ */
+struct piede_segmento {
+    uint64_t primo_seq; // Numero di sequenza del primo messaggio del segmento
+    int64_t primo_timestamp; // Istante del primo messaggio del segmento
+    uint64_t precedente; // Offset del piede precedente (0 se è il primo segmento)
+    uint32_t num_indice;
+    uint32_t riservato;
+};
+
+/*
+ * Voce dell'indice sparso di un segmento
+ */
+struct voce_indice {
+    uint64_t seq;
+    int64_t timestamp;
+    uint64_t offset; // Offset del messaggio nel file
+};
+
+/*
+ * Legge in 'intestazione' il record all'offset 'pos' della mappa, controllando che sia integro.
+ * Restituisce 1 se il record è valido, 0 altrimenti (fine del file o record troncato).
+ */
+static int read_record(const char* mappa, size_t dim, size_t pos, struct intestazione_record* intestazione) {
+    uint32_t coda;
+
+    if (pos < LEN_MAGIC || dim < pos + sizeof(struct intestazione_record))
+        return 0;
+    memcpy(intestazione, mappa + pos, sizeof(struct intestazione_record));
+    if (intestazione->lunghezza != sizeof(struct intestazione_record) + intestazione->len_mittente +
+                                   intestazione->len_dati + sizeof(uint32_t) ||
+        dim - pos < intestazione->lunghezza)
+        return 0;
+
+    memcpy(&coda, mappa + pos + intestazione->lunghezza - sizeof(uint32_t), sizeof(uint32_t));
+    return coda == intestazione->lunghezza;
+}
+
+/*
+ * Restituisce l'offset del record che termina all'offset 'fine' o NESSUN_RECORD se non c'è
+ * (inizio del file o record non integro)
+ */
+static size_t previous_record(const char* mappa, size_t dim, size_t fine) {
+    struct intestazione_record intestazione;
+    uint32_t lunghezza;
+
+    if (fine < LEN_MAGIC + sizeof(struct intestazione_record) + sizeof(uint32_t) || fine > dim)
+        return NESSUN_RECORD;
+    memcpy(&lunghezza, mappa + fine - sizeof(uint32_t), sizeof(uint32_t));
+    if (lunghezza > fine - LEN_MAGIC || !read_record(mappa, dim, fine - lunghezza, &intestazione) ||
+        intestazione.lunghezza != lunghezza)
+        return NESSUN_RECORD;
+
+    return fine - lunghezza;
+}
+
+/*
+ * Restituisce la fine dell'ultimo record integro della mappa. Se il file termina con un record troncato
+ * (ad esempio per un crash durante la scrittura) lo scorre dall'inizio.
+ */
+static size_t valid_end(const char* mappa, size_t dim) {
+    struct intestazione_record intestazione;
+    size_t pos = LEN_MAGIC;
+
+    if (dim <= LEN_MAGIC || previous_record(mappa, dim, dim) != NESSUN_RECORD)
+        return dim < LEN_MAGIC ? 0 : dim;
+
+    while (read_record(mappa, dim, pos, &intestazione))
+        pos += intestazione.lunghezza;
+    return pos;
+}
+
+/*
+ * Restituisce l'offset dell'ultimo piede che precede l'offset 'fine' (0 se non ce ne sono)
+ */
+static size_t last_footer(const char* mappa, size_t dim, size_t fine) {
+    struct intestazione_record intestazione;
+    size_t pos;
+
+    // Dopo l'ultimo piede ci sono al più CHAT_SEGMENT_LEN messaggi
+    for (pos = previous_record(mappa, dim, fine); pos != NESSUN_RECORD; pos = previous_record(mappa, dim, pos)) {
+        read_record(mappa, dim, pos, &intestazione);
+        if (intestazione.tipo == RECORD_PIEDE)
+            return pos;
+    }
+
+    return 0;
+}
+
+/*
+ * Legge il record in fondo al file 'fd' (lungo 'dim' byte) senza mapparlo.
+ * Restituisce 1 se c'è un record integro, 0 altrimenti.
+ */
+static int read_last_record(int fd, size_t dim, struct intestazione_record* intestazione) {
+    uint32_t lunghezza;
+
+    if (dim < LEN_MAGIC + sizeof(struct intestazione_record) + sizeof(uint32_t) ||
+        pread(fd, &lunghezza, sizeof(uint32_t), dim - sizeof(uint32_t)) != sizeof(uint32_t) ||
+        lunghezza > dim - LEN_MAGIC || lunghezza < sizeof(struct intestazione_record) + sizeof(uint32_t) ||
+        pread(fd, intestazione, sizeof(struct intestazione_record), dim - lunghezza) != sizeof(struct intestazione_record))
+        return 0;
+
+    return intestazione->lunghezza == lunghezza &&
+           lunghezza == sizeof(struct intestazione_record) + intestazione->len_mittente + intestazione->len_dati +
+                        sizeof(uint32_t);
+}
+
+/*
+ * Scrive sul file un record con i campi specificati ('dati' è il testo di un messaggio o il contenuto di un piede)
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+static int write_record(FILE* file, struct intestazione_record* intestazione, const char* mittente,
+                        const void* dati) {
+    intestazione->lunghezza = sizeof(struct intestazione_record) + intestazione->len_mittente +
+                              intestazione->len_dati + sizeof(uint32_t);
+
+    if (fwrite(intestazione, sizeof(struct intestazione_record), 1, file) != 1 ||
+        fwrite(mittente, 1, intestazione->len_mittente, file) != intestazione->len_mittente ||
+        fwrite(dati, 1, intestazione->len_dati, file) != intestazione->len_dati ||
+        fwrite(&intestazione->lunghezza, sizeof(uint32_t), 1, file) != 1)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Chiude il segmento che termina in fondo al file 'fd' (lungo 'dim' byte) aggiungendo il suo piede
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+static int seal_segment(FILE* file, int fd, size_t dim) {
+    struct intestazione_record intestazione;
+    struct piede_segmento* piede;
+    struct voce_indice* indice;
+    size_t messaggi[CHAT_SEGMENT_LEN]; // Offset dei messaggi del segmento
+    size_t pos, len_dati;
+    char* mappa;
+    int num = 0, i, ret;
+
+    mappa = mmap(NULL, dim, PROT_READ, MAP_SHARED, fd, 0);
+    if (mappa == MAP_FAILED) {
+        perror("Impossibile mappare il log della chat");
+        return -1;
+    }
+
+    // Risalgo i messaggi del segmento fino al piede precedente (o all'inizio del file)
+    len_dati = sizeof(struct piede_segmento) + (CHAT_SEGMENT_LEN / CHAT_INDEX_STEP + 1) * sizeof(struct voce_indice);
+    piede = calloc(1, len_dati);
+    if (piede == NULL) {
+        perror("Impossibile allocare il piede del segmento");
+        munmap(mappa, dim);
+        return -1;
+    }
+    for (pos = previous_record(mappa, dim, dim); pos != NESSUN_RECORD; pos = previous_record(mappa, dim, pos)) {
+        read_record(mappa, dim, pos, &intestazione);
+        if (intestazione.tipo == RECORD_PIEDE) {
+            piede->precedente = pos;
+            break;
+        }
+        if (num == CHAT_SEGMENT_LEN)
+            break; // Segmento più lungo del previsto: l'indice copre solo gli ultimi messaggi
+        messaggi[CHAT_SEGMENT_LEN - ++num] = pos;
+    }
+
+    // Indice sparso: un messaggio ogni CHAT_INDEX_STEP, a partire dal primo
+    indice = (struct voce_indice*) (piede + 1);
+    for (i = 0; i < num; i++) {
+        read_record(mappa, dim, messaggi[CHAT_SEGMENT_LEN - num + i], &intestazione);
+        if (i == 0) {
+            piede->primo_seq = intestazione.seq;
+            piede->primo_timestamp = intestazione.timestamp;
+        }
+        if (i % CHAT_INDEX_STEP == 0) {
+            indice[piede->num_indice].seq = intestazione.seq;
+            indice[piede->num_indice].timestamp = intestazione.timestamp;
+            indice[piede->num_indice].offset = messaggi[CHAT_SEGMENT_LEN - num + i];
+            piede->num_indice++;
+        }
+    }
+    munmap(mappa, dim);
+
+    // Il piede riporta numero di sequenza e istante dell'ultimo messaggio (l'ultimo record letto)
+    intestazione.tipo = RECORD_PIEDE;
+    intestazione.letto = 0;
+    intestazione.journal = 0;
+    intestazione.len_mittente = 0;
+    intestazione.len_dati = sizeof(struct piede_segmento) + piede->num_indice * sizeof(struct voce_indice);
+    ret = num > 0 ? write_record(file, &intestazione, "", piede) : 0;
+    free(piede);
+
+    return ret;
+}
+
+/*
+ * Aggiunge un messaggio in fondo al log aperto in 'file' (che deve essere stato svuotato con fflush() dopo
+ * l'ultima scrittura), chiudendo prima il segmento se è pieno. Restituisce 0 in caso di successo, -1 in caso di errore.
+ * NB: il chiamante deve impedire che altri scrivano contemporaneamente sul log.
+ */
+static int append_record(FILE* file, const char* mittente, const char* testo, size_t len_testo, int letto,
+                         time_t timestamp, unsigned int journal, unsigned long long* seq) {
+    struct intestazione_record intestazione;
+    struct stat info;
+    size_t dim;
+    char* mappa;
+    int fd = fileno(file);
+
+    if (fstat(fd, &info) == -1)
+        return -1;
+    dim = info.st_size;
+
+    // Se in fondo al file c'è un record troncato (crash durante una scrittura) lo elimino
+    if (dim > LEN_MAGIC && read_last_record(fd, dim, &intestazione) == 0) {
+        mappa = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mappa == MAP_FAILED)
+            return -1;
+        dim = valid_end(mappa, dim);
+        munmap(mappa, info.st_size);
+        if (ftruncate(fd, dim) == -1)
+            return -1;
+    }
+
+    if (dim < LEN_MAGIC) { // Log nuovo (o illeggibile)
+        if (dim > 0 && ftruncate(fd, 0) == -1)
+            return -1;
+        if (fwrite(CHAT_LOG_MAGIC, 1, LEN_MAGIC, file) != LEN_MAGIC)
+            return -1;
+        intestazione.seq = 0;
+    } else if (dim == LEN_MAGIC) {
+        intestazione.seq = 0;
+    } else {
+        read_last_record(fd, dim, &intestazione);
+
+        // L'ultimo messaggio ha riempito il segmento: lo chiudo
+        if (intestazione.tipo == RECORD_MESSAGGIO && intestazione.seq % CHAT_SEGMENT_LEN == 0 &&
+            seal_segment(file, fd, dim) == -1)
+            return -1;
+    }
+
+    intestazione.seq++;
+    intestazione.tipo = RECORD_MESSAGGIO;
+    intestazione.letto = letto;
+    intestazione.timestamp = timestamp;
+    intestazione.journal = journal;
+    intestazione.len_mittente = strlen(mittente);
+    intestazione.len_dati = len_testo;
+    if (write_record(file, &intestazione, mittente, testo) == -1 || fflush(file) != 0)
+        return -1;
+
+    if (seq != NULL)
+        *seq = intestazione.seq;
+    return 0;
+}
+
+/*
+ * Aggiunge il messaggio in fondo al log 'path' (aperto tramite 'cache') bloccando il file.
+ * Restituisce il file su cui è stato scritto o NULL in caso di errore (con errno ESTALE se il log è stato spostato:
+ * va ricalcolato il path con get_chat_log_path()).
+ */
+static FILE* append_locked(struct cache_file* cache, char* path, char* mittente, char* testo, int letto,
+                           time_t timestamp, unsigned int journal, unsigned long long* seq) {
+    FILE* file;
+    int ret;
+
+    file = get_cached_file(cache, path);
+    if (file == NULL)
+        return NULL;
+
+    // Sul log scrivono anche gli altri processi (server e device): il numero di sequenza si decide col file bloccato
+    if (lock_file_in_place(fileno(file), path) == -1) {
+        if (errno == ESTALE) {
+            close_cached_file(cache, path);
+            errno = ESTALE;
+        } else {
+            perror("Impossibile bloccare il log della chat");
+        }
+        return NULL;
+    }
+    ret = append_record(file, mittente, testo, strlen(testo), letto, timestamp, journal, seq);
+    flock(fileno(file), LOCK_UN);
+
+    if (ret == -1) {
+        fprintf(stderr, "Errore durante la scrittura del log della chat '%s' : %s\n", path, strerror(errno));
+        close_cached_file(cache, path);
+        return NULL;
+    }
+
+    return file;
+}
+
+/*
+ * Aggiunge in fondo al log 'path' (aperto tramite 'cache') il messaggio di 'mittente', con il timestamp corrente
+ * e il segno di lettura 'letto'. Se 'seq' è diverso da NULL ci pone il numero di sequenza del messaggio.
+ * Il record arriva subito sul file. Restituisce il file su cui è stato scritto (da passare eventualmente a
+ * commit_append()) o NULL in caso di errore (con errno ESTALE se il log è stato spostato dallo strumento di
+ * migrazione: basta ricalcolarne il path e riprovare).
+ */
+FILE* append_chat_message(struct cache_file* cache, char* path, char* mittente, char* testo, int letto,
+                          unsigned long long* seq) {
+    return append_locked(cache, path, mittente, testo, letto, time(NULL), 0, seq);
+}
+
+/*
+ * Come append_chat_message(), ma per un messaggio non letto registrato all'istante 'timestamp' dal record 'journal'
+ * del journal del server (vedi last_chat_journal_record())
+ */
+FILE* append_journaled_chat_message(struct cache_file* cache, char* path, char* mittente, char* testo,
+                                    time_t timestamp, unsigned int journal) {
+    return append_locked(cache, path, mittente, testo, 0, timestamp, journal, NULL);
+}
+
+/*
+ * Restituisce il numero dell'ultimo record del journal del server registrato nel log 'path' (0 se nessuno)
+ */
+unsigned int last_chat_journal_record(char* path) {
+    struct lettore_chat lettore;
+    struct intestazione_record intestazione;
+    size_t pos;
+    unsigned int journal = 0;
+
+    if (open_chat_reader(&lettore, path) <= 0)
+        return 0;
+
+    // Risalgo il log dalla fine: i messaggi scritti dai device non hanno un record del journal
+    for (pos = previous_record(lettore.mappa, lettore.dim, lettore.dim); pos != NESSUN_RECORD && journal == 0;
+         pos = previous_record(lettore.mappa, lettore.dim, pos)) {
+        read_record(lettore.mappa, lettore.dim, pos, &intestazione);
+        if (intestazione.tipo == RECORD_MESSAGGIO)
+            journal = intestazione.journal;
+    }
+
+    close_chat_reader(&lettore);
+    return journal;
+}
+
+/*
+ * Converte il log testuale della chat tra 'utente1' e 'utente2' (se c'è) nel log binario. I messaggi ricevono
+ * come timestamp l'ultima modifica del vecchio file e sono letti se lo erano nel vecchio log (segno nella riga
+ * o segno di lettura del destinatario). Il vecchio log e i suoi segni di lettura vengono cancellati.
+ */
+static void convert_text_chat_log(char* utente1, char* utente2, char* path) {
+    char testo_path[PATH_MAX]; // Path del log testuale
+    char tmp_path[PATH_MAX]; // Path del log binario in costruzione
+    long letti1, letti2; // Segni di lettura (offset) dei due utenti nel log testuale
+    char* linea = NULL; // Riga letta dal file
+    size_t dim_linea = 0;
+    ssize_t len;
+    size_t len_segno;
+    char* separatore;
+    struct stat info;
+    FILE* testo;
+    FILE* binario;
+    int letto, errore = 0;
+
+    fix_chat_log_name(utente1, utente2);
+    get_text_chat_log_path(utente1, utente2, testo_path);
+    testo = open_file(testo_path, "r");
+    if (testo == NULL)
+        return; // Nessun log da convertire
+
+    letti1 = get_read_mark(testo_path, utente1);
+    letti2 = get_read_mark(testo_path, utente2);
+    if (fstat(fileno(testo), &info) == -1)
+        info.st_mtime = 0;
+
+    // Il log viene costruito a parte e poi collegato al suo nome: se un altro processo lo ha già fatto, si rinuncia
+    snprintf(tmp_path, PATH_MAX, "%s.%d.tmp", path, (int) getpid());
+    binario = open_or_create(tmp_path, "w+");
+    if (binario == NULL) {
+        fclose(testo);
+        return;
+    }
+
+    while (!errore && (len = getline(&linea, &dim_linea, testo)) != -1) {
+        if (len > 0 && linea[len - 1] == '\n')
+            linea[--len] = '\0';
+
+        separatore = strstr(linea, ": ");
+        if (separatore == NULL)
+            continue; // Riga non valida
+        *separatore = '\0';
+
+        // Il messaggio è letto se ha il segno nella riga o se termina prima del segno di lettura del destinatario
+        letto = 1;
+        len_segno = strlen(READ_MARK) + 1;
+        if (len >= len_segno && strcmp(&linea[len - len_segno + 1], READ_MARK) == 0) {
+            linea[len - len_segno] = '\0';
+        } else if (len >= (len_segno = strlen(UNREAD_MARK) + 1) &&
+                   strcmp(&linea[len - len_segno + 1], UNREAD_MARK) == 0) {
+            linea[len - len_segno] = '\0';
+            letto = ftell(testo) <= (strcmp(linea, utente1) == 0 ? letti2 : letti1);
+        }
+
+        errore = append_record(binario, linea, separatore + 2, strlen(separatore + 2), letto, info.st_mtime, 0,
+                               NULL) == -1;
+    }
+    free(linea);
+    fclose(testo);
+
+    if (fclose(binario) != 0 || errore) {
+        fprintf(stderr, "Errore durante la conversione del log della chat '%s'\n", testo_path);
+        remove(tmp_path);
+        return;
+    }
+    if (link(tmp_path, path) == 0) {
+        remove(testo_path);
+        remove_read_mark(testo_path, utente1);
+        remove_read_mark(testo_path, utente2);
+
+        #ifdef DEBUG
+        printf("Log della chat '%s' convertito in '%s'.\n", testo_path, path);
+        #endif
+    }
+    remove(tmp_path);
+}
+
+/*
+ * Se il log binario della chat tra 'utente1' e 'utente2' non esiste ancora, lo crea convertendo il log
+ * testuale (righe "mittente: messaggio (*)") scritto dalle versioni precedenti, se c'è, poi pone il path
+ * del log in 'path'.
+ */
+void prepare_chat_log(char* utente1, char* utente2, char* path) {
+    get_chat_log_path(utente1, utente2, path);
+    if (access(path, F_OK) == -1)
+        convert_text_chat_log(utente1, utente2, path);
+}
+
+/*
+ * Mappa in memoria il log 'path' e posiziona il lettore sul primo messaggio (se il log è stato appena spostato dallo
+ * strumento di migrazione, lo cerca nel nuovo path). Restituisce 1 in caso di successo, 0 se il log non esiste,
+ * -1 in caso di errore.
+ */
+int open_chat_reader(struct lettore_chat* lettore, char* path) {
+    char spostato[PATH_MAX]; // Path del log dopo la migrazione
+    struct stat info;
+    int fd;
+
+    lettore->mappa = NULL;
+    lettore->dim_mappa = 0;
+    lettore->dim = 0;
+    lettore->pos = LEN_MAGIC;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1 && errno == ENOENT && get_migrated_path(path, spostato) == 1)
+        fd = open(spostato, O_RDONLY);
+    if (fd == -1)
+        return errno == ENOENT ? 0 : -1;
+
+    // Il blocco condiviso garantisce che nessuno stia scrivendo un record mentre si prende la dimensione del file
+    flock(fd, LOCK_SH);
+    if (fstat(fd, &info) == -1 || info.st_size <= LEN_MAGIC) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return 1; // Log vuoto
+    }
+
+    lettore->mappa = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (lettore->mappa == MAP_FAILED) {
+        perror("Impossibile mappare il log della chat");
+        lettore->mappa = NULL;
+        return -1;
+    }
+    lettore->dim_mappa = info.st_size;
+    lettore->dim = info.st_size;
+
+    if (memcmp(lettore->mappa, CHAT_LOG_MAGIC, LEN_MAGIC) != 0) {
+        fprintf(stderr, "Il file '%s' non è un log di una chat.\n", path);
+        close_chat_reader(lettore);
+        return -1;
+    }
+
+    // Gli eventuali byte di un record troncato non vengono letti
+    lettore->dim = valid_end(lettore->mappa, lettore->dim);
+    return 1;
+}
+
+/*
+ * Posiziona il lettore sul primo messaggio con chiave (numero di sequenza o, se 'per_tempo' è 1, timestamp)
+ * maggiore o uguale a 'obiettivo'
+ */
+static void seek_chat(struct lettore_chat* lettore, long long obiettivo, int per_tempo) {
+    struct intestazione_record intestazione;
+    struct piede_segmento piede;
+    struct voce_indice voce;
+    size_t pos;
+    long long primo, ultimo, chiave;
+    unsigned int i;
+
+    lettore->pos = LEN_MAGIC;
+    if (lettore->mappa == NULL)
+        return;
+
+    // Risalgo i segmenti dall'ultimo finché non trovo quello che contiene l'obiettivo
+    for (pos = last_footer(lettore->mappa, lettore->dim, lettore->dim); pos != 0; pos = piede.precedente) {
+        if (!read_record(lettore->mappa, lettore->dim, pos, &intestazione) || intestazione.tipo != RECORD_PIEDE)
+            break; // Piede non valido: scorro il file dall'inizio
+        memcpy(&piede, lettore->mappa + pos + sizeof(struct intestazione_record), sizeof(struct piede_segmento));
+        primo = per_tempo ? piede.primo_timestamp : (long long) piede.primo_seq;
+        ultimo = per_tempo ? intestazione.timestamp : (long long) intestazione.seq;
+
+        if (obiettivo > ultimo) { // L'obiettivo è dopo questo segmento
+            lettore->pos = pos + intestazione.lunghezza;
+            break;
+        }
+        if (obiettivo > primo) { // L'obiettivo è in questo segmento: parto dall'ultima voce dell'indice che lo precede
+            for (i = 0; i < piede.num_indice; i++) {
+                memcpy(&voce, lettore->mappa + pos + sizeof(struct intestazione_record) +
+                              sizeof(struct piede_segmento) + i * sizeof(struct voce_indice), sizeof(voce));
+                chiave = per_tempo ? voce.timestamp : (long long) voce.seq;
+                if (chiave >= obiettivo)
+                    break;
+                lettore->pos = voce.offset;
+            }
+            break;
+        }
+        if (piede.precedente >= pos)
+            break; // Catena dei piedi non valida
+    }
+
+    // Salto i messaggi che precedono l'obiettivo
+    while (read_record(lettore->mappa, lettore->dim, lettore->pos, &intestazione)) {
+        chiave = per_tempo ? intestazione.timestamp : (long long) intestazione.seq;
+        if (intestazione.tipo == RECORD_MESSAGGIO && chiave >= obiettivo)
+            break;
+        lettore->pos += intestazione.lunghezza;
+    }
+}
+
+/*
+ * Posiziona il lettore sul primo messaggio con numero di sequenza maggiore o uguale a 'seq'
+ */
+void seek_chat_sequence(struct lettore_chat* lettore, unsigned long long seq) {
+    seek_chat(lettore, (long long) seq, 0);
+}
+
+/*
+ * Posiziona il lettore sul primo messaggio registrato all'istante 'timestamp' o dopo
+ */
+void seek_chat_time(struct lettore_chat* lettore, time_t timestamp) {
+    seek_chat(lettore, (long long) timestamp, 1);
+}
+
+/*
+ * Legge il messaggio successivo e lo pone in 'messaggio'. Restituisce 1 se c'era, 0 se il log è finito.
+ */
+int next_chat_message(struct lettore_chat* lettore, struct messaggio_chat* messaggio) {
+    struct intestazione_record intestazione;
+    const char* record;
+
+    while (lettore->mappa != NULL && read_record(lettore->mappa, lettore->dim, lettore->pos, &intestazione)) {
+        record = lettore->mappa + lettore->pos;
+        lettore->pos += intestazione.lunghezza;
+        if (intestazione.tipo != RECORD_MESSAGGIO)
+            continue; // Piede di un segmento
+
+        messaggio->seq = intestazione.seq;
+        messaggio->timestamp = (time_t) intestazione.timestamp;
+        messaggio->letto = intestazione.letto;
+        messaggio->mittente = record + sizeof(struct intestazione_record);
+        messaggio->len_mittente = intestazione.len_mittente;
+        messaggio->testo = messaggio->mittente + intestazione.len_mittente;
+        messaggio->len_testo = intestazione.len_dati;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Chiude il lettore (i messaggi letti non sono più validi)
+ */
+void close_chat_reader(struct lettore_chat* lettore) {
+    if (lettore->mappa != NULL)
+        munmap(lettore->mappa, lettore->dim_mappa);
+    lettore->mappa = NULL;
+    lettore->dim_mappa = 0;
+    lettore->dim = 0;
+}
@@ -0,0 +1,107 @@
+/************************************************************
+ *                                                          *
+ *            Log binario segmentato delle chat             *
+ *                                                          *
+ ************************************************************/
+
+#ifndef LOG_CHAT_H
+#define LOG_CHAT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+#include "cache_file.h"
+
+/*
+ * Il log di una chat è un file binario in cui si aggiungono solo record in fondo. Ogni record ha la lunghezza
+ * sia all'inizio sia alla fine (così il file si può scorrere in entrambe le direzioni) e contiene mittente,
+ * timestamp, numero di sequenza (da 1, crescente nel log) e segno di lettura del messaggio.
+ * Ogni CHAT_SEGMENT_LEN messaggi il segmento viene chiuso da un record "piede" con un indice sparso
+ * (numero di sequenza, timestamp e offset di un messaggio ogni CHAT_INDEX_STEP) e l'offset del piede precedente:
+ * il lettore mappa il file in memoria (mmap()) e raggiunge un numero di sequenza o un istante saltando di piede
+ * in piede, senza rileggere i messaggi precedenti.
+ * Il log viene scritto sia dal server sia dai device: chi aggiunge un record blocca il file con flock().
+ * I messaggi scritti dal server riportano anche il numero del record del suo journal (vedi util/journal.h).
+ */
+
+/*
+ * Messaggio letto dal log. I campi puntano nel file mappato (non sono terminati): restano validi
+ * finché non si chiude il lettore.
+ */
+struct messaggio_chat {
+    unsigned long long seq; // Numero di sequenza nel log
+    time_t timestamp; // Istante in cui è stato registrato (0 se sconosciuto, ad esempio dopo la conversione)
+    int letto; // 1 se è stato registrato come già letto dal destinatario
+    const char* mittente;
+    int len_mittente;
+    const char* testo;
+    int len_testo;
+};
+
+/*
+ * Lettore di un log mappato in memoria
+ */
+struct lettore_chat {
+    char* mappa; // Contenuto del file (NULL se il file è vuoto)
+    size_t dim_mappa; // Dimensione della mappa
+    size_t dim; // Byte della mappa occupati da record integri
+    size_t pos; // Offset del prossimo record da leggere
+};
+
+/*
+ * Se il log binario della chat tra 'utente1' e 'utente2' non esiste ancora, lo crea convertendo il log
+ * testuale (righe "mittente: messaggio (*)") scritto dalle versioni precedenti, se c'è, poi pone il path
+ * del log in 'path'.
+ */
+void prepare_chat_log(char* utente1, char* utente2, char* path);
+
+/*
+ * Aggiunge in fondo al log 'path' (aperto tramite 'cache') il messaggio di 'mittente', con il timestamp corrente
+ * e il segno di lettura 'letto'. Se 'seq' è diverso da NULL ci pone il numero di sequenza del messaggio.
+ * Il record arriva subito sul file. Restituisce il file su cui è stato scritto (da passare eventualmente a
+ * commit_append()) o NULL in caso di errore (con errno ESTALE se il log è stato spostato dallo strumento di
+ * migrazione: basta ricalcolarne il path e riprovare).
+ */
+FILE* append_chat_message(struct cache_file* cache, char* path, char* mittente, char* testo, int letto,
+                          unsigned long long* seq);
+
+/*
+ * Come append_chat_message(), ma per un messaggio non letto registrato all'istante 'timestamp' dal record 'journal'
+ * del journal del server (vedi last_chat_journal_record())
+ */
+FILE* append_journaled_chat_message(struct cache_file* cache, char* path, char* mittente, char* testo,
+                                    time_t timestamp, unsigned int journal);
+
+/*
+ * Restituisce il numero dell'ultimo record del journal del server registrato nel log 'path' (0 se nessuno)
+ */
+unsigned int last_chat_journal_record(char* path);
+
+/*
+ * Mappa in memoria il log 'path' e posiziona il lettore sul primo messaggio (se il log è stato appena spostato dallo
+ * strumento di migrazione, lo cerca nel nuovo path). Restituisce 1 in caso di successo, 0 se il log non esiste,
+ * -1 in caso di errore.
+ */
+int open_chat_reader(struct lettore_chat* lettore, char* path);
+
+/*
+ * Posiziona il lettore sul primo messaggio con numero di sequenza maggiore o uguale a 'seq'
+ */
+void seek_chat_sequence(struct lettore_chat* lettore, unsigned long long seq);
+
+/*
+ * Posiziona il lettore sul primo messaggio registrato all'istante 'timestamp' o dopo
+ */
+void seek_chat_time(struct lettore_chat* lettore, time_t timestamp);
+
+/*
+ * Legge il messaggio successivo e lo pone in 'messaggio'. Restituisce 1 se c'era, 0 se il log è finito.
+ */
+int next_chat_message(struct lettore_chat* lettore, struct messaggio_chat* messaggio);
+
+/*
+ * Chiude il lettore (i messaggi letti non sono più validi)
+ */
+void close_chat_reader(struct lettore_chat* lettore);
+
+#endif
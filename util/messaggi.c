@@ -6,23 +6,139 @@
  ************************************************************/
 
 #include "messaggi.h"
+#include "compressione.h"
 #include "string.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+
+static int max_frame_len = DEFAULT_MAX_FRAME_LEN; // Lunghezza massima dei frame con lunghezza varint
 
 /*
- * Invia una stringa sul socket specificato.
- * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ * Imposta la lunghezza massima dei frame con lunghezza varint (il corpo, senza la lunghezza)
  */
-int send_string(int socket, char* string) {
+void set_max_frame_len(int len) {
+    max_frame_len = len;
+}
+
+/*
+ * Restituisce la lunghezza massima dei frame con lunghezza varint
+ */
+int get_max_frame_len(void) {
+    return max_frame_len;
+}
+
+/*
+ * Garantisce che '*buffer' (allocato con malloc() e di '*capacita' byte) possa contenere almeno 'len' byte,
+ * riallocandolo se necessario. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reserve_buffer(char** buffer, int* capacita, int len) {
+    char* nuovo;
+
+    if (*buffer != NULL && *capacita >= len)
+        return 0;
+
+    nuovo = realloc(*buffer, len);
+    if (nuovo == NULL) {
+        perror("Impossibile allocare un buffer");
+        return -1;
+    }
+    *buffer = nuovo;
+    *capacita = len;
+
+    return 0;
+}
+
+/*
+ * Codifica 'valore' come varint (7 bit per byte, a partire dai meno significativi) in 'buffer', che deve
+ * poter contenere MAX_VARINT_LEN byte. Restituisce il numero di byte scritti.
+ */
+int encode_varint(uint32_t valore, char* buffer) {
+    int len = 0;
+
+    // Il bit più significativo di ogni byte indica se il varint prosegue nel byte successivo
+    while (valore >= 0x80) {
+        buffer[len++] = (valore & 0x7f) | 0x80;
+        valore >>= 7;
+    }
+    buffer[len++] = valore;
+
+    return len;
+}
+
+/*
+ * Restituisce il numero di byte occupati da 'valore' codificato come varint
+ */
+int varint_len(uint32_t valore) {
+    int len = 1;
+
+    while (valore >= 0x80) {
+        valore >>= 7;
+        len++;
+    }
+
+    return len;
+}
+
+/*
+ * Decodifica il varint all'inizio dei 'len' byte di 'dati' e lo pone in 'valore'.
+ * Restituisce il numero di byte letti, 0 se il varint è incompleto e -1 se non è valido.
+ */
+int decode_varint(char* dati, int len, uint32_t* valore) {
+    uint32_t byte;
+    int i;
+
+    *valore = 0;
+    for (i = 0; i < len && i < MAX_VARINT_LEN; i++) {
+        byte = (unsigned char) dati[i];
+
+        // L'ultimo byte può contenere solo i 4 bit rimasti di un intero a 32 bit
+        if (i == MAX_VARINT_LEN - 1 && byte > 0x0f)
+            return -1;
+
+        *valore |= (byte & 0x7f) << (7 * i);
+        if ((byte & 0x80) == 0)
+            return i + 1;
+    }
+
+    return i == MAX_VARINT_LEN ? -1 : 0;
+}
+
+/*
+ * Invia tutti i 'len' byte di 'buffer' sul socket specificato (una singola send() può inviarne meno).
+ * Con MSG_NOSIGNAL la chiusura del peer viene segnalata come errore (EPIPE) anziché con SIGPIPE.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int send_all(int socket, void* buffer, int len) {
+    int ret, inviati = 0;
+
+    while (inviati < len) {
+        ret = send(socket, (char*) buffer + inviati, len - inviati, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        inviati += ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Pone in 'buffer' il frame che trasporta la stringa specificata (lunghezza e caratteri).
+ * 'buffer' deve poter contenere strlen(string) + 2 byte. Restituisce la lunghezza del frame.
+ */
+int build_string_frame(char* string, char* buffer) {
     int len = strlen(string);
     uint16_t network_order_len = htons(len);
-    int ret;
-    char tmp[len]; // Serve per evitare di modificare la stringa passata come parametro
-    char buffer[len + sizeof(uint16_t)]; // Buffer contenente la lunghezza della stringa e la stringa
+    char tmp[len + 1]; // Serve per evitare di modificare la stringa passata come parametro
 
     // Copio la stringa per non modificare quella passata come parametro
     strcpy(tmp, string);
@@ -30,14 +146,48 @@ int send_string(int socket, char* string) {
     // Sostituisco il new-line con il terminatore di stringa, se presente
     remove_new_line(tmp);
 
+    memcpy(buffer, &network_order_len, sizeof(uint16_t));
+    memcpy(&buffer[sizeof(uint16_t)], tmp, len);
+
+    return len + sizeof(uint16_t);
+}
+
+/*
+ * Riceve esattamente 'len' byte sul socket specificato (una singola recv() può restituirne meno
+ * se il frame arriva in più segmenti).
+ * Restituisce il numero di byte ricevuti, 0 in caso di disconnessione del socket e -1 in caso di errore.
+ */
+static int receive_all(int socket, void* buffer, int len) {
+    int ret, ricevuti = 0;
+
+    while (ricevuti < len) {
+        ret = recv(socket, (char*) buffer + ricevuti, len - ricevuti, 0);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return ret;
+
+        ricevuti += ret;
+    }
+
+    return ricevuti;
+}
+
+/*
+ * Invia una stringa sul socket specificato.
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_string(int socket, char* string) {
+    int len, ret;
+    char buffer[strlen(string) + sizeof(uint16_t)]; // Buffer contenente la lunghezza della stringa e la stringa
+
     #ifdef DEBUG
-    printf("Invio sul socket %d la stringa '%s', di lunghezza %d.\n", socket, tmp, len);
+    printf("Invio sul socket %d la stringa '%s', di lunghezza %d.\n", socket, string, (int) strlen(string));
     #endif
 
     // Invio messaggio (contenente lunghezza della stringa e stringa stessa)
-    memcpy(buffer, &network_order_len, sizeof(uint16_t));
-    memcpy(&buffer[sizeof(uint16_t)], &tmp, len);
-    ret = send(socket, (void*) buffer, len + sizeof(uint16_t), 0);
+    len = build_string_frame(string, buffer);
+    ret = send_all(socket, (void*) buffer, len);
     if (ret < 0) {
         perror("Errore durante l'invio di una stringa");
         return ret;
@@ -59,7 +209,7 @@ int send_integer(int socket, int intero) {
     #endif
 
     // Invio l'intero
-    ret = send(socket, (void*) &network_order_int, sizeof(uint16_t), 0);
+    ret = send_all(socket, (void*) &network_order_int, sizeof(uint16_t));
     if (ret < 0) {
         perror("Errore durante l'invio di un intero.\n");
         return ret;
@@ -84,7 +234,7 @@ int send_bit(int socket, void* bits, int count) {
     // Invio messaggio (contenente il numero di bit e la sequenza di bit stessa)
     memcpy(buffer, &network_order_len, sizeof(uint16_t));
     memcpy(&buffer[sizeof(uint16_t)], bits, count);
-    ret = send(socket, (void*) buffer, count + sizeof(uint16_t), 0);
+    ret = send_all(socket, (void*) buffer, count + sizeof(uint16_t));
     if (ret < 0) {
         perror("Errore durante l'invio di bit");
         return ret;
@@ -102,7 +252,7 @@ int receive_integer(int socket, int* received) {
     int ret, tmp;
 
     // Ricevo l'intero
-    ret = recv(socket, (void*) &tmp, sizeof(uint16_t), 0);
+    ret = receive_all(socket, (void*) &tmp, sizeof(uint16_t));
     if (ret <= 0) {
         if (ret == -1)
             perror("Errore durante la ricezione di un intero");
@@ -128,7 +278,7 @@ int receive_string(int socket, char* received) {
     uint16_t network_order_len;
 
     // Prelevo la lunghezza della stringa
-    ret = recv(socket, (void*) &network_order_len, sizeof(uint16_t), 0);
+    ret = receive_all(socket, (void*) &network_order_len, sizeof(uint16_t));
     if (ret <= 0) {
         if (ret == -1)
             perror("Errore durante il prelievo della lunghezza di una stringa");
@@ -142,8 +292,8 @@ int receive_string(int socket, char* received) {
     #endif
 
     // Prelevo la stringa
-    ret = recv(socket, received, len, 0);
-    if (ret <= 0) {
+    ret = receive_all(socket, received, len);
+    if (ret < 0 || (ret == 0 && len > 0)) {
         if (ret == -1)
             perror("Errore durante la ricezione di una stringa");
 
@@ -168,7 +318,7 @@ int receive_bit(int socket, void* received) {
     uint16_t network_order_len;
 
     // Prelevo la lunghezza della sequenza di bit
-    ret = recv(socket, (void*) &network_order_len, sizeof(uint16_t), 0);
+    ret = receive_all(socket, (void*) &network_order_len, sizeof(uint16_t));
     if (ret <= 0) {
         if (ret == -1)
             perror("Errore durante il prelievo della lunghezza di una sequenza di bit");
@@ -182,8 +332,8 @@ int receive_bit(int socket, void* received) {
     #endif
 
     // Prelevo la sequenza di bit
-    ret = recv(socket, (void*) received, len, 0);
-    if (ret <= 0) {
+    ret = receive_all(socket, (void*) received, len);
+    if (ret < 0 || (ret == 0 && len > 0)) {
         if (ret == -1)
             perror("Errore durante il prelievo di una sequenza di bit");
 
@@ -195,4 +345,481 @@ int receive_bit(int socket, void* received) {
     #endif
 
     return 1;
+}
+
+/*
+ * Aspetta di ricevere un frame (lunghezza e corpo) sul socket specificato. Pone in 'received' il corpo,
+ * di cui possono essere ricevuti al massimo 'max' byte, e in 'len' la sua lunghezza.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del socket e
+ * un numero negativo in caso di errore (anche se il frame è più lungo di 'max' byte).
+ */
+int receive_frame(int socket, char* received, int max, int* len) {
+    int ret;
+    uint16_t network_order_len;
+
+    // Prelevo la lunghezza del frame
+    ret = receive_all(socket, (void*) &network_order_len, sizeof(uint16_t));
+    if (ret <= 0) {
+        if (ret == -1)
+            perror("Errore durante il prelievo della lunghezza di un frame");
+
+        return ret;
+    }
+    *len = ntohs(network_order_len);
+
+    if (*len > max) {
+        fprintf(stderr, "Ricevuto sul socket %d un frame di %d byte: la lunghezza massima è %d.\n", socket, *len, max);
+        return -1;
+    }
+
+    // Prelevo il corpo del frame
+    ret = receive_all(socket, received, *len);
+    if (ret < 0 || (ret == 0 && *len > 0)) {
+        if (ret == -1)
+            perror("Errore durante la ricezione di un frame");
+
+        return ret;
+    }
+
+    #ifdef DEBUG
+    printf("Ricevuto sul socket %d un frame di %d byte.\n", socket, *len);
+    #endif
+
+    return 1;
+}
+
+/*
+ * Aspetta di ricevere un frame con lunghezza varint sul socket specificato. Pone il corpo in '*received'
+ * (di '*capacita' byte, riallocato se il frame non ci sta) e in 'len' la sua lunghezza.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del socket e
+ * un numero negativo in caso di errore (anche se il frame supera la lunghezza massima).
+ */
+int receive_varint_frame(int socket, char** received, int* capacita, int* len) {
+    char lunghezza[MAX_VARINT_LEN];
+    uint32_t valore;
+    int ret, letti = 0;
+
+    // Prelevo la lunghezza del frame un byte alla volta, finché il varint non è completo
+    do {
+        ret = receive_all(socket, &lunghezza[letti], 1);
+        if (ret <= 0) {
+            if (ret == -1)
+                perror("Errore durante il prelievo della lunghezza di un frame");
+
+            return ret;
+        }
+        letti++;
+    } while ((ret = decode_varint(lunghezza, letti, &valore)) == 0);
+
+    if (ret == -1 || valore > (uint32_t) max_frame_len) {
+        fprintf(stderr, "Ricevuto sul socket %d un frame non valido: la lunghezza massima è %d.\n", socket,
+                max_frame_len);
+        return -1;
+    }
+    *len = valore;
+
+    // Prelevo il corpo del frame
+    if (reserve_buffer(received, capacita, *len) == -1)
+        return -1;
+    ret = receive_all(socket, *received, *len);
+    if (ret < 0 || (ret == 0 && *len > 0)) {
+        if (ret == -1)
+            perror("Errore durante la ricezione di un frame");
+
+        return ret;
+    }
+
+    #ifdef DEBUG
+    printf("Ricevuto sul socket %d un frame di %d byte.\n", socket, *len);
+    #endif
+
+    return 1;
+}
+
+/*
+ * Comprime con 'codec' il corpo di un frame con lunghezza varint ('len' byte in 'corpo') e pone in '*uscita'
+ * (allocato con malloc(), da liberare dal chiamante) il frame compresso: la lunghezza (varint) seguita dal byte
+ * 'marcatore', dal codec, dalla lunghezza originale del corpo (varint) e dai dati compressi.
+ * Restituisce la lunghezza del frame compresso, 0 se il corpo va inviato così com'è (più corto della soglia
+ * di compressione o incomprimibile) e -1 in caso di errore.
+ */
+int pack_varint_frame(char* corpo, int len, int codec, char marcatore, char** uscita) {
+    char lunghezza[MAX_VARINT_LEN];
+    char* frame;
+    int intestazione, compressi, len_lunghezza;
+
+    if (!should_compress(codec, len))
+        return 0;
+
+    // Il corpo compresso viene scritto dopo lo spazio per la lunghezza del frame, che si conosce solo alla fine
+    frame = malloc(MAX_VARINT_LEN + 2 + MAX_VARINT_LEN + len);
+    if (frame == NULL) {
+        perror("Impossibile allocare il buffer di un frame compresso");
+        return -1;
+    }
+    intestazione = MAX_VARINT_LEN;
+    frame[intestazione++] = marcatore;
+    frame[intestazione++] = codec;
+    intestazione += encode_varint(len, &frame[intestazione]);
+
+    // Conviene inviare il frame compresso solo se è più corto dell'originale
+    compressi = compress_data(codec, corpo, len, &frame[intestazione], MAX_VARINT_LEN + len - intestazione - 1);
+    if (compressi == -1) {
+        free(frame);
+        return 0;
+    }
+
+    // La lunghezza del frame precede il corpo compresso
+    len_lunghezza = encode_varint(intestazione - MAX_VARINT_LEN + compressi, lunghezza);
+    memmove(&frame[len_lunghezza], &frame[MAX_VARINT_LEN], intestazione - MAX_VARINT_LEN + compressi);
+    memcpy(frame, lunghezza, len_lunghezza);
+    *uscita = frame;
+
+    return len_lunghezza + intestazione - MAX_VARINT_LEN + compressi;
+}
+
+/*
+ * Decomprime il corpo di un frame compresso da pack_varint_frame() ('len' byte in 'dati', dopo il marcatore)
+ * e lo pone in '*uscita' (di '*capacita' byte, riallocato se il corpo non ci sta).
+ * Restituisce la lunghezza del corpo decompresso o -1 se il frame non è valido (anche se il corpo decompresso
+ * supera la lunghezza massima dei frame).
+ */
+int unpack_varint_frame(char* dati, int len, char** uscita, int* capacita) {
+    uint32_t originale;
+    int ret, codec;
+
+    if (len < 1)
+        return -1;
+    codec = (unsigned char) dati[0];
+    ret = decode_varint(&dati[1], len - 1, &originale);
+    if (ret <= 0 || originale > (uint32_t) max_frame_len || reserve_buffer(uscita, capacita, originale) == -1)
+        return -1;
+
+    // Il corpo decompresso deve avere esattamente la lunghezza annunciata
+    if (decompress_data(codec, &dati[1 + ret], len - 1 - ret, *uscita, originale) != (int) originale)
+        return -1;
+
+    return originale;
+}
+
+/*
+ * Inizializza un buffer di ricezione vuoto.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_receive_buffer(struct buffer_ricezione* buffer) {
+    buffer->dati = NULL;
+    if (reserve_buffer(&buffer->dati, &buffer->capacita, RECEIVE_BUFFER_LEN) == -1)
+        return -1;
+
+    buffer->inizio = 0;
+    buffer->fine = 0;
+    buffer->stato = FRAME_ATTESA_LUNGHEZZA;
+    buffer->lunghezza = 0;
+    buffer->chiuso = 0;
+
+    return 0;
+}
+
+/*
+ * Libera la memoria del buffer di ricezione
+ */
+void free_receive_buffer(struct buffer_ricezione* buffer) {
+    free(buffer->dati);
+    buffer->dati = NULL;
+    buffer->capacita = 0;
+}
+
+/*
+ * Sposta in testa al buffer i byte non ancora consumati, così da liberare spazio in coda
+ */
+static void compact_receive_buffer(struct buffer_ricezione* buffer) {
+    if (buffer->inizio == 0)
+        return;
+
+    memmove(buffer->dati, &buffer->dati[buffer->inizio], buffer->fine - buffer->inizio);
+    buffer->fine -= buffer->inizio;
+    buffer->inizio = 0;
+}
+
+/*
+ * Legge dal socket, senza bloccarsi, tutti i byte disponibili finché c'è spazio nel buffer.
+ * Restituisce 1 se il buffer si è riempito (sul socket potrebbero esserci altri byte da leggere),
+ * 0 se sono stati letti tutti i byte disponibili, un valore negativo in caso di errore.
+ * Se il peer ha chiuso la connessione viene impostato il campo 'chiuso' del buffer.
+ */
+int fill_receive_buffer(int socket, struct buffer_ricezione* buffer) {
+    char* ridotto;
+    int ret;
+
+    compact_receive_buffer(buffer);
+
+    // Se il buffer era stato ingrandito per un frame ormai consumato, torna alla dimensione iniziale
+    if (buffer->capacita > RECEIVE_BUFFER_LEN && buffer->fine <= RECEIVE_BUFFER_LEN &&
+        (buffer->stato == FRAME_ATTESA_LUNGHEZZA || buffer->lunghezza <= RECEIVE_BUFFER_LEN)) {
+        ridotto = realloc(buffer->dati, RECEIVE_BUFFER_LEN);
+        if (ridotto != NULL) {
+            buffer->dati = ridotto;
+            buffer->capacita = RECEIVE_BUFFER_LEN;
+        }
+    }
+
+    while (buffer->fine < buffer->capacita) {
+        ret = recv(socket, &buffer->dati[buffer->fine], buffer->capacita - buffer->fine, MSG_DONTWAIT);
+        if (ret == 0) { // Disconnessione del peer
+            buffer->chiuso = 1;
+            return 0;
+        }
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0; // Letti tutti i byte disponibili
+
+            perror("Errore durante la ricezione dal socket");
+            return -1;
+        }
+
+        buffer->fine += ret;
+
+        #ifdef DEBUG
+        printf("Ricevuti %d byte sul socket %d (%d in attesa di essere elaborati).\n", ret, socket,
+               buffer->fine - buffer->inizio);
+        #endif
+    }
+
+    return 1; // Buffer pieno
+}
+
+/*
+ * Estrae dal buffer il prossimo frame, se è stato ricevuto completamente. 'tipo' indica il frame
+ * atteso: FRAME_STRINGA (lunghezza e dati), FRAME_INTERO o FRAME_VARINT. Se il frame non sta nel
+ * buffer, il buffer viene ingrandito per le letture successive man mano che si riempie (raddoppiando
+ * fino alla lunghezza del frame), così la memoria allocata dipende dai byte ricevuti e non dalla
+ * lunghezza annunciata nell'intestazione.
+ * Restituisce 1 se il frame è completo (e lo pone in 'frame'), 0 se servono altri byte e -1 se il
+ * frame non è valido (lunghezza superiore a MAX_FRAME_LEN o, per FRAME_VARINT, a get_max_frame_len()).
+ */
+int next_frame(struct buffer_ricezione* buffer, int tipo, struct frame* frame) {
+    uint16_t network_order;
+    uint32_t valore;
+    int ret, capacita;
+
+    if (buffer->stato == FRAME_ATTESA_LUNGHEZZA && tipo == FRAME_VARINT) {
+        ret = decode_varint(&buffer->dati[buffer->inizio], buffer->fine - buffer->inizio, &valore);
+        if (ret == 0)
+            return 0;
+        if (ret == -1 || valore > (uint32_t) max_frame_len) {
+            fprintf(stderr, "Ricevuto un frame non valido: la lunghezza massima è %d.\n", max_frame_len);
+            return -1;
+        }
+
+        buffer->inizio += ret;
+        buffer->lunghezza = valore;
+        buffer->stato = FRAME_ATTESA_CORPO;
+    } else if (buffer->stato == FRAME_ATTESA_LUNGHEZZA) {
+        // Sia la lunghezza di una stringa che un intero occupano 2 byte
+        if (buffer->fine - buffer->inizio < sizeof(uint16_t))
+            return 0;
+
+        memcpy(&network_order, &buffer->dati[buffer->inizio], sizeof(uint16_t));
+        buffer->inizio += sizeof(uint16_t);
+
+        // Un intero è composto solo da questi 2 byte
+        if (tipo == FRAME_INTERO) {
+            frame->dati = NULL;
+            frame->lunghezza = 0;
+            frame->intero = ntohs(network_order);
+            return 1;
+        }
+
+        buffer->lunghezza = ntohs(network_order);
+        if (buffer->lunghezza > MAX_FRAME_LEN) {
+            fprintf(stderr, "Ricevuto un frame di %d byte: la lunghezza massima è %d.\n", buffer->lunghezza,
+                    MAX_FRAME_LEN);
+            return -1;
+        }
+        buffer->stato = FRAME_ATTESA_CORPO;
+    }
+
+    // Aspetto che il corpo del frame sia arrivato per intero, facendogli spazio se il buffer è troppo piccolo
+    if (buffer->fine - buffer->inizio < buffer->lunghezza) {
+        if (buffer->capacita - buffer->inizio < buffer->lunghezza) {
+            compact_receive_buffer(buffer);
+
+            // Il buffer cresce solo quando è pieno: un frame annunciato ma non ancora inviato non occupa memoria
+            if (buffer->fine == buffer->capacita) {
+                capacita = buffer->capacita * 2 < buffer->lunghezza ? buffer->capacita * 2 : buffer->lunghezza;
+                if (reserve_buffer(&buffer->dati, &buffer->capacita, capacita) == -1)
+                    return -1;
+            }
+        }
+        return 0;
+    }
+
+    frame->dati = &buffer->dati[buffer->inizio];
+    frame->lunghezza = buffer->lunghezza;
+    frame->intero = 0;
+    buffer->inizio += buffer->lunghezza;
+    buffer->stato = FRAME_ATTESA_LUNGHEZZA;
+
+    return 1;
+}
+
+/*
+ * Inizializza una coda di invio vuota
+ */
+void init_send_queue(struct coda_invio* coda) {
+    coda->testa = NULL;
+    coda->coda = NULL;
+    coda->in_coda = 0;
+}
+
+/*
+ * Accoda 'len' byte alla coda di invio, allocando nuovi segmenti se quello in fondo è pieno.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int queue_bytes(struct coda_invio* coda, char* dati, int len) {
+    struct segmento_invio* segmento;
+    int copiati;
+
+    while (len > 0) {
+        // Se l'ultimo segmento è pieno (o non ce ne sono) ne aggiungo uno in fondo alla lista
+        if (coda->coda == NULL || coda->coda->fine == SEND_SEGMENT_LEN) {
+            segmento = malloc(sizeof(struct segmento_invio));
+            if (segmento == NULL) {
+                perror("Impossibile allocare un segmento della coda di invio");
+                return -1;
+            }
+            segmento->inizio = 0;
+            segmento->fine = 0;
+            segmento->next = NULL;
+
+            if (coda->coda == NULL)
+                coda->testa = segmento;
+            else
+                coda->coda->next = segmento;
+            coda->coda = segmento;
+        }
+
+        segmento = coda->coda;
+        copiati = SEND_SEGMENT_LEN - segmento->fine < len ? SEND_SEGMENT_LEN - segmento->fine : len;
+        memcpy(&segmento->dati[segmento->fine], dati, copiati);
+        segmento->fine += copiati;
+        coda->in_coda += copiati;
+        dati += copiati;
+        len -= copiati;
+    }
+
+    return 0;
+}
+
+/*
+ * Accoda una stringa alla coda di invio (lo stesso frame inviato da send_string()).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int queue_string(struct coda_invio* coda, char* string) {
+    int len;
+    char buffer[strlen(string) + sizeof(uint16_t)]; // Buffer contenente la lunghezza della stringa e la stringa
+
+    #ifdef DEBUG
+    printf("Accodata la stringa '%s', di lunghezza %d.\n", string, (int) strlen(string));
+    #endif
+
+    len = build_string_frame(string, buffer);
+    return queue_bytes(coda, buffer, len);
+}
+
+/*
+ * Accoda un intero alla coda di invio (lo stesso frame inviato da send_integer()).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int queue_integer(struct coda_invio* coda, int intero) {
+    uint16_t network_order_int = htons(intero); // Converto l'intero da host-order a network-order
+
+    #ifdef DEBUG
+    printf("Accodato l'intero '%d'.\n", intero);
+    #endif
+
+    return queue_bytes(coda, (char*) &network_order_int, sizeof(uint16_t));
+}
+
+/*
+ * Accoda 'count' bit in 'bits' alla coda di invio (lo stesso frame inviato da send_bit()).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int queue_bit(struct coda_invio* coda, void* bits, int count) {
+    uint16_t network_order_len = htons(count);
+
+    if (queue_bytes(coda, (char*) &network_order_len, sizeof(uint16_t)) == -1)
+        return -1;
+
+    return queue_bytes(coda, bits, count);
+}
+
+/*
+ * Invia sul socket (non bloccante) quanti più byte in coda possibile, senza bloccarsi.
+ * Restituisce il numero di byte rimasti in coda o un valore negativo in caso di errore
+ * (in tal caso la coda viene svuotata).
+ */
+int flush_send_queue(int socket, struct coda_invio* coda) {
+    struct iovec iov[SEND_QUEUE_MAX_IOV];
+    struct segmento_invio* segmento;
+    int i, ret;
+
+    while (coda->in_coda > 0) {
+        // Raccolgo i segmenti da inviare con una sola system call
+        for (i = 0, segmento = coda->testa; segmento != NULL && i < SEND_QUEUE_MAX_IOV; segmento = segmento->next, i++) {
+            iov[i].iov_base = &segmento->dati[segmento->inizio];
+            iov[i].iov_len = segmento->fine - segmento->inizio;
+        }
+
+        ret = writev(socket, iov, i);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break; // Il socket non accetta altri byte: il resto verrà inviato in seguito
+
+            perror("Errore durante l'invio della coda di un socket");
+            free_send_queue(coda);
+            return -1;
+        }
+
+        #ifdef DEBUG
+        printf("Inviati %d byte sul socket %d (%d rimasti in coda).\n", ret, socket, coda->in_coda - ret);
+        #endif
+
+        // Rimuovo i byte inviati, liberando i segmenti completati
+        coda->in_coda -= ret;
+        while (ret > 0) {
+            segmento = coda->testa;
+            if (ret < segmento->fine - segmento->inizio) {
+                segmento->inizio += ret;
+                break;
+            }
+
+            ret -= segmento->fine - segmento->inizio;
+            coda->testa = segmento->next;
+            free(segmento);
+        }
+        if (coda->testa == NULL)
+            coda->coda = NULL;
+    }
+
+    return coda->in_coda;
+}
+
+/*
+ * Libera tutti i segmenti della coda di invio
+ */
+void free_send_queue(struct coda_invio* coda) {
+    struct segmento_invio* segmento;
+
+    while (coda->testa != NULL) {
+        segmento = coda->testa;
+        coda->testa = segmento->next;
+        free(segmento);
+    }
+    coda->coda = NULL;
+    coda->in_coda = 0;
 }
\ No newline at end of file
@@ -5,6 +5,109 @@
  *                                                          *
  ************************************************************/
 
+#ifndef MESSAGGI_H
+#define MESSAGGI_H
+
+#include <stdint.h>
+#include "../costanti.h"
+
+#define FRAME_STRINGA 0 // Frame composto da lunghezza e dati (inviato con send_string() o send_bit())
+#define FRAME_INTERO 1 // Frame composto dal solo intero (inviato con send_integer())
+#define FRAME_VARINT 2 // Frame composto da lunghezza (codificata come varint) e dati
+
+#define FRAME_ATTESA_LUNGHEZZA 0 // Il parser attende la lunghezza del prossimo frame
+#define FRAME_ATTESA_CORPO 1 // Il parser ha letto la lunghezza e attende il corpo del frame
+
+/*
+ * Buffer di ricezione di un socket non bloccante. Accumula i byte disponibili sul socket (anche
+ * frammenti di frame) e permette di estrarre i frame man mano che vengono completati: lo stato del
+ * parser viene mantenuto tra una lettura e l'altra, quindi un client lento non blocca chi lo serve.
+ */
+struct buffer_ricezione {
+    char* dati; // Byte ricevuti e non ancora consumati
+    int capacita; // Dimensione di 'dati': parte da RECEIVE_BUFFER_LEN e cresce per contenere i frame più grandi
+    int inizio; // Posizione del primo byte non ancora consumato
+    int fine; // Posizione del primo byte libero
+    int stato; // Stato del parser (FRAME_ATTESA_LUNGHEZZA o FRAME_ATTESA_CORPO)
+    int lunghezza; // Lunghezza del corpo del frame corrente (valida in FRAME_ATTESA_CORPO)
+    int chiuso; // Vale 1 quando il peer ha chiuso la connessione
+};
+
+/*
+ * Frame estratto da un buffer di ricezione
+ */
+struct frame {
+    char* dati; // Corpo del frame (punta dentro il buffer: è valido fino alla prossima lettura dal socket)
+    int lunghezza; // Lunghezza del corpo
+    int intero; // Valore ricevuto, per i frame di tipo FRAME_INTERO
+};
+
+/*
+ * Segmento di una coda di invio: contiene una porzione dei byte da inviare
+ */
+struct segmento_invio {
+    char dati[SEND_SEGMENT_LEN];
+    int inizio; // Posizione del primo byte non ancora inviato
+    int fine; // Posizione del primo byte libero
+    struct segmento_invio* next; // Segmento successivo (è una lista)
+};
+
+/*
+ * Coda di invio di un socket non bloccante. I frame vengono accodati senza effettuare system call
+ * e inviati tutti insieme (con una writev()) quando il socket è pronto in scrittura: i byte che il
+ * socket non accetta subito restano in coda per l'invio successivo.
+ */
+struct coda_invio {
+    struct segmento_invio* testa; // Primo segmento da inviare
+    struct segmento_invio* coda; // Ultimo segmento (in cui si accodano i nuovi frame)
+    int in_coda; // Numero di byte in attesa di essere inviati
+};
+
+/*
+ * Imposta la lunghezza massima dei frame con lunghezza varint (il corpo, senza la lunghezza)
+ */
+void set_max_frame_len(int len);
+
+/*
+ * Restituisce la lunghezza massima dei frame con lunghezza varint
+ */
+int get_max_frame_len(void);
+
+/*
+ * Garantisce che '*buffer' (allocato con malloc() e di '*capacita' byte) possa contenere almeno 'len' byte,
+ * riallocandolo se necessario. Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reserve_buffer(char** buffer, int* capacita, int len);
+
+/*
+ * Codifica 'valore' come varint (7 bit per byte, a partire dai meno significativi) in 'buffer', che deve
+ * poter contenere MAX_VARINT_LEN byte. Restituisce il numero di byte scritti.
+ */
+int encode_varint(uint32_t valore, char* buffer);
+
+/*
+ * Restituisce il numero di byte occupati da 'valore' codificato come varint
+ */
+int varint_len(uint32_t valore);
+
+/*
+ * Decodifica il varint all'inizio dei 'len' byte di 'dati' e lo pone in 'valore'.
+ * Restituisce il numero di byte letti, 0 se il varint è incompleto e -1 se non è valido.
+ */
+int decode_varint(char* dati, int len, uint32_t* valore);
+
+/*
+ * Invia tutti i 'len' byte di 'buffer' sul socket specificato (una singola send() può inviarne meno).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int send_all(int socket, void* buffer, int len);
+
+/*
+ * Pone in 'buffer' il frame che trasporta la stringa specificata (lunghezza e caratteri).
+ * 'buffer' deve poter contenere strlen(string) + 2 byte. Restituisce la lunghezza del frame.
+ */
+int build_string_frame(char* string, char* buffer);
+
 /*
  * Invia una stringa sul socket specificato.
  * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
@@ -42,4 +145,110 @@ int receive_string(int socket, char received[]);
  * Restituisce 1 in caso di successo, 0 in caso di disconnessione del socket e
  * un numero negativo in caso di errore.
  */
-int receive_bit(int socket, void* received);
\ No newline at end of file
+int receive_bit(int socket, void* received);
+
+/*
+ * Aspetta di ricevere un frame (lunghezza e corpo) sul socket specificato. Pone in 'received' il corpo,
+ * di cui possono essere ricevuti al massimo 'max' byte, e in 'len' la sua lunghezza.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del socket e
+ * un numero negativo in caso di errore (anche se il frame è più lungo di 'max' byte).
+ */
+int receive_frame(int socket, char* received, int max, int* len);
+
+/*
+ * Aspetta di ricevere un frame con lunghezza varint sul socket specificato. Pone il corpo in '*received'
+ * (di '*capacita' byte, riallocato se il frame non ci sta) e in 'len' la sua lunghezza.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del socket e
+ * un numero negativo in caso di errore (anche se il frame supera la lunghezza massima).
+ */
+int receive_varint_frame(int socket, char** received, int* capacita, int* len);
+
+/*
+ * Comprime con 'codec' il corpo di un frame con lunghezza varint ('len' byte in 'corpo') e pone in '*uscita'
+ * (allocato con malloc(), da liberare dal chiamante) il frame compresso: la lunghezza (varint) seguita dal byte
+ * 'marcatore', dal codec, dalla lunghezza originale del corpo (varint) e dai dati compressi.
+ * Restituisce la lunghezza del frame compresso, 0 se il corpo va inviato così com'è (più corto della soglia
+ * di compressione o incomprimibile) e -1 in caso di errore.
+ */
+int pack_varint_frame(char* corpo, int len, int codec, char marcatore, char** uscita);
+
+/*
+ * Decomprime il corpo di un frame compresso da pack_varint_frame() ('len' byte in 'dati', dopo il marcatore)
+ * e lo pone in '*uscita' (di '*capacita' byte, riallocato se il corpo non ci sta).
+ * Restituisce la lunghezza del corpo decompresso o -1 se il frame non è valido (anche se il corpo decompresso
+ * supera la lunghezza massima dei frame).
+ */
+int unpack_varint_frame(char* dati, int len, char** uscita, int* capacita);
+
+/*
+ * Inizializza una coda di invio vuota
+ */
+void init_send_queue(struct coda_invio* coda);
+
+/*
+ * Accoda 'len' byte alla coda di invio, allocando nuovi segmenti se quello in fondo è pieno.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int queue_bytes(struct coda_invio* coda, char* dati, int len);
+
+/*
+ * Accoda una stringa alla coda di invio (lo stesso frame inviato da send_string()).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int queue_string(struct coda_invio* coda, char* string);
+
+/*
+ * Accoda un intero alla coda di invio (lo stesso frame inviato da send_integer()).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int queue_integer(struct coda_invio* coda, int intero);
+
+/*
+ * Accoda 'count' bit in 'bits' alla coda di invio (lo stesso frame inviato da send_bit()).
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int queue_bit(struct coda_invio* coda, void* bits, int count);
+
+/*
+ * Invia sul socket (non bloccante) quanti più byte in coda possibile, senza bloccarsi.
+ * Restituisce il numero di byte rimasti in coda o un valore negativo in caso di errore
+ * (in tal caso la coda viene svuotata).
+ */
+int flush_send_queue(int socket, struct coda_invio* coda);
+
+/*
+ * Libera tutti i segmenti della coda di invio
+ */
+void free_send_queue(struct coda_invio* coda);
+
+/*
+ * Inizializza un buffer di ricezione vuoto.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_receive_buffer(struct buffer_ricezione* buffer);
+
+/*
+ * Libera la memoria del buffer di ricezione
+ */
+void free_receive_buffer(struct buffer_ricezione* buffer);
+
+/*
+ * Legge dal socket, senza bloccarsi, tutti i byte disponibili finché c'è spazio nel buffer.
+ * Restituisce 1 se il buffer si è riempito (sul socket potrebbero esserci altri byte da leggere),
+ * 0 se sono stati letti tutti i byte disponibili, un valore negativo in caso di errore.
+ * Se il peer ha chiuso la connessione viene impostato il campo 'chiuso' del buffer.
+ */
+int fill_receive_buffer(int socket, struct buffer_ricezione* buffer);
+
+/*
+ * Estrae dal buffer il prossimo frame, se è stato ricevuto completamente. 'tipo' indica il frame
+ * atteso: FRAME_STRINGA (lunghezza e dati), FRAME_INTERO o FRAME_VARINT. Se il frame non sta nel
+ * buffer, il buffer viene ingrandito per le letture successive man mano che si riempie (raddoppiando
+ * fino alla lunghezza del frame), così la memoria allocata dipende dai byte ricevuti e non dalla
+ * lunghezza annunciata nell'intestazione.
+ * Restituisce 1 se il frame è completo (e lo pone in 'frame'), 0 se servono altri byte e -1 se il
+ * frame non è valido (lunghezza superiore a MAX_FRAME_LEN o, per FRAME_VARINT, a get_max_frame_len()).
+ */
+int next_frame(struct buffer_ricezione* buffer, int tipo, struct frame* frame);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,536 @@
+/************************************************************
+ *                                                          *
+ *        Protocollo di comunicazione device<->server       *
+ *                                                          *
+ ************************************************************/
+
+#include "protocollo.h"
+#include "messaggi.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+/*
+ * Tabella dei messaggi, indicizzata per opcode. Nel protocollo a stringhe un messaggio viene inviato
+ * come il suo nome (se c'è) seguito da un frame per ogni campo: la tabella riproduce esattamente
+ * i dialoghi descritti in costanti.h, così i device che non conoscono il protocollo binario
+ * continuano a funzionare.
+ */
+static const struct tipo_messaggio tipi_messaggio[256] = {
+    [OP_HELLO] = {NULL, "i"}, // Versione del protocollo proposta dal device o scelta dal server
+
+    [OP_SIGNUP] = {SIGNUP, "ssi"}, // Username, password e porta di ascolto
+    [OP_LOGIN] = {LOGIN, "ssi"}, // Username, password e porta di ascolto
+    [OP_HANGING] = {HANGING_COMMAND, ""},
+    [OP_LOGOUT] = {LOGOUT_COMMAND, ""},
+    [OP_NEW_CHAT] = {NEW_CHAT_COMMAND, "s"}, // Utente con cui si vuole avviare la chat
+    [OP_SHOW] = {SHOW_COMMAND, "s"}, // Mittente dei messaggi pendenti da leggere
+    [OP_OFFLINE_MESSAGE] = {OFFLINE_MESSAGE, "ss"}, // Destinatario e messaggio
+    [OP_START_GROUP_CHAT] = {START_GROUP_CHAT, ""},
+    [OP_USER_STATUS] = {NULL, "s"}, // Utente di cui si vuole sapere se è online
+    [OP_GROUP_CHAT_DONE] = {GROUP_CHAT_DONE, ""},
+    [OP_CLIENT_PORT_REQUEST] = {CLIENT_PORT_REQUEST, "s"}, // Utente da aggiungere alla chat di gruppo
+    [OP_MEMBER_PORT_REQUEST] = {MEMBER_PORT_REQUEST, "s"}, // Membro della chat di gruppo
+    [OP_BULK_STATUS] = {NULL, "s"}, // Utenti di cui si vuole sapere se sono online, separati da '\n'
+    [OP_CHAT_MESSAGE] = {NULL, "ssi"}, // Destinatario, messaggio e suo numero di sequenza nella conversazione
+    [OP_FEATURES] = {NULL, "i"}, // Funzionalità supportate dal device o da entrambe le parti (risposta del server)
+    [OP_CAPABILITIES] = {NULL, "iii"}, // Versione, lunghezza massima dei frame e funzionalità (vedi OP_CAPABILITIES)
+    [OP_SESSION] = {NULL, "i"}, // Sessione del device
+
+    [OP_FILE_CHUNK] = {NULL, "b"}, // Byte del file
+    [OP_FILE_END] = {NULL, ""},
+
+    [OP_SIGNED_UP] = {SIGNED_UP, ""},
+    [OP_EXISTING_USERNAME] = {ALREADY_EXISTING_USERNAME, ""},
+    [OP_AUTHENTICATED] = {AUTHENTICATED, ""},
+    [OP_UNKNOWN_USER] = {UNKNOWN_USER, ""},
+    [OP_WRONG_PASSWORD] = {WRONG_PASSWORD, ""},
+    [OP_USER_ONLINE] = {USER_ONLINE, ""},
+    [OP_USER_PORT] = {USER_ONLINE, "i"}, // Utente online e sua porta di ascolto
+    [OP_USER_OFFLINE] = {USER_OFFLINE, ""},
+    [OP_PENDING] = {NULL, "sss"}, // Mittente, numero di messaggi pendenti e timestamp dell'ultimo
+    [OP_DONE_HANGING] = {DONE_HANGING, ""},
+    [OP_SHOW_LINE] = {NULL, "s"}, // Messaggio pendente
+    [OP_DONE_SHOW] = {DONE_SHOW, ""},
+    [OP_LOGGED_MSG] = {LOGGED_MSG, ""},
+    [OP_MEMBER_PORT] = {NULL, "i"}, // Porta di ascolto del membro (INVALID_SOCKET se è offline)
+    [OP_BULK_PRESENCE] = {NULL, "bb"}, // Mappa degli utenti online e loro porte di ascolto (vedi OP_BULK_STATUS)
+    [OP_PEER_PORT] = {NULL, "ii"}, // Porta di ascolto (INVALID_SOCKET se è offline) e versione del protocollo del peer
+
+    [OP_NOW_ONLINE] = {NOW_ONLINE, "si"}, // Username e porta di ascolto dell'utente
+    [OP_MESSAGES_SENT] = {MESSAGES_SENT, "s"}, // Destinatario che ha letto i messaggi pendenti
+    [OP_MESSAGES_ACKED] = {NULL, "si"}, // Destinatario e numero di sequenza dell'ultimo messaggio registrato
+    [OP_PEER_ONLINE] = {NULL, "sii"} // Username, porta di ascolto e versione del protocollo dell'utente
+};
+
+/*
+ * Buffer in cui receive_message() riceve i messaggi: crescono fino alla dimensione del messaggio più grande
+ * ricevuto, così i messaggi brevi non richiedono allocazioni e quelli lunghi non sono limitati da un array fisso
+ */
+static char* frame_ricevuto = NULL; // Corpo dell'ultimo frame binario ricevuto
+static int capacita_frame = 0;
+static char* campi_ricevuti = NULL; // Stringhe dell'ultimo messaggio ricevuto (vedi 'struct messaggio')
+static int capacita_campi = 0;
+static char* frame_espanso = NULL; // Corpo decompresso dell'ultimo messaggio compresso ricevuto
+static int capacita_espanso = 0;
+
+/*
+ * Restituisce la descrizione del messaggio con l'opcode specificato, o NULL se l'opcode non esiste
+ */
+const struct tipo_messaggio* find_message_type(int opcode) {
+    if (opcode < 0 || opcode > 255 || tipi_messaggio[opcode].campi == NULL)
+        return NULL;
+
+    return &tipi_messaggio[opcode];
+}
+
+/*
+ * Restituisce 1 se l'opcode è quello di una notifica inviata dal server di sua iniziativa, altrimenti 0
+ */
+int is_notification(int opcode) {
+    return opcode >= OP_NOW_ONLINE;
+}
+
+/*
+ * Restituisce la lunghezza massima di un campo stringa nella versione del protocollo indicata
+ */
+int max_field_len(int versione) {
+    // Nel frame ci sono anche l'opcode, la lunghezza del campo e (da PROTOCOL_PIPELINE) l'identificativo
+    if (versione >= PROTOCOL_PIPELINE)
+        return get_max_frame_len() - 1 - 2 * MAX_VARINT_LEN;
+    if (versione == PROTOCOL_VARINT)
+        return get_max_frame_len() - 1 - MAX_VARINT_LEN;
+
+    // I device che usano i frame a 16 bit ricevono i campi in buffer di MAX_MSG_LEN byte
+    return MAX_MSG_LEN;
+}
+
+/*
+ * Restituisce la lunghezza del corpo del messaggio con i campi indicati (nel protocollo a stringhe, l'intero
+ * messaggio), o -1 se il messaggio è troppo lungo per la versione del protocollo indicata
+ */
+static int message_length(const struct tipo_messaggio* tipo, int versione, uint32_t id, int opcode, va_list campi) {
+    int i, len, corpo = versione == PROTOCOL_LEGACY ? 0 : 1; // Nel protocollo binario il corpo inizia con l'opcode
+    char* stringa;
+
+    if (versione >= PROTOCOL_PIPELINE)
+        corpo += varint_len(id); // Seguito dall'identificativo della richiesta
+
+    for (i = 0; tipo->campi[i] != '\0'; i++) {
+        if (tipo->campi[i] == 'i') {
+            corpo += versione >= PROTOCOL_VARINT ? varint_len(va_arg(campi, int)) : sizeof(uint16_t);
+            continue;
+        }
+
+        stringa = va_arg(campi, char*);
+        len = tipo->campi[i] == 'b' ? va_arg(campi, int) : (int) strlen(stringa);
+        if (len > max_field_len(versione)) {
+            fprintf(stderr, "Impossibile codificare il messaggio con opcode %d: campo più lungo di %d byte.\n",
+                    opcode, max_field_len(versione));
+            return -1;
+        }
+        corpo += len + (versione >= PROTOCOL_VARINT ? varint_len(len) : sizeof(uint16_t));
+    }
+
+    if (versione == PROTOCOL_LEGACY && tipo->legacy != NULL)
+        corpo += strlen(tipo->legacy) + sizeof(uint16_t); // Il nome del messaggio è un frame a sé
+    if (versione >= PROTOCOL_VARINT && corpo > get_max_frame_len()) {
+        fprintf(stderr, "Impossibile codificare il messaggio con opcode %d: frame più lungo di %d byte.\n", opcode,
+                get_max_frame_len());
+        return -1;
+    }
+
+    return corpo;
+}
+
+/*
+ * Restituisce la lunghezza dell'intestazione del frame di un messaggio con il corpo lungo 'corpo' byte
+ */
+static int header_length(int versione, int corpo) {
+    if (versione == PROTOCOL_LEGACY)
+        return 0; // Ogni campo è un frame con la propria lunghezza
+
+    return versione >= PROTOCOL_VARINT ? varint_len(corpo) : sizeof(uint16_t);
+}
+
+/*
+ * Scrive in 'buffer' il messaggio con il corpo lungo 'corpo' byte (calcolato con message_length()).
+ * Restituisce la lunghezza del messaggio codificato.
+ */
+static int write_message(char* buffer, const struct tipo_messaggio* tipo, int versione, uint32_t id, int opcode,
+                         int corpo, va_list campi) {
+    uint16_t network_order;
+    char* stringa;
+    int i, len = 0, len_stringa;
+
+    if (versione == PROTOCOL_LEGACY) {
+        // Il nome del messaggio, se c'è, è un frame a sé
+        if (tipo->legacy != NULL)
+            len += build_string_frame(tipo->legacy, buffer);
+    } else {
+        // Un unico frame: la lunghezza e l'opcode (e l'identificativo della richiesta), seguiti dai campi
+        if (versione >= PROTOCOL_VARINT)
+            len += encode_varint(corpo, buffer);
+        else {
+            network_order = htons(corpo);
+            memcpy(buffer, &network_order, sizeof(uint16_t));
+            len += sizeof(uint16_t);
+        }
+        buffer[len++] = opcode;
+        if (versione >= PROTOCOL_PIPELINE)
+            len += encode_varint(id, &buffer[len]);
+    }
+
+    // I campi hanno lo stesso formato nei protocolli con frame a 16 bit, mentre da PROTOCOL_VARINT si usano i varint
+    for (i = 0; tipo->campi[i] != '\0'; i++) {
+        if (tipo->campi[i] == 'i' && versione >= PROTOCOL_VARINT) {
+            len += encode_varint(va_arg(campi, int), &buffer[len]);
+            continue;
+        }
+        if (tipo->campi[i] == 'i') {
+            network_order = htons(va_arg(campi, int));
+            memcpy(&buffer[len], &network_order, sizeof(uint16_t));
+            len += sizeof(uint16_t);
+            continue;
+        }
+
+        // Stringhe e blocchi di byte: la lunghezza seguita dai byte (senza terminatore)
+        stringa = va_arg(campi, char*);
+        len_stringa = tipo->campi[i] == 'b' ? va_arg(campi, int) : (int) strlen(stringa);
+        if (versione >= PROTOCOL_VARINT)
+            len += encode_varint(len_stringa, &buffer[len]);
+        else {
+            network_order = htons(len_stringa);
+            memcpy(&buffer[len], &network_order, sizeof(uint16_t));
+            len += sizeof(uint16_t);
+        }
+        memcpy(&buffer[len], stringa, len_stringa);
+        len += len_stringa;
+    }
+
+    return len;
+}
+
+/*
+ * Codifica il messaggio con l'opcode specificato secondo la versione del protocollo indicata. I campi vanno
+ * passati nell'ordine della descrizione del messaggio; 'id' è l'identificativo della richiesta (usato dalla
+ * versione PROTOCOL_PIPELINE in poi). Il messaggio viene posto in 'locale' (di MESSAGE_BUFFER_LEN byte) se ci sta, altrimenti
+ * in un buffer allocato della sua dimensione: in '*buffer' viene posto quello usato, da liberare con
+ * free_message_buffer().
+ * Restituisce la lunghezza del messaggio codificato o un valore negativo in caso di errore.
+ */
+int encode_message(char* locale, char** buffer, int versione, uint32_t id, int opcode, va_list campi) {
+    const struct tipo_messaggio* tipo = find_message_type(opcode);
+    va_list copia;
+    int corpo, len;
+
+    if (tipo == NULL) {
+        fprintf(stderr, "Impossibile codificare il messaggio con opcode %d: opcode sconosciuto.\n", opcode);
+        return -1;
+    }
+
+    // Calcolo la lunghezza del messaggio (i campi vengono letti due volte) per scegliere dove codificarlo
+    va_copy(copia, campi);
+    corpo = message_length(tipo, versione, id, opcode, copia);
+    va_end(copia);
+    if (corpo < 0)
+        return -1;
+    len = header_length(versione, corpo) + corpo;
+
+    *buffer = locale;
+    if (len > MESSAGE_BUFFER_LEN) {
+        *buffer = malloc(len);
+        if (*buffer == NULL) {
+            perror("Impossibile allocare il buffer di un messaggio");
+            return -1;
+        }
+    }
+
+    return write_message(*buffer, tipo, versione, id, opcode, corpo, campi);
+}
+
+/*
+ * Libera il buffer usato da encode_message() per un messaggio che non stava in 'locale'
+ */
+void free_message_buffer(char* locale, char* buffer) {
+    if (buffer != locale)
+        free(buffer);
+}
+
+/*
+ * Codifica in 'buffer' (di MESSAGE_BUFFER_LEN byte) il messaggio con l'opcode e i campi indicati.
+ * Restituisce la lunghezza del messaggio codificato o un valore negativo in caso di errore (anche se non ci sta).
+ */
+int build_message(char* buffer, int versione, uint32_t id, int opcode, ...) {
+    va_list campi;
+    char* usato;
+    int len;
+
+    va_start(campi, opcode);
+    len = encode_message(buffer, &usato, versione, id, opcode, campi);
+    va_end(campi);
+
+    if (len >= 0 && usato != buffer) {
+        fprintf(stderr, "Il messaggio con opcode %d non sta in %d byte.\n", opcode, MESSAGE_BUFFER_LEN);
+        free_message_buffer(buffer, usato);
+        return -1;
+    }
+
+    return len;
+}
+
+/*
+ * Se la versione del protocollo lo prevede e 'codec' è diverso da CODEC_NONE, comprime il messaggio codificato
+ * da encode_message() ('len' byte in '*buffer'), sostituendolo con un messaggio OP_COMPRESSED. Se il messaggio
+ * è più corto della soglia di compressione o non si riduce viene lasciato così com'è.
+ * Restituisce la lunghezza del messaggio da inviare (in '*buffer', da liberare con free_message_buffer())
+ * o un valore negativo in caso di errore.
+ */
+int compress_message(char* locale, char** buffer, int len, int versione, int codec) {
+    char* compresso;
+    uint32_t corpo;
+    int intestazione, ret;
+
+    if (versione < PROTOCOL_COMPRESSED || codec == CODEC_NONE)
+        return len;
+
+    // Si comprime il corpo del frame (opcode, identificativo e campi), non la sua lunghezza
+    intestazione = decode_varint(*buffer, len, &corpo);
+    if (intestazione <= 0)
+        return -1;
+    ret = pack_varint_frame(&(*buffer)[intestazione], corpo, codec, (char) OP_COMPRESSED, &compresso);
+    if (ret <= 0)
+        return ret == 0 ? len : ret;
+
+    free_message_buffer(locale, *buffer);
+    *buffer = compresso; // Allocato, quindi verrà liberato da free_message_buffer()
+    return ret;
+}
+
+/*
+ * Se il corpo di un frame binario ('*lunghezza' byte in '*dati') è un messaggio compresso (OP_COMPRESSED),
+ * lo decomprime in '*spazio' (di '*capacita' byte, riallocato se serve) e aggiorna '*dati' e '*lunghezza'.
+ * Restituisce 0 in caso di successo (anche se il messaggio non era compresso) e -1 se non è valido.
+ */
+int expand_message(int versione, char** dati, int* lunghezza, char** spazio, int* capacita) {
+    int len;
+
+    if (versione < PROTOCOL_COMPRESSED || *lunghezza < 1 || (unsigned char) (*dati)[0] != OP_COMPRESSED)
+        return 0;
+
+    len = unpack_varint_frame(&(*dati)[1], *lunghezza - 1, spazio, capacita);
+    if (len == -1)
+        return -1;
+    *dati = *spazio;
+    *lunghezza = len;
+
+    return 0;
+}
+
+/*
+ * Decodifica l'intestazione del corpo di un frame binario ('lunghezza' byte in 'dati'): l'opcode e, da
+ * PROTOCOL_PIPELINE, l'identificativo della richiesta (altrimenti 0).
+ * Restituisce il numero di byte dell'intestazione (i campi iniziano subito dopo) o -1 se non è valida.
+ */
+int decode_header(int versione, char* dati, int lunghezza, int* opcode, uint32_t* id) {
+    int ret;
+
+    if (lunghezza < 1)
+        return -1; // Manca l'opcode
+    *opcode = (unsigned char) dati[0];
+    *id = 0;
+    if (versione < PROTOCOL_PIPELINE)
+        return 1;
+
+    ret = decode_varint(&dati[1], lunghezza - 1, id);
+    return ret <= 0 ? -1 : 1 + ret;
+}
+
+/*
+ * Decodifica i campi descritti da 'campi' dai 'lunghezza' byte di 'dati' (il corpo di un frame binario,
+ * dopo l'opcode), ponendoli in 'stringhe' e 'interi' nella posizione del campo. I caratteri delle stringhe
+ * vengono copiati, terminati, in 'spazio', che deve poter contenere 'lunghezza' + MAX_CAMPI byte.
+ * Restituisce 0 in caso di successo, -1 se i dati non corrispondono ai campi attesi.
+ */
+int decode_fields(char* campi, int versione, char* dati, int lunghezza, char* spazio, char* stringhe[], int interi[]) {
+    uint16_t network_order;
+    uint32_t valore;
+    int i, ret, letti = 0;
+
+    for (i = 0; campi[i] != '\0'; i++) {
+        // La lunghezza di una stringa e un intero sono un varint da PROTOCOL_VARINT, altrimenti occupano 2 byte
+        if (versione >= PROTOCOL_VARINT) {
+            ret = decode_varint(&dati[letti], lunghezza - letti, &valore);
+            if (ret <= 0)
+                return -1;
+            letti += ret;
+        } else {
+            if (lunghezza - letti < (int) sizeof(uint16_t))
+                return -1;
+            memcpy(&network_order, &dati[letti], sizeof(uint16_t));
+            letti += sizeof(uint16_t);
+            valore = ntohs(network_order);
+        }
+
+        if (campi[i] == 'i') {
+            interi[i] = (int) valore;
+            continue;
+        }
+
+        if (valore > (uint32_t) max_field_len(versione) || valore > (uint32_t) (lunghezza - letti))
+            return -1;
+        memcpy(spazio, &dati[letti], valore);
+        spazio[valore] = '\0';
+        stringhe[i] = spazio;
+        if (campi[i] == 'b')
+            interi[i] = valore; // I blocchi di byte possono contenere il byte 0: serve la lunghezza
+        spazio += valore + 1;
+        letti += valore;
+    }
+
+    // Il frame non deve contenere altro oltre ai campi attesi
+    return letti == lunghezza ? 0 : -1;
+}
+
+/*
+ * Invia sul socket specificato il messaggio con l'opcode e i campi indicati, come risposta o richiesta
+ * con identificativo 'id' (vedi 'struct messaggio').
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_message(int socket, int versione, uint32_t id, int opcode, ...) {
+    char locale[MESSAGE_BUFFER_LEN];
+    char* buffer;
+    va_list campi;
+    int len, ret;
+
+    va_start(campi, opcode);
+    len = encode_message(locale, &buffer, versione, id, opcode, campi);
+    va_end(campi);
+    if (len < 0)
+        return len;
+
+    #ifdef DEBUG
+    printf("Invio sul socket %d il messaggio con opcode %d (%d byte).\n", socket, opcode, len);
+    #endif
+
+    // Tutti i frame del messaggio vengono inviati insieme
+    ret = send_all(socket, buffer, len);
+    if (ret < 0)
+        perror("Errore durante l'invio di un messaggio");
+    free_message_buffer(locale, buffer);
+
+    return ret;
+}
+
+/*
+ * Riceve un campo stringa del protocollo a stringhe (un frame di al massimo MAX_MSG_LEN byte)
+ * e lo pone, terminato, in 'stringa'. Restituisce lo stesso valore di receive_frame().
+ */
+static int receive_legacy_string(int socket, char* stringa) {
+    int ret, len;
+
+    ret = receive_frame(socket, stringa, MAX_MSG_LEN, &len);
+    if (ret > 0)
+        stringa[len] = '\0';
+
+    return ret;
+}
+
+/*
+ * Aspetta di ricevere un messaggio sul socket specificato e lo pone in 'messaggio'. Nel protocollo a stringhe
+ * il tipo del messaggio viene dedotto dai 'num_attesi' opcode in 'attesi'.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del socket e
+ * un numero negativo in caso di errore.
+ */
+int receive_message(int socket, int versione, const int* attesi, int num_attesi, struct messaggio* messaggio) {
+    const struct tipo_messaggio* tipo = NULL;
+    const struct tipo_messaggio* atteso;
+    char buffer[MAX_MSG_LEN + 1];
+    char* corpo; // Corpo del frame binario ricevuto (decompresso, se il messaggio era compresso)
+    int ret, i, len, intestazione = -1, primo = 0;
+
+    messaggio->id = 0;
+    if (versione != PROTOCOL_LEGACY) {
+        // Il messaggio è un unico frame: opcode (e identificativo della richiesta) e campi
+        if (versione >= PROTOCOL_VARINT)
+            ret = receive_varint_frame(socket, &frame_ricevuto, &capacita_frame, &len);
+        else if (reserve_buffer(&frame_ricevuto, &capacita_frame, MAX_FRAME_LEN) == -1)
+            ret = -1;
+        else
+            ret = receive_frame(socket, frame_ricevuto, MAX_FRAME_LEN, &len);
+        if (ret <= 0)
+            return ret;
+
+        // Un messaggio compresso viene decompresso e decodificato come gli altri
+        corpo = frame_ricevuto;
+        if (expand_message(versione, &corpo, &len, &frame_espanso, &capacita_espanso) == 0)
+            intestazione = decode_header(versione, corpo, len, &messaggio->opcode, &messaggio->id);
+        if (intestazione > 0)
+            tipo = find_message_type(messaggio->opcode);
+        if (tipo == NULL || reserve_buffer(&campi_ricevuti, &capacita_campi, len + MAX_CAMPI) == -1 ||
+            decode_fields(tipo->campi, versione, &corpo[intestazione], len - intestazione, campi_ricevuti,
+                          messaggio->stringhe, messaggio->interi) == -1) {
+            fprintf(stderr, "Ricevuto sul socket %d un messaggio non valido.\n", socket);
+            return -1;
+        }
+
+        return 1;
+    }
+
+    // Nel protocollo a stringhe ogni campo è lungo al massimo MAX_MSG_LEN byte
+    if (reserve_buffer(&campi_ricevuti, &capacita_campi, MAX_CAMPI * (MAX_MSG_LEN + 1)) == -1)
+        return -1;
+    for (i = 0; i < MAX_CAMPI; i++)
+        messaggio->stringhe[i] = &campi_ricevuti[i * (MAX_MSG_LEN + 1)];
+
+    /*
+     * Protocollo a stringhe: il primo frame è il nome del messaggio, a meno che il messaggio atteso non ne
+     * abbia uno (in tal caso il frame è già il primo campo). Se il messaggio atteso inizia con un intero,
+     * non c'è alcun nome da leggere.
+     */
+    atteso = find_message_type(attesi[0]);
+    if (atteso->legacy == NULL && atteso->campi[0] == 'i')
+        tipo = atteso;
+    else {
+        ret = receive_legacy_string(socket, buffer);
+        if (ret <= 0)
+            return ret;
+
+        // Cerco tra i messaggi attesi quello con questo nome
+        for (i = 0; i < num_attesi && tipo == NULL; i++) {
+            atteso = find_message_type(attesi[i]);
+            if (atteso->legacy != NULL && strcmp(atteso->legacy, buffer) == 0)
+                tipo = atteso;
+        }
+
+        // Altrimenti il frame è il primo campo di un messaggio senza nome
+        for (i = 0; i < num_attesi && tipo == NULL; i++) {
+            atteso = find_message_type(attesi[i]);
+            if (atteso->legacy == NULL && atteso->campi[0] == 's') {
+                tipo = atteso;
+                strcpy(messaggio->stringhe[0], buffer);
+                primo = 1;
+            }
+        }
+
+        if (tipo == NULL) {
+            fprintf(stderr, "Ricevuto sul socket %d il messaggio inatteso '%s'.\n", socket, buffer);
+            return -1;
+        }
+    }
+
+    // Ricevo i campi rimanenti, un frame ciascuno
+    for (i = primo; tipo->campi[i] != '\0'; i++) {
+        if (tipo->campi[i] == 'i')
+            ret = receive_integer(socket, &messaggio->interi[i]);
+        else
+            ret = receive_legacy_string(socket, messaggio->stringhe[i]);
+        if (ret <= 0)
+            return ret;
+    }
+
+    messaggio->opcode = tipo - tipi_messaggio;
+    return 1;
+}
@@ -0,0 +1,244 @@
+/************************************************************
+ *                                                          *
+ *        Protocollo di comunicazione device<->server       *
+ *                                                          *
+ ************************************************************/
+
+#ifndef PROTOCOLLO_H
+#define PROTOCOLLO_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include "../costanti.h"
+#include "compressione.h"
+
+/*
+ * Versioni del protocollo. Il device apre la connessione inviando OP_HELLO con la versione più recente
+ * che conosce e il server risponde con quella che verrà usata (la minore tra le due). Un device che
+ * non invia OP_HELLO (o un server che non risponde) usa il protocollo a stringhe.
+ */
+#define PROTOCOL_LEGACY 1 // Protocollo a stringhe: nome del messaggio e campi in frame separati (vedi costanti.h)
+#define PROTOCOL_BINARY 2 // Protocollo binario: un frame per messaggio, con opcode e campi tipizzati
+#define PROTOCOL_VARINT 3 // Protocollo binario con lunghezze e interi codificati come varint (frame fino a get_max_frame_len())
+#define PROTOCOL_PIPELINE 4 // Come PROTOCOL_VARINT, con l'identificativo della richiesta dopo l'opcode (vedi 'struct messaggio')
+#define PROTOCOL_PRESENCE 5 // Come PROTOCOL_PIPELINE, con la richiesta OP_BULK_STATUS
+#define PROTOCOL_SEQUENCED 6 // Come PROTOCOL_PRESENCE, con i messaggi numerati (OP_CHAT_MESSAGE) e confermati in modo cumulativo
+#define PROTOCOL_COMPRESSED 7 // Come PROTOCOL_SEQUENCED, con la negoziazione dei codec (OP_FEATURES) e i messaggi compressi
+/*
+ * Come PROTOCOL_COMPRESSED, con lo scambio delle capacità (OP_CAPABILITIES): lunghezza massima dei frame e
+ * funzionalità opzionali, sia con il server sia con i peer. Il server comunica anche la versione del protocollo
+ * dei peer (OP_PEER_PORT, OP_PEER_ONLINE), così il device sa se può negoziare la connessione peer-to-peer.
+ */
+#define PROTOCOL_HANDSHAKE 8
+#define PROTOCOL_SESSION 9 // Come PROTOCOL_HANDSHAKE, con la sessione del device (OP_SESSION) dopo il login
+#define PROTOCOL_VERSION PROTOCOL_SESSION // Versione più recente supportata
+
+// Dimensione di un buffer locale per i messaggi più comuni: quelli più lunghi vengono codificati in un buffer allocato
+#define MESSAGE_BUFFER_LEN ((MAX_CAMPI + 1) * (MAX_MSG_LEN + 2))
+
+/*
+ * Opcode dei messaggi scambiati tra device e server (primo byte del frame nel protocollo binario)
+ */
+enum opcode {
+    // Negoziazione della versione (sempre nel formato binario)
+    OP_HELLO = 0x00,
+
+    // Richieste dei device
+    OP_SIGNUP = 0x01,
+    OP_LOGIN = 0x02,
+    OP_HANGING = 0x03,
+    OP_LOGOUT = 0x04,
+    OP_NEW_CHAT = 0x05,
+    OP_SHOW = 0x06,
+    OP_OFFLINE_MESSAGE = 0x07,
+    OP_START_GROUP_CHAT = 0x08, // Solo nel protocollo a stringhe: apre l'elenco degli OP_USER_STATUS
+    OP_USER_STATUS = 0x09,
+    OP_GROUP_CHAT_DONE = 0x0a, // Solo nel protocollo a stringhe: chiude l'elenco degli OP_USER_STATUS
+    OP_CLIENT_PORT_REQUEST = 0x0b,
+    OP_MEMBER_PORT_REQUEST = 0x0c,
+    OP_BULK_STATUS = 0x0d, // Solo da PROTOCOL_PRESENCE: lo stato di un intero elenco di utenti in un'unica richiesta
+    /*
+     * Solo da PROTOCOL_SEQUENCED: come OP_OFFLINE_MESSAGE, ma senza risposta (vedi OP_MESSAGES_ACKED). I numeri
+     * di sequenza crescono per tutta la sessione del device (vedi OP_SESSION; senza, fino al login successivo):
+     * il server ignora (confermandoli) i messaggi di una conversazione con un numero non superiore a quello
+     * dell'ultimo registrato, cioè quelli ritrasmessi, anche se arrivano su una nuova connessione.
+     */
+    OP_CHAT_MESSAGE = 0x0e,
+    /*
+     * Solo da PROTOCOL_COMPRESSED: il device annuncia le funzionalità opzionali che supporta (FEATURE_* in
+     * compressione.h) e il server risponde con lo stesso opcode e quelle supportate da entrambi. Da quel momento
+     * ciascuna parte può inviare messaggi compressi (OP_COMPRESSED) con uno dei codec in comune.
+     */
+    OP_FEATURES = 0x0f,
+    /*
+     * Solo da PROTOCOL_HANDSHAKE, al posto di OP_FEATURES: versione del protocollo, lunghezza massima dei frame
+     * che si accettano e funzionalità opzionali. La risposta (stesso opcode) contiene i valori in comune: la
+     * versione minore, la lunghezza minore e le funzionalità supportate da entrambi. Lo stesso scambio apre le
+     * connessioni peer-to-peer tra device che supportano PROTOCOL_HANDSHAKE (vedi PEER_HELLO in costanti.h).
+     */
+    OP_CAPABILITIES = 0x10,
+    /*
+     * Solo da PROTOCOL_SESSION, dopo il login e senza risposta: la sessione del device, un numero diverso da 0 scelto
+     * all'avvio. Finché non cambia, i numeri di sequenza di OP_CHAT_MESSAGE proseguono anche su una nuova
+     * connessione e il server non registra di nuovo i messaggi ritrasmessi dopo una riconnessione.
+     */
+    OP_SESSION = 0x11,
+
+    // Messaggi tra peer (solo su connessioni peer-to-peer negoziate con OP_CAPABILITIES)
+    OP_FILE_CHUNK = 0x20, // Blocco di un file condiviso
+    OP_FILE_END = 0x21, // Fine del file condiviso
+
+    // Risposte del server
+    OP_SIGNED_UP = 0x40,
+    OP_EXISTING_USERNAME = 0x41,
+    OP_AUTHENTICATED = 0x42,
+    OP_UNKNOWN_USER = 0x43,
+    OP_WRONG_PASSWORD = 0x44,
+    OP_USER_ONLINE = 0x45,
+    OP_USER_PORT = 0x46,
+    OP_USER_OFFLINE = 0x47,
+    OP_PENDING = 0x48,
+    OP_DONE_HANGING = 0x49,
+    OP_SHOW_LINE = 0x4a,
+    OP_DONE_SHOW = 0x4b,
+    OP_LOGGED_MSG = 0x4c,
+    OP_MEMBER_PORT = 0x4d,
+    /*
+     * Risposta a OP_BULK_STATUS: una mappa di bit (il bit i % 8 del byte i / 8 vale 1 se l'i-esimo utente
+     * dell'elenco è online) e le porte di ascolto degli utenti online, nell'ordine dell'elenco, 2 byte
+     * ciascuna in network order
+     */
+    OP_BULK_PRESENCE = 0x4e,
+    // Solo da PROTOCOL_HANDSHAKE, al posto di OP_USER_PORT e OP_MEMBER_PORT: porta di ascolto e versione del peer
+    OP_PEER_PORT = 0x4f,
+
+    // Notifiche inviate dal server di sua iniziativa (non rispondono ad alcuna richiesta)
+    OP_NOW_ONLINE = 0x80,
+    OP_MESSAGES_SENT = 0x81,
+    /*
+     * Conferma cumulativa dei messaggi OP_CHAT_MESSAGE: tutti i messaggi inviati al destinatario indicato, fino
+     * al numero di sequenza indicato, sono stati registrati. Il server la invia una volta sola per tutti i
+     * messaggi della stessa conversazione elaborati insieme.
+     */
+    OP_MESSAGES_ACKED = 0x82,
+    OP_PEER_ONLINE = 0x83, // Solo da PROTOCOL_HANDSHAKE, al posto di OP_NOW_ONLINE: anche la versione del peer
+
+    /*
+     * Messaggio compresso (in entrambe le direzioni, dopo OP_FEATURES): il corpo del frame contiene il codec,
+     * la lunghezza originale e il corpo compresso di un altro messaggio (vedi pack_varint_frame())
+     */
+    OP_COMPRESSED = 0xff
+};
+
+/*
+ * Descrizione di un tipo di messaggio
+ */
+struct tipo_messaggio {
+    char* legacy; // Nome del messaggio nel protocollo a stringhe (NULL se il messaggio inizia direttamente con i campi)
+    /*
+     * Campi del messaggio: un carattere per campo, 's' per una stringa, 'i' per un intero e 'b' per un blocco
+     * di byte (solo nel protocollo binario: si passano il puntatore e la lunghezza, e in ricezione la lunghezza
+     * viene posta tra gli interi, nella posizione del campo)
+     */
+    char* campi;
+};
+
+/*
+ * Messaggio ricevuto: l'opcode e i campi decodificati (nella posizione del campo). Le stringhe puntano
+ * a un buffer interno a receive_message(): sono valide fino alla prossima ricezione di un messaggio.
+ *
+ * Da PROTOCOL_PIPELINE ogni messaggio porta anche l'identificativo della richiesta: il device ne sceglie
+ * uno diverso per ogni richiesta e il server lo ripete in tutte le risposte, così il device può inviare
+ * più richieste senza attendere le risposte e associare ciascuna risposta alla sua richiesta.
+ * Le notifiche hanno identificativo 0, come tutti i messaggi delle versioni precedenti.
+ */
+struct messaggio {
+    int opcode;
+    uint32_t id; // Identificativo della richiesta (0 se non c'è)
+    char* stringhe[MAX_CAMPI];
+    int interi[MAX_CAMPI];
+};
+
+/*
+ * Restituisce la descrizione del messaggio con l'opcode specificato, o NULL se l'opcode non esiste
+ */
+const struct tipo_messaggio* find_message_type(int opcode);
+
+/*
+ * Restituisce 1 se l'opcode è quello di una notifica inviata dal server di sua iniziativa, altrimenti 0
+ */
+int is_notification(int opcode);
+
+/*
+ * Restituisce la lunghezza massima di un campo stringa nella versione del protocollo indicata
+ */
+int max_field_len(int versione);
+
+/*
+ * Codifica il messaggio con l'opcode specificato secondo la versione del protocollo indicata. I campi vanno
+ * passati nell'ordine della descrizione del messaggio; 'id' è l'identificativo della richiesta (usato dalla
+ * versione PROTOCOL_PIPELINE in poi). Il messaggio viene posto in 'locale' (di MESSAGE_BUFFER_LEN byte) se ci sta, altrimenti
+ * in un buffer allocato della sua dimensione: in '*buffer' viene posto quello usato, da liberare con
+ * free_message_buffer().
+ * Restituisce la lunghezza del messaggio codificato o un valore negativo in caso di errore.
+ */
+int encode_message(char* locale, char** buffer, int versione, uint32_t id, int opcode, va_list campi);
+
+/*
+ * Libera il buffer usato da encode_message() per un messaggio che non stava in 'locale'
+ */
+void free_message_buffer(char* locale, char* buffer);
+
+/*
+ * Codifica in 'buffer' (di MESSAGE_BUFFER_LEN byte) il messaggio con l'opcode e i campi indicati.
+ * Restituisce la lunghezza del messaggio codificato o un valore negativo in caso di errore (anche se non ci sta).
+ */
+int build_message(char* buffer, int versione, uint32_t id, int opcode, ...);
+
+/*
+ * Se la versione del protocollo lo prevede e 'codec' è diverso da CODEC_NONE, comprime il messaggio codificato
+ * da encode_message() ('len' byte in '*buffer'), sostituendolo con un messaggio OP_COMPRESSED. Se il messaggio
+ * è più corto della soglia di compressione o non si riduce viene lasciato così com'è.
+ * Restituisce la lunghezza del messaggio da inviare (in '*buffer', da liberare con free_message_buffer())
+ * o un valore negativo in caso di errore.
+ */
+int compress_message(char* locale, char** buffer, int len, int versione, int codec);
+
+/*
+ * Se il corpo di un frame binario ('*lunghezza' byte in '*dati') è un messaggio compresso (OP_COMPRESSED),
+ * lo decomprime in '*spazio' (di '*capacita' byte, riallocato se serve) e aggiorna '*dati' e '*lunghezza'.
+ * Restituisce 0 in caso di successo (anche se il messaggio non era compresso) e -1 se non è valido.
+ */
+int expand_message(int versione, char** dati, int* lunghezza, char** spazio, int* capacita);
+
+/*
+ * Decodifica l'intestazione del corpo di un frame binario ('lunghezza' byte in 'dati'): l'opcode e, da
+ * PROTOCOL_PIPELINE, l'identificativo della richiesta (altrimenti 0).
+ * Restituisce il numero di byte dell'intestazione (i campi iniziano subito dopo) o -1 se non è valida.
+ */
+int decode_header(int versione, char* dati, int lunghezza, int* opcode, uint32_t* id);
+
+/*
+ * Decodifica i campi descritti da 'campi' dai 'lunghezza' byte di 'dati' (il corpo di un frame binario,
+ * dopo l'opcode), ponendoli in 'stringhe' e 'interi' nella posizione del campo. I caratteri delle stringhe
+ * vengono copiati, terminati, in 'spazio', che deve poter contenere 'lunghezza' + MAX_CAMPI byte.
+ * Restituisce 0 in caso di successo, -1 se i dati non corrispondono ai campi attesi.
+ */
+int decode_fields(char* campi, int versione, char* dati, int lunghezza, char* spazio, char* stringhe[], int interi[]);
+
+/*
+ * Invia sul socket specificato il messaggio con l'opcode e i campi indicati, come risposta o richiesta
+ * con identificativo 'id' (vedi 'struct messaggio').
+ * Restituisce 0 in caso di successo, un valore negativo in caso di errore.
+ */
+int send_message(int socket, int versione, uint32_t id, int opcode, ...);
+
+/*
+ * Aspetta di ricevere un messaggio sul socket specificato e lo pone in 'messaggio'. Nel protocollo a stringhe
+ * il tipo del messaggio viene dedotto dai 'num_attesi' opcode in 'attesi'.
+ * Restituisce 1 in caso di successo, 0 in caso di disconnessione del socket e
+ * un numero negativo in caso di errore.
+ */
+int receive_message(int socket, int versione, const int* attesi, int num_attesi, struct messaggio* messaggio);
+
+#endif
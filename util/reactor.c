@@ -0,0 +1,152 @@
+/***************************************************
+ *                                                 *
+ *       Event loop (reactor) basato su epoll      *
+ *                                                 *
+ **************************************************/
+
+#include "reactor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/resource.h>
+
+#define MAX_OPEN_FILES 1048576 // Limite usato quando quello hard è infinito
+
+/*
+ * Inizializza il reactor in modo che ogni attesa restituisca al massimo 'max_eventi' eventi.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_init(struct reactor* reactor, int max_eventi) {
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epoll_fd == -1) {
+        perror("Errore durante la creazione dell'istanza epoll");
+        return -1;
+    }
+
+    reactor->eventi = malloc(max_eventi * sizeof(struct epoll_event));
+    if (reactor->eventi == NULL) {
+        perror("Impossibile allocare il buffer degli eventi");
+        close(reactor->epoll_fd);
+        return -1;
+    }
+    reactor->max_eventi = max_eventi;
+
+    return 0;
+}
+
+/*
+ * Esegue l'operazione 'op' (EPOLL_CTL_ADD/MOD/DEL) sul descrittore 'fd'
+ */
+static int reactor_ctl(struct reactor* reactor, int op, int fd, uint32_t eventi) {
+    struct epoll_event evento;
+
+    memset(&evento, 0, sizeof(evento));
+    evento.events = eventi;
+    evento.data.fd = fd;
+
+    if (epoll_ctl(reactor->epoll_fd, op, fd, &evento) == -1) {
+        #ifdef DEBUG
+        printf("epoll_ctl(%d) fallita sul descrittore %d: %s\n", op, fd, strerror(errno));
+        #endif
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Inizia a monitorare il descrittore 'fd' per gli eventi 'eventi' (REACTOR_READ, REACTOR_WRITE, REACTOR_EDGE).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_add(struct reactor* reactor, int fd, uint32_t eventi) {
+    return reactor_ctl(reactor, EPOLL_CTL_ADD, fd, eventi);
+}
+
+/*
+ * Cambia gli eventi monitorati sul descrittore 'fd'.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_modify(struct reactor* reactor, int fd, uint32_t eventi) {
+    return reactor_ctl(reactor, EPOLL_CTL_MOD, fd, eventi);
+}
+
+/*
+ * Smette di monitorare il descrittore 'fd'.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_remove(struct reactor* reactor, int fd) {
+    return reactor_ctl(reactor, EPOLL_CTL_DEL, fd, 0);
+}
+
+/*
+ * Aspetta (al massimo 'timeout' millisecondi, -1 = per sempre) che almeno un descrittore sia pronto.
+ * Restituisce il numero di eventi pronti, accessibili con reactor_ready_fd() e reactor_ready_events(),
+ * 0 se il timeout è scaduto o l'attesa è stata interrotta da un segnale, -1 in caso di errore.
+ */
+int reactor_wait(struct reactor* reactor, int timeout) {
+    int ret = epoll_wait(reactor->epoll_fd, reactor->eventi, reactor->max_eventi, timeout);
+    if (ret == -1) {
+        if (errno == EINTR) // Interruzione da parte di un segnale: non è un errore
+            return 0;
+
+        perror("Errore nella epoll_wait()");
+    }
+
+    return ret;
+}
+
+/*
+ * Restituisce il descrittore dell'i-esimo evento pronto
+ */
+int reactor_ready_fd(struct reactor* reactor, int i) {
+    return reactor->eventi[i].data.fd;
+}
+
+/*
+ * Restituisce gli eventi (REACTOR_READ, REACTOR_WRITE, REACTOR_HANGUP) dell'i-esimo descrittore pronto
+ */
+uint32_t reactor_ready_events(struct reactor* reactor, int i) {
+    return reactor->eventi[i].events;
+}
+
+/*
+ * Libera le risorse del reactor
+ */
+void reactor_close(struct reactor* reactor) {
+    close(reactor->epoll_fd);
+    free(reactor->eventi);
+    reactor->eventi = NULL;
+}
+
+/*
+ * Alza il limite dei descrittori aperti del processo al massimo consentito, così da poter gestire
+ * molte più connessioni delle 1024 di default.
+ * Restituisce il nuovo limite o -1 in caso di errore.
+ */
+int raise_fd_limit(void) {
+    struct rlimit limite;
+
+    if (getrlimit(RLIMIT_NOFILE, &limite) == -1) {
+        perror("Impossibile leggere il limite dei descrittori aperti");
+        return -1;
+    }
+
+    // Il limite soft può essere alzato fino a quello hard senza privilegi
+    if (limite.rlim_max == RLIM_INFINITY)
+        limite.rlim_max = MAX_OPEN_FILES; // Il kernel non accetta un limite infinito per i descrittori
+    if (limite.rlim_cur < limite.rlim_max) {
+        limite.rlim_cur = limite.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limite) == -1) {
+            perror("Impossibile alzare il limite dei descrittori aperti");
+            return -1;
+        }
+    }
+
+    #ifdef DEBUG
+    printf("Limite dei descrittori aperti: %ld.\n", (long) limite.rlim_cur);
+    #endif
+
+    return (int) limite.rlim_cur;
+}
@@ -0,0 +1,77 @@
+/***************************************************
+ *                                                 *
+ *       Event loop (reactor) basato su epoll      *
+ *                                                 *
+ **************************************************/
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define REACTOR_READ EPOLLIN // Il descrittore è pronto in lettura
+#define REACTOR_WRITE EPOLLOUT // Il descrittore è pronto in scrittura
+#define REACTOR_EDGE EPOLLET // Notifica edge-triggered (solo ai cambi di stato): va letto tutto fino a EAGAIN
+#define REACTOR_HANGUP (EPOLLHUP | EPOLLERR | EPOLLRDHUP) // Il descrittore è stato chiuso o è in errore
+
+/*
+ * Event loop: contiene il descrittore epoll e il buffer in cui vengono restituiti gli eventi pronti.
+ * Diversamente dalla select() non c'è un limite al numero di descrittori monitorati (FD_SETSIZE)
+ * e a ogni risveglio si scorrono solo i descrittori pronti.
+ */
+struct reactor {
+    int epoll_fd; // Descrittore dell'istanza epoll
+    struct epoll_event* eventi; // Eventi pronti restituiti dall'ultima reactor_wait()
+    int max_eventi; // Numero massimo di eventi restituiti da una singola reactor_wait()
+};
+
+/*
+ * Inizializza il reactor in modo che ogni attesa restituisca al massimo 'max_eventi' eventi.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_init(struct reactor* reactor, int max_eventi);
+
+/*
+ * Inizia a monitorare il descrittore 'fd' per gli eventi 'eventi' (REACTOR_READ, REACTOR_WRITE, REACTOR_EDGE).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_add(struct reactor* reactor, int fd, uint32_t eventi);
+
+/*
+ * Cambia gli eventi monitorati sul descrittore 'fd'.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_modify(struct reactor* reactor, int fd, uint32_t eventi);
+
+/*
+ * Smette di monitorare il descrittore 'fd'.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int reactor_remove(struct reactor* reactor, int fd);
+
+/*
+ * Aspetta (al massimo 'timeout' millisecondi, -1 = per sempre) che almeno un descrittore sia pronto.
+ * Restituisce il numero di eventi pronti, accessibili con reactor_ready_fd() e reactor_ready_events(),
+ * 0 se il timeout è scaduto o l'attesa è stata interrotta da un segnale, -1 in caso di errore.
+ */
+int reactor_wait(struct reactor* reactor, int timeout);
+
+/*
+ * Restituisce il descrittore dell'i-esimo evento pronto
+ */
+int reactor_ready_fd(struct reactor* reactor, int i);
+
+/*
+ * Restituisce gli eventi (REACTOR_READ, REACTOR_WRITE, REACTOR_HANGUP) dell'i-esimo descrittore pronto
+ */
+uint32_t reactor_ready_events(struct reactor* reactor, int i);
+
+/*
+ * Libera le risorse del reactor
+ */
+void reactor_close(struct reactor* reactor);
+
+/*
+ * Alza il limite dei descrittori aperti del processo al massimo consentito, così da poter gestire
+ * molte più connessioni delle 1024 di default.
+ * Restituisce il nuovo limite o -1 in caso di errore.
+ */
+int raise_fd_limit(void);
@@ -0,0 +1,329 @@
+/************************************************************
+ *                                                          *
+ *          Snapshot binario dello stato in memoria         *
+ *                                                          *
+ ************************************************************/
+
+#include "snapshot.h"
+#include "crc.h"
+#include "file.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "SNAPSHT1" // Primi byte dello snapshot (identificano il formato)
+#define LEN_MAGIC 8
+#define FINE_SNAPSHOT 0 // Tipo della sezione vuota che chiude lo snapshot: senza, il file è incompleto
+
+/*
+ * Intestazione del file
+ */
+struct intestazione_snapshot {
+    char magic[LEN_MAGIC];
+    int64_t istante;
+};
+
+/*
+ * Intestazione di una sezione, seguita da 'lunghezza' byte di dati e dal riempimento fino a un multiplo di 8 byte
+ */
+struct intestazione_sezione {
+    uint32_t tipo;
+    uint32_t crc;
+    uint64_t lunghezza;
+};
+
+/*
+ * Restituisce i byte di riempimento che seguono 'lunghezza' byte di dati
+ */
+static size_t padding(uint64_t lunghezza) {
+    return (8 - lunghezza % 8) % 8;
+}
+
+/*
+ * Scrive l'intestazione della sezione in corso (al suo posto, davanti ai dati) e il riempimento
+ */
+static void end_snapshot_section(struct scrittura_snapshot* snapshot) {
+    struct intestazione_sezione sezione;
+    static const char zeri[8] = {0};
+    long fine;
+
+    if (snapshot->inizio_sezione == -1)
+        return;
+
+    sezione.tipo = snapshot->tipo;
+    sezione.crc = ~snapshot->crc;
+    sezione.lunghezza = snapshot->lunghezza;
+    if (fwrite(zeri, 1, padding(sezione.lunghezza), snapshot->file) != padding(sezione.lunghezza) ||
+        (fine = ftell(snapshot->file)) == -1 || fseek(snapshot->file, snapshot->inizio_sezione, SEEK_SET) == -1 ||
+        fwrite(&sezione, sizeof(sezione), 1, snapshot->file) != 1 || fseek(snapshot->file, fine, SEEK_SET) == -1)
+        snapshot->errore = 1;
+    snapshot->inizio_sezione = -1;
+}
+
+/*
+ * Inizia a scrivere uno snapshot che sostituirà 'path' (la stringa deve restare valida fino al commit).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int begin_snapshot(struct scrittura_snapshot* snapshot, char* path) {
+    struct intestazione_snapshot intestazione;
+
+    snapshot->path = path;
+    strcpy(snapshot->tmp_path, path);
+    strcat(snapshot->tmp_path, ".tmp");
+    snapshot->inizio_sezione = -1;
+    snapshot->errore = 0;
+
+    snapshot->file = open_or_create(snapshot->tmp_path, "w");
+    if (snapshot->file == NULL)
+        return -1;
+
+    memcpy(intestazione.magic, SNAPSHOT_MAGIC, LEN_MAGIC);
+    intestazione.istante = time(NULL);
+    if (fwrite(&intestazione, sizeof(intestazione), 1, snapshot->file) != 1)
+        snapshot->errore = 1;
+    return 0;
+}
+
+/*
+ * Inizia una nuova sezione di tipo 'tipo' (chiudendo quella in corso, se c'è)
+ */
+void begin_snapshot_section(struct scrittura_snapshot* snapshot, int tipo) {
+    struct intestazione_sezione sezione = {0, 0, 0}; // Segnaposto, riscritto alla fine della sezione
+
+    end_snapshot_section(snapshot);
+
+    snapshot->inizio_sezione = ftell(snapshot->file);
+    snapshot->tipo = tipo;
+    snapshot->crc = 0xFFFFFFFF;
+    snapshot->lunghezza = 0;
+    if (snapshot->inizio_sezione == -1 || fwrite(&sezione, sizeof(sezione), 1, snapshot->file) != 1)
+        snapshot->errore = 1;
+}
+
+/*
+ * Aggiunge 'len' byte di 'dati' alla sezione in corso
+ */
+void write_to_snapshot(struct scrittura_snapshot* snapshot, const void* dati, size_t len) {
+    if (len == 0)
+        return;
+    if (fwrite(dati, 1, len, snapshot->file) != len)
+        snapshot->errore = 1;
+    snapshot->crc = update_crc(snapshot->crc, dati, len);
+    snapshot->lunghezza += len;
+}
+
+/*
+ * Aggiungono alla sezione in corso un intero a 32 o 64 bit o una stringa (lunghezza e caratteri, terminatore compreso)
+ */
+void write_snapshot_u32(struct scrittura_snapshot* snapshot, uint32_t valore) {
+    write_to_snapshot(snapshot, &valore, sizeof(valore));
+}
+
+void write_snapshot_u64(struct scrittura_snapshot* snapshot, uint64_t valore) {
+    write_to_snapshot(snapshot, &valore, sizeof(valore));
+}
+
+void write_snapshot_string(struct scrittura_snapshot* snapshot, const char* stringa) {
+    uint32_t len = strlen(stringa) + 1;
+
+    write_snapshot_u32(snapshot, len);
+    write_to_snapshot(snapshot, stringa, len);
+}
+
+/*
+ * Chiude la sezione in corso e rende lo snapshot definitivo: lo sincronizza su disco e sostituisce quello vecchio.
+ * Restituisce 0 in caso di successo, -1 in caso di errore (lo snapshot vecchio resta al suo posto).
+ */
+int commit_snapshot(struct scrittura_snapshot* snapshot) {
+    begin_snapshot_section(snapshot, FINE_SNAPSHOT);
+    end_snapshot_section(snapshot);
+
+    if (snapshot->errore || fflush(snapshot->file) != 0 || fsync(fileno(snapshot->file)) == -1) {
+        fprintf(stderr, "Errore durante la scrittura dello snapshot '%s' : %s\n", snapshot->tmp_path, strerror(errno));
+        abort_snapshot(snapshot);
+        return -1;
+    }
+    if (fclose(snapshot->file) != 0 || rename(snapshot->tmp_path, snapshot->path) == -1) {
+        perror("Impossibile sostituire lo snapshot");
+        remove(snapshot->tmp_path);
+        return -1;
+    }
+    sync_parent_directory(snapshot->path);
+
+    return 0;
+}
+
+/*
+ * Abbandona lo snapshot in scrittura (lo snapshot vecchio resta al suo posto)
+ */
+void abort_snapshot(struct scrittura_snapshot* snapshot) {
+    fclose(snapshot->file);
+    remove(snapshot->tmp_path);
+}
+
+/*
+ * Scorre le sezioni dello snapshot mappato e le registra. Restituisce 0 se lo snapshot è completo, -1 altrimenti.
+ */
+static int parse_sections(struct lettura_snapshot* snapshot) {
+    struct intestazione_snapshot intestazione;
+    struct intestazione_sezione sezione;
+    size_t pos = sizeof(intestazione);
+
+    if (snapshot->dimensione < sizeof(intestazione))
+        return -1;
+    memcpy(&intestazione, snapshot->mappa, sizeof(intestazione));
+    if (memcmp(intestazione.magic, SNAPSHOT_MAGIC, LEN_MAGIC) != 0)
+        return -1;
+    snapshot->istante = (time_t) intestazione.istante;
+
+    snapshot->num_sezioni = 0;
+    while (snapshot->dimensione - pos >= sizeof(sezione)) {
+        memcpy(&sezione, snapshot->mappa + pos, sizeof(sezione));
+        pos += sizeof(sezione);
+        if (sezione.lunghezza > snapshot->dimensione - pos ||
+            padding(sezione.lunghezza) > snapshot->dimensione - pos - sezione.lunghezza)
+            return -1; // Sezione troncata
+
+        if (sezione.tipo == FINE_SNAPSHOT)
+            return 0;
+        if (snapshot->num_sezioni == SNAPSHOT_MAX_SEZIONI)
+            return -1;
+        snapshot->sezioni[snapshot->num_sezioni].tipo = sezione.tipo;
+        snapshot->sezioni[snapshot->num_sezioni].crc = sezione.crc;
+        snapshot->sezioni[snapshot->num_sezioni].dati = snapshot->mappa + pos;
+        snapshot->sezioni[snapshot->num_sezioni].lunghezza = sezione.lunghezza;
+        snapshot->num_sezioni++;
+        pos += sezione.lunghezza + padding(sezione.lunghezza);
+    }
+
+    return -1; // Manca la sezione finale
+}
+
+/*
+ * Mappa in memoria lo snapshot 'path' e ne verifica la struttura. Restituisce 1 se lo snapshot è stato aperto,
+ * 0 se non esiste o non è valido (viene segnalato), -1 in caso di errore.
+ */
+int open_snapshot(struct lettura_snapshot* snapshot, char* path) {
+    struct stat info;
+    int fd;
+
+    snapshot->mappa = NULL;
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return 0; // Nessuno snapshot
+        fprintf(stderr, "Impossibile aprire lo snapshot '%s' : %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &info) == -1) {
+        fprintf(stderr, "Impossibile aprire lo snapshot '%s' : %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    snapshot->dimensione = info.st_size;
+    if (snapshot->dimensione > 0) {
+        snapshot->mappa = mmap(NULL, snapshot->dimensione, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (snapshot->mappa == MAP_FAILED) {
+            fprintf(stderr, "Impossibile mappare lo snapshot '%s' : %s\n", path, strerror(errno));
+            snapshot->mappa = NULL;
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd); // La mappa resta valida anche dopo la chiusura (e dopo che il file viene sostituito)
+
+    if (snapshot->mappa == NULL || parse_sections(snapshot) == -1) {
+        fprintf(stderr, "Lo snapshot '%s' non è valido: viene ignorato.\n", path);
+        close_snapshot(snapshot);
+        return 0;
+    }
+
+    #ifdef DEBUG
+    printf("Snapshot '%s' aperto: %d sezioni, %zu byte.\n", path, snapshot->num_sezioni, snapshot->dimensione);
+    #endif
+
+    return 1;
+}
+
+/*
+ * Posiziona 'cursore' all'inizio della sezione di tipo 'tipo'. Se 'verifica' è 1 controlla anche il CRC dei dati
+ * (costa una lettura di tutta la sezione: le sezioni grandi, lette solo in parte, possono farne a meno).
+ * Restituisce 0 in caso di successo, -1 se la sezione non esiste o è danneggiata.
+ */
+int find_snapshot_section(struct lettura_snapshot* snapshot, int tipo, int verifica, struct cursore_snapshot* cursore) {
+    struct sezione_snapshot* sezione;
+    int i;
+
+    for (i = 0; i < snapshot->num_sezioni; i++) {
+        sezione = &snapshot->sezioni[i];
+        if (sezione->tipo != tipo)
+            continue;
+
+        if (verifica && ~update_crc(0xFFFFFFFF, sezione->dati, sezione->lunghezza) != sezione->crc) {
+            fprintf(stderr, "La sezione %d dello snapshot è danneggiata.\n", tipo);
+            return -1;
+        }
+        cursore->pos = sezione->dati;
+        cursore->fine = sezione->dati + sezione->lunghezza;
+        cursore->errore = 0;
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Copia in 'dati' i prossimi 'len' byte del cursore. Restituisce 0 in caso di successo, -1 se la sezione è finita.
+ */
+static int read_from_cursor(struct cursore_snapshot* cursore, void* dati, size_t len) {
+    if (cursore->errore || (size_t) (cursore->fine - cursore->pos) < len) {
+        cursore->errore = 1;
+        return -1;
+    }
+    memcpy(dati, cursore->pos, len);
+    cursore->pos += len;
+    return 0;
+}
+
+/*
+ * Leggono dal cursore un intero a 32 o 64 bit o una stringa (il puntatore restituito è nella mappa)
+ */
+uint32_t read_snapshot_u32(struct cursore_snapshot* cursore) {
+    uint32_t valore;
+
+    return read_from_cursor(cursore, &valore, sizeof(valore)) == 0 ? valore : 0;
+}
+
+uint64_t read_snapshot_u64(struct cursore_snapshot* cursore) {
+    uint64_t valore;
+
+    return read_from_cursor(cursore, &valore, sizeof(valore)) == 0 ? valore : 0;
+}
+
+const char* read_snapshot_string(struct cursore_snapshot* cursore) {
+    uint32_t len = read_snapshot_u32(cursore);
+    const char* stringa = cursore->pos;
+
+    // La stringa deve stare nella sezione ed essere terminata
+    if (cursore->errore || len == 0 || (size_t) (cursore->fine - cursore->pos) < len || stringa[len - 1] != '\0') {
+        cursore->errore = 1;
+        return NULL;
+    }
+    cursore->pos += len;
+    return stringa;
+}
+
+/*
+ * Toglie la mappa dello snapshot
+ */
+void close_snapshot(struct lettura_snapshot* snapshot) {
+    if (snapshot->mappa != NULL)
+        munmap(snapshot->mappa, snapshot->dimensione);
+    snapshot->mappa = NULL;
+    snapshot->num_sezioni = 0;
+}
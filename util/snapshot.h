@@ -0,0 +1,130 @@
+/************************************************************
+ *                                                          *
+ *          Snapshot binario dello stato in memoria         *
+ *                                                          *
+ ************************************************************/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <linux/limits.h>
+
+#define SNAPSHOT_MAX_SEZIONI 16 // Numero massimo di sezioni di uno snapshot
+
+/*
+ * Lo snapshot è un file binario che fotografa lo stato in memoria di un programma, così al riavvio non va ricostruito
+ * rileggendo tutta la storia. È diviso in sezioni, ognuna con un tipo (deciso da chi lo scrive), la lunghezza e il
+ * CRC dei dati; i dati sono allineati a 8 byte. Viene scritto in un file temporaneo che sostituisce quello vecchio
+ * solo quando è completo e su disco: al path c'è sempre uno snapshot integro (o nessuno).
+ * Per la lettura il file viene mappato in memoria: le sezioni si leggono dalla mappa senza copiarle e chi ne conserva
+ * dei puntatori non deve chiudere lo snapshot finché li usa.
+ */
+
+/*
+ * Snapshot in scrittura. Gli errori di scrittura vengono accumulati e segnalati da commit_snapshot().
+ */
+struct scrittura_snapshot {
+    FILE* file; // File temporaneo
+    char* path; // Path dello snapshot
+    char tmp_path[PATH_MAX]; // Path del file temporaneo
+    long inizio_sezione; // Offset dell'intestazione della sezione in corso (-1 se non ce n'è una)
+    int tipo; // Tipo della sezione in corso
+    uint32_t crc; // CRC dei dati della sezione in corso (non ancora complementato)
+    uint64_t lunghezza; // Byte di dati della sezione in corso
+    int errore; // 1 se qualche scrittura è fallita
+};
+
+/*
+ * Sezione di uno snapshot in lettura
+ */
+struct sezione_snapshot {
+    int tipo;
+    uint32_t crc;
+    const char* dati; // Dati della sezione (nella mappa del file)
+    uint64_t lunghezza;
+};
+
+/*
+ * Snapshot in lettura (mappato in memoria)
+ */
+struct lettura_snapshot {
+    char* mappa; // Contenuto del file
+    size_t dimensione; // Byte della mappa
+    time_t istante; // Istante in cui è stato scritto lo snapshot
+    struct sezione_snapshot sezioni[SNAPSHOT_MAX_SEZIONI];
+    int num_sezioni;
+};
+
+/*
+ * Cursore con cui si leggono in ordine i dati di una sezione. Una lettura oltre la fine della sezione imposta
+ * 'errore' a 1 e restituisce 0 (o NULL): basta controllare 'errore' una volta, dopo aver letto.
+ */
+struct cursore_snapshot {
+    const char* pos; // Prossimo byte da leggere
+    const char* fine; // Fine dei dati della sezione
+    int errore;
+};
+
+/*
+ * Inizia a scrivere uno snapshot che sostituirà 'path' (la stringa deve restare valida fino al commit).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int begin_snapshot(struct scrittura_snapshot* snapshot, char* path);
+
+/*
+ * Inizia una nuova sezione di tipo 'tipo' (chiudendo quella in corso, se c'è)
+ */
+void begin_snapshot_section(struct scrittura_snapshot* snapshot, int tipo);
+
+/*
+ * Aggiunge 'len' byte di 'dati' alla sezione in corso
+ */
+void write_to_snapshot(struct scrittura_snapshot* snapshot, const void* dati, size_t len);
+
+/*
+ * Aggiungono alla sezione in corso un intero a 32 o 64 bit o una stringa (lunghezza e caratteri, terminatore compreso)
+ */
+void write_snapshot_u32(struct scrittura_snapshot* snapshot, uint32_t valore);
+void write_snapshot_u64(struct scrittura_snapshot* snapshot, uint64_t valore);
+void write_snapshot_string(struct scrittura_snapshot* snapshot, const char* stringa);
+
+/*
+ * Chiude la sezione in corso e rende lo snapshot definitivo: lo sincronizza su disco e sostituisce quello vecchio.
+ * Restituisce 0 in caso di successo, -1 in caso di errore (lo snapshot vecchio resta al suo posto).
+ */
+int commit_snapshot(struct scrittura_snapshot* snapshot);
+
+/*
+ * Abbandona lo snapshot in scrittura (lo snapshot vecchio resta al suo posto)
+ */
+void abort_snapshot(struct scrittura_snapshot* snapshot);
+
+/*
+ * Mappa in memoria lo snapshot 'path' e ne verifica la struttura. Restituisce 1 se lo snapshot è stato aperto,
+ * 0 se non esiste o non è valido (viene segnalato), -1 in caso di errore.
+ */
+int open_snapshot(struct lettura_snapshot* snapshot, char* path);
+
+/*
+ * Posiziona 'cursore' all'inizio della sezione di tipo 'tipo'. Se 'verifica' è 1 controlla anche il CRC dei dati
+ * (costa una lettura di tutta la sezione: le sezioni grandi, lette solo in parte, possono farne a meno).
+ * Restituisce 0 in caso di successo, -1 se la sezione non esiste o è danneggiata.
+ */
+int find_snapshot_section(struct lettura_snapshot* snapshot, int tipo, int verifica, struct cursore_snapshot* cursore);
+
+/*
+ * Leggono dal cursore un intero a 32 o 64 bit o una stringa (il puntatore restituito è nella mappa)
+ */
+uint32_t read_snapshot_u32(struct cursore_snapshot* cursore);
+uint64_t read_snapshot_u64(struct cursore_snapshot* cursore);
+const char* read_snapshot_string(struct cursore_snapshot* cursore);
+
+/*
+ * Toglie la mappa dello snapshot
+ */
+void close_snapshot(struct lettura_snapshot* snapshot);
+
+#endif
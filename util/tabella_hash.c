@@ -0,0 +1,179 @@
+/************************************************************
+ *                                                          *
+ *          Tabella hash con chiavi di tipo stringa         *
+ *                                                          *
+ ************************************************************/
+
+#include "tabella_hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MIN_SECCHI 16 // Numero minimo di secchi di una tabella
+
+/*
+ * Hash FNV-1a della stringa specificata
+ */
+static uint32_t hash_string(const char* stringa) {
+    uint32_t hash = 2166136261u;
+
+    for (; *stringa != '\0'; stringa++) {
+        hash ^= (unsigned char) *stringa;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Inizializza una tabella vuota con almeno 'capacita' secchi.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_hash_table(struct tabella_hash* tabella, unsigned int capacita) {
+    unsigned int num_secchi = MIN_SECCHI;
+
+    while (num_secchi < capacita)
+        num_secchi *= 2;
+
+    tabella->secchi = calloc(num_secchi, sizeof(struct elemento_hash*));
+    if (tabella->secchi == NULL) {
+        perror("Impossibile allocare la tabella hash");
+        return -1;
+    }
+    tabella->num_secchi = num_secchi;
+    tabella->num_elementi = 0;
+
+    return 0;
+}
+
+/*
+ * Raddoppia il numero di secchi della tabella, ridistribuendo gli elementi.
+ * Se l'allocazione fallisce la tabella resta com'è (solo con catene più lunghe).
+ */
+static void grow_hash_table(struct tabella_hash* tabella) {
+    struct elemento_hash** secchi;
+    struct elemento_hash* elemento;
+    struct elemento_hash* successivo;
+    unsigned int i, num_secchi = tabella->num_secchi * 2;
+    uint32_t indice;
+
+    secchi = calloc(num_secchi, sizeof(struct elemento_hash*));
+    if (secchi == NULL)
+        return;
+
+    for (i = 0; i < tabella->num_secchi; i++) {
+        for (elemento = tabella->secchi[i]; elemento != NULL; elemento = successivo) {
+            successivo = elemento->next;
+            indice = hash_string(elemento->chiave) & (num_secchi - 1);
+            elemento->next = secchi[indice];
+            secchi[indice] = elemento;
+        }
+    }
+
+    free(tabella->secchi);
+    tabella->secchi = secchi;
+    tabella->num_secchi = num_secchi;
+}
+
+/*
+ * Restituisce il valore associato a 'chiave' o NULL se la chiave non è presente
+ */
+void* find_in_hash_table(struct tabella_hash* tabella, const char* chiave) {
+    struct elemento_hash* elemento;
+
+    elemento = tabella->secchi[hash_string(chiave) & (tabella->num_secchi - 1)];
+    for (; elemento != NULL; elemento = elemento->next)
+        if (strcmp(elemento->chiave, chiave) == 0)
+            return elemento->valore;
+
+    return NULL;
+}
+
+/*
+ * Associa 'valore' a 'chiave' (che non deve essere già presente).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int insert_into_hash_table(struct tabella_hash* tabella, const char* chiave, void* valore) {
+    struct elemento_hash* elemento;
+    uint32_t indice;
+    size_t len = strlen(chiave) + 1;
+
+    elemento = malloc(sizeof(struct elemento_hash) + len);
+    if (elemento == NULL) {
+        perror("Impossibile allocare un elemento della tabella hash");
+        return -1;
+    }
+    memcpy(elemento->chiave, chiave, len);
+    elemento->valore = valore;
+
+    if (tabella->num_elementi >= tabella->num_secchi)
+        grow_hash_table(tabella);
+
+    indice = hash_string(chiave) & (tabella->num_secchi - 1);
+    elemento->next = tabella->secchi[indice];
+    tabella->secchi[indice] = elemento;
+    tabella->num_elementi++;
+
+    return 0;
+}
+
+/*
+ * Rimuove 'chiave' dalla tabella. Restituisce il valore che le era associato o NULL se non era presente.
+ */
+void* remove_from_hash_table(struct tabella_hash* tabella, const char* chiave) {
+    struct elemento_hash** posizione;
+    struct elemento_hash* elemento;
+    void* valore;
+
+    posizione = &tabella->secchi[hash_string(chiave) & (tabella->num_secchi - 1)];
+    for (; *posizione != NULL; posizione = &(*posizione)->next) {
+        elemento = *posizione;
+        if (strcmp(elemento->chiave, chiave) != 0)
+            continue;
+
+        *posizione = elemento->next;
+        valore = elemento->valore;
+        free(elemento);
+        tabella->num_elementi--;
+        return valore;
+    }
+
+    return NULL;
+}
+
+/*
+ * Invoca 'visita' per ogni elemento della tabella (in ordine qualsiasi), passandole anche 'contesto'
+ */
+void visit_hash_table(struct tabella_hash* tabella, void (*visita)(const char* chiave, void* valore, void* contesto),
+                      void* contesto) {
+    struct elemento_hash* elemento;
+    unsigned int i;
+
+    for (i = 0; i < tabella->num_secchi; i++)
+        for (elemento = tabella->secchi[i]; elemento != NULL; elemento = elemento->next)
+            visita(elemento->chiave, elemento->valore, contesto);
+}
+
+/*
+ * Libera la tabella e, se 'libera' è diverso da NULL, lo invoca su ogni valore
+ */
+void free_hash_table(struct tabella_hash* tabella, void (*libera)(void* valore)) {
+    struct elemento_hash* elemento;
+    struct elemento_hash* successivo;
+    unsigned int i;
+
+    for (i = 0; i < tabella->num_secchi; i++) {
+        for (elemento = tabella->secchi[i]; elemento != NULL; elemento = successivo) {
+            successivo = elemento->next;
+            if (libera != NULL)
+                libera(elemento->valore);
+            free(elemento);
+        }
+    }
+
+    free(tabella->secchi);
+    tabella->secchi = NULL;
+    tabella->num_secchi = 0;
+    tabella->num_elementi = 0;
+}
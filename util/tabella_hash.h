@@ -0,0 +1,62 @@
+/************************************************************
+ *                                                          *
+ *          Tabella hash con chiavi di tipo stringa         *
+ *                                                          *
+ ************************************************************/
+
+#ifndef TABELLA_HASH_H
+#define TABELLA_HASH_H
+
+/*
+ * Elemento della tabella: la chiave viene copiata nell'elemento, il valore è del chiamante
+ */
+struct elemento_hash {
+    void* valore;
+    struct elemento_hash* next; // Elemento successivo nello stesso secchio
+    char chiave[]; // Chiave (terminata), allocata insieme all'elemento
+};
+
+/*
+ * Tabella hash a liste di trabocco: il numero di secchi raddoppia quando gli elementi lo superano,
+ * così ricerche e inserimenti restano a costo costante qualunque sia il numero di elementi
+ */
+struct tabella_hash {
+    struct elemento_hash** secchi;
+    unsigned int num_secchi; // Sempre una potenza di 2
+    unsigned int num_elementi;
+};
+
+/*
+ * Inizializza una tabella vuota con almeno 'capacita' secchi.
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int init_hash_table(struct tabella_hash* tabella, unsigned int capacita);
+
+/*
+ * Restituisce il valore associato a 'chiave' o NULL se la chiave non è presente
+ */
+void* find_in_hash_table(struct tabella_hash* tabella, const char* chiave);
+
+/*
+ * Associa 'valore' a 'chiave' (che non deve essere già presente).
+ * Restituisce 0 in caso di successo, -1 in caso di errore.
+ */
+int insert_into_hash_table(struct tabella_hash* tabella, const char* chiave, void* valore);
+
+/*
+ * Rimuove 'chiave' dalla tabella. Restituisce il valore che le era associato o NULL se non era presente.
+ */
+void* remove_from_hash_table(struct tabella_hash* tabella, const char* chiave);
+
+/*
+ * Invoca 'visita' per ogni elemento della tabella (in ordine qualsiasi), passandole anche 'contesto'
+ */
+void visit_hash_table(struct tabella_hash* tabella, void (*visita)(const char* chiave, void* valore, void* contesto),
+                      void* contesto);
+
+/*
+ * Libera la tabella e, se 'libera' è diverso da NULL, lo invoca su ogni valore
+ */
+void free_hash_table(struct tabella_hash* tabella, void (*libera)(void* valore));
+
+#endif